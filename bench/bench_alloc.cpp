@@ -0,0 +1,136 @@
+// Allocation throughput and peak RSS of mkstr versus the previous
+// malloc-per-string path (header + separate payload + strtab slot).
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "value.h"
+
+namespace legacy {
+
+struct String
+{
+    static constexpr size_t MaxSmallSize = 28;
+    uint32_t len;
+    union {
+        char* ptr;
+        char  str[MaxSmallSize];
+    };
+};
+
+std::vector<String*> strtab;
+
+uint64_t mkstr(const char* str, size_t len)
+{
+    String* s = (String*) malloc(sizeof(*s));
+    s->len = len;
+    if (len < String::MaxSmallSize) {
+        memcpy(&s->str[0], str, len);
+        s->str[len] = '\0';
+    } else {
+        s->ptr = (char*) malloc(len + 1);
+        memcpy(s->ptr, str, len);
+        s->ptr[len] = '\0';
+    }
+    strtab.push_back(s);
+    return strtab.size() - 1;
+}
+
+} // namespace legacy
+
+static constexpr int NStrings = 1000000;
+
+// Mix of identifier-sized and longer strings, 4..67 bytes.
+static std::vector<std::string> mkinputs()
+{
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 64; ++i) {
+        inputs.push_back(std::string(4 + i, 'a' + i % 26));
+    }
+    return inputs;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<Value> retained;
+
+static void visitretained(void*, GcVisitFn visit)
+{
+    for (Value v : retained) {
+        visit(v);
+    }
+}
+
+static void run_heap(const std::vector<std::string>& in, bool retain)
+{
+    for (int i = 0; i < NStrings; ++i) {
+        const std::string& s = in[i % in.size()];
+        Value v = mkstr(s.data(), s.size());
+        if (retain) {
+            retained.push_back(v);
+        }
+    }
+}
+
+static void run_legacy(const std::vector<std::string>& in)
+{
+    for (int i = 0; i < NStrings; ++i) {
+        const std::string& s = in[i % in.size()];
+        legacy::mkstr(s.data(), s.size());
+    }
+}
+
+// Runs `fn` in a child process so each path gets its own peak RSS.
+template <typename F>
+static long peakrss_kb(F fn)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        _exit(0);
+    }
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    return ru.ru_maxrss;
+}
+
+int main(int argc, char** argv)
+{
+    auto in = mkinputs();
+    gc_addroots(visitretained, nullptr);
+
+    printf("%-28s %12s\n", "benchmark", "Mstrings/s");
+
+    auto start = std::chrono::steady_clock::now();
+    run_legacy(in);
+    printf("%-28s %12.2f\n", "malloc (retained)", NStrings / seconds(start) / 1e6);
+
+    start = std::chrono::steady_clock::now();
+    run_heap(in, true);
+    printf("%-28s %12.2f\n", "heap (retained)", NStrings / seconds(start) / 1e6);
+    retained.clear();
+
+    start = std::chrono::steady_clock::now();
+    run_heap(in, false);
+    printf("%-28s %12.2f\n", "heap (garbage)", NStrings / seconds(start) / 1e6);
+
+    long base   = peakrss_kb([] {});
+    long legacy = peakrss_kb([&] { run_legacy(in); });
+    long heap   = peakrss_kb([&] { run_heap(in, true); });
+    printf("\npeak RSS building %d retained strings:\n", NStrings);
+    printf("%-28s %9ld KiB\n", "malloc", legacy - base);
+    printf("%-28s %9ld KiB\n", "heap", heap - base);
+
+    GcStats s = gc_stats();
+    printf("\nminor GCs: %lu, major GCs: %lu, max minor pause: %.1f us\n",
+            s.minor_collections, s.major_collections, s.max_minor_pause_ns / 1e3);
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Global procedure calls: builtins and closures called through a
+// global, where each call site caches its callee, plus a site whose
+// global is rebound on every iteration so every call misses.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs every form of `src`, printing the time spent in the last one.
+static bool bench(const char* name, const char* src, const char* expected)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    Value out;
+    double elapsed = 0.0;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            break;
+        } else if (status == ERROR) {
+            fprintf(stderr, "%s: %s\n", name, r.err.c_str());
+            return false;
+        }
+        uint32_t proto;
+        std::string err;
+        if (compile(form, proto, err) != OK) {
+            fprintf(stderr, "%s: %s\n", name, err.c_str());
+            return false;
+        }
+        r.clear();
+        auto start = std::chrono::steady_clock::now();
+        if (vm_run(proto, out) != OK) {
+            fprintf(stderr, "%s: %s\n", name, valprint(out, false).c_str());
+            return false;
+        }
+        elapsed = seconds(start);
+    }
+    if (valprint(out) != expected) {
+        fprintf(stderr, "%s: returned %s, expected %s\n", name, valprint(out).c_str(), expected);
+        return false;
+    }
+    printf("%-20s %8.3f s\n", name, elapsed);
+    return true;
+}
+
+// 1000 x 1000 iterations; the inner loop stays shallow enough for the
+// value stack.
+#define REPEAT(body) \
+    "(define (repeat k acc) (if (= k 0) acc (repeat (- k 1) " body ")))" \
+    "(repeat 1000 0)"
+
+int main()
+{
+    vm_init();
+    bool ok = true;
+    ok &= bench("builtin calls",
+        "(define (loop i acc)"
+        "  (if (= i 0) acc (loop (- i 1) (if (not (eq? i 'x)) (+ acc (modulo i 3)) acc))))"
+        REPEAT("(+ acc (loop 1000 0))"),
+        "1000000");
+    ok &= bench("closure calls",
+        "(define (id x) x)"
+        "(define (inc x) (+ x 1))"
+        "(define (loop i acc)"
+        "  (if (= i 0) acc (loop (- i 1) (inc (id (id acc))))))"
+        REPEAT("(+ acc (loop 1000 0))"),
+        "1000000");
+    ok &= bench("rebound callee",
+        "(define (f x) (+ x 1))"
+        "(define (g x) (+ x 1))"
+        "(define (loop i acc)"
+        "  (set! f g)"
+        "  (if (= i 0) acc (loop (- i 1) (f acc))))"
+        REPEAT("(+ acc (loop 1000 0))"),
+        "1000000");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// The incremental reader on small datums, fed whole or a byte at a time:
+// cost per datum, and latency from the datum's last byte to reader_next
+// handing it out, against the pull Reader on the same text. Then round
+// trips through eval_stream over a pipe.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "isolate.h"
+#include "read.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double nanos(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double, std::nano>(b - a).count();
+}
+
+static const char Datum[] = "(handle 42 \"key\" 'sym)\n";
+static const size_t DatumLen = sizeof(Datum) - 1;
+
+static double median(std::vector<double>& v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static void reader(size_t n)
+{
+    std::string text;
+    for (size_t j = 0; j < n; ++j) {
+        text += Datum;
+    }
+    {
+        auto start = Clock::now();
+        Input in(text.data(), text.size());
+        Reader r(in);
+        Node form;
+        size_t got = 0;
+        while (read(r, form) == OK) {
+            r.clear();
+            ++got;
+        }
+        printf("  %-22s %10.0f %10s\n", "pull Reader", nanos(start, Clock::now()) / got, "-");
+    }
+    for (size_t chunk : { DatumLen, (size_t) 1 }) {
+        FeedReader r;
+        std::vector<double> latency;
+        auto start = Clock::now();
+        for (size_t j = 0; j < n; ++j) {
+            const char* d = text.data() + j * DatumLen;
+            for (size_t at = 0; at < DatumLen; at += chunk) {
+                auto t0 = Clock::now();
+                reader_feed(r, d + at, chunk);
+                Node form;
+                if (reader_next(r, form) == OK) {
+                    latency.push_back(nanos(t0, Clock::now()));
+                    r.clear();
+                }
+            }
+        }
+        double total = nanos(start, Clock::now()) / n;
+        printf("  %-22s %10.0f %10.0f\n", chunk == 1 ? "fed byte by byte" : "fed whole", total, median(latency));
+    }
+}
+
+static void roundtrips(size_t n, bool bytewise)
+{
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        return;
+    }
+    FILE* results = fdopen(out[1], "w");
+    std::thread driver([&] { eval_stream(in[0], results); });
+    const char req[] = "(+ 1 2)\n";
+    std::vector<double> rtt;
+    char buf[64];
+    for (size_t j = 0; j < n; ++j) {
+        auto t0 = Clock::now();
+        if (bytewise) {
+            for (size_t k = 0; k < sizeof(req) - 1; ++k) {
+                (void) !write(in[1], req + k, 1);
+            }
+        } else {
+            (void) !write(in[1], req, sizeof(req) - 1);
+        }
+        // "3\n"
+        size_t got = 0;
+        while (got < 2) {
+            ssize_t m = read(out[0], buf + got, sizeof(buf) - got);
+            if (m <= 0) {
+                break;
+            }
+            got += m;
+        }
+        rtt.push_back(nanos(t0, Clock::now()) / 1000);
+    }
+    close(in[1]);
+    driver.join();
+    fclose(results);
+    close(in[0]);
+    close(out[0]);
+    printf("  %-22s %10.1f\n", bytewise ? "written byte by byte" : "written whole", median(rtt));
+}
+
+int main()
+{
+    printf("reader, %zu-byte datums  %10s %10s\n", DatumLen, "ns/datum", "latency ns");
+    reader(200000);
+    printf("\neval_stream over a pipe, (+ 1 2)\n  %-22s %10s\n", "", "median us");
+    roundtrips(5000, false);
+    roundtrips(5000, true);
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Memory of the evaluation server as the worker count grows from 1 to
+// 32, with every worker loading the prelude itself ("loaded") and with
+// the workers sharing one frozen copy ("frozen"). The prelude is 2000
+// generated procedures, a 100000 element list and 20000 strings. Each
+// count runs in a child process of its own, which starts the server,
+// has every worker answer a few requests that use the prelude, and
+// reports its resident set growth over the idle process.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "serve.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::string prelude()
+{
+    std::string src =
+        "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))\n"
+        "(define numbers (build 100000 '()))\n"
+        "(define (words n acc)\n"
+        "  (if (= n 0) acc (words (- n 1) (cons (string-append \"a long string \" \"number of words\") acc))))\n"
+        "(define names (words 20000 '()))\n"
+        "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n";
+    char buf[256];
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(buf, sizeof(buf), "(define (helper-%d x) (if (< x %d) (list 'lt x) (helper-%d (- x 1))))\n",
+                 i, i, i > 0 ? i - 1 : 0);
+        src += buf;
+    }
+    return src;
+}
+
+static size_t rss()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long size = 0, resident = 0;
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void ask(int fd, const char* req)
+{
+    if (write(fd, req, strlen(req)) != (ssize_t) strlen(req)) {
+        perror("write");
+        exit(1);
+    }
+    char c;
+    while (read(fd, &c, 1) == 1 && c != '\n') {
+    }
+}
+
+// Runs in the child: the resident set growth in bytes, and the startup
+// time in milliseconds.
+static void measure(const std::string& src, int workers, bool freeze, int out)
+{
+    size_t idle = rss();
+    ServeConfig config;
+    config.socket = "/tmp/cscheme-bench-" + std::to_string(getpid()) + ".sock";
+    config.workers = workers;
+    config.prelude = src;
+    config.freeze = freeze;
+    Server server(config);
+    std::string err;
+    auto start = Clock::now();
+    if (!server.start(err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        _exit(1);
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    // enough connections that every worker gets some
+    std::vector<std::thread> clients;
+    for (int j = 0; j < 2 * workers; ++j) {
+        clients.emplace_back([&] {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path, config.socket.data(), config.socket.size());
+            if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+                perror("connect");
+                _exit(1);
+            }
+            ask(fd, "(sum numbers 0)\n");
+            ask(fd, "(helper-1999 10)\n");
+            ask(fd, "(car names)\n");
+            close(fd);
+        });
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    double result[2] = { (double) (rss() - idle), ms };
+    if (write(out, result, sizeof(result)) != sizeof(result)) {
+        _exit(1);
+    }
+    server.stop();
+}
+
+// Forks, so every run starts from the same single-threaded process.
+static void run(const std::string& src, int workers, bool freeze, double& mb, double& ms)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure(src, workers, freeze, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    double result[2] = { 0, 0 };
+    if (read(fds[0], result, sizeof(result)) != sizeof(result)) {
+        fprintf(stderr, "child failed\n");
+        exit(1);
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    mb = result[0] / (1 << 20);
+    ms = result[1];
+}
+
+int main()
+{
+    std::string src = prelude();
+    printf("%7s %12s %12s %12s %12s\n", "workers", "loaded MB", "frozen MB", "loaded ms", "frozen ms");
+    double first[2] = { 0, 0 }, last[2] = { 0, 0 };
+    int counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (int workers : counts) {
+        double mb[2], ms[2];
+        run(src, workers, false, mb[0], ms[0]);
+        run(src, workers, true, mb[1], ms[1]);
+        printf("%7d %12.1f %12.1f %12.1f %12.1f\n", workers, mb[0], mb[1], ms[0], ms[1]);
+        for (int k = 0; k < 2; ++k) {
+            if (workers == 1) {
+                first[k] = mb[k];
+            }
+            last[k] = mb[k];
+        }
+    }
+    printf("per added worker: loaded %.2f MB, frozen %.2f MB\n",
+           (last[0] - first[0]) / 31, (last[1] - first[1]) / 31);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Warm start from a heap image: builds reference data of 1M rows
+// (a 4-element list each, with a string and a double), then compares
+// rebuilding it in a fresh interpreter with loading it from the image
+// written by save-image.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <future>
+#include <string>
+#include <sys/stat.h>
+#include "image.h"
+#include "isolate.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* Build =
+    "(define (row i) (list i (* i 2) \"reference\" (+ i 0.25)))"
+    "(define (rows n acc) (if (= n 0) acc (rows (- n 1) (cons (row n) acc))))"
+    "(define data (rows 1000000 '()))";
+static const char* Check = "(length data)";
+
+int main()
+{
+    const char* path = "bench_image.img";
+    printf("%-14s %10s %12s\n", "start", "time s", "image bytes");
+    auto start = std::chrono::steady_clock::now();
+    std::string r = std::async(std::launch::async, [&] {
+        eval(Build, strlen(Build));
+        double t = seconds(start);
+        printf("%-14s %10.3f\n", "build", t);
+        std::string save = std::string("(save-image \"") + path + "\")";
+        auto s = std::chrono::steady_clock::now();
+        EvalResult saved = eval(save.data(), save.size());
+        printf("%-14s %10.3f\n", "save-image", seconds(s));
+        return saved.value;
+    }).get();
+    if (r != "#t") {
+        fprintf(stderr, "save-image: %s\n", r.c_str());
+        return 1;
+    }
+    struct stat st;
+    stat(path, &st);
+    for (int pass = 0; pass < 2; ++pass) {
+        start = std::chrono::steady_clock::now();
+        r = std::async(std::launch::async, [&] {
+            std::string err;
+            if (!image_load(path, err)) {
+                return err;
+            }
+            return eval(Check, strlen(Check)).value;
+        }).get();
+        if (r != "1000000") {
+            fprintf(stderr, "load: %s\n", r.c_str());
+            return 1;
+        }
+        printf("%-14s %10.3f %12lld\n", "load image", seconds(start), (long long) st.st_size);
+    }
+    remove(path);
+    return 0;
+}
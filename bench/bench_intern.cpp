@@ -0,0 +1,100 @@
+// Symbol-heavy parsing: intern every identifier of a 10M token input
+// and compare with std::unordered_set<std::string> (old2's strtab) and
+// with no interning at all.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "value.h"
+#include "intern.h"
+
+static constexpr int NTokens = 10000000;
+static constexpr int NVocab  = 4096;
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Zipf-ish identifier stream with ~1% unique temporaries.
+static std::string mkinput()
+{
+    std::vector<std::string> vocab;
+    const char* stems[] = { "car", "cdr", "list", "define", "lambda", "let", "node",
+        "value", "index", "count", "make", "vector", "string", "hash", "set", "ref" };
+    for (int i = 0; i < NVocab; ++i) {
+        vocab.push_back(std::string(stems[i % 16]) + "-" + stems[(i / 16) % 16] + std::to_string(i / 256));
+    }
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    std::string text;
+    for (int i = 0; i < NTokens; ++i) {
+        if (i % 100 == 0) {
+            text += "tmp" + std::to_string(i);
+        } else {
+            text += vocab[(size_t)(NVocab * u(rng) * u(rng) * u(rng))];
+        }
+        text += ' ';
+    }
+    return text;
+}
+
+template <typename F>
+static double scan(const std::string& text, F fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+        const char* tok = p;
+        while (*p != ' ') {
+            ++p;
+        }
+        fn(tok, p - tok);
+        ++p;
+    }
+    return seconds(start);
+}
+
+static std::vector<Value> ast;
+
+static void visitast(void*, GcVisitFn visit)
+{
+    for (Value v : ast) {
+        visit(v);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string text = mkinput();
+    ast.reserve(NTokens);
+    gc_addroots(visitast, nullptr);
+
+    printf("%-28s %12s\n", "benchmark", "Mtokens/s");
+
+    double t = scan(text, [](const char* s, size_t len) { ast.push_back(mksym(s, len)); });
+    printf("%-28s %12.2f\n", "intern table", NTokens / t / 1e6);
+    InternStats s = intern_stats();
+    ast.clear();
+
+    std::unordered_set<std::string> set;
+    t = scan(text, [&](const char* s, size_t len) { set.emplace(s, len); });
+    printf("%-28s %12.2f\n", "std::unordered_set", NTokens / t / 1e6);
+
+    uint64_t before = gc_stats().bytes_allocated;
+    t = scan(text, [](const char* s, size_t len) { mkstr(s, len); });
+    uint64_t nointern = gc_stats().bytes_allocated - before;
+    printf("%-28s %12.2f\n", "no interning (mkstr)", NTokens / t / 1e6);
+
+    printf("\nlookups %lu, hits %lu (%.1f%%), misses %lu\n",
+            s.lookups, s.hits, 100.0 * s.hits / s.lookups, s.misses);
+    printf("probe length: avg %.3f, max %lu (%lu entries, capacity %lu)\n",
+            (double) s.probes / s.lookups, s.max_probe, s.entries, s.capacity);
+    printf("heap bytes: %.1f MiB without interning, %.1f MiB saved by interning\n",
+            nointern / 1048576.0, s.bytes_saved / 1048576.0);
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Isolate scaling: 1, 2, 4, ... 64 isolates each run the same
+// CPU- and allocation-bound job concurrently. Since isolates share
+// nothing, throughput should scale with the number of cores until
+// they run out; past that it should stay flat, not drop.
+#include <cstdio>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "isolate.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* Setup =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"
+    "(define (job) (+ (fib 22) (length (build 100000 '()))))";
+static const char* Job = "(job)";
+static const int JobsPerIsolate = 8;
+
+int main()
+{
+    printf("%d hardware threads\n", (int) std::thread::hardware_concurrency());
+    printf("%8s %8s %10s %10s %9s\n", "isolates", "jobs", "time s", "jobs/s", "speedup");
+    double base = 0;
+    for (int n = 1; n <= 64; n *= 2) {
+        std::vector<std::unique_ptr<Isolate>> isolates;
+        for (int i = 0; i < n; ++i) {
+            isolates.emplace_back(new Isolate);
+            if (isolates.back()->eval(Setup).status != OK) {
+                fprintf(stderr, "setup failed\n");
+                return 1;
+            }
+        }
+        std::vector<std::future<EvalResult>> results;
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < JobsPerIsolate; ++j) {
+            for (auto& iso : isolates) {
+                results.push_back(iso->submit(Job));
+            }
+        }
+        for (auto& f : results) {
+            EvalResult r = f.get();
+            if (r.status != OK || r.value != "117711") {
+                fprintf(stderr, "bad result: %s\n", r.value.c_str());
+                return 1;
+            }
+        }
+        double t = seconds(start);
+        double rate = results.size() / t;
+        if (n == 1) {
+            base = rate;
+        }
+        printf("%8d %8zu %10.3f %10.1f %8.2fx\n", n, results.size(), t, rate, rate / base);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Tokenizer throughput on a generated s-expression corpus, once per
+// pre-scan instruction set: token boundaries alone ("scan"), then the
+// full lexer, which also parses numbers and interns symbols and strings.
+//   bench_lex [MB]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include "lex.h"
+#include "scan.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Source-like text: indentation, comments, identifiers, integers of
+// every width, and string literals.
+static std::string mkcorpus(size_t bytes)
+{
+    std::mt19937 rng(1);
+    std::string text;
+    text.reserve(bytes + 512);
+    for (unsigned i = 0; text.size() < bytes; ++i) {
+        std::string n = std::to_string(i);
+        text += "(define (process-record-" + n + " record index)\n";
+        text += "  ;; normalize the fields of the record before storing it\n";
+        text += "  (let ((total " + std::to_string(rng() % 100) + ") (limit " + std::to_string(rng()) +
+            ") (name \"record number " + n + "\"))\n";
+        text += "    (if (< index " + std::to_string(rng() % 100000) + ")\n";
+        text += "        (vector-set! table index (+ total limit " + std::to_string(rng() % 1000000) + "))\n";
+        text += "        (string-append name \" is out of range\"))))\n\n";
+    }
+    return text;
+}
+
+// Splits the corpus the way lex() does without making values.
+static size_t boundaries(const std::string& corpus)
+{
+    ScanBlock b;
+    const unsigned char* p = (const unsigned char*) corpus.data();
+    const unsigned char* end = p + corpus.size();
+    size_t ntokens = 0;
+    while ((p = scan_space(b, p, end)) < end) {
+        switch (*p) {
+            case ';':
+                p = (const unsigned char*) memchr(p, '\n', end - p);
+                p = p ? p : end;
+                continue;
+            case '(': case ')': case '\'':
+                ++p;
+                break;
+            case '"':
+                for (++p; (p = scan_string(b, p, end)) < end && *p == '\\'; p += 2) {}
+                ++p;
+                break;
+            default:
+                p = scan_delim(b, p, end);
+                break;
+        }
+        ++ntokens;
+    }
+    return ntokens;
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? atoi(argv[1]) : 100;
+    std::string corpus = mkcorpus(mb << 20);
+    ScanIsa best = scan_isa();
+    printf("%-8s %-5s %12s %8s %10s %8s\n", "isa", "pass", "tokens", "s", "Mtok/s", "MB/s");
+    for (int isa = SCAN_SCALAR; isa < SCAN_NISAS; ++isa) {
+        if (!scan_setisa((ScanIsa) isa)) {
+            continue;
+        }
+        for (bool full : { false, true }) {
+            for (int round = 0; round < 2; ++round) {
+                auto start = std::chrono::steady_clock::now();
+                size_t ntokens = 0;
+                if (full) {
+                    Input in(corpus.data(), corpus.size());
+                    Value v;
+                    for (Token t; (t = lex(in, v)) != T_EOF; ++ntokens) {
+                        if (t == T_ERROR) {
+                            fprintf(stderr, "lex error: %s\n", valprint(v, false).c_str());
+                            return 1;
+                        }
+                    }
+                } else {
+                    ntokens = boundaries(corpus);
+                }
+                double t = seconds(start);
+                if (round == 1) {
+                    printf("%-8s %-5s %12zu %8.3f %10.1f %8.1f\n", scan_isaname((ScanIsa) isa), full ? "lex" : "scan",
+                           ntokens, t, ntokens / t / 1e6, corpus.size() / t / 1e6);
+                }
+            }
+        }
+    }
+    scan_setisa(best);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Variable lookup cost: free variables of deeply nested closures and
+// global-heavy code. Each loop iteration performs ~12 variable
+// references, so the time is dominated by how they are resolved.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs every form of `src`, printing the time spent in the last one.
+static bool bench(const char* name, const char* src, const char* expected)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    Value out;
+    double elapsed = 0.0;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            break;
+        } else if (status == ERROR) {
+            fprintf(stderr, "%s: %s\n", name, r.err.c_str());
+            return false;
+        }
+        uint32_t proto;
+        std::string err;
+        if (compile(form, proto, err) != OK) {
+            fprintf(stderr, "%s: %s\n", name, err.c_str());
+            return false;
+        }
+        r.clear();
+        auto start = std::chrono::steady_clock::now();
+        if (vm_run(proto, out) != OK) {
+            fprintf(stderr, "%s: %s\n", name, valprint(out, false).c_str());
+            return false;
+        }
+        elapsed = seconds(start);
+    }
+    if (valprint(out) != expected) {
+        fprintf(stderr, "%s: returned %s, expected %s\n", name, valprint(out).c_str(), expected);
+        return false;
+    }
+    printf("%-20s %8.3f s\n", name, elapsed);
+    return true;
+}
+
+// 1000 x 1000 iterations; the inner loop stays shallow enough for the
+// value stack.
+#define REPEAT(body) \
+    "(define (repeat k acc) (if (= k 0) acc (repeat (- k 1) " body ")))" \
+    "(repeat 1000 0)"
+
+int main()
+{
+    vm_init();
+    bool ok = true;
+    ok &= bench("nested closures",
+        "(define (deep n)"
+        "  (let ((a 1)) (let ((b 2)) (let ((c 3)) (let ((d 4))"
+        "  (let ((e 5)) (let ((f 6)) (let ((g 7)) (let ((h 8))"
+        "    (define (loop i acc)"
+        "      (if (= i 0) acc (loop (- i 1) (+ acc a b c d e f g h))))"
+        "    (loop n 0))))))))))"
+        REPEAT("(+ acc (deep 1000))"),
+        "36000000");
+    ok &= bench("globals",
+        "(define g0 0) (define g1 1) (define g2 2) (define g3 3)"
+        "(define g4 4) (define g5 5) (define g6 6) (define g7 7)"
+        "(define (loop i acc)"
+        "  (if (= i 0) acc (loop (- i 1) (+ acc g0 g1 g2 g3 g4 g5 g6 g7))))"
+        REPEAT("(+ acc (loop 1000 0))"),
+        "28000000");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// Numeric fast paths: the tagged operations from num.h against plain C
+// on the same loops, then the same loops as Scheme code in the VM.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "num.h"
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+static constexpr int N = 100000000;
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Keep the C loops scalar so both sides do one operation per element.
+#define SCALAR __attribute__((noinline, optimize("no-tree-vectorize")))
+
+SCALAR static double c_intsum(int n)
+{
+    int s = 0;
+    for (int i = 0; i < n; ++i) {
+        s += i & 15;
+    }
+    return s;
+}
+
+SCALAR static double tagged_intsum(int n)
+{
+    Value s = mkint(0);
+    for (int i = 0; i < n; ++i) {
+        num_add(s, mkint(i & 15), s);
+    }
+    return num_todouble(s);
+}
+
+SCALAR static double c_flosum(int n)
+{
+    double s = 0;
+    for (int i = 0; i < n; ++i) {
+        s += i * 0.5;
+    }
+    return s;
+}
+
+SCALAR static double tagged_flosum(int n)
+{
+    Value s = mkdouble(0), half = mkdouble(0.5);
+    for (int i = 0; i < n; ++i) {
+        Value t;
+        num_mul(mkint(i), half, t);
+        num_add(s, t, s);
+    }
+    return num_todouble(s);
+}
+
+SCALAR static double c_compare(int n)
+{
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        count += (i & 255) < 100;
+    }
+    return count;
+}
+
+SCALAR static double tagged_compare(int n)
+{
+    Value count = mkint(0), one = mkint(1), hundred = mkint(100);
+    for (int i = 0; i < n; ++i) {
+        int cmp;
+        num_cmp(mkint(i & 255), hundred, cmp);
+        if (cmp < 0) {
+            num_add(count, one, count);
+        }
+    }
+    return num_todouble(count);
+}
+
+static double timeit(double (*fn)(int), double& result)
+{
+    auto start = std::chrono::steady_clock::now();
+    result = fn(N);
+    return seconds(start);
+}
+
+static double run(const char* src, std::string& result)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    double elapsed = 0;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status != OK) {
+            break;
+        }
+        uint32_t proto;
+        std::string err;
+        if (compile(form, proto, err) != OK) {
+            result = "error: " + err;
+            return 0;
+        }
+        r.clear();
+        Value v;
+        auto start = std::chrono::steady_clock::now();
+        status = vm_run(proto, v);
+        elapsed = seconds(start);
+        result = status == OK ? valprint(v) : "error: " + valprint(v, false);
+    }
+    return elapsed;
+}
+
+// The same loops, N/10000 iterations run 10000 times so recursion stays
+// within the value stack.
+#define LOOP(init, step) \
+    "(define (loop i n acc) (if (= i n) acc (loop (+ i 1) n " step ")))" \
+    "(define (outer k acc) (if (= k 0) acc (outer (- k 1) (loop 0 10000 acc))))" \
+    "(outer 10000 " init ")"
+
+int main()
+{
+    struct { const char* name; double (*c)(int); double (*tagged)(int); const char* scheme; } cases[] = {
+        { "fixnum add",   c_intsum,  tagged_intsum,  LOOP("0", "(+ acc (remainder i 16))") },
+        { "flonum mul+add", c_flosum, tagged_flosum, LOOP("0.0", "(+ acc (* i 0.5))") },
+        { "compare",      c_compare, tagged_compare, LOOP("0", "(if (< (remainder i 256) 100) (+ acc 1) acc)") },
+    };
+    vm_init();
+    printf("%-16s %9s %9s %7s %9s %7s\n", "loop (100M)", "C s", "tagged s", "ratio", "vm s", "ratio");
+    for (const auto& c : cases) {
+        double a, b;
+        double tc = timeit(c.c, a);
+        double tt = timeit(c.tagged, b);
+        std::string result;
+        double tv = run(c.scheme, result);
+        if (a != b) {
+            fprintf(stderr, "%s: C %.17g, tagged %.17g\n", c.name, a, b);
+            return 1;
+        }
+        printf("%-16s %9.3f %9.3f %6.2fx %9.3f %6.1fx   (%s)\n", c.name, tc, tt, tt / tc, tv, tv / tc, result.c_str());
+    }
+    return 0;
+}
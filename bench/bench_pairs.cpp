@@ -0,0 +1,148 @@
+// Cons cells: memory per element and traversal speed of a 10M-element
+// list, against the layout of old/value.h where every cons is a
+// heap-allocated Value carrying a string, a double, a char, a pair and
+// a procedure at once.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <unistd.h>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long rssbytes()
+{
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+constexpr long N = 10000000;
+
+//----------------------------------------------------------
+// Baseline: the old representation.
+//----------------------------------------------------------
+struct OldValue;
+struct OldPair { OldValue* car; OldValue* cdr; };
+struct OldProc { std::string name; int builtin; };
+struct OldValue
+{
+    int         kind;
+    std::string str;
+    double      num;
+    char        ch;
+    OldPair     p;
+    OldProc     proc;
+};
+
+static void baseline()
+{
+    long rss = rssbytes();
+    auto start = std::chrono::steady_clock::now();
+    OldValue* one = new OldValue{ 1, "", 1.0 };
+    OldValue* list = nullptr;
+    for (long i = 0; i < N; ++i) {
+        list = new OldValue{ 5, "", 0.0, 0, { one, list } };
+    }
+    double build = seconds(start);
+    long bytes = rssbytes() - rss;
+    start = std::chrono::steady_clock::now();
+    long n = 0;
+    for (OldValue* v = list; v; v = v->p.cdr) {
+        ++n;
+    }
+    double walk = seconds(start);
+    printf("%-26s %8.3f s %8.1f B/elem (sizeof %zu)\n", "old: build", build, (double) bytes / N, sizeof(OldValue));
+    printf("%-26s %8.3f s\n", "old: length", walk);
+    while (list) {
+        OldValue* next = list->p.cdr;
+        delete list;
+        list = next;
+    }
+    delete one;
+    if (n != N) {
+        fprintf(stderr, "old: walked %ld\n", n);
+    }
+}
+
+//----------------------------------------------------------
+// Pairs in the pair space, driven from Scheme.
+//----------------------------------------------------------
+static bool eval(const char* src, std::string& result)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            return true;
+        } else if (status == ERROR) {
+            result = r.err;
+            return false;
+        }
+        uint32_t proto;
+        if (compile(form, proto, result) != OK) {
+            return false;
+        }
+        r.clear();
+        Value out;
+        status = vm_run(proto, out);
+        result = valprint(out, false);
+        if (status != OK) {
+            return false;
+        }
+    }
+}
+
+static bool bench(const char* name, const char* src, const char* expected, bool perelem = false)
+{
+    long rss = rssbytes();
+    auto start = std::chrono::steady_clock::now();
+    std::string result;
+    if (!eval(src, result)) {
+        fprintf(stderr, "%s: %s\n", name, result.c_str());
+        return false;
+    }
+    double elapsed = seconds(start);
+    if (result != expected) {
+        fprintf(stderr, "%s: returned %s, expected %s\n", name, result.c_str(), expected);
+        return false;
+    }
+    printf("%-26s %8.3f s", name, elapsed);
+    if (perelem) {
+        printf(" %8.1f B/elem", (double) (rssbytes() - rss) / N);
+    }
+    printf("\n");
+    return true;
+}
+
+int main()
+{
+    vm_init();
+    bool ok = true;
+    ok &= bench("make-list", "(define a (make-list 10000000 1)) 'ok", "ok", true);
+    ok &= bench("cons loop",
+        "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"
+        "(define b (build 10000000 '())) 'ok", "ok", true);
+    ok &= bench("length", "(length b)", "10000000");
+    ok &= bench("sum loop",
+        "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))"
+        "(sum a 0)", "10000000");
+    ok &= bench("map", "(length (map (lambda (x) (+ x 1)) b))", "10000000");
+    // last, so its freed memory does not hide the growth above
+    baseline();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+// Data parallelism: a CPU-bound map over a list with `map` and then
+// with `pmap` on pools of 1, 2, 4, ... workers, up to the number of
+// hardware threads (and at least 4). Speedup should be close to
+// linear until the pool outgrows the cores.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "isolate.h"
+#include "pool.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run(const char* src, std::string& result)
+{
+    EvalResult r = eval(src, strlen(src));
+    result = r.value;
+    return r.status == OK;
+}
+
+int main()
+{
+    std::string result, expected;
+    if (!run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+             "(define (score x) (+ x (fib 20)))"
+             "(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))"
+             "(define items (iota 512 '()))", result)) {
+        fprintf(stderr, "error: %s\n", result.c_str());
+        return 1;
+    }
+    const char* seq = "(length (map score items))";
+    const char* par = "(length (pmap score items))";
+
+    unsigned hw = std::thread::hardware_concurrency();
+    printf("%u hardware threads\n", hw);
+    printf("%-10s %8s %10s %9s\n", "program", "workers", "time s", "speedup");
+    auto start = std::chrono::steady_clock::now();
+    if (!run(seq, expected)) {
+        fprintf(stderr, "error: %s\n", expected.c_str());
+        return 1;
+    }
+    double base = seconds(start);
+    printf("%-10s %8s %10.3f %8.2fx\n", "map", "-", base, 1.0);
+    for (unsigned n = 1; n <= std::max(4u, hw); n *= 2) {
+        Pool::resize(n);
+        start = std::chrono::steady_clock::now();
+        if (!run(par, result) || result != expected) {
+            fprintf(stderr, "error: %s\n", result.c_str());
+            return 1;
+        }
+        double t = seconds(start);
+        printf("%-10s %8u %10.3f %8.2fx\n", "pmap", n, t, base / t);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Profiler overhead: the same CPU-bound program (fib, and a map over
+// a fresh list) with and without the sampling profiler at 1 kHz. The
+// overhead should stay under 5%.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "isolate.h"
+#include "profile.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* Setup =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))";
+static const char* Work = "(+ (fib 30) (length (map (lambda (x) (* x x)) (iota 1000000 '()))))";
+
+static double run()
+{
+    auto start = std::chrono::steady_clock::now();
+    EvalResult r = eval(Work, strlen(Work));
+    if (r.status != OK) {
+        fprintf(stderr, "error: %s\n", r.value.c_str());
+    }
+    return seconds(start);
+}
+
+int main()
+{
+    eval(Setup, strlen(Setup));
+    run();
+    double off = 1e9, on = 1e9;
+    size_t samples = 0;
+    for (int rep = 0; rep < 5; ++rep) {
+        off = std::min(off, run());
+        std::string err;
+        if (!profile_start(ProfileHz, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+        size_t from = profile_mark();
+        on = std::min(on, run());
+        profile_stop();
+        samples = profile_mark() - from;
+    }
+    printf("%-14s %10s\n", "profiler", "time s");
+    printf("%-14s %10.3f\n", "off", off);
+    printf("%-14s %10.3f\n", "on, 1 kHz", on);
+    printf("overhead %.1f%% (%zu log words in the last run)\n", 100.0 * (on - off) / off, samples);
+    return 0;
+}
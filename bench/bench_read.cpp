@@ -0,0 +1,88 @@
+// Reader throughput on a large generated data file, mapped vs. streamed
+// through the 8K buffer.
+//   bench_read [MB] [path]
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include "read.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void mkfile(const char* path, size_t bytes)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("fopen");
+        exit(1);
+    }
+    std::string rec;
+    size_t written = 0;
+    for (unsigned i = 0; written < bytes; ++i) {
+        rec = "(\"customer-" + std::to_string(i % 100000) + "\" " + std::to_string(i) +
+            " " + std::to_string(i % 1000) + ".25 (address \"" + std::to_string(i % 977) +
+            " Main Street, Springfield\") #t status-" + std::to_string(i % 7) + ")\n";
+        fwrite(rec.data(), 1, rec.size(), f);
+        written += rec.size();
+    }
+    fclose(f);
+}
+
+// Tokens only, or whole datums when `full`.
+static void bench(const char* path, bool map, bool full, size_t bytes)
+{
+    FILE* f = fopen(path, "r");
+    auto start = std::chrono::steady_clock::now();
+    size_t n = 0;
+    {
+        Input in(f, map);
+        Reader r(in);
+        for (Value v; !full;) {
+            Token t = lex(in, v);
+            if (t == T_EOF || t == T_ERROR) {
+                break;
+            }
+            ++n;
+        }
+        for (; full;) {
+            Node form;
+            int status = read(r, form);
+            if (status != OK) {
+                if (status == ERROR) {
+                    fprintf(stderr, "read error: %s\n", r.err.c_str());
+                    exit(1);
+                }
+                break;
+            }
+            r.clear();
+            ++n;
+        }
+    }
+    double t = seconds(start);
+    fclose(f);
+    printf("%-10s %-5s %10zu %-6s %8.3f s %8.1f MB/s\n", map ? "mmap" : "streaming", full ? "read" : "lex",
+           n, full ? "forms" : "tokens", t, bytes / t / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+    size_t mb = argc > 1 ? atoi(argv[1]) : 200;
+    const char* path = argc > 2 ? argv[2] : "/tmp/bench_read.scm";
+    mkfile(path, mb << 20);
+    FILE* f = fopen(path, "r");
+    fseek(f, 0, SEEK_END);
+    size_t bytes = ftell(f);
+    fclose(f);
+
+    for (int round = 0; round < 2; ++round) {
+        for (bool full : { false, true }) {
+            bench(path, false, full, bytes);
+            bench(path, true, full, bytes);
+        }
+    }
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// The evaluation server under a local load generator: p50/p99 latency
+// and requests per second for 1, 2 and 4 workers, each with two client
+// connections sending requests back to back. The prelude is 2000
+// generated procedures plus fib. For comparison, "cold" answers each
+// request the way a fresh process would: a new interpreter that loads
+// the prelude first (without the exec itself).
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "isolate.h"
+#include "serve.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double micros(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double, std::micro>(b - a).count();
+}
+
+static std::string prelude()
+{
+    std::string src = "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n";
+    char buf[256];
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(buf, sizeof(buf), "(define (helper-%d x) (if (< x %d) (list 'lt x) (helper-%d (- x 1))))\n",
+                 i, i, i > 0 ? i - 1 : 0);
+        src += buf;
+    }
+    return src;
+}
+
+static int connectto(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+static void report(const char* name, int workers, std::vector<double>& lat, double secs)
+{
+    std::sort(lat.begin(), lat.end());
+    printf("%-12s %7d %10.1f %10.1f %12.0f\n", name, workers, lat[lat.size() / 2], lat[lat.size() * 99 / 100],
+           lat.size() / secs);
+}
+
+static void load(const std::string& src, const char* name, const std::string& req, int workers, int perclient)
+{
+    ServeConfig config;
+    config.socket = "/tmp/cscheme-bench-" + std::to_string(getpid()) + ".sock";
+    config.workers = workers;
+    config.prelude = src;
+    Server server(config);
+    std::string err;
+    if (!server.start(err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        exit(1);
+    }
+    int nclients = 2 * workers;
+    std::vector<std::vector<double>> lats(nclients);
+    auto start = Clock::now();
+    std::vector<std::thread> clients;
+    for (int j = 0; j < nclients; ++j) {
+        clients.emplace_back([&, j] {
+            int fd = connectto(config.socket);
+            char buf[256];
+            for (int k = 0; k < perclient; ++k) {
+                auto t0 = Clock::now();
+                (void) !write(fd, req.data(), req.size());
+                ssize_t got = 0;
+                while (got == 0 || buf[got - 1] != '\n') {
+                    ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+                    if (n <= 0) {
+                        exit(1);
+                    }
+                    got += n;
+                }
+                lats[j].push_back(micros(t0, Clock::now()));
+            }
+            close(fd);
+        });
+    }
+    for (std::thread& t : clients) {
+        t.join();
+    }
+    double secs = micros(start, Clock::now()) / 1e6;
+    std::vector<double> all;
+    for (auto& l : lats) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    report(name, workers, all, secs);
+}
+
+static void cold(const std::string& src, const std::string& req, int n)
+{
+    std::vector<double> lat;
+    auto start = Clock::now();
+    for (int j = 0; j < n; ++j) {
+        auto t0 = Clock::now();
+        std::thread([&] {
+            eval(src.data(), src.size());
+            eval(req.data(), req.size());
+        }).join();
+        lat.push_back(micros(t0, Clock::now()));
+    }
+    report("cold", 1, lat, micros(start, Clock::now()) / 1e6);
+}
+
+int main()
+{
+    std::string src = prelude();
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    printf("%-12s %7s %10s %10s %12s\n", "request", "workers", "p50 us", "p99 us", "req/s");
+    cold(src, "(helper-10 5)\n", 50);
+    for (int workers : { 1, 2, 4 }) {
+        load(src, "small", "(helper-10 5)\n", workers, 20000 / workers);
+    }
+    for (int workers : { 1, 2, 4 }) {
+        load(src, "fib 15", "(fib 15)\n", workers, 1000 / workers);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+// Startup: a generated 50k-line prelude of small procedures, loaded
+// from source (lex, read, compile, run, then write the .csc) and then
+// from the warm .csc cache. Each load runs in a fresh thread, and so
+// a fresh interpreter.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+#include "csc.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string prelude(int lines)
+{
+    std::string src;
+    char buf[512];
+    for (int i = 0; lines > 0; ++i, lines -= 5) {
+        snprintf(buf, sizeof(buf),
+            "(define (helper-%d x y)\n"
+            "  (let ((z (+ x %d)))\n"
+            "    (if (< z y)\n"
+            "        (list 'lt z \"helper-%d\" %d.5)\n"
+            "        (helper-%d (- x 1) (* y 2)))))\n",
+            i, i, i, i, i > 0 ? i - 1 : 0);
+        src += buf;
+    }
+    src += "(helper-9999 1 100000)\n";
+    return src;
+}
+
+static bool fromsource(const std::string& src, const char* path, uint64_t hash)
+{
+    Input in(src.data(), src.size());
+    Reader r(in);
+    std::vector<uint32_t> protos;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            break;
+        } else if (status != OK) {
+            return false;
+        }
+        uint32_t proto;
+        std::string err;
+        if (compile(form, proto, err) != OK) {
+            return false;
+        }
+        r.clear();
+        protos.push_back(proto);
+        Value v;
+        if (vm_run(proto, v) != OK) {
+            return false;
+        }
+    }
+    return csc_save(path, hash, protos);
+}
+
+static bool fromcache(const char* path, uint64_t hash)
+{
+    std::vector<uint32_t> protos;
+    if (!csc_load(path, hash, protos)) {
+        return false;
+    }
+    for (uint32_t proto : protos) {
+        Value v;
+        if (vm_run(proto, v) != OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    const char* path = "bench_startup.csc";
+    std::string src = prelude(50000);
+    remove(path);
+    printf("%-14s %10s %10s\n", "load", "time s", "bytes");
+    for (int pass = 0; pass < 3; ++pass) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = std::async(std::launch::async, [&] {
+            vm_init();
+            uint64_t hash = csc_hash(src.data(), src.size());
+            return pass == 0 ? fromsource(src, path, hash) : fromcache(path, hash);
+        }).get();
+        if (!ok) {
+            fprintf(stderr, "load failed\n");
+            return 1;
+        }
+        double t = seconds(start);
+        struct stat st;
+        long size = pass == 0 ? (long) src.size() : stat(path, &st) == 0 ? (long) st.st_size : -1;
+        printf("%-14s %10.3f %10ld\n", pass == 0 ? "cold source" : "warm cache", t, size);
+    }
+    remove(path);
+    return 0;
+}
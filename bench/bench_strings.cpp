@@ -0,0 +1,41 @@
+// Building one string out of n fragments: repeated string-append copies
+// everything built so far on every step (quadratic), a string port
+// appends to a growing buffer and copies once at the end (linear).
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "isolate.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* Setup =
+    "(define (by-append n acc) (if (= n 0) acc (by-append (- n 1) (string-append acc \"fragment \"))))"
+    "(define (fill p n) (if (= n 0) p (begin (write-string \"fragment \" p) (fill p (- n 1)))))"
+    "(define (by-port n) (get-output-string (fill (open-output-string) n)))";
+
+static double run(const char* fn, int n)
+{
+    std::string src = "(string-length (" + std::string(fn) + " " + std::to_string(n) +
+        (strcmp(fn, "by-append") == 0 ? " \"\"))" : "))");
+    auto start = std::chrono::steady_clock::now();
+    EvalResult r = eval(src.data(), src.size());
+    double t = seconds(start);
+    if (r.status != OK || r.value != std::to_string(9 * n)) {
+        fprintf(stderr, "%s: %s\n", fn, r.value.c_str());
+    }
+    return t;
+}
+
+int main()
+{
+    eval(Setup, strlen(Setup));
+    printf("%-10s %12s %12s\n", "fragments", "append s", "port s");
+    for (int n = 2500; n <= 40000; n *= 2) {
+        printf("%-10d %12.4f %12.4f\n", n, run("by-append", n), run("by-port", n));
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Keyed lookups: an association list walked in Scheme, the native hash
+// table from Scheme (hash-ref) and from C++ (tab_get), and
+// std::unordered_map on the same 64-bit Value bits, for fixnum and
+// symbol keys.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "isolate.h"
+#include "table.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* Setup =
+    "(define (assq-loop key alist)"
+    "  (cond ((null? alist) #f) ((eq? (car (car alist)) key) (car alist)) (else (assq-loop key (cdr alist)))))"
+    "(define (alist-lookups keys alist sum)"
+    "  (if (null? keys) sum (alist-lookups (cdr keys) alist (+ sum (cdr (assq-loop (car keys) alist))))))"
+    "(define (hash-lookups keys h sum)"
+    "  (if (null? keys) sum (hash-lookups (cdr keys) h (+ sum (hash-ref h (car keys))))))"
+    "(define (fill-hash pairs h) (if (null? pairs) h (begin (hash-set! h (car (car pairs)) (cdr (car pairs))) (fill-hash (cdr pairs) h))))"
+    "(define (repeat k f sum) (if (= k 0) sum (repeat (- k 1) f (+ sum (f)))))";
+
+static double evaltime(const std::string& src, std::string& value)
+{
+    auto start = std::chrono::steady_clock::now();
+    EvalResult r = eval(src.data(), src.size());
+    double t = seconds(start);
+    value = r.status == OK ? r.value : "error: " + r.value;
+    return t;
+}
+
+// `keys` is a Scheme list expression of n distinct keys.
+static void scheme(const char* kind, int n, const std::string& keys, int reps)
+{
+    std::string v1, v2;
+    std::string setup = "(define bench-keys " + keys + ")"
+        "(define bench-alist (map (lambda (k) (cons k 1)) bench-keys))"
+        "(define bench-hash (fill-hash bench-alist (make-hash-table)))";
+    evaltime(setup, v1);
+    std::string reps_ = std::to_string(reps);
+    double alist = evaltime("(repeat " + reps_ + " (lambda () (alist-lookups bench-keys bench-alist 0)) 0)", v1);
+    double hash = evaltime("(repeat " + reps_ + " (lambda () (hash-lookups bench-keys bench-hash 0)) 0)", v2);
+    double lookups = (double) n * reps;
+    printf("%-8s %6d %14.1f %14.1f %s\n", kind, n, alist / lookups * 1e9, hash / lookups * 1e9,
+           v1 == v2 ? "" : "MISMATCH");
+}
+
+static void native(int n)
+{
+    std::vector<Value> keys;
+    for (int j = 0; j < n; ++j) {
+        keys.push_back(mkint(j * 7919));
+    }
+    Value tab = tab_new();
+    gc_pushroot(tab);
+    std::unordered_map<uint64_t, uint64_t> map;
+    for (Value k : keys) {
+        tab_set(tab, k, k);
+        map[k.uval] = k.uval;
+    }
+    const int reps = 20000000 / n;
+    uint64_t sum1 = 0, sum2 = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) {
+        for (Value k : keys) {
+            Value v;
+            tab_get(tab, k, v);
+            sum1 += v.uval;
+        }
+    }
+    double t1 = seconds(start);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) {
+        for (Value k : keys) {
+            sum2 += map.find(k.uval)->second;
+        }
+    }
+    double t2 = seconds(start);
+    double lookups = (double) n * reps;
+    printf("%-8s %6d %14.1f %14.1f %s\n", "c++", n, t1 / lookups * 1e9, t2 / lookups * 1e9,
+           sum1 == sum2 ? "" : "MISMATCH");
+    gc_poproot();
+}
+
+int main()
+{
+    eval(Setup, strlen(Setup));
+    printf("Scheme, ns per lookup\n%-8s %6s %14s %14s\n", "keys", "n", "assoc list", "hash-ref");
+    for (int n : { 10, 100, 1000 }) {
+        int reps = 2000000 / (n * (n + 20) / 20);
+        std::string ints = "(list";
+        std::string syms = "(list";
+        for (int j = 0; j < n; ++j) {
+            ints += " " + std::to_string(j * 7919);
+            syms += " 'key-symbol-" + std::to_string(j);
+        }
+        scheme("fixnum", n, ints + ")", std::max(reps, 1));
+        scheme("symbol", n, syms + ")", std::max(reps, 1));
+    }
+    printf("\nC++, ns per lookup\n%-8s %6s %14s %14s\n", "keys", "n", "tab_get", "unordered_map");
+    for (int n : { 100, 10000, 1000000 }) {
+        native(n);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Tail calls in constant space: a self-recursive loop and a pair of
+// mutually recursive procedures run for 1M and then 100M iterations.
+// Peak RSS must not grow between the two runs.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <sys/resource.h>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long maxrsskb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// Runs every form of `src`, returning the printed value of the last one.
+static bool run(const char* src, std::string& result)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            return true;
+        } else if (status == ERROR) {
+            result = r.err;
+            return false;
+        }
+        uint32_t proto;
+        if (compile(form, proto, result) != OK) {
+            return false;
+        }
+        r.clear();
+        Value out;
+        status = vm_run(proto, out);
+        result = valprint(out, false);
+        if (status != OK) {
+            return false;
+        }
+    }
+}
+
+int main()
+{
+    vm_init();
+    std::string result;
+    if (!run("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))"
+             "(define (ping n) (if (= n 0) 'ping (pong (- n 1))))"
+             "(define (pong n) (if (= n 0) 'pong (ping (- n 1))))", result)) {
+        fprintf(stderr, "error: %s\n", result.c_str());
+        return 1;
+    }
+    struct { const char* name; const char* src; } cases[] = {
+        { "self loop",       "(loop %ld 0)" },
+        { "mutual recursion", "(ping %ld)" },
+    };
+    bool ok = true;
+    printf("%-18s %12s %10s %12s\n", "program", "iterations", "time s", "maxrss KiB");
+    for (auto& c : cases) {
+        long before = 0;
+        for (long n : { 1000000L, 100000000L }) {
+            char src[64];
+            snprintf(src, sizeof(src), c.src, n);
+            auto start = std::chrono::steady_clock::now();
+            if (!run(src, result)) {
+                fprintf(stderr, "%s: %s\n", c.name, result.c_str());
+                return 1;
+            }
+            long rss = maxrsskb();
+            printf("%-18s %12ld %10.3f %12ld\n", c.name, n, seconds(start), rss);
+            if (before && rss > before + 1024) {
+                fprintf(stderr, "%s: peak RSS grew by %ld KiB\n", c.name, rss - before);
+                ok = false;
+            }
+            before = rss;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Homogeneous vectors: heap bytes per element of an f64vector against
+// a list of flonums, and the bulk builtins called from Scheme against
+// the same operation as a plain C loop over a std::vector, at a size
+// that fits in L1 and one that streams from memory.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "isolate.h"
+#include "uvec.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static volatile double sink;
+static volatile double one = 1.0;  // keeps the C loop from folding x * 1.0
+
+static const char* Setup =
+    "(define (repeat k thunk) (if (= k 0) #t (begin (thunk) (repeat (- k 1) thunk))))";
+
+static double perelem(const std::string& src, size_t n, int reps)
+{
+    auto start = std::chrono::steady_clock::now();
+    EvalResult r = eval(src.data(), src.size());
+    double t = seconds(start);
+    if (r.status != OK) {
+        fprintf(stderr, "%s: %s\n", src.c_str(), r.value.c_str());
+    }
+    return t / ((double) n * reps) * 1e9;
+}
+
+template <typename Fn>
+static double perelemc(size_t n, int reps, Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) {
+        fn();
+    }
+    return seconds(start) / ((double) n * reps) * 1e9;
+}
+
+static double allocated(const char* src)
+{
+    uint64_t before = gc_stats().bytes_allocated;
+    eval(src, strlen(src));
+    return (double) (gc_stats().bytes_allocated - before) / 1000000;
+}
+
+int main()
+{
+    eval(Setup, strlen(Setup));
+    printf("heap bytes per element, 1e6 elements\n");
+    printf("  %-28s %6.2f\n", "(make-f64vector n 1.5)", allocated("(define fv (make-f64vector 1000000 1.5)) #t"));
+    printf("  %-28s %6.2f\n", "(make-list n 1.5)", allocated("(define fl (make-list 1000000 1.5)) #t"));
+    const char* release = "(set! fv #f) (set! fl #f)";
+    eval(release, strlen(release));
+
+    printf("\nns per element          %12s %12s\n", "scheme", "plain C");
+    for (size_t n : { 2048, 4000000 }) {
+        int reps = std::max<int>(1, 200000000 / n);
+        std::string ns = std::to_string(n);
+        std::string rs = std::to_string(reps);
+        std::string src = "(define x (make-f64vector " + ns + " 1.0)) (define y (make-f64vector " + ns + " 0.5)) #t";
+        eval(src.data(), src.size());
+        std::vector<double> x(n, 1.0), y(n, 0.5);
+
+        auto row = [&](const char* name, const std::string& body, double c) {
+            double s = perelem("(repeat " + rs + " (lambda () " + body + "))", n, reps);
+            printf("  %-10s n=%-8zu %12.3f %12.3f\n", name, n, s, c);
+        };
+        row("sum", "(f64vector-sum x)", perelemc(n, reps, [&] {
+            double s = 0;
+            for (size_t j = 0; j < n; ++j) s += x[j];
+            sink = s;
+        }));
+        row("dot", "(f64vector-dot x y)", perelemc(n, reps, [&] {
+            double s = 0;
+            for (size_t j = 0; j < n; ++j) s += x[j] * y[j];
+            sink = s;
+        }));
+        row("map! +", "(f64vector-map! + x y)", perelemc(n, reps, [&] {
+            for (size_t j = 0; j < n; ++j) x[j] += y[j];
+            sink = x[0];
+        }));
+        row("map! *", "(f64vector-map! * x 1.0)", perelemc(n, reps, [&] {
+            double k = one;
+            for (size_t j = 0; j < n; ++j) x[j] *= k;
+            sink = x[0];
+        }));
+        row("fill!", "(f64vector-fill! x 2.0)", perelemc(n, reps, [&] {
+            std::fill(x.begin(), x.end(), 2.0);
+            sink = x[0];
+        }));
+        row("copy!", "(f64vector-copy! x 0 y)", perelemc(n, reps, [&] {
+            memcpy(x.data(), y.data(), n * sizeof(double));
+            sink = x[0];
+        }));
+    }
+    return 0;
+}
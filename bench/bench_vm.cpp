@@ -0,0 +1,168 @@
+// Bytecode VM vs. a direct AST walker over the same reader output, using
+// the same name-chain environment model, on call-heavy programs.
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+#include "builtins.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//----------------------------------------------------------
+// Tree walker: enough of Scheme for the programs below
+// (if, define of procedures, calls, integer builtins).
+//----------------------------------------------------------
+struct WalkEnv;
+struct WalkProc
+{
+    const Node*             params;
+    const Node*             body;
+    std::shared_ptr<WalkEnv> env;
+};
+
+struct WalkEnv
+{
+    std::unordered_map<uint64_t, Value> vars;
+    std::shared_ptr<WalkEnv>            parent;
+};
+
+struct Walker
+{
+    std::vector<WalkProc> procs; // referenced by LUDATA payload
+    Value ifsym   = mksym("if");
+    Value defsym  = mksym("define");
+
+    Value* lookup(WalkEnv* env, Value sym)
+    {
+        for (; env; env = env->parent.get()) {
+            auto found = env->vars.find(sym.uval);
+            if (found != env->vars.end()) {
+                return &found->second;
+            }
+        }
+        return nullptr;
+    }
+
+    Value eval(const Node& n, const std::shared_ptr<WalkEnv>& env)
+    {
+        if (!n.islist) {
+            return issym(n.atom) ? *lookup(env.get(), n.atom) : n.atom;
+        }
+        Value head = n.items[0].atom;
+        if (!n.items[0].islist && head.uval == ifsym.uval) {
+            return !isfalse(eval(n.items[1], env)) ? eval(n.items[2], env) : eval(n.items[3], env);
+        }
+        if (!n.items[0].islist && head.uval == defsym.uval) {
+            const Node& target = n.items[1];
+            procs.push_back(WalkProc{&target, &n.items[2], env});
+            env->vars[target.items[0].atom.uval] = mkref(LV_LUDATA, procs.size() - 1);
+            return mknil();
+        }
+        Value f = eval(n.items[0], env);
+        Value args[8];
+        int nargs = n.items.size() - 1;
+        for (int i = 0; i < nargs; ++i) {
+            args[i] = eval(n.items[i + 1], env);
+        }
+        if (isbuiltin(f)) {
+            Value out;
+            builtins[unsafe_tobuiltin(f)].fn(args, nargs, out);
+            return out;
+        }
+        const WalkProc& proc = procs[f.b.lo];
+        auto frame = std::make_shared<WalkEnv>();
+        frame->parent = proc.env;
+        for (int i = 0; i < nargs; ++i) {
+            frame->vars[proc.params->items[i + 1].atom.uval] = args[i];
+        }
+        return eval(*proc.body, frame);
+    }
+};
+
+static std::vector<Node> readall(const char* src, Reader& r)
+{
+    std::vector<Node> forms;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status != OK) {
+            if (status == ERROR) {
+                fprintf(stderr, "read error: %s\n", r.err.c_str());
+                exit(1);
+            }
+            return forms;
+        }
+        forms.push_back(std::move(form));
+    }
+}
+
+struct Program
+{
+    const char* name;
+    const char* src;
+    const char* expected;
+};
+
+static const Program programs[] = {
+    { "fib 27",
+      "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 27)",
+      "196418" },
+    { "tak 24 16 8",
+      "(define (tak x y z) (if (not (< y x)) z"
+      "  (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))))"
+      "(tak 24 16 8)",
+      "9" },
+};
+
+int main()
+{
+    vm_init();
+    Walker walker;
+    printf("%-14s %10s %10s %8s\n", "program", "walker s", "vm s", "speedup");
+    for (const Program& prog : programs) {
+        Input in(prog.src, strlen(prog.src));
+        Reader r(in);
+        std::vector<Node> forms = readall(prog.src, r);
+
+        auto start = std::chrono::steady_clock::now();
+        auto global = std::make_shared<WalkEnv>();
+        for (size_t i = 0; i < nbuiltins; ++i) {
+            global->vars[mksym(builtins[i].name).uval] = mkbuiltin(i);
+        }
+        Value out;
+        for (const Node& form : forms) {
+            out = walker.eval(form, global);
+        }
+        double walk = seconds(start);
+        if (valprint(out) != prog.expected) {
+            fprintf(stderr, "%s: walker returned %s\n", prog.name, valprint(out).c_str());
+            return 1;
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (const Node& form : forms) {
+            uint32_t proto;
+            std::string err;
+            if (compile(form, proto, err) != OK || vm_run(proto, out) != OK) {
+                fprintf(stderr, "%s: %s\n", prog.name, err.empty() ? valprint(out, false).c_str() : err.c_str());
+                return 1;
+            }
+        }
+        double run = seconds(start);
+        if (valprint(out) != prog.expected) {
+            fprintf(stderr, "%s: vm returned %s\n", prog.name, valprint(out).c_str());
+            return 1;
+        }
+        printf("%-14s %10.3f %10.3f %7.2fx\n", prog.name, walk, run, walk / run);
+    }
+    return 0;
+}
@@ -0,0 +1,395 @@
+// The regression suite: micro benchmarks of value boxing, strings and
+// the lexer, and the usual small Scheme programs, each run until it has
+// taken --benchmark_min_time seconds. The flags and the JSON layout
+// follow Google Benchmark, so its compare.py can diff two runs:
+//
+//   cscheme_bench --benchmark_format=json > before.json
+//
+// Other flags: --benchmark_filter=SUBSTRING, --benchmark_min_time=SEC.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "value.h"
+#include "gc.h"
+#include "lex.h"
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+#include "isolate.h"
+
+namespace {
+
+// Keeps the compiler from dropping a computation whose result is unused.
+template <typename T>
+inline void keep(const T& v)
+{
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+double cputime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct Benchmark
+{
+    std::string                   name;
+    std::function<bool(uint64_t)> run;     // runs n iterations, false on error
+    uint64_t                      bytes = 0; // per iteration, for throughput
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t    iterations;
+    double      real_ns;                   // per iteration
+    double      cpu_ns;
+    double      bytes_per_second;
+};
+
+std::vector<Benchmark> benchmarks;
+
+void add(std::string name, std::function<bool(uint64_t)> run, uint64_t bytes = 0)
+{
+    benchmarks.push_back(Benchmark{ std::move(name), std::move(run), bytes });
+}
+
+// Like Google Benchmark: grow the iteration count until one batch takes
+// at least `mintime`, and report that batch.
+bool measure(const Benchmark& b, double mintime, Result& r)
+{
+    for (uint64_t n = 1;;) {
+        auto start = std::chrono::steady_clock::now();
+        double cpustart = cputime();
+        if (!b.run(n)) {
+            return false;
+        }
+        double cpu = cputime() - cpustart;
+        double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (real >= mintime || n >= (uint64_t) 1e9) {
+            r = Result{ b.name, n, real * 1e9 / n, cpu * 1e9 / n, b.bytes ? b.bytes * n / real : 0.0 };
+            return true;
+        }
+        double grow = real > 0 ? 1.4 * mintime / real : 10.0;
+        n = std::max(n + 1, (uint64_t) (n * std::min(10.0, grow)));
+    }
+}
+
+//----------------------------------------------------------
+// Values and strings
+//----------------------------------------------------------
+
+void valuebenchmarks()
+{
+    add("value/mkint", [](uint64_t n) {
+        for (uint64_t j = 0; j < n; ++j) {
+            keep(mkint((int) j));
+        }
+        return true;
+    });
+    add("value/mkdouble", [](uint64_t n) {
+        for (uint64_t j = 0; j < n; ++j) {
+            keep(mkdouble(j * 0.5));
+        }
+        return true;
+    });
+    add("value/totag", [](uint64_t n) {
+        static const Value values[] = { mkint(1), mkdouble(2.5), mknil(), mktrue(), mkfalse(),
+                                        mkref(LV_STR, 1), mkref(LV_PAIR, 2), mkint(-3) };
+        uint32_t sum = 0;
+        for (uint64_t j = 0; j < n; ++j) {
+            sum += totag(values[j % 8]);
+        }
+        keep(sum);
+        return true;
+    });
+    add("value/unbox", [](uint64_t n) {
+        Value i = mkint(7), d = mkdouble(0.25);
+        keep(i);
+        keep(d);
+        double sum = 0;
+        for (uint64_t j = 0; j < n; ++j) {
+            sum += isint(i) ? unsafe_toint(i) : 0;
+            sum += isdouble(d) ? unsafe_todouble(d) : 0;
+        }
+        keep(sum);
+        return true;
+    });
+    add("string/mkstr", [](uint64_t n) {
+        for (uint64_t j = 0; j < n; ++j) {
+            keep(mkstr("hello, world", 12));
+        }
+        return true;
+    });
+    add("string/unsafe_tostr", [](uint64_t n) {
+        Value s = mkstr("hello, world", 12);
+        uint64_t sum = 0;
+        for (uint64_t j = 0; j < n; ++j) {
+            keep(s);
+            sum += unsafe_tostr(s)->len;
+        }
+        keep(sum);
+        return true;
+    });
+}
+
+//----------------------------------------------------------
+// Lexer
+//----------------------------------------------------------
+
+std::string lexsource()
+{
+    std::string src;
+    for (int j = 0; src.size() < (1u << 20); ++j) {
+        src += "(define (item-" + std::to_string(j) + " x) ; a comment\n"
+               "  (cond ((< x " + std::to_string(j) + ") 'small \"a string\")\n"
+               "        (else (* x 2.5))))\n";
+    }
+    return src;
+}
+
+void lexbenchmarks()
+{
+    static const std::string src = lexsource();
+    add("lex/tokens", [](uint64_t n) {
+        for (uint64_t j = 0; j < n; ++j) {
+            Input in(src.data(), src.size());
+            Value v;
+            Token t;
+            while ((t = lex(in, v)) < T_EOF) {
+                keep(v);
+            }
+            if (t == T_ERROR) {
+                return false;
+            }
+        }
+        return true;
+    }, src.size());
+    add("read/forms", [](uint64_t n) {
+        for (uint64_t j = 0; j < n; ++j) {
+            Input in(src.data(), src.size());
+            Reader r(in);
+            int status;
+            for (;;) {
+                Node form;
+                if ((status = read(r, form)) != OK) {
+                    break;
+                }
+                r.clear();
+            }
+            if (status == ERROR) {
+                return false;
+            }
+        }
+        return true;
+    }, src.size());
+}
+
+//----------------------------------------------------------
+// Scheme programs
+//----------------------------------------------------------
+
+const char* Programs =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(define (tak x y z) (if (not (< y x)) z"
+    "  (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))))"
+    "(define (ack m n) (cond ((= m 0) (+ n 1))"
+    "                        ((= n 0) (ack (- m 1) 1))"
+    "                        (else (ack (- m 1) (ack m (- n 1))))))"
+    // nqueens: count the placements of n queens
+    "(define (queens-ok? row dist placed)"
+    "  (or (null? placed)"
+    "      (and (not (= (car placed) (+ row dist)))"
+    "           (not (= (car placed) (- row dist)))"
+    "           (not (= (car placed) row))"
+    "           (queens-ok? row (+ dist 1) (cdr placed)))))"
+    "(define (queens-try row n placed)"
+    "  (cond ((= (length placed) n) 1)"
+    "        ((> row n) 0)"
+    "        (else (+ (if (queens-ok? row 1 placed) (queens-try 1 n (cons row placed)) 0)"
+    "                 (queens-try (+ row 1) n placed)))))"
+    "(define (nqueens n) (queens-try 1 n '()))"
+    // string-append: build a string piece by piece
+    "(define (strings n acc) (if (= n 0) (string-length acc)"
+    "  (strings (- n 1) (string-append acc \"ab\"))))"
+    // assoc-heavy: look every key up in a 200 entry association list
+    "(define (assq-loop key alist)"
+    "  (cond ((null? alist) #f)"
+    "        ((eq? (car (car alist)) key) (car alist))"
+    "        (else (assq-loop key (cdr alist)))))"
+    "(define (alist n acc) (if (= n 0) acc (alist (- n 1) (cons (list n (* n n)) acc))))"
+    "(define table (alist 200 '()))"
+    "(define (lookups keys sum)"
+    "  (if (null? keys) sum"
+    "      (lookups (cdr keys) (+ sum (car (cdr (assq-loop (car (car keys)) table)))))))"
+    "(define (assoc-bench k sum) (if (= k 0) sum (assoc-bench (- k 1) (+ sum (lookups table 0)))))";
+
+bool compileexpr(const char* src, uint32_t& proto)
+{
+    Input in(src, strlen(src));
+    Reader r(in);
+    Node form;
+    std::string err;
+    if (read(r, form) != OK || compile(form, proto, err) != OK) {
+        fprintf(stderr, "%s: cannot compile\n", src);
+        return false;
+    }
+    return true;
+}
+
+void program(const char* name, const char* expr, const char* expected)
+{
+    std::string key = name;
+    add(key, [=](uint64_t n) {
+        uint32_t proto;
+        if (!compileexpr(expr, proto)) {
+            return false;
+        }
+        for (uint64_t j = 0; j < n; ++j) {
+            Value out;
+            if (vm_run(proto, out) != OK || valprint(out) != expected) {
+                fprintf(stderr, "%s: %s returned %s, expected %s\n", name, expr,
+                        valprint(out).c_str(), expected);
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+void schemebenchmarks()
+{
+    program("scheme/fib", "(fib 25)", "75025");
+    program("scheme/tak", "(tak 18 12 6)", "7");
+    program("scheme/ack", "(ack 2 9)", "21");
+    program("scheme/nqueens", "(nqueens 8)", "92");
+    program("scheme/string-append", "(strings 1000 \"\")", "2000");
+    program("scheme/assoc", "(assoc-bench 10 0)", "26867000");
+}
+
+std::string jsonstr(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + '"';
+}
+
+void printjson(const std::vector<Result>& results)
+{
+    char date[64], host[256] = "unknown";
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    gethostname(host, sizeof(host) - 1);
+    printf("{\n  \"context\": {\n");
+    printf("    \"date\": %s,\n", jsonstr(date).c_str());
+    printf("    \"host_name\": %s,\n", jsonstr(host).c_str());
+    printf("    \"executable\": \"cscheme_bench\",\n");
+    printf("    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+    printf("    \"library_build_type\": \"release\"\n");
+#else
+    printf("    \"library_build_type\": \"debug\"\n");
+#endif
+    printf("  },\n  \"benchmarks\": [\n");
+    for (size_t j = 0; j < results.size(); ++j) {
+        const Result& r = results[j];
+        printf("    {\n");
+        printf("      \"name\": %s,\n", jsonstr(r.name).c_str());
+        printf("      \"run_name\": %s,\n", jsonstr(r.name).c_str());
+        printf("      \"run_type\": \"iteration\",\n");
+        printf("      \"iterations\": %llu,\n", (unsigned long long) r.iterations);
+        printf("      \"real_time\": %.4f,\n", r.real_ns);
+        printf("      \"cpu_time\": %.4f,\n", r.cpu_ns);
+        if (r.bytes_per_second > 0) {
+            printf("      \"bytes_per_second\": %.1f,\n", r.bytes_per_second);
+        }
+        printf("      \"time_unit\": \"ns\"\n");
+        printf("    }%s\n", j + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+void printconsole(const Result& r)
+{
+    printf("%-24s %14.1f ns %14.1f ns %12llu", r.name.c_str(), r.real_ns, r.cpu_ns,
+           (unsigned long long) r.iterations);
+    if (r.bytes_per_second > 0) {
+        printf(" %10.1f MB/s", r.bytes_per_second / 1e6);
+    }
+    printf("\n");
+}
+
+void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [--benchmark_format=console|json] [--benchmark_filter=SUBSTRING]\n"
+            "       [--benchmark_min_time=SECONDS]\n", argv0);
+    exit(1);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    const char* filter = "";
+    double mintime = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--benchmark_format=json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--benchmark_format=console") == 0) {
+            json = false;
+        } else if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+            filter = argv[i] + 19;
+        } else if (strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+            mintime = atof(argv[i] + 21);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    EvalResult setup = eval(Programs, strlen(Programs));
+    if (setup.status != OK) {
+        fprintf(stderr, "error: %s\n", setup.value.c_str());
+        return 1;
+    }
+    valuebenchmarks();
+    lexbenchmarks();
+    schemebenchmarks();
+
+    if (!json) {
+        printf("%-24s %17s %17s %12s\n", "benchmark", "time", "cpu", "iterations");
+    }
+    std::vector<Result> results;
+    for (const Benchmark& b : benchmarks) {
+        if (!strstr(b.name.c_str(), filter)) {
+            continue;
+        }
+        Result r;
+        if (!measure(b, mintime, r)) {
+            fprintf(stderr, "%s failed\n", b.name.c_str());
+            return 1;
+        }
+        results.push_back(r);
+        if (!json) {
+            printconsole(r);
+        }
+    }
+    if (json) {
+        printjson(results);
+    }
+    return 0;
+}
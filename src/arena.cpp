@@ -0,0 +1,106 @@
+#include "arena.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+
+static size_t pagesize()
+{
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static void oom(size_t size)
+{
+    fprintf(stderr, "arena: out of memory mapping %zu bytes\n", size);
+    abort();
+}
+
+void region_init(Region& r, size_t cap)
+{
+    cap = alignup(cap, pagesize());
+    void* p = mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        oom(cap);
+    }
+    r.base = r.top = (char*) p;
+    r.lim  = r.base + cap;
+}
+
+bool region_grow(Region& r, size_t cap)
+{
+    cap = alignup(cap, pagesize());
+    if (cap <= r.cap()) {
+        return false;
+    }
+    size_t used = r.used();
+    void* p = mremap(r.base, r.cap(), cap, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+        oom(cap);
+    }
+    bool moved = p != r.base;
+    r.base = (char*) p;
+    r.top  = r.base + used;
+    r.lim  = r.base + cap;
+    return moved;
+}
+
+void region_trim(Region& r)
+{
+    char* from = (char*) alignup((uintptr_t) r.top, pagesize());
+    if (from < r.lim) {
+        madvise(from, r.lim - from, MADV_DONTNEED);
+    }
+}
+
+void region_free(Region& r)
+{
+    if (r.base) {
+        munmap(r.base, r.cap());
+    }
+    r.base = r.top = r.lim = nullptr;
+}
+
+Slab::Slab(size_t slotsize)
+    : slotsize_(alignup(slotsize, 8))
+{
+    size_t n = ChunkBytes / slotsize_;
+    shift_ = 0;
+    while ((2u << shift_) <= n) {
+        ++shift_;
+    }
+    mask_ = (1u << shift_) - 1;
+}
+
+Slab::~Slab()
+{
+    for (char* chunk : chunks_) {
+        ::free(chunk);
+    }
+}
+
+uint32_t Slab::alloc()
+{
+    ++used_;
+    if (!free_.empty()) {
+        uint32_t index = free_.back();
+        free_.pop_back();
+        return index;
+    }
+    if (next_ == capacity()) {
+        size_t bytes = alignup(slotsize_ << shift_, CacheLine);
+        char* chunk = (char*) aligned_alloc(CacheLine, bytes);
+        if (!chunk) {
+            oom(bytes);
+        }
+        chunks_.push_back(chunk);
+    }
+    return next_++;
+}
+
+void Slab::free(uint32_t index)
+{
+    assert(index < next_ && used_ > 0);
+    --used_;
+    free_.push_back(index);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+
+constexpr size_t CacheLine = 64;
+
+inline size_t alignup(size_t n, size_t a) { return (n + a - 1) & ~(a - 1); }
+
+//----------------------------------------------------------
+// Size classes: every heap object size is rounded to a
+// 16-byte granule so object fields stay 16-byte aligned.
+// Beyond 512 bytes objects are rounded to whole cache
+// lines so big payloads never share a line with the next
+// object's header.
+//----------------------------------------------------------
+constexpr size_t SizeGranule   = 16;
+constexpr size_t SmallSizeMax  = 512;
+
+inline size_t sizeclass(size_t size)
+{
+    return alignup(size, size <= SmallSizeMax ? SizeGranule : CacheLine);
+}
+
+//----------------------------------------------------------
+// Region: a contiguous, page-backed bump-pointer arena.
+// Pages are mapped lazily by the kernel, so a region only
+// costs RSS for the part that has been bumped into.
+//----------------------------------------------------------
+struct Region
+{
+    char* base = nullptr;
+    char* top  = nullptr;
+    char* lim  = nullptr;
+
+    bool contains(const void* p) const { return p >= base && p < lim; }
+    size_t used() const { return top - base; }
+    size_t avail() const { return lim - top; }
+    size_t cap() const { return lim - base; }
+
+    void* bump(size_t size)
+    {
+        assert(avail() >= size);
+        void* p = top;
+        top += size;
+        return p;
+    }
+};
+
+void region_init(Region& r, size_t cap);
+// Grows the region to at least `cap` bytes. Returns true if the region
+// had to move, in which case every pointer into it is stale.
+bool region_grow(Region& r, size_t cap);
+// Gives the pages between `top` and `lim` back to the kernel.
+void region_trim(Region& r);
+void region_free(Region& r);
+
+//----------------------------------------------------------
+// Slab: fixed-size slots carved out of cache-line aligned
+// chunks, addressed by a dense 32-bit index so a slot can be
+// referenced directly from a Value payload. Freed slots are
+// reused LIFO. Intended for small, uniform objects (pairs,
+// closures, ...) that should not pay for a GcHeader.
+//----------------------------------------------------------
+class Slab
+{
+public:
+    static constexpr size_t ChunkBytes = 64u << 10;
+
+    explicit Slab(size_t slotsize);
+    ~Slab();
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    uint32_t alloc();
+    void free(uint32_t index);
+
+    void* get(uint32_t index) const
+    {
+        assert(index < capacity());
+        return chunks_[index >> shift_] + (index & mask_) * slotsize_;
+    }
+
+    size_t slotsize() const { return slotsize_; }
+    size_t capacity() const { return chunks_.size() << shift_; }
+    size_t used() const { return used_; }
+
+private:
+    size_t              slotsize_;
+    uint32_t            shift_;
+    uint32_t            mask_;
+    uint32_t            next_ = 0; // first never-used slot
+    size_t              used_ = 0;
+    std::vector<char*>  chunks_;
+    std::vector<uint32_t> free_;
+};
+
+template <typename T>
+class TypedSlab : public Slab
+{
+public:
+    TypedSlab() : Slab(sizeof(T)) {}
+    T* get(uint32_t index) const { return (T*) Slab::get(index); }
+};
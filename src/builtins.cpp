@@ -0,0 +1,1056 @@
+#include "builtins.h"
+#include "num.h"
+#include "vm.h"
+#include "pool.h"
+#include "transfer.h"
+#include "image.h"
+#include "profile.h"
+#include "port.h"
+#include "table.h"
+#include "uvec.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int fail(Value& out, const char* fn, const char* msg)
+{
+    std::string s = fn;
+    s += ": ";
+    s += msg;
+    out = mkstr(s.c_str(), s.size());
+    return ERROR;
+}
+
+static double todouble(Value v) { return num_todouble(v); }
+
+static bool allnumeric(Value* args, int nargs, bool& anydouble)
+{
+    anydouble = false;
+    for (int i = 0; i < nargs; ++i) {
+        if (isdouble(args[i])) {
+            anydouble = true;
+        } else if (!isint(args[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Folds `op` over the arguments, starting from `init`.
+static int fold(const char* name, bool (*op)(Value, Value, Value&), Value init, Value* args, int nargs, Value& out)
+{
+    Value acc = init;
+    for (int i = 0; i < nargs; ++i) {
+        if (!op(acc, args[i], acc)) {
+            return fail(out, name, "non-numeric argument");
+        }
+    }
+    out = acc;
+    return OK;
+}
+
+static int b_plus(Value* args, int nargs, Value& out) { return fold("+", num_add, mkint(0), args, nargs, out); }
+static int b_multiply(Value* args, int nargs, Value& out) { return fold("*", num_mul, mkint(1), args, nargs, out); }
+
+static int b_minus(Value* args, int nargs, Value& out)
+{
+    if (nargs == 1) {
+        return fold("-", num_sub, mkint(0), args, 1, out);
+    }
+    if (!isnum(args[0])) {
+        return fail(out, "-", "non-numeric argument");
+    }
+    return fold("-", num_sub, args[0], args + 1, nargs - 1, out);
+}
+
+static int b_divide(Value* args, int nargs, Value& out)
+{
+    bool anydouble;
+    if (!allnumeric(args, nargs, anydouble)) {
+        return fail(out, "/", "non-numeric argument");
+    }
+    double result = nargs == 1 ? 1.0 / todouble(args[0]) : todouble(args[0]);
+    for (int i = 1; i < nargs; ++i) {
+        result /= todouble(args[i]);
+    }
+    // checked before the cast, which is undefined for NaN, the
+    // infinities of a division by zero and (/ -2147483648 -1)
+    if (!anydouble && std::isfinite(result) && result >= INT_MIN && result <= INT_MAX && result == (int) result) {
+        out = mkint((int) result);
+    } else {
+        out = mkdouble(result);
+    }
+    return OK;
+}
+
+// `ok` says which three-way results make a pair of arguments pass.
+static int compare(const char* name, Value* args, int nargs, Value& out, bool (*ok)(int))
+{
+    for (int i = 0; i < nargs; ++i) {
+        if (!isnum(args[i])) {
+            return fail(out, name, "non-numeric argument");
+        }
+    }
+    for (int i = 1; i < nargs; ++i) {
+        int cmp = 0;
+        num_cmp(args[i-1], args[i], cmp);
+        if (!ok(cmp)) {
+            out = mkfalse();
+            return OK;
+        }
+    }
+    out = mktrue();
+    return OK;
+}
+
+static int b_eq(Value* args, int nargs, Value& out) { return compare("=", args, nargs, out, [](int c) { return c == 0; }); }
+static int b_lt(Value* args, int nargs, Value& out) { return compare("<", args, nargs, out, [](int c) { return c == -1; }); }
+static int b_gt(Value* args, int nargs, Value& out) { return compare(">", args, nargs, out, [](int c) { return c == 1; }); }
+static int b_lte(Value* args, int nargs, Value& out) { return compare("<=", args, nargs, out, [](int c) { return c == -1 || c == 0; }); }
+static int b_gte(Value* args, int nargs, Value& out) { return compare(">=", args, nargs, out, [](int c) { return c == 1 || c == 0; }); }
+
+template <typename Op>
+static int intdiv(const char* name, Value* args, Value& out, Op op)
+{
+    if (!isint(args[0]) || !isint(args[1])) {
+        return fail(out, name, "non-integer argument");
+    }
+    if (unsafe_toint(args[1]) == 0) {
+        return fail(out, name, "division by zero");
+    }
+    if (unsafe_toint(args[0]) == INT_MIN && unsafe_toint(args[1]) == -1) {
+        // the only quotient that overflows; remainder and modulo are 0
+        out = strcmp(name, "quotient") == 0 ? mkdouble(-(double) INT_MIN) : mkint(0);
+        return OK;
+    }
+    out = mkint(op(unsafe_toint(args[0]), unsafe_toint(args[1])));
+    return OK;
+}
+
+static int b_quotient(Value* args, int nargs, Value& out) { return intdiv("quotient", args, out, [](int a, int b) { return a / b; }); }
+static int b_remainder(Value* args, int nargs, Value& out) { return intdiv("remainder", args, out, [](int a, int b) { return a % b; }); }
+static int b_modulo(Value* args, int nargs, Value& out)
+{
+    return intdiv("modulo", args, out, [](int a, int b) { int m = a % b; return (m != 0 && (m < 0) != (b < 0)) ? m + b : m; });
+}
+
+static Value mkbool(bool b) { return b ? mktrue() : mkfalse(); }
+
+static int b_not(Value* args, int nargs, Value& out) { out = mkbool(isfalse(args[0])); return OK; }
+static int b_eqp(Value* args, int nargs, Value& out) { out = mkbool(args[0].uval == args[1].uval); return OK; }
+static int b_numberp(Value* args, int nargs, Value& out) { out = mkbool(isnum(args[0])); return OK; }
+static int b_symbolp(Value* args, int nargs, Value& out) { out = mkbool(issym(args[0])); return OK; }
+static int b_stringp(Value* args, int nargs, Value& out) { out = mkbool(isstr(args[0])); return OK; }
+static int b_procedurep(Value* args, int nargs, Value& out) { out = mkbool(isfun(args[0])); return OK; }
+
+static int b_cons(Value* args, int nargs, Value& out) { out = mkpair(args[0], args[1]); return OK; }
+static int b_pairp(Value* args, int nargs, Value& out) { out = mkbool(ispair(args[0])); return OK; }
+static int b_nullp(Value* args, int nargs, Value& out) { out = mkbool(isnil(args[0])); return OK; }
+static int b_list(Value* args, int nargs, Value& out) { out = mklist(args, nargs); return OK; }
+
+static int b_car(Value* args, int nargs, Value& out)
+{
+    if (!ispair(args[0])) {
+        return fail(out, "car", "not a pair");
+    }
+    out = unsafe_topair(args[0])->car;
+    return OK;
+}
+
+static int b_cdr(Value* args, int nargs, Value& out)
+{
+    if (!ispair(args[0])) {
+        return fail(out, "cdr", "not a pair");
+    }
+    out = unsafe_topair(args[0])->cdr;
+    return OK;
+}
+
+static int b_setcar(Value* args, int nargs, Value& out)
+{
+    if (!ispair(args[0])) {
+        return fail(out, "set-car!", "not a pair");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, "set-car!", "pair is frozen");
+    }
+    vm_savepair(args[0]);
+    unsafe_topair(args[0])->car = args[1];
+    gc_pairbarrier(args[0].b.lo, args[1]);
+    out = mknil();
+    return OK;
+}
+
+static int b_setcdr(Value* args, int nargs, Value& out)
+{
+    if (!ispair(args[0])) {
+        return fail(out, "set-cdr!", "not a pair");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, "set-cdr!", "pair is frozen");
+    }
+    vm_savepair(args[0]);
+    unsafe_topair(args[0])->cdr = args[1];
+    gc_pairbarrier(args[0].b.lo, args[1]);
+    out = mknil();
+    return OK;
+}
+
+// Number of pairs in proper list `v`, or -1.
+static long listlength(Value v)
+{
+    long n = 0;
+    for (; ispair(v); v = unsafe_topair(v)->cdr) {
+        ++n;
+    }
+    return isnil(v) ? n : -1;
+}
+
+static int b_length(Value* args, int nargs, Value& out)
+{
+    long n = listlength(args[0]);
+    if (n < 0) {
+        return fail(out, "length", "not a proper list");
+    }
+    out = mkint(n);
+    return OK;
+}
+
+static int b_reverse(Value* args, int nargs, Value& out)
+{
+    long n = listlength(args[0]);
+    if (n < 0) {
+        return fail(out, "reverse", "not a proper list");
+    }
+    gc_reservepairs(n);
+    Value acc = mknil();
+    for (Value v = args[0]; ispair(v); v = unsafe_topair(v)->cdr) {
+        acc = mkref(LV_PAIR, gc_newpair(unsafe_topair(v)->car, acc));
+    }
+    out = acc;
+    return OK;
+}
+
+static int b_append(Value* args, int nargs, Value& out)
+{
+    if (nargs == 0) {
+        out = mknil();
+        return OK;
+    }
+    // every list but the last is copied; the elements stay reachable
+    // through the arguments
+    std::vector<Value> items;
+    for (int i = 0; i < nargs - 1; ++i) {
+        if (listlength(args[i]) < 0) {
+            return fail(out, "append", "not a proper list");
+        }
+        for (Value v = args[i]; ispair(v); v = unsafe_topair(v)->cdr) {
+            items.push_back(unsafe_topair(v)->car);
+        }
+    }
+    out = mklist(items.data(), items.size(), args[nargs - 1]);
+    return OK;
+}
+
+static int b_stringlength(Value* args, int nargs, Value& out)
+{
+    if (!isstr(args[0])) {
+        return fail(out, "string-length", "not a string");
+    }
+    out = mkint(strview(args[0]).size());
+    return OK;
+}
+
+static int b_stringappend(Value* args, int nargs, Value& out)
+{
+    std::string result;
+    for (int i = 0; i < nargs; ++i) {
+        if (!isstr(args[i])) {
+            return fail(out, "string-append", "not a string");
+        }
+        result.append(strview(args[i]));
+    }
+    out = mkstr(result.data(), result.size());
+    return OK;
+}
+
+static int b_makelist(Value* args, int nargs, Value& out)
+{
+    if (!isint(args[0]) || unsafe_toint(args[0]) < 0) {
+        return fail(out, "make-list", "expected a non-negative integer");
+    }
+    Value fill = nargs > 1 ? args[1] : mknil();
+    int n = unsafe_toint(args[0]);
+    gc_reservepairs(n);
+    Value list = mknil();
+    for (int i = 0; i < n; ++i) {
+        list = mkref(LV_PAIR, gc_newpair(fill, list));
+    }
+    out = list;
+    return OK;
+}
+
+// Values a builtin holds on to while it calls back into Scheme.
+struct TempRoots
+{
+    std::vector<Value> v;
+
+    TempRoots() { gc_addroots(visit, this); }
+    ~TempRoots() { gc_removeroots(visit, this); }
+
+    static void visit(void* ctx, GcVisitFn fn)
+    {
+        for (Value x : ((TempRoots*) ctx)->v) {
+            fn(x);
+        }
+    }
+};
+
+// Applies args[0] to successive elements of the lists args[1..], until
+// the shortest one runs out, and collects the results if `collect`.
+static int maplists(const char* name, Value* args, int nargs, Value& out, bool collect)
+{
+    if (!isfun(args[0])) {
+        return fail(out, name, "not a procedure");
+    }
+    int nlists = nargs - 1;
+    TempRoots roots;                  // the remaining lists, then the results
+    roots.v.assign(args + 1, args + nargs);
+    Value callargs[256];
+    for (;;) {
+        for (int j = 0; j < nlists; ++j) {
+            Value v = roots.v[j];
+            if (!ispair(v)) {
+                if (!isnil(v)) {
+                    return fail(out, name, "not a proper list");
+                }
+                out = collect ? mklist(roots.v.data() + nlists, roots.v.size() - nlists) : mknil();
+                return OK;
+            }
+            callargs[j] = unsafe_topair(v)->car;
+            roots.v[j]  = unsafe_topair(v)->cdr;
+        }
+        Value r;
+        if (vm_call(args[0], callargs, nlists, r) != OK) {
+            out = r;
+            return ERROR;
+        }
+        if (collect) {
+            roots.v.push_back(r);
+        }
+    }
+}
+
+static int b_map(Value* args, int nargs, Value& out) { return maplists("map", args, nargs, out, true); }
+static int b_foreach(Value* args, int nargs, Value& out) { return maplists("for-each", args, nargs, out, false); }
+
+// Data parallelism: the list is cut into chunks which are mapped, or
+// folded, on the shared pool by copies of the procedure (transfer.h).
+// The procedure must be pure; its side effects would happen in a
+// worker's interpreter. preduce folds every chunk from `init` and then
+// the chunk results in order, so `f` must be associative with `init`
+// as its identity. Called from a worker, they run sequentially. What
+// the workers print is passed on in order when the caller's output is
+// captured (vm_capture), and goes to stdout otherwise.
+enum ParKind { PMAP, PFOREACH, PREDUCE };
+
+struct ParChunk
+{
+    std::string in;
+    std::string out;      // packed results, or the error message
+    std::string printed;  // the output, if captured
+    int         status = OK;
+};
+
+// Runs on a worker: `fn` holds the procedure and, for preduce, `init`.
+static void mapchunk(ParKind kind, const std::string& fn, ParChunk& c)
+{
+    Unpacker fu(fn.data(), fn.size());
+    Value f   = fu.unpack();
+    Value acc = kind == PREDUCE ? fu.unpack() : mknil();
+    Unpacker in(c.in.data(), c.in.size());
+    Packer results;
+    std::string err;
+    while (!in.done()) {
+        gc_pushroot(acc);
+        Value x = in.unpack();
+        gc_poproot();
+        Value callargs[2] = { acc, x };
+        Value r;
+        bool reduce = kind == PREDUCE;
+        if (vm_call(f, callargs + !reduce, 1 + reduce, r) != OK) {
+            c.status = ERROR;
+            c.out = valprint(r, false);
+            return;
+        }
+        if (reduce) {
+            acc = r;
+        } else if (kind == PMAP && !results.pack(r, err)) {
+            c.status = ERROR;
+            c.out = err;
+            return;
+        }
+    }
+    if (kind == PREDUCE && !results.pack(acc, err)) {
+        c.status = ERROR;
+        c.out = err;
+        return;
+    }
+    c.out = results.data();
+}
+
+static void runchunk(ParKind kind, const std::string& fn, ParChunk& c, bool capture, size_t room)
+{
+    if (capture) {
+        vm_capture(&c.printed, room);
+    }
+    mapchunk(kind, fn, c);
+    vm_capture(nullptr, 0);
+}
+
+static int parlist(const char* name, ParKind kind, Value f, Value init, Value list, Value& out)
+{
+    if (!isfun(f)) {
+        return fail(out, name, "not a procedure");
+    }
+    TempRoots roots;                  // f, init, the items, then the results
+    roots.v.push_back(f);
+    roots.v.push_back(init);
+    Value v = list;
+    for (; ispair(v); v = unsafe_topair(v)->cdr) {
+        roots.v.push_back(unsafe_topair(v)->car);
+    }
+    if (!isnil(v)) {
+        return fail(out, name, "not a proper list");
+    }
+    size_t n = roots.v.size() - 2;
+
+    if (Pool::onworker()) {
+        Value acc = init;
+        for (size_t j = 0; j < n; ++j) {
+            Value callargs[2] = { acc, roots.v[2 + j] };
+            Value r;
+            bool reduce = kind == PREDUCE;
+            if (vm_call(f, callargs + !reduce, 1 + reduce, r) != OK) {
+                out = r;
+                return ERROR;
+            }
+            if (reduce) {
+                acc = roots.v[1] = r;
+            } else if (kind == PMAP) {
+                roots.v.push_back(r);
+            }
+        }
+        out = kind == PMAP ? mklist(roots.v.data() + 2 + n, n) : kind == PREDUCE ? acc : mknil();
+        return OK;
+    }
+
+    std::string err;
+    Packer fp;
+    if (!fp.pack(f, err) || (kind == PREDUCE && !fp.pack(init, err))) {
+        return fail(out, name, err.c_str());
+    }
+    size_t room = 0;
+    bool capture = vm_capturing(room);
+    Pool& pool = Pool::shared();
+    // a few chunks per worker, so stealing can even out uneven ones
+    size_t nchunks = std::min<size_t>(n, 4 * pool.size());
+    std::vector<ParChunk> chunks(nchunks);
+    std::vector<std::function<void()>> tasks;
+    for (size_t k = 0; k < nchunks; ++k) {
+        Packer items;
+        for (size_t j = k * n / nchunks; j < (k + 1) * n / nchunks; ++j) {
+            if (!items.pack(roots.v[2 + j], err)) {
+                return fail(out, name, err.c_str());
+            }
+        }
+        chunks[k].in = items.data();
+        tasks.push_back([kind, &fp, &chunks, k, capture, room] {
+            runchunk(kind, fp.data(), chunks[k], capture, room);
+        });
+    }
+    pool.run(tasks);
+
+    roots.v.resize(2);
+    for (const ParChunk& c : chunks) {
+        if (!vm_print(c.printed)) {
+            return fail(out, name, "output too long");
+        }
+        if (c.status != OK) {
+            out = mkstr(c.out.data(), c.out.size());
+            return ERROR;
+        }
+        Unpacker u(c.out.data(), c.out.size());
+        while (!u.done()) {
+            roots.v.push_back(u.unpack());
+        }
+    }
+    if (kind == PMAP) {
+        out = mklist(roots.v.data() + 2, roots.v.size() - 2);
+    } else if (kind == PREDUCE) {
+        for (size_t k = 2; k < roots.v.size(); ++k) {
+            Value callargs[2] = { roots.v[1], roots.v[k] };
+            if (vm_call(f, callargs, 2, roots.v[1]) != OK) {
+                out = roots.v[1];
+                return ERROR;
+            }
+        }
+        out = roots.v[1];
+    } else {
+        out = mknil();
+    }
+    return OK;
+}
+
+static int b_pmap(Value* args, int nargs, Value& out) { return parlist("pmap", PMAP, args[0], mknil(), args[1], out); }
+static int b_pforeach(Value* args, int nargs, Value& out) { return parlist("pfor-each", PFOREACH, args[0], mknil(), args[1], out); }
+static int b_preduce(Value* args, int nargs, Value& out) { return parlist("preduce", PREDUCE, args[0], args[1], args[2], out); }
+
+static int b_saveimage(Value* args, int nargs, Value& out)
+{
+    if (!isstr(args[0])) {
+        return fail(out, "save-image", "expected a file name");
+    }
+    std::string err;
+    if (!image_save(std::string(strview(args[0])).c_str(), err)) {
+        return fail(out, "save-image", err.c_str());
+    }
+    out = mktrue();
+    return OK;
+}
+
+// (with-profiling thunk [file]): calls thunk with the sampling profiler
+// on, then writes the collapsed stacks to `file`, or a summary to
+// stderr, and returns what thunk returned.
+static int b_withprofiling(Value* args, int nargs, Value& out)
+{
+    if (!isfun(args[0])) {
+        return fail(out, "with-profiling", "not a procedure");
+    }
+    if (nargs > 1 && !isstr(args[1])) {
+        return fail(out, "with-profiling", "expected a file name");
+    }
+    std::string path = nargs > 1 ? std::string(strview(args[1])) : "";
+    std::string err;
+    if (!profile_start(ProfileHz, err)) {
+        return fail(out, "with-profiling", err.c_str());
+    }
+    size_t from = profile_mark();
+    int status = vm_call(args[0], nullptr, 0, out);
+    profile_stop();
+    if (status != OK) {
+        return status;
+    }
+    if (path.empty()) {
+        profile_summary(stderr, from, 20);
+        return OK;
+    }
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return fail(out, "with-profiling", "cannot open the output file");
+    }
+    profile_write(f, from);
+    fclose(f);
+    return OK;
+}
+
+static int b_makehashtable(Value* args, int nargs, Value& out)
+{
+    if (nargs > 0 && (!isint(args[0]) || unsafe_toint(args[0]) < 0)) {
+        return fail(out, "make-hash-table", "expected a non-negative size");
+    }
+    out = tab_new(nargs > 0 ? unsafe_toint(args[0]) : 0);
+    return OK;
+}
+
+// (hash-ref table key [default]): a missing key is an error unless a
+// default is given.
+static int b_hashref(Value* args, int nargs, Value& out)
+{
+    if (!istab(args[0])) {
+        return fail(out, "hash-ref", "not a hash table");
+    }
+    if (tab_get(args[0], args[1], out)) {
+        return OK;
+    }
+    if (nargs > 2) {
+        out = args[2];
+        return OK;
+    }
+    std::string msg = "no such key: " + valprint(args[1]);
+    return fail(out, "hash-ref", msg.c_str());
+}
+
+static int b_hashset(Value* args, int nargs, Value& out)
+{
+    if (!istab(args[0])) {
+        return fail(out, "hash-set!", "not a hash table");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, "hash-set!", "table is frozen");
+    }
+    vm_saveentry(args[0], args[1]);
+    tab_set(args[0], args[1], args[2]);
+    out = mknil();
+    return OK;
+}
+
+static int b_hashremove(Value* args, int nargs, Value& out)
+{
+    if (!istab(args[0])) {
+        return fail(out, "hash-remove!", "not a hash table");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, "hash-remove!", "table is frozen");
+    }
+    vm_saveentry(args[0], args[1]);
+    out = tab_remove(args[0], args[1]) ? mktrue() : mkfalse();
+    return OK;
+}
+
+static int b_hashcount(Value* args, int nargs, Value& out)
+{
+    if (!istab(args[0])) {
+        return fail(out, "hash-count", "not a hash table");
+    }
+    out = mkint(tab_count(args[0]));
+    return OK;
+}
+
+// Homogeneous vectors. Each procedure is one of the generic ones below
+// applied to an element type, with its own name for error messages.
+
+static const char* const UvecWhat[] = { "not a bytevector", "not an s32vector", "not an f64vector" };
+
+static bool isuvecof(Value v, UvecType t) { return isuvec(v) && unsafe_touvec(v)->type == t; }
+
+static bool iselem(UvecType t, Value x)
+{
+    switch (t) {
+        case UV_U8:  return isint(x) && unsafe_toint(x) >= 0 && unsafe_toint(x) <= 255;
+        case UV_S32: return isint(x);
+        case UV_F64: return isnum(x);
+    }
+    return false;
+}
+
+static const char* badelem(UvecType t)
+{
+    return t == UV_U8 ? "expected a byte" : t == UV_S32 ? "expected an integer" : "non-numeric argument";
+}
+
+// `x` has passed iselem.
+static void setelem(Value v, size_t j, Value x)
+{
+    switch (unsafe_touvec(v)->type) {
+        case UV_U8:  uvec_u8(v)[j] = unsafe_toint(x); break;
+        case UV_S32: uvec_s32(v)[j] = unsafe_toint(x); break;
+        case UV_F64: uvec_f64(v)[j] = todouble(x); break;
+    }
+}
+
+static Value getelem(Value v, size_t j)
+{
+    switch (unsafe_touvec(v)->type) {
+        case UV_U8:  return mkint(uvec_u8(v)[j]);
+        case UV_S32: return mkint(uvec_s32(v)[j]);
+        case UV_F64: break;
+    }
+    return mkdouble(uvec_f64(v)[j]);
+}
+
+// An index argument in [0, limit].
+static bool isindex(Value x, size_t limit)
+{
+    return isint(x) && unsafe_toint(x) >= 0 && (size_t) unsafe_toint(x) <= limit;
+}
+
+static void uvfill(Value v, Value x, size_t start, size_t end)
+{
+    switch (unsafe_touvec(v)->type) {
+        case UV_U8:  memset(uvec_u8(v) + start, unsafe_toint(x), end - start); break;
+        case UV_S32: std::fill(uvec_s32(v) + start, uvec_s32(v) + end, unsafe_toint(x)); break;
+        case UV_F64: std::fill(uvec_f64(v) + start, uvec_f64(v) + end, todouble(x)); break;
+    }
+}
+
+// (make-f64vector n [fill])
+static int uvmake(UvecType t, const char* name, Value* args, int nargs, Value& out)
+{
+    if (!isint(args[0]) || unsafe_toint(args[0]) < 0) {
+        return fail(out, name, "expected a non-negative length");
+    }
+    if (nargs > 1 && !iselem(t, args[1])) {
+        return fail(out, name, badelem(t));
+    }
+    size_t n = unsafe_toint(args[0]);
+    Value v = uvec_new(t, n);
+    if (nargs > 1) {
+        uvfill(v, args[1], 0, n);
+    }
+    out = v;
+    return OK;
+}
+
+// (f64vector x ...)
+static int uvlist(UvecType t, const char* name, Value* args, int nargs, Value& out)
+{
+    for (int i = 0; i < nargs; ++i) {
+        if (!iselem(t, args[i])) {
+            return fail(out, name, badelem(t));
+        }
+    }
+    Value v = uvec_new(t, nargs);
+    for (int i = 0; i < nargs; ++i) {
+        setelem(v, i, args[i]);
+    }
+    out = v;
+    return OK;
+}
+
+static int uvlength(UvecType t, const char* name, Value* args, Value& out)
+{
+    if (!isuvecof(args[0], t)) {
+        return fail(out, name, UvecWhat[t]);
+    }
+    out = mkint(uvec_len(args[0]));
+    return OK;
+}
+
+static int uvref(UvecType t, const char* name, Value* args, Value& out)
+{
+    if (!isuvecof(args[0], t)) {
+        return fail(out, name, UvecWhat[t]);
+    }
+    if (!isindex(args[1], uvec_len(args[0])) || (size_t) unsafe_toint(args[1]) == uvec_len(args[0])) {
+        return fail(out, name, "index out of range");
+    }
+    out = getelem(args[0], unsafe_toint(args[1]));
+    return OK;
+}
+
+static int uvset(UvecType t, const char* name, Value* args, Value& out)
+{
+    if (!isuvecof(args[0], t)) {
+        return fail(out, name, UvecWhat[t]);
+    }
+    if (!isindex(args[1], uvec_len(args[0])) || (size_t) unsafe_toint(args[1]) == uvec_len(args[0])) {
+        return fail(out, name, "index out of range");
+    }
+    if (!iselem(t, args[2])) {
+        return fail(out, name, badelem(t));
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, name, "vector is frozen");
+    }
+    vm_saveelems(args[0], unsafe_toint(args[1]), unsafe_toint(args[1]) + 1);
+    setelem(args[0], unsafe_toint(args[1]), args[2]);
+    out = mknil();
+    return OK;
+}
+
+// (f64vector-fill! v x [start [end]])
+static int uvfillp(UvecType t, const char* name, Value* args, int nargs, Value& out)
+{
+    if (!isuvecof(args[0], t)) {
+        return fail(out, name, UvecWhat[t]);
+    }
+    if (!iselem(t, args[1])) {
+        return fail(out, name, badelem(t));
+    }
+    size_t len = uvec_len(args[0]);
+    if ((nargs > 2 && !isindex(args[2], len)) || (nargs > 3 && !isindex(args[3], len))) {
+        return fail(out, name, "index out of range");
+    }
+    size_t start = nargs > 2 ? unsafe_toint(args[2]) : 0;
+    size_t end = nargs > 3 ? unsafe_toint(args[3]) : len;
+    if (start > end) {
+        return fail(out, name, "index out of range");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, name, "vector is frozen");
+    }
+    vm_saveelems(args[0], start, end);
+    uvfill(args[0], args[1], start, end);
+    out = mknil();
+    return OK;
+}
+
+// (f64vector-copy! to at from [start [end]]), as R7RS bytevector-copy!:
+// the ranges may overlap.
+static int uvcopy(UvecType t, const char* name, Value* args, int nargs, Value& out)
+{
+    if (!isuvecof(args[0], t) || !isuvecof(args[2], t)) {
+        return fail(out, name, UvecWhat[t]);
+    }
+    size_t tolen = uvec_len(args[0]);
+    size_t fromlen = uvec_len(args[2]);
+    if (!isindex(args[1], tolen) || (nargs > 3 && !isindex(args[3], fromlen)) ||
+        (nargs > 4 && !isindex(args[4], fromlen))) {
+        return fail(out, name, "index out of range");
+    }
+    size_t at = unsafe_toint(args[1]);
+    size_t start = nargs > 3 ? unsafe_toint(args[3]) : 0;
+    size_t end = nargs > 4 ? unsafe_toint(args[4]) : fromlen;
+    if (start > end || end - start > tolen - at) {
+        return fail(out, name, "index out of range");
+    }
+    if (isfrozen(args[0])) {
+        return fail(out, name, "vector is frozen");
+    }
+    vm_saveelems(args[0], at, at + (end - start));
+    size_t size = uvec_elemsize(t);
+    memmove(unsafe_touvec(args[0])->data + at * size, unsafe_touvec(args[2])->data + start * size, (end - start) * size);
+    out = mknil();
+    return OK;
+}
+
+static int b_makebytevector(Value* args, int nargs, Value& out) { return uvmake(UV_U8, "make-bytevector", args, nargs, out); }
+static int b_bytevector(Value* args, int nargs, Value& out) { return uvlist(UV_U8, "bytevector", args, nargs, out); }
+static int b_bytevectorp(Value* args, int nargs, Value& out) { out = mkbool(isuvecof(args[0], UV_U8)); return OK; }
+static int b_bytevectorlength(Value* args, int nargs, Value& out) { return uvlength(UV_U8, "bytevector-length", args, out); }
+static int b_bytevectorref(Value* args, int nargs, Value& out) { return uvref(UV_U8, "bytevector-u8-ref", args, out); }
+static int b_bytevectorset(Value* args, int nargs, Value& out) { return uvset(UV_U8, "bytevector-u8-set!", args, out); }
+static int b_bytevectorfill(Value* args, int nargs, Value& out) { return uvfillp(UV_U8, "bytevector-fill!", args, nargs, out); }
+static int b_bytevectorcopy(Value* args, int nargs, Value& out) { return uvcopy(UV_U8, "bytevector-copy!", args, nargs, out); }
+
+static int b_makes32vector(Value* args, int nargs, Value& out) { return uvmake(UV_S32, "make-s32vector", args, nargs, out); }
+static int b_s32vector(Value* args, int nargs, Value& out) { return uvlist(UV_S32, "s32vector", args, nargs, out); }
+static int b_s32vectorp(Value* args, int nargs, Value& out) { out = mkbool(isuvecof(args[0], UV_S32)); return OK; }
+static int b_s32vectorlength(Value* args, int nargs, Value& out) { return uvlength(UV_S32, "s32vector-length", args, out); }
+static int b_s32vectorref(Value* args, int nargs, Value& out) { return uvref(UV_S32, "s32vector-ref", args, out); }
+static int b_s32vectorset(Value* args, int nargs, Value& out) { return uvset(UV_S32, "s32vector-set!", args, out); }
+static int b_s32vectorfill(Value* args, int nargs, Value& out) { return uvfillp(UV_S32, "s32vector-fill!", args, nargs, out); }
+static int b_s32vectorcopy(Value* args, int nargs, Value& out) { return uvcopy(UV_S32, "s32vector-copy!", args, nargs, out); }
+
+static int b_makef64vector(Value* args, int nargs, Value& out) { return uvmake(UV_F64, "make-f64vector", args, nargs, out); }
+static int b_f64vector(Value* args, int nargs, Value& out) { return uvlist(UV_F64, "f64vector", args, nargs, out); }
+static int b_f64vectorp(Value* args, int nargs, Value& out) { out = mkbool(isuvecof(args[0], UV_F64)); return OK; }
+static int b_f64vectorlength(Value* args, int nargs, Value& out) { return uvlength(UV_F64, "f64vector-length", args, out); }
+static int b_f64vectorref(Value* args, int nargs, Value& out) { return uvref(UV_F64, "f64vector-ref", args, out); }
+static int b_f64vectorset(Value* args, int nargs, Value& out) { return uvset(UV_F64, "f64vector-set!", args, out); }
+static int b_f64vectorfill(Value* args, int nargs, Value& out) { return uvfillp(UV_F64, "f64vector-fill!", args, nargs, out); }
+static int b_f64vectorcopy(Value* args, int nargs, Value& out) { return uvcopy(UV_F64, "f64vector-copy!", args, nargs, out); }
+
+// The sum of a large s32vector can leave the fixnum range.
+static int b_s32vectorsum(Value* args, int nargs, Value& out)
+{
+    if (!isuvecof(args[0], UV_S32)) {
+        return fail(out, "s32vector-sum", UvecWhat[UV_S32]);
+    }
+    int64_t sum = s32_sum(uvec_s32(args[0]), uvec_len(args[0]));
+    out = sum >= INT_MIN && sum <= INT_MAX ? mkint((int) sum) : mkdouble((double) sum);
+    return OK;
+}
+
+static int b_f64vectorsum(Value* args, int nargs, Value& out)
+{
+    if (!isuvecof(args[0], UV_F64)) {
+        return fail(out, "f64vector-sum", UvecWhat[UV_F64]);
+    }
+    out = mkdouble(f64_sum(uvec_f64(args[0]), uvec_len(args[0])));
+    return OK;
+}
+
+static int b_f64vectordot(Value* args, int nargs, Value& out)
+{
+    if (!isuvecof(args[0], UV_F64) || !isuvecof(args[1], UV_F64)) {
+        return fail(out, "f64vector-dot", UvecWhat[UV_F64]);
+    }
+    if (uvec_len(args[0]) != uvec_len(args[1])) {
+        return fail(out, "f64vector-dot", "vectors differ in length");
+    }
+    out = mkdouble(f64_dot(uvec_f64(args[0]), uvec_f64(args[1]), uvec_len(args[0])));
+    return OK;
+}
+
+// (f64vector-map! op x y): x[i] = (op x[i] y[i]) for one of the builtins
+// + - * /, with `y` an f64vector of the same length or a number.
+static int b_f64vectormap(Value* args, int nargs, Value& out)
+{
+    BuiltinFn fn = isbuiltin(args[0]) ? builtins[unsafe_tobuiltin(args[0])].fn : nullptr;
+    UvecOp op;
+    if (fn == b_plus) {
+        op = UV_ADD;
+    } else if (fn == b_minus) {
+        op = UV_SUB;
+    } else if (fn == b_multiply) {
+        op = UV_MUL;
+    } else if (fn == b_divide) {
+        op = UV_DIV;
+    } else {
+        return fail(out, "f64vector-map!", "expected one of + - * /");
+    }
+    if (!isuvecof(args[1], UV_F64)) {
+        return fail(out, "f64vector-map!", UvecWhat[UV_F64]);
+    }
+    if (isfrozen(args[1])) {
+        return fail(out, "f64vector-map!", "vector is frozen");
+    }
+    size_t n = uvec_len(args[1]);
+    if (!isnum(args[2])) {
+        if (!isuvecof(args[2], UV_F64)) {
+            return fail(out, "f64vector-map!", UvecWhat[UV_F64]);
+        }
+        if (uvec_len(args[2]) != n) {
+            return fail(out, "f64vector-map!", "vectors differ in length");
+        }
+    }
+    // saved once the store is certain, or a failing call would copy the
+    // whole vector into the undo log for nothing
+    vm_saveelems(args[1], 0, n);
+    if (isnum(args[2])) {
+        f64_mapscalar(op, uvec_f64(args[1]), todouble(args[2]), n);
+    } else {
+        f64_map(op, uvec_f64(args[1]), uvec_f64(args[2]), n);
+    }
+    out = mknil();
+    return OK;
+}
+
+static int b_openoutputstring(Value* args, int nargs, Value& out)
+{
+    out = port_open();
+    return OK;
+}
+
+static int b_getoutputstring(Value* args, int nargs, Value& out)
+{
+    if (!isport(args[0])) {
+        return fail(out, "get-output-string", "not a port");
+    }
+    out = port_string(args[0]);
+    return OK;
+}
+
+// The output procedures write to the port given as their last argument,
+// or with vm_print.
+static int output(const char* name, std::string_view s, Value* args, int nargs, int nfixed, Value& out)
+{
+    if (nargs > nfixed) {
+        if (!isport(args[nfixed])) {
+            return fail(out, name, "not a port");
+        }
+        vm_saveport(args[nfixed]);
+        port_write(args[nfixed], s);
+    } else if (!vm_print(s)) {
+        return fail(out, name, "output too long");
+    }
+    out = mknil();
+    return OK;
+}
+
+static int b_writestring(Value* args, int nargs, Value& out)
+{
+    if (!isstr(args[0])) {
+        return fail(out, "write-string", "not a string");
+    }
+    return output("write-string", strview(args[0]), args, nargs, 1, out);
+}
+
+static int b_display(Value* args, int nargs, Value& out)
+{
+    if (isstr(args[0])) {
+        return output("display", strview(args[0]), args, nargs, 1, out);
+    }
+    return output("display", valprint(args[0], false), args, nargs, 1, out);
+}
+
+static int b_write(Value* args, int nargs, Value& out)
+{
+    return output("write", valprint(args[0], true), args, nargs, 1, out);
+}
+
+static int b_newline(Value* args, int nargs, Value& out)
+{
+    return output("newline", "\n", args, nargs, 0, out);
+}
+
+// Images refer to builtins by their index here, so new ones go at the
+// end (and a reordering bumps ImageVersion).
+const Builtin builtins[] = {
+    { "+",          b_plus,       0, -1 },
+    { "-",          b_minus,      1, -1 },
+    { "*",          b_multiply,   0, -1 },
+    { "/",          b_divide,     1, -1 },
+    { "=",          b_eq,         1, -1 },
+    { "<",          b_lt,         1, -1 },
+    { ">",          b_gt,         1, -1 },
+    { "<=",         b_lte,        1, -1 },
+    { ">=",         b_gte,        1, -1 },
+    { "quotient",   b_quotient,   2,  2 },
+    { "remainder",  b_remainder,  2,  2 },
+    { "modulo",     b_modulo,     2,  2 },
+    { "not",        b_not,        1,  1 },
+    { "eq?",        b_eqp,        2,  2 },
+    { "number?",    b_numberp,    1,  1 },
+    { "symbol?",    b_symbolp,    1,  1 },
+    { "string?",    b_stringp,    1,  1 },
+    { "procedure?", b_procedurep, 1,  1 },
+    { "cons",       b_cons,       2,  2 },
+    { "car",        b_car,        1,  1 },
+    { "cdr",        b_cdr,        1,  1 },
+    { "set-car!",   b_setcar,     2,  2 },
+    { "set-cdr!",   b_setcdr,     2,  2 },
+    { "pair?",      b_pairp,      1,  1 },
+    { "null?",      b_nullp,      1,  1 },
+    { "list",       b_list,       0, -1 },
+    { "make-list",  b_makelist,   1,  2 },
+    { "length",     b_length,     1,  1 },
+    { "reverse",    b_reverse,    1,  1 },
+    { "append",     b_append,     0, -1 },
+    { "string-length", b_stringlength, 1, 1 },
+    { "string-append", b_stringappend, 0, -1 },
+    { "map",        b_map,        2, -1 },
+    { "for-each",   b_foreach,    2, -1 },
+    { "pmap",       b_pmap,       2,  2 },
+    { "pfor-each",  b_pforeach,   2,  2 },
+    { "preduce",    b_preduce,    3,  3 },
+    { "save-image", b_saveimage,  1,  1 },
+    { "with-profiling", b_withprofiling, 1, 2 },
+    { "display",    b_display,    1,  2 },
+    { "write",      b_write,      1,  2 },
+    { "newline",    b_newline,    0,  1 },
+    { "open-output-string", b_openoutputstring, 0, 0 },
+    { "get-output-string",  b_getoutputstring,  1, 1 },
+    { "write-string", b_writestring, 1, 2 },
+    { "make-hash-table", b_makehashtable, 0, 1 },
+    { "hash-ref",   b_hashref,    2,  3 },
+    { "hash-set!",  b_hashset,    3,  3 },
+    { "hash-remove!", b_hashremove, 2, 2 },
+    { "hash-count", b_hashcount,  1,  1 },
+    { "make-bytevector",    b_makebytevector,    1,  2 },
+    { "bytevector",         b_bytevector,        0, -1 },
+    { "bytevector?",        b_bytevectorp,       1,  1 },
+    { "bytevector-length",  b_bytevectorlength,  1,  1 },
+    { "bytevector-u8-ref",  b_bytevectorref,     2,  2 },
+    { "bytevector-u8-set!", b_bytevectorset,     3,  3 },
+    { "bytevector-fill!",   b_bytevectorfill,    2,  4 },
+    { "bytevector-copy!",   b_bytevectorcopy,    3,  5 },
+    { "make-s32vector",     b_makes32vector,     1,  2 },
+    { "s32vector",          b_s32vector,         0, -1 },
+    { "s32vector?",         b_s32vectorp,        1,  1 },
+    { "s32vector-length",   b_s32vectorlength,   1,  1 },
+    { "s32vector-ref",      b_s32vectorref,      2,  2 },
+    { "s32vector-set!",     b_s32vectorset,      3,  3 },
+    { "s32vector-fill!",    b_s32vectorfill,     2,  4 },
+    { "s32vector-copy!",    b_s32vectorcopy,     3,  5 },
+    { "s32vector-sum",      b_s32vectorsum,      1,  1 },
+    { "make-f64vector",     b_makef64vector,     1,  2 },
+    { "f64vector",          b_f64vector,         0, -1 },
+    { "f64vector?",         b_f64vectorp,        1,  1 },
+    { "f64vector-length",   b_f64vectorlength,   1,  1 },
+    { "f64vector-ref",      b_f64vectorref,      2,  2 },
+    { "f64vector-set!",     b_f64vectorset,      3,  3 },
+    { "f64vector-fill!",    b_f64vectorfill,     2,  4 },
+    { "f64vector-copy!",    b_f64vectorcopy,     3,  5 },
+    { "f64vector-sum",      b_f64vectorsum,      1,  1 },
+    { "f64vector-dot",      b_f64vectordot,      2,  2 },
+    { "f64vector-map!",     b_f64vectormap,      3,  3 },
+};
+
+const size_t nbuiltins = sizeof(builtins) / sizeof(builtins[0]);
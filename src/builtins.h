@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include "value.h"
+
+// Builtins receive their arguments in place on the VM stack and store
+// the result (or, on ERROR, an error message) in `out`. `out` may alias
+// the register just below the arguments.
+using BuiltinFn = int (*)(Value* args, int nargs, Value& out);
+
+struct Builtin
+{
+    const char* name;
+    BuiltinFn   fn;
+    int         minargs;
+    int         maxargs; // -1: variadic
+};
+
+extern const Builtin builtins[];
+extern const size_t  nbuiltins;
@@ -0,0 +1,836 @@
+#include "compile.h"
+#include "vm.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct Syms
+{
+    Value quote, if_, define, set, lambda, begin, let, letstar, letrec;
+    Value and_, or_, cond, else_, when, unless;
+    Value add, sub, mul, lt, numeq, gt;
+};
+
+// per thread, like the heap the symbols live in
+thread_local Syms syms;
+thread_local bool symsready = false;
+// Prototypes being generated; the VM only roots their constants once
+// they have been added to it.
+thread_local std::vector<const Proto*> building;
+
+void visitsyms(void*, GcVisitFn visit)
+{
+    const Value* v = (const Value*) &syms;
+    for (size_t i = 0; i < sizeof(Syms) / sizeof(Value); ++i) {
+        visit(v[i]);
+    }
+    for (const Proto* p : building) {
+        for (Value k : p->consts) {
+            visit(k);
+        }
+    }
+}
+
+void initsyms()
+{
+    if (symsready) {
+        return;
+    }
+    gc_addroots(visitsyms, nullptr);
+    syms.quote   = mksym("quote");
+    syms.if_     = mksym("if");
+    syms.define  = mksym("define");
+    syms.set     = mksym("set!");
+    syms.lambda  = mksym("lambda");
+    syms.begin   = mksym("begin");
+    syms.let     = mksym("let");
+    syms.letstar = mksym("let*");
+    syms.letrec  = mksym("letrec");
+    syms.and_    = mksym("and");
+    syms.or_     = mksym("or");
+    syms.cond    = mksym("cond");
+    syms.else_   = mksym("else");
+    syms.when    = mksym("when");
+    syms.unless  = mksym("unless");
+    syms.add     = mksym("+");
+    syms.sub     = mksym("-");
+    syms.mul     = mksym("*");
+    syms.lt      = mksym("<");
+    syms.numeq   = mksym("=");
+    syms.gt      = mksym(">");
+    symsready = true;
+}
+
+[[noreturn]] void fail(const std::string& msg) { throw std::runtime_error(msg); }
+
+bool issymbol(const Node& n, Value sym) { return !n.islist && n.atom.uval == sym.uval; }
+
+bool isform(const Node& n, Value sym) { return n.islist && !n.items.empty() && issymbol(n.items[0], sym); }
+
+const Node& symbolnode(const Node& n, const char* form)
+{
+    if (n.islist || !issym(n.atom)) {
+        fail(std::string(form) + ": expected a symbol");
+    }
+    return n;
+}
+
+//----------------------------------------------------------
+// Expansion: rewrites the derived binding forms (let, let*,
+// letrec, named let, (define (f ...) ...)) into lambda and
+// define so that lambda is the only form introducing
+// variables.
+//----------------------------------------------------------
+
+Node expand(const Node& n);
+
+std::vector<Node> expandall(const Node& n, size_t from)
+{
+    std::vector<Node> items(n.items.begin(), n.items.begin() + std::min(from, n.items.size()));
+    for (size_t i = from; i < n.items.size(); ++i) {
+        items.push_back(expand(n.items[i]));
+    }
+    return items;
+}
+
+void bindings(const Node& n, const char* form, std::vector<Node>& names, std::vector<Node>& inits)
+{
+    if (!n.islist || n.dotted) {
+        fail(std::string(form) + ": expected a list of bindings");
+    }
+    for (const Node& b : n.items) {
+        if (!b.islist || b.dotted || b.items.size() != 2) {
+            fail(std::string(form) + ": invalid binding");
+        }
+        names.push_back(symbolnode(b.items[0], form));
+        inits.push_back(b.items[1]);
+    }
+}
+
+Node lambdanode(Node params, const Node& n, size_t from)
+{
+    std::vector<Node> items = { mkatom(syms.lambda), std::move(params) };
+    items.insert(items.end(), n.items.begin() + from, n.items.end());
+    return mklist(std::move(items));
+}
+
+// (let ((v e) ...) body...)      => ((lambda (v ...) body...) e ...)
+// (let f ((v e) ...) body...)    => ((lambda () (define f (lambda (v ...) body...)) (f e ...)))
+Node let(const Node& n)
+{
+    if (n.items.size() < 3) {
+        fail("let: expected bindings and a body");
+    }
+    std::vector<Node> names, inits;
+    if (!n.items[1].islist) {
+        const Node& name = symbolnode(n.items[1], "let");
+        bindings(n.items[2], "let", names, inits);
+        std::vector<Node> loop = { mkatom(syms.define), name, lambdanode(mklist(names), n, 3) };
+        std::vector<Node> start = { name };
+        start.insert(start.end(), inits.begin(), inits.end());
+        return mklist({ mklist({ mkatom(syms.lambda), mklist({}), mklist(std::move(loop)), mklist(std::move(start)) }) });
+    }
+    bindings(n.items[1], "let", names, inits);
+    std::vector<Node> app = { lambdanode(mklist(names), n, 2) };
+    app.insert(app.end(), inits.begin(), inits.end());
+    return mklist(std::move(app));
+}
+
+// (let* (b1 b2 ...) body...)     => (let (b1) (let* (b2 ...) body...))
+Node letstar(const Node& n)
+{
+    if (n.items.size() < 3 || !n.items[1].islist) {
+        fail("let*: expected bindings and a body");
+    }
+    const auto& bs = n.items[1].items;
+    if (bs.size() <= 1) {
+        std::vector<Node> items = n.items;
+        items[0] = mkatom(syms.let);
+        return let(mklist(std::move(items)));
+    }
+    std::vector<Node> inner = { mkatom(syms.letstar), mklist(std::vector<Node>(bs.begin() + 1, bs.end())) };
+    inner.insert(inner.end(), n.items.begin() + 2, n.items.end());
+    return mklist({ mkatom(syms.let), mklist({ bs[0] }), mklist(std::move(inner)) });
+}
+
+// (letrec ((v e) ...) body...)   => ((lambda () (define v e) ... body...))
+Node letrec(const Node& n)
+{
+    if (n.items.size() < 3) {
+        fail("letrec: expected bindings and a body");
+    }
+    std::vector<Node> names, inits;
+    bindings(n.items[1], "letrec", names, inits);
+    std::vector<Node> items = { mkatom(syms.lambda), mklist({}) };
+    for (size_t i = 0; i < names.size(); ++i) {
+        items.push_back(mklist({ mkatom(syms.define), names[i], inits[i] }));
+    }
+    items.insert(items.end(), n.items.begin() + 2, n.items.end());
+    return mklist({ mklist(std::move(items)) });
+}
+
+// (define (f params...) body...) => (define f (lambda (params...) body...))
+// (define (f . rest) body...)     => (define f (lambda rest body...))
+Node define(const Node& n)
+{
+    if (n.items.size() < 3) {
+        fail("define: expected a name and a value");
+    }
+    const Node& target = n.items[1];
+    if (!target.islist) {
+        if (n.items.size() != 3) {
+            fail("define: expected a name and a value");
+        }
+        return mklist(expandall(n, 2));
+    }
+    if (target.items.empty()) {
+        fail("define: expected a name");
+    }
+    Node params = mklist(std::vector<Node>(target.items.begin() + 1, target.items.end()));
+    if (target.dotted) {
+        params.dotted = params.items.size() > 1;
+        if (!params.dotted) {
+            Node rest = params.items[0];
+            params = std::move(rest);
+        }
+    }
+    Node fn = expand(lambdanode(std::move(params), n, 2));
+    return mklist({ n.items[0], symbolnode(target.items[0], "define"), std::move(fn) });
+}
+
+Node expand(const Node& n)
+{
+    if (n.dotted) {
+        fail("invalid s-expression, dotted list");
+    }
+    if (!n.islist || n.items.empty()) {
+        return n;
+    }
+    const Node& head = n.items[0];
+    if (!head.islist && issym(head.atom)) {
+        Value s = head.atom;
+        if (s.uval == syms.quote.uval)   return n;
+        if (s.uval == syms.let.uval)     return expand(let(n));
+        if (s.uval == syms.letstar.uval) return expand(letstar(n));
+        if (s.uval == syms.letrec.uval)  return expand(letrec(n));
+        if (s.uval == syms.define.uval)  return define(n);
+        if (s.uval == syms.lambda.uval)  return mklist(expandall(n, 2));
+        if (s.uval == syms.cond.uval) {
+            std::vector<Node> items = { head };
+            for (size_t i = 1; i < n.items.size(); ++i) {
+                const Node& clause = n.items[i];
+                if (clause.dotted) {
+                    fail("cond: invalid clause");
+                }
+                items.push_back(clause.islist ? mklist(expandall(clause, 0)) : clause);
+            }
+            return mklist(std::move(items));
+        }
+    }
+    return mklist(expandall(n, 0));
+}
+
+//----------------------------------------------------------
+// Resolution: finds, for every lambda, which of its
+// variables are referenced from an inner lambda. Only those
+// need to live in a heap frame; the rest stay in registers.
+//----------------------------------------------------------
+
+// Variables of one lambda: parameters first, then internal defines.
+struct Scope
+{
+    std::vector<Value> names;
+    std::vector<bool>  captured;
+    Scope*             parent = nullptr;
+
+    int find(Value sym) const
+    {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i].uval == sym.uval) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+using Scopes = std::unordered_map<const Node*, Scope>;
+
+void reference(Scope* scope, Value sym)
+{
+    for (Scope* s = scope; s; s = s->parent) {
+        int i = s->find(sym);
+        if (i >= 0) {
+            if (s != scope) {
+                s->captured[i] = true;
+            }
+            return;
+        }
+    }
+}
+
+void resolve(const Node& n, Scope* scope, Scopes& scopes);
+
+void resolveall(const Node& n, size_t from, Scope* scope, Scopes& scopes)
+{
+    for (size_t i = from; i < n.items.size(); ++i) {
+        resolve(n.items[i], scope, scopes);
+    }
+}
+
+// (lambda (a b) ...), (lambda (a b . rest) ...) or (lambda rest ...):
+// the parameters past the fixed ones arrive as a list in `rest`.
+size_t fixedparams(const Node& params) { return params.islist ? params.items.size() - params.dotted : 0; }
+bool hasrest(const Node& params) { return !params.islist || params.dotted; }
+
+void resolvelambda(const Node& n, Scope* parent, Scopes& scopes)
+{
+    if (n.items.size() < 3) {
+        fail("lambda: expected parameters and a body");
+    }
+    const Node& params = n.items[1];
+    Scope& scope = scopes[&n];
+    scope.parent = parent;
+    if (params.islist) {
+        for (const Node& param : params.items) {
+            scope.names.push_back(symbolnode(param, "lambda").atom);
+        }
+    } else {
+        scope.names.push_back(symbolnode(params, "lambda").atom);
+    }
+    if (scope.names.size() > 255) {
+        fail("lambda: too many parameters");
+    }
+    for (size_t i = 2; i < n.items.size(); ++i) {
+        const Node& form = n.items[i];
+        if (isform(form, syms.define) && form.items.size() == 3) {
+            Value name = symbolnode(form.items[1], "define").atom;
+            if (scope.find(name) < 0) {
+                scope.names.push_back(name);
+            }
+        }
+    }
+    scope.captured.assign(scope.names.size(), false);
+    resolveall(n, 2, &scope, scopes);
+}
+
+// `scope` is nullptr at top level, where every variable is global.
+void resolve(const Node& n, Scope* scope, Scopes& scopes)
+{
+    if (!n.islist) {
+        if (issym(n.atom)) {
+            reference(scope, n.atom);
+        }
+        return;
+    }
+    if (n.items.empty()) {
+        fail("invalid s-expression, no arguments");
+    }
+    const Node& head = n.items[0];
+    if (!head.islist && issym(head.atom)) {
+        Value s = head.atom;
+        if (s.uval == syms.quote.uval) {
+            return;
+        } else if (s.uval == syms.lambda.uval) {
+            return resolvelambda(n, scope, scopes);
+        } else if (s.uval == syms.define.uval) {
+            Value name = symbolnode(n.items[1], "define").atom;
+            if (scope && scope->find(name) < 0) {
+                fail("define: not allowed in this context: " + valprint(name));
+            }
+            return resolveall(n, 2, scope, scopes);
+        } else if (s.uval == syms.set.uval) {
+            if (n.items.size() != 3) {
+                fail("set!: expected a name and a value");
+            }
+            reference(scope, symbolnode(n.items[1], "set!").atom);
+            return resolveall(n, 2, scope, scopes);
+        } else if (s.uval == syms.cond.uval) {
+            for (size_t i = 1; i < n.items.size(); ++i) {
+                const Node& clause = n.items[i];
+                if (!clause.islist || clause.items.empty()) {
+                    fail("cond: invalid clause");
+                }
+                resolveall(clause, issymbol(clause.items[0], syms.else_) ? 1 : 0, scope, scopes);
+            }
+            return;
+        } else if (s.uval == syms.if_.uval || s.uval == syms.begin.uval || s.uval == syms.and_.uval ||
+                   s.uval == syms.or_.uval || s.uval == syms.when.uval || s.uval == syms.unless.uval) {
+            return resolveall(n, 1, scope, scopes);
+        }
+    }
+    resolveall(n, 0, scope, scopes);
+}
+
+//----------------------------------------------------------
+// Code generation
+//----------------------------------------------------------
+
+struct FuncState
+{
+    Proto*                p;
+    FuncState*            parent;
+    const Scope*          scope;       // nullptr at top level
+    const Scopes*         scopes;
+    std::vector<uint32_t> where;       // register, or frame slot if captured
+    bool                  hasframe = false;
+    uint32_t              top = 0;     // first free register
+};
+
+// Where a variable reference resolved to.
+struct Ref
+{
+    enum Kind { REG, ENV, GLOBAL } kind;
+    uint32_t depth;
+    uint32_t index;
+};
+
+Ref lookup(FuncState& fs, Value sym)
+{
+    uint32_t depth = 0;
+    for (FuncState* f = &fs; f; f = f->parent) {
+        int i = f->scope ? f->scope->find(sym) : -1;
+        if (i >= 0) {
+            if (!f->scope->captured[i]) {
+                assert(f == &fs);
+                return Ref{Ref::REG, 0, f->where[i]};
+            }
+            if (depth > 255) {
+                fail("procedures nested too deeply");
+            }
+            return Ref{Ref::ENV, depth, f->where[i]};
+        }
+        depth += f->hasframe;
+    }
+    return Ref{Ref::GLOBAL, 0, 0};
+}
+
+uint32_t emit(FuncState& fs, uint32_t insn)
+{
+    fs.p->code.push_back(insn);
+    return fs.p->code.size() - 1;
+}
+
+uint32_t here(FuncState& fs) { return fs.p->code.size(); }
+
+void patch(FuncState& fs, uint32_t at, uint32_t target)
+{
+    int32_t offset = (int32_t) target - (int32_t) (at + 1);
+    if (offset < INT16_MIN || offset > INT16_MAX) {
+        fail("procedure too large");
+    }
+    uint32_t i = fs.p->code[at];
+    fs.p->code[at] = mkasbx(getop(i), geta(i), offset);
+}
+
+uint32_t alloc(FuncState& fs)
+{
+    if (fs.top >= 255) {
+        fail("expression too complex");
+    }
+    uint32_t r = fs.top++;
+    if (fs.top > fs.p->nregs) {
+        fs.p->nregs = fs.top;
+    }
+    return r;
+}
+
+uint32_t konst(FuncState& fs, Value v)
+{
+    auto& consts = fs.p->consts;
+    for (size_t i = 0; i < consts.size(); ++i) {
+        if (consts[i].uval == v.uval) {
+            return i;
+        }
+    }
+    if (consts.size() >= 65536) {
+        fail("too many constants");
+    }
+    consts.push_back(v);
+    return consts.size() - 1;
+}
+
+// `tail` is set when the value of `n` is what the procedure returns, so
+// a call there can replace the current frame.
+void expr(FuncState& fs, const Node& n, uint32_t dst, bool tail = false);
+
+void body(FuncState& fs, const Node& n, size_t from, uint32_t dst, bool tail)
+{
+    if (from >= n.items.size()) {
+        emit(fs, mkabc(OP_LOADNIL, dst, 0, 0));
+        return;
+    }
+    for (size_t i = from; i < n.items.size(); ++i) {
+        expr(fs, n.items[i], dst, tail && i + 1 == n.items.size());
+    }
+}
+
+void constant(FuncState& fs, Value v, uint32_t dst)
+{
+    if (isnil(v)) {
+        emit(fs, mkabc(OP_LOADNIL, dst, 0, 0));
+    } else if (istrue(v) || isfalse(v)) {
+        emit(fs, mkabc(OP_LOADBOOL, dst, istrue(v), 0));
+    } else {
+        emit(fs, mkabx(OP_LOADK, dst, konst(fs, v)));
+    }
+}
+
+void variable(FuncState& fs, Value sym, uint32_t dst)
+{
+    Ref ref = lookup(fs, sym);
+    switch (ref.kind) {
+        case Ref::REG:
+            if (ref.index != dst) {
+                emit(fs, mkabc(OP_MOVE, dst, ref.index, 0));
+            }
+            break;
+        case Ref::ENV:
+            emit(fs, mkabc(OP_GETENV, dst, ref.depth, ref.index));
+            break;
+        case Ref::GLOBAL:
+            emit(fs, mkabx(OP_GETGLOBAL, dst, konst(fs, sym)));
+            break;
+    }
+}
+
+// Stores R[src] into `sym`. Top-level defines create globals.
+void assign(FuncState& fs, Value sym, uint32_t src, bool define)
+{
+    Ref ref = lookup(fs, sym);
+    switch (ref.kind) {
+        case Ref::REG:
+            emit(fs, mkabc(OP_MOVE, ref.index, src, 0));
+            break;
+        case Ref::ENV:
+            emit(fs, mkabc(OP_SETENV, src, ref.depth, ref.index));
+            break;
+        case Ref::GLOBAL:
+            emit(fs, mkabx(define ? OP_DEFGLOBAL : OP_SETGLOBAL, src, konst(fs, sym)));
+            break;
+    }
+}
+
+// Builds the constant for a quoted datum. Sublists are rooted until the
+// list holding them has been allocated.
+Value datum(const Node& n)
+{
+    if (!n.islist) {
+        return n.atom;
+    }
+    std::vector<Value> items;
+    for (const Node& item : n.items) {
+        items.push_back(datum(item));
+        gc_pushroot(items.back());
+    }
+    Value tail = n.dotted ? items.back() : mknil();
+    Value list = mklist(items.data(), items.size() - n.dotted, tail);
+    gc_poproot(items.size());
+    return list;
+}
+
+void quote(FuncState& fs, const Node& n, uint32_t dst)
+{
+    if (n.items.size() != 2) {
+        fail("quote: expected 1 argument");
+    }
+    constant(fs, datum(n.items[1]), dst);
+}
+
+void if_(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    if (n.items.size() != 3 && n.items.size() != 4) {
+        fail("if: expected 2 or 3 arguments");
+    }
+    expr(fs, n.items[1], dst);
+    uint32_t jf = emit(fs, mkasbx(OP_JMPF, dst, 0));
+    expr(fs, n.items[2], dst, tail);
+    uint32_t je = emit(fs, mkasbx(OP_JMP, 0, 0));
+    patch(fs, jf, here(fs));
+    if (n.items.size() == 4) {
+        expr(fs, n.items[3], dst, tail);
+    } else {
+        emit(fs, mkabc(OP_LOADNIL, dst, 0, 0));
+    }
+    patch(fs, je, here(fs));
+}
+
+void lambda(FuncState& fs, const Node& n, Value name, uint32_t dst)
+{
+    const Scope& scope = fs.scopes->at(&n);
+    Proto* p = new Proto;
+    building.push_back(p);
+    p->name = name;
+    p->nparams = fixedparams(n.items[1]);
+    p->rest = hasrest(n.items[1]);
+    // parameters, the rest one included, arrive in the first registers
+    uint32_t nargs = p->nparams + p->rest;
+    p->nregs = nargs;
+
+    FuncState child{p, &fs, &scope, fs.scopes};
+    child.top = nargs;
+    uint32_t nslots = 0;
+    for (size_t i = 0; i < scope.names.size(); ++i) {
+        if (scope.captured[i]) {
+            child.where.push_back(nslots++);
+        } else {
+            child.where.push_back(i < nargs ? i : alloc(child));
+        }
+    }
+    if (nslots > 255) {
+        fail("lambda: too many captured variables");
+    }
+    if (nslots > 0) {
+        child.hasframe = true;
+        emit(child, mkabc(OP_ENTER, nslots, 0, 0));
+        for (uint32_t i = 0; i < nargs; ++i) {
+            if (scope.captured[i]) {
+                emit(child, mkabc(OP_SETENV, i, 0, child.where[i]));
+            }
+        }
+    }
+    uint32_t ret = alloc(child);
+    body(child, n, 2, ret, true);
+    emit(child, mkabc(OP_RET, ret, 0, 0));
+
+    uint32_t index = vm_addproto(p);
+    building.pop_back();
+    fs.p->protos.push_back(index);
+    if (fs.p->protos.size() > 65536) {
+        fail("too many nested procedures");
+    }
+    emit(fs, mkabx(OP_CLOSURE, dst, fs.p->protos.size() - 1));
+}
+
+void define(FuncState& fs, const Node& n, uint32_t dst)
+{
+    Value name = n.items[1].atom;
+    const Node& value = n.items[2];
+    if (isform(value, syms.lambda)) {
+        lambda(fs, value, name, dst);
+    } else {
+        expr(fs, value, dst);
+    }
+    assign(fs, name, dst, true);
+}
+
+void set(FuncState& fs, const Node& n, uint32_t dst)
+{
+    expr(fs, n.items[2], dst);
+    assign(fs, n.items[1].atom, dst, false);
+}
+
+// Opcode for a two-argument call of a global arithmetic builtin.
+Opcode arithop(Value sym)
+{
+    if (sym.uval == syms.add.uval)   return OP_ADD;
+    if (sym.uval == syms.sub.uval)   return OP_SUB;
+    if (sym.uval == syms.mul.uval)   return OP_MUL;
+    if (sym.uval == syms.lt.uval)    return OP_LT;
+    if (sym.uval == syms.numeq.uval) return OP_EQ;
+    if (sym.uval == syms.gt.uval)    return OP_GT;
+    return OP_NOPS;
+}
+
+// Register holding the value of `n`: a local's own register, or a
+// fresh one.
+uint32_t operand(FuncState& fs, const Node& n)
+{
+    if (!n.islist && issym(n.atom)) {
+        Ref ref = lookup(fs, n.atom);
+        if (ref.kind == Ref::REG) {
+            return ref.index;
+        }
+    }
+    uint32_t r = alloc(fs);
+    expr(fs, n, r);
+    return r;
+}
+
+void call(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    size_t nargs = n.items.size() - 1;
+    const Node& head = n.items[0];
+    if (nargs == 2 && !head.islist && issym(head.atom) && lookup(fs, head.atom).kind == Ref::GLOBAL) {
+        Opcode op = arithop(head.atom);
+        if (op != OP_NOPS) {
+            uint32_t save = fs.top;
+            uint32_t b = operand(fs, n.items[1]);
+            uint32_t c = operand(fs, n.items[2]);
+            emit(fs, mkabc(op, dst, b, c));
+            fs.top = save;
+            return;
+        }
+    }
+    if (nargs > 255) {
+        fail("too many arguments");
+    }
+    uint32_t save = fs.top;
+    // call in place if nothing lives above the destination
+    uint32_t base = dst + 1 == fs.top ? dst : alloc(fs);
+    // a global callee is left to CALLG's call site cache
+    bool global = !head.islist && issym(head.atom) && lookup(fs, head.atom).kind == Ref::GLOBAL;
+    if (!global) {
+        expr(fs, head, base);
+    }
+    for (size_t i = 1; i < n.items.size(); ++i) {
+        expr(fs, n.items[i], alloc(fs));
+    }
+    if (global) {
+        CallSite site;
+        site.sym = head.atom;
+        site.pc  = emit(fs, mkabc(tail ? OP_TAILCALLG : OP_CALLG, base, nargs, 0));
+        fs.p->sites.push_back(site);
+        emit(fs, fs.p->sites.size() - 1);
+    } else {
+        emit(fs, mkabc(tail ? OP_TAILCALL : OP_CALL, base, nargs, 0));
+    }
+    if (dst != base && !tail) {
+        emit(fs, mkabc(OP_MOVE, dst, base, 0));
+    }
+    fs.top = save;
+}
+
+void and_(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    if (n.items.size() == 1) {
+        constant(fs, mktrue(), dst);
+        return;
+    }
+    std::vector<uint32_t> jumps;
+    for (size_t i = 1; i < n.items.size(); ++i) {
+        expr(fs, n.items[i], dst, tail && i + 1 == n.items.size());
+        if (i + 1 < n.items.size()) {
+            jumps.push_back(emit(fs, mkasbx(OP_JMPF, dst, 0)));
+        }
+    }
+    for (uint32_t j : jumps) {
+        patch(fs, j, here(fs));
+    }
+}
+
+void or_(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    if (n.items.size() == 1) {
+        constant(fs, mkfalse(), dst);
+        return;
+    }
+    std::vector<uint32_t> jumps;
+    for (size_t i = 1; i < n.items.size(); ++i) {
+        expr(fs, n.items[i], dst, tail && i + 1 == n.items.size());
+        if (i + 1 < n.items.size()) {
+            jumps.push_back(emit(fs, mkasbx(OP_JMPT, dst, 0)));
+        }
+    }
+    for (uint32_t j : jumps) {
+        patch(fs, j, here(fs));
+    }
+}
+
+void cond(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    std::vector<uint32_t> ends;
+    bool haselse = false;
+    for (size_t i = 1; i < n.items.size(); ++i) {
+        const Node& clause = n.items[i];
+        if (!clause.islist || clause.items.empty()) {
+            fail("cond: invalid clause");
+        }
+        if (issymbol(clause.items[0], syms.else_)) {
+            body(fs, clause, 1, dst, tail);
+            haselse = true;
+            break;
+        }
+        expr(fs, clause.items[0], dst);
+        if (clause.items.size() == 1) {
+            ends.push_back(emit(fs, mkasbx(OP_JMPT, dst, 0)));
+            continue;
+        }
+        uint32_t jf = emit(fs, mkasbx(OP_JMPF, dst, 0));
+        body(fs, clause, 1, dst, tail);
+        ends.push_back(emit(fs, mkasbx(OP_JMP, 0, 0)));
+        patch(fs, jf, here(fs));
+    }
+    if (!haselse) {
+        emit(fs, mkabc(OP_LOADNIL, dst, 0, 0));
+    }
+    for (uint32_t j : ends) {
+        patch(fs, j, here(fs));
+    }
+}
+
+void when(FuncState& fs, const Node& n, uint32_t dst, bool negate, bool tail)
+{
+    if (n.items.size() < 2) {
+        fail(negate ? "unless: expected a test" : "when: expected a test");
+    }
+    expr(fs, n.items[1], dst);
+    uint32_t j = emit(fs, mkasbx(negate ? OP_JMPT : OP_JMPF, dst, 0));
+    body(fs, n, 2, dst, tail);
+    uint32_t je = emit(fs, mkasbx(OP_JMP, 0, 0));
+    patch(fs, j, here(fs));
+    emit(fs, mkabc(OP_LOADNIL, dst, 0, 0));
+    patch(fs, je, here(fs));
+}
+
+void expr(FuncState& fs, const Node& n, uint32_t dst, bool tail)
+{
+    if (!n.islist) {
+        if (issym(n.atom)) {
+            variable(fs, n.atom, dst);
+        } else {
+            constant(fs, n.atom, dst);
+        }
+        return;
+    }
+    const Node& head = n.items[0];
+    if (!head.islist && issym(head.atom)) {
+        Value s = head.atom;
+        if (s.uval == syms.quote.uval)   return quote(fs, n, dst);
+        if (s.uval == syms.if_.uval)     return if_(fs, n, dst, tail);
+        if (s.uval == syms.define.uval)  return define(fs, n, dst);
+        if (s.uval == syms.set.uval)     return set(fs, n, dst);
+        if (s.uval == syms.begin.uval)   return body(fs, n, 1, dst, tail);
+        if (s.uval == syms.and_.uval)    return and_(fs, n, dst, tail);
+        if (s.uval == syms.or_.uval)     return or_(fs, n, dst, tail);
+        if (s.uval == syms.cond.uval)    return cond(fs, n, dst, tail);
+        if (s.uval == syms.when.uval)    return when(fs, n, dst, false, tail);
+        if (s.uval == syms.unless.uval)  return when(fs, n, dst, true, tail);
+        if (s.uval == syms.lambda.uval)  return lambda(fs, n, mknil(), dst);
+    }
+    call(fs, n, dst, tail);
+}
+
+} // namespace
+
+int compile(const Node& form, uint32_t& proto, std::string& err)
+{
+    initsyms();
+    // the nested procedures compiled before an error are already added
+    size_t nprotos = vm_nprotos();
+    Proto* p = new Proto;
+    building.assign(1, p);
+    try {
+        Node expanded = expand(form);
+        Scopes scopes;
+        resolve(expanded, nullptr, scopes);
+        FuncState fs{p, nullptr, nullptr, &scopes};
+        uint32_t ret = alloc(fs);
+        expr(fs, expanded, ret, true);
+        emit(fs, mkabc(OP_RET, ret, 0, 0));
+    } catch (const std::runtime_error& e) {
+        err = e.what();
+        // `p` and the procedures it was in the middle of
+        for (const Proto* q : building) {
+            delete q;
+        }
+        building.clear();
+        vm_dropprotos(nprotos);
+        return ERROR;
+    }
+    proto = vm_addproto(p);
+    building.clear();
+    return OK;
+}
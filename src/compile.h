@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+#include "read.h"
+
+// Compiles a top-level form into a new zero-argument prototype.
+int compile(const Node& form, uint32_t& proto, std::string& err);
@@ -0,0 +1,443 @@
+#include "csc.h"
+#include "vm.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout, all integers little endian:
+//
+//   CscHeader
+//   nsyms x  (len:32, bytes)
+//   nprotos x (nparams:32, rest:32, nregs:32, name, ncode:32, code,
+//              nconsts:32, consts, nchildren:32, children,
+//              nsites:32, (sym:32, pc:32) * nsites)
+//   ntop x   proto:32
+//
+// Prototypes are numbered in file order, children before parents.
+// `sum` is csc_hash of everything after the header, so a damaged file
+// is caught before it is parsed; the parse and vm_verify still check
+// every count, index and instruction.
+// Constants are tagged like transfer.h: 'i' 'd' 'n' 't' 'f', 's' len
+// bytes, 'y' symbol number, 'l' n item*n tail.
+
+namespace {
+
+struct CscHeader
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t nops;     // guards against opcode renumbering
+    uint32_t nsyms;
+    uint64_t hash;
+    uint64_t sum;
+    uint32_t nprotos;
+    uint32_t ntop;
+};
+
+const char Magic[4] = { 'C', 'S', 'C', '\0' };
+
+struct Writer
+{
+    std::string           out;
+    std::vector<Value>    syms;
+    std::unordered_map<uint64_t, uint32_t> symindex;
+    std::vector<uint32_t> protos;  // vm index -> file number + 1
+    uint32_t              nprotos = 0;
+
+    void put32(uint32_t x) { out.append((const char*) &x, 4); }
+
+    uint32_t sym(Value s)
+    {
+        auto it = symindex.emplace(s.uval, syms.size());
+        if (it.second) {
+            syms.push_back(s);
+        }
+        return it.first->second;
+    }
+
+    void constant(Value v)
+    {
+        if (isdouble(v)) {
+            out += 'd';
+            out.append((const char*) &v.uval, 8);
+            return;
+        }
+        switch (totag(v)) {
+            case LV_INT:   out += 'i'; put32(v.b.lo); break;
+            case LV_NIL:   out += 'n'; break;
+            case LV_TRUE:  out += 't'; break;
+            case LV_FALSE: out += 'f'; break;
+            case LV_STR: {
+                std::string_view s = strview(v);
+                out += 's';
+                put32(s.size());
+                out.append(s);
+                break;
+            }
+            case LV_SYM:   out += 'y'; put32(sym(v)); break;
+            case LV_PAIR: {
+                std::vector<Value> items;
+                for (; ispair(v); v = unsafe_topair(v)->cdr) {
+                    items.push_back(unsafe_topair(v)->car);
+                }
+                out += 'l';
+                put32(items.size());
+                for (Value item : items) {
+                    constant(item);
+                }
+                constant(v);
+                break;
+            }
+            default:
+                assert(0 && "not a literal");
+                out += 'n';
+        }
+    }
+
+    void proto(uint32_t index)
+    {
+        if (index < protos.size() && protos[index]) {
+            return;
+        }
+        const Proto* p = vm_proto(index);
+        for (uint32_t child : p->protos) {
+            proto(child);
+        }
+        if (index >= protos.size()) {
+            protos.resize(index + 1);
+        }
+        protos[index] = ++nprotos;
+
+        put32(p->nparams);
+        put32(p->rest);
+        put32(p->nregs);
+        constant(p->name);
+        put32(p->code.size());
+        out.append((const char*) p->code.data(), p->code.size() * sizeof(uint32_t));
+        put32(p->consts.size());
+        for (Value k : p->consts) {
+            constant(k);
+        }
+        put32(p->protos.size());
+        for (uint32_t child : p->protos) {
+            put32(protos[child] - 1);
+        }
+        put32(p->sites.size());
+        for (const CallSite& site : p->sites) {
+            put32(sym(site.sym));
+            put32(site.pc);
+        }
+    }
+};
+
+// Bounds-checked reads over the mapped file; a short or corrupt file
+// just clears `ok`.
+struct Reader
+{
+    const char*        p;
+    const char*        end;
+    bool               ok = true;
+    std::vector<Value> syms;
+    std::vector<Value> keep;  // constants not yet owned by the VM
+
+    bool need(size_t n)
+    {
+        ok = ok && (size_t) (end - p) >= n;
+        return ok;
+    }
+
+    uint32_t get32()
+    {
+        uint32_t x = 0;
+        if (need(4)) {
+            memcpy(&x, p, 4);
+            p += 4;
+        }
+        return x;
+    }
+
+    // A count of records of at least `size` bytes each, checked against
+    // the bytes left before anything is allocated for them.
+    uint32_t count(size_t size)
+    {
+        uint32_t n = get32();
+        need(n * size);
+        return ok ? n : 0;
+    }
+
+    Value constant(int depth = 0)
+    {
+        // nested lists recurse
+        if (depth > 10000 || !need(1)) {
+            ok = false;
+            return mknil();
+        }
+        char tag = *p++;
+        switch (tag) {
+            case 'i': return mkint((int) get32());
+            case 'd': {
+                Value v = mknil();
+                if (need(8)) {
+                    memcpy(&v.uval, p, 8);
+                    p += 8;
+                }
+                // anything else would be a forged reference
+                ok = ok && isdouble(v);
+                return ok ? v : mknil();
+            }
+            case 'n': return mknil();
+            case 't': return mktrue();
+            case 'f': return mkfalse();
+            case 's': {
+                uint32_t len = get32();
+                if (!need(len)) {
+                    return mknil();
+                }
+                Value v = mkstr(p, len);
+                p += len;
+                return v;
+            }
+            case 'y': {
+                uint32_t j = get32();
+                ok = ok && j < syms.size();
+                return ok ? syms[j] : mknil();
+            }
+            case 'l': {
+                uint32_t n = get32();
+                size_t first = keep.size();
+                for (uint32_t j = 0; j < n && ok; ++j) {
+                    keep.push_back(constant(depth + 1));
+                }
+                keep.push_back(constant(depth + 1));
+                if (!ok) {
+                    return mknil();
+                }
+                Value list = mklist(keep.data() + first, n, keep.back());
+                keep.resize(first);
+                return list;
+            }
+            default:
+                ok = false;
+                return mknil();
+        }
+    }
+
+    static void visit(void* ctx, GcVisitFn fn)
+    {
+        Reader* r = (Reader*) ctx;
+        for (Value v : r->syms) {
+            fn(v);
+        }
+        for (Value v : r->keep) {
+            fn(v);
+        }
+    }
+};
+
+}
+
+uint64_t csc_hash(const char* data, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, data, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return h;
+}
+
+struct CscWriter
+{
+    uint64_t              hash;
+    Writer                w;
+    std::vector<uint32_t> top;   // file numbers
+};
+
+std::shared_ptr<CscWriter> csc_writer(uint64_t hash)
+{
+    auto cw = std::make_shared<CscWriter>();
+    cw->hash = hash;
+    return cw;
+}
+
+void csc_add(CscWriter& cw, uint32_t proto)
+{
+    cw.w.proto(proto);
+    cw.top.push_back(cw.w.protos[proto] - 1);
+}
+
+bool csc_write(const CscWriter& cw, const char* path)
+{
+    const Writer& w = cw.w;
+    CscHeader h;
+    memcpy(h.magic, Magic, 4);
+    h.version = CscVersion;
+    h.nops    = OP_NOPS;
+    h.nsyms   = w.syms.size();
+    h.hash    = cw.hash;
+    h.nprotos = w.nprotos;
+    h.ntop    = cw.top.size();
+    std::string syms;
+    for (Value s : w.syms) {
+        std::string_view str = strview(s);
+        uint32_t len = str.size();
+        syms.append((const char*) &len, 4);
+        syms.append(str);
+    }
+    syms += w.out;
+    syms.append((const char*) cw.top.data(), cw.top.size() * sizeof(uint32_t));
+    h.sum = csc_hash(syms.data(), syms.size());
+
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(syms.data(), 1, syms.size(), f) == syms.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool csc_save(const char* path, uint64_t hash, const std::vector<uint32_t>& top)
+{
+    std::shared_ptr<CscWriter> cw = csc_writer(hash);
+    for (uint32_t index : top) {
+        csc_add(*cw, index);
+    }
+    return csc_write(*cw, path);
+}
+
+bool csc_load(const char* path, uint64_t hash, std::vector<uint32_t>& top)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CscHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    CscHeader h;
+    memcpy(&h, map, sizeof(h));
+    if (memcmp(h.magic, Magic, 4) != 0 || h.version != CscVersion || h.nops != OP_NOPS || h.hash != hash ||
+        h.sum != csc_hash((const char*) map + sizeof(h), size - sizeof(h))) {
+        munmap(map, size);
+        return false;
+    }
+
+    vm_init();
+    Reader r;
+    r.p   = (const char*) map + sizeof(h);
+    r.end = (const char*) map + size;
+    gc_addroots(Reader::visit, &r);
+    for (uint32_t j = 0; j < h.nsyms && r.ok; ++j) {
+        uint32_t len = r.get32();
+        if (r.need(len)) {
+            r.syms.push_back(mksym(r.p, len));
+            r.p += len;
+        }
+    }
+    // prototypes are only handed to the VM once the whole file checked out
+    std::vector<Proto*> protos;
+    for (uint32_t j = 0; j < h.nprotos && r.ok; ++j) {
+        Proto* p = new Proto;
+        protos.push_back(p);
+        p->nparams = r.get32();
+        uint32_t rest = r.get32();
+        r.ok = r.ok && rest <= 1;
+        p->rest    = rest;
+        p->nregs   = r.get32();
+        p->name    = r.constant();
+        r.keep.push_back(p->name);
+        p->code.resize(r.count(sizeof(uint32_t)));
+        if (!p->code.empty()) {
+            memcpy(p->code.data(), r.p, p->code.size() * sizeof(uint32_t));
+            r.p += p->code.size() * sizeof(uint32_t);
+        }
+        p->consts.resize(r.count(1));
+        for (Value& k : p->consts) {
+            k = r.constant();
+            r.keep.push_back(k);
+        }
+        p->protos.resize(r.count(4));
+        for (uint32_t& child : p->protos) {
+            child = r.get32();
+            r.ok = r.ok && child < j;
+        }
+        p->sites.resize(r.count(8));
+        for (CallSite& site : p->sites) {
+            uint32_t s = r.get32();
+            r.ok = r.ok && s < r.syms.size();
+            site.sym = r.ok ? r.syms[s] : mknil();
+            site.pc  = r.get32();
+        }
+    }
+    std::vector<uint32_t> tops(r.ok && r.need((size_t) h.ntop * 4) ? h.ntop : 0);
+    for (uint32_t& t : tops) {
+        t = r.get32();
+        r.ok = r.ok && t < protos.size();
+    }
+    // Top-level forms run without a heap frame, and every other
+    // prototype in the frames of its parent's body; parents come after
+    // their children.
+    std::vector<std::vector<uint32_t>> frames(protos.size());
+    std::vector<bool> known(protos.size());
+    auto runsin = [&](uint32_t j, const std::vector<uint32_t>& f) {
+        r.ok = r.ok && (!known[j] || frames[j] == f);
+        frames[j] = f;
+        known[j] = true;
+    };
+    for (uint32_t t : tops) {
+        runsin(t, {});
+    }
+    std::vector<uint32_t> inner;
+    for (size_t j = protos.size(); j-- > 0 && r.ok;) {
+        r.ok = known[j] && vm_verify(protos[j], frames[j], inner);
+        for (uint32_t child : protos[j]->protos) {
+            runsin(child, inner);
+        }
+    }
+    if (r.ok && r.p == r.end) {
+        std::vector<uint32_t> index(protos.size());
+        for (size_t j = 0; j < protos.size(); ++j) {
+            for (uint32_t& child : protos[j]->protos) {
+                child = index[child];
+            }
+            index[j] = vm_addproto(protos[j]);
+        }
+        top.clear();
+        for (uint32_t t : tops) {
+            top.push_back(index[t]);
+        }
+    } else {
+        for (Proto* p : protos) {
+            delete p;
+        }
+    }
+    gc_removeroots(Reader::visit, &r);
+    munmap(map, size);
+    return r.ok && r.p == r.end;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//----------------------------------------------------------
+// Compiled-code cache. A .csc file holds the prototypes of a
+// source file's top-level forms, in order, together with
+// everything they reference: child prototypes, constant
+// pools, and the names of every symbol used, which are
+// interned once up front. It is keyed by a hash of the
+// source text and by the bytecode format, so a stale file is
+// simply ignored and rewritten.
+//----------------------------------------------------------
+
+// Bump whenever the instruction set, the meaning of an instruction or
+// the file layout changes; the opcode count alone does not catch
+// renumbering.
+constexpr uint32_t CscVersion = 3;
+
+uint64_t csc_hash(const char* data, size_t len);
+
+struct CscWriter;
+
+// Starts a file for source hashing to `hash`. Each top-level prototype
+// is added as soon as it is compiled: running it may change its quoted
+// constants, and the file must hold them as they were read.
+std::shared_ptr<CscWriter> csc_writer(uint64_t hash);
+// Serializes top-level prototype `proto` and everything it references.
+void csc_add(CscWriter& w, uint32_t proto);
+// Writes the file to `path`, replacing it atomically. Call-site caches
+// are not saved.
+bool csc_write(const CscWriter& w, const char* path);
+
+// All of the above for prototypes `top`, none of which has run yet.
+bool csc_save(const char* path, uint64_t hash, const std::vector<uint32_t>& top);
+
+// If `path` was written for source hashing to `hash` by this build, adds
+// its prototypes to the VM and sets `top` to the top-level ones.
+bool csc_load(const char* path, uint64_t hash, std::vector<uint32_t>& top);
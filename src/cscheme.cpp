@@ -1,32 +1,249 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
-#include <cmath>
+#include <string>
+#include <vector>
 #include "value.h"
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+#include "csc.h"
+#include "image.h"
+#include "profile.h"
+#include "stats.h"
+#include "isolate.h"
+#include "serve.h"
+#include <csignal>
 
-void printval(double v)
+static void usage(const char* argv0)
 {
-    uint8_t p[8];
-    memcpy(&p, &v, sizeof(p));
-    for (size_t i = 0; i < 8; ++i) {
-        printf("0x%02X ", p[i]);
+    fprintf(stderr, "usage: %s [--dump-bytecode] [--callsites] [--no-cache] [--image FILE]\n"
+            "       [--profile=OUT.folded] [--stats] <FILE>\n"
+            "       %s [--image FILE] --stream\n"
+            "       %s [--image FILE] [--workers N] --serve SOCKET [PRELUDE]\n", argv0, argv0, argv0);
+    exit(1);
+}
+
+static bool slurp(FILE* fp, std::string& out)
+{
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
     }
-    printf("\n");
+    return !ferror(fp);
 }
 
-int main(int argc, char** argv)
+// foo.scm -> foo.csc, anything else gets .csc appended
+static std::string cachepath(const char* path)
+{
+    std::string p = path;
+    size_t n = p.size();
+    if (n > 4 && p.compare(n - 4, 4, ".scm") == 0) {
+        p.resize(n - 4);
+    }
+    return p + ".csc";
+}
+
+static int runproto(uint32_t proto, bool dump)
 {
-    printf("cscheme>\n");
+    if (dump) {
+        vm_dump(proto, stdout);
+    }
+    Value result;
+    if (vm_run(proto, result) != OK) {
+        fprintf(stderr, "error: %s\n", valprint(result, false).c_str());
+        return ERROR;
+    }
+    return OK;
+}
 
-    double v = std::nan("");
-    printval(v);
+// Serves until SIGINT or SIGTERM.
+static int runserver(const char* socket, int workers, const char* image, const char* prelude)
+{
+    ServeConfig config;
+    config.socket = socket;
+    config.workers = workers;
+    if (image) {
+        config.image = image;
+    }
+    if (prelude) {
+        FILE* fp = fopen(prelude, "r");
+        if (!fp || !slurp(fp, config.prelude)) {
+            perror(prelude);
+            return 1;
+        }
+        fclose(fp);
+    }
+    // blocked here, so the workers inherit the mask and sigwait gets them
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+    Server server(config);
+    std::string err;
+    if (!server.start(err)) {
+        fprintf(stderr, "error: %s\n", err.c_str());
+        return 1;
+    }
+    int sig;
+    sigwait(&sigs, &sig);
+    server.stop();
+    return 0;
+}
 
-    double x = 100.0 * v;
-    printval(x);
+int main(int argc, char** argv)
+{
+    bool dump = false;
+    bool callsites = false;
+    bool usecache = true;
+    const char* image = nullptr;
+    const char* profile = nullptr;
+    bool showstats = false;
+    bool stream = false;
+    const char* serve = nullptr;
+    int workers = 1;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            dump = true;
+        } else if (strcmp(argv[i], "--callsites") == 0) {
+            callsites = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            usecache = false;
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            image = argv[++i];
+        } else if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10] != '\0') {
+            profile = argv[i] + 10;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            showstats = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            workers = atoi(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage(argv[0]);
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (serve) {
+        return runserver(serve, workers, image, path);
+    }
+    if (stream) {
+        // stdin is read as it arrives, one result line per form: a pipe
+        // (or a socket, through socat and the like) becomes a REPL
+        if (path) {
+            usage(argv[0]);
+        }
+        vm_init();
+        if (image) {
+            std::string err;
+            if (!image_load(image, err)) {
+                fprintf(stderr, "error: %s\n", err.c_str());
+                return 1;
+            }
+        }
+        return eval_stream(0, stdout) == OK ? 0 : 1;
+    }
+    if (!path) {
+        usage(argv[0]);
+    }
 
-    printval(NAN);
+    bool isstdin = strcmp(path, "-") == 0;
+    FILE* fp = isstdin ? stdin : fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        exit(1);
+    }
+    // Regular files are mapped, and the cache key is hashed from the same
+    // bytes the lexer reads in place. Anything else is streamed, form by
+    // form as it arrives, and never cached.
+    Input input(fp);
+    usecache = usecache && !isstdin && input.mapped();
 
-    printval(0. / 0.);
+    vm_init();
+    if (image) {
+        std::string err;
+        if (!image_load(image, err)) {
+            fprintf(stderr, "error: %s\n", err.c_str());
+            return 1;
+        }
+    }
+    if (profile) {
+        std::string err;
+        if (!profile_start(ProfileHz, err)) {
+            fprintf(stderr, "error: %s\n", err.c_str());
+            return 1;
+        }
+    }
+    int status = OK;
+    uint64_t hash = usecache ? csc_hash((const char*) input.cur, input.lim - input.cur) : 0;
+    std::vector<uint32_t> protos;
+    if (usecache && csc_load(cachepath(path).c_str(), hash, protos)) {
+        // the source is not even lexed
+        for (uint32_t proto : protos) {
+            if ((status = runproto(proto, dump)) != OK) {
+                break;
+            }
+        }
+    } else {
+        std::shared_ptr<CscWriter> cache = usecache ? csc_writer(hash) : nullptr;
+        Reader reader(input);
+        for (;;) {
+            Node form;
+            status = read(reader, form);
+            if (status == DONE) {
+                status = OK;
+                break;
+            } else if (status == ERROR) {
+                fprintf(stderr, "error: %s\n", reader.err.c_str());
+                break;
+            }
 
-    return 0;
+            uint32_t proto;
+            std::string err;
+            status = compile(form, proto, err);
+            reader.clear();
+            if (status != OK) {
+                fprintf(stderr, "error: %s\n", err.c_str());
+                break;
+            }
+            if (cache) {
+                csc_add(*cache, proto);
+            }
+            if ((status = runproto(proto, dump)) != OK) {
+                break;
+            }
+        }
+        // only a file that ran to the end is worth caching
+        if (cache && status == OK) {
+            csc_write(*cache, cachepath(path).c_str());
+        }
+    }
+    if (profile) {
+        profile_stop();
+        FILE* out = fopen(profile, "w");
+        if (!out) {
+            perror(profile);
+            return 1;
+        }
+        profile_write(out);
+        fclose(out);
+    }
+    if (!isstdin) {
+        fclose(fp);
+    }
+    if (callsites) {
+        vm_dumpcallsites(stderr, 20);
+    }
+    if (showstats) {
+        stats_report(stderr, stats_total());
+    }
+    return status == OK ? 0 : 1;
 }
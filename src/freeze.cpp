@@ -0,0 +1,390 @@
+#include "freeze.h"
+#include "intern.h"
+#include "table.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct Frozen
+{
+    char*         base = nullptr;
+    size_t        size = 0;      // of the objects; the mapping is page aligned
+    size_t        mapped = 0;
+    FrozenStrings strings;
+    FrozenGlobals globals;
+    std::vector<TabData*> tables;  // the slots of the segment's tables
+
+    ~Frozen()
+    {
+        if (base) {
+            munmap(base, mapped);
+        }
+        for (TabData* t : tables) {
+            tab_freedata(t);
+        }
+    }
+};
+
+namespace {
+
+// Pair slots and handles are both small integers, so pair keys are
+// tagged.
+constexpr uint64_t PairKey = 1ull << 63;
+
+uint64_t objkey(Value v) { return ispair(v) ? tohandle(v) | PairKey : tohandle(v); }
+
+// Lays out what is reachable from the globals in visiting order, like
+// image.cpp's Saver, then writes it with every reference replaced by
+// the frozen Value of its target.
+struct Freezer
+{
+    std::unordered_map<uint64_t, uint32_t> offsets;  // objkey -> offset
+    std::unordered_set<uint64_t>           syms;     // objkeys reached as symbols
+    std::vector<Value>                     objs;     // in segment order
+    std::vector<uint32_t>                  protoid;  // vm index -> frozen index + 1
+    std::vector<uint32_t>                  protos;   // vm indices, children first
+    std::vector<Value>                     work;
+    size_t                                 size = 0;
+    std::string                            err;
+
+    void fail(std::string msg)
+    {
+        if (err.empty()) {
+            err = std::move(msg);
+        }
+    }
+
+    void add(Value v, size_t bytes, bool traced)
+    {
+        if (!offsets.emplace(objkey(v), size).second) {
+            return;
+        }
+        objs.push_back(v);
+        size += bytes;
+        if (traced) {
+            work.push_back(v);
+        }
+    }
+
+    void visit(Value v)
+    {
+        if (isdouble(v)) {
+            return;
+        }
+        switch (totag(v)) {
+            case LV_INT: case LV_NIL: case LV_TRUE: case LV_FALSE:
+                return;
+            case LV_SYM:
+                if (!isshort(v)) {
+                    syms.insert(objkey(v));
+                    add(v, gc_objsize(gc_deref(tohandle(v))), false);
+                }
+                return;
+            case LV_STR:
+                if (!isshort(v)) {
+                    add(v, gc_objsize(gc_deref(tohandle(v))), false);
+                }
+                return;
+            case LV_UDATA:
+                add(v, gc_objsize(vm_env(v)), true);
+                return;
+            case LV_PAIR:
+                add(v, sizeof(Pair), true);
+                return;
+            case LV_TAB:
+                add(v, gc_objsize(unsafe_totab(v)), true);
+                return;
+            case LV_UVEC:
+                add(v, gc_objsize(unsafe_touvec(v)), false);
+                return;
+            case LV_FUN:
+                if (isbuiltin(v)) {
+                    return;
+                }
+                if (!vm_closureproto(unsafe_toclosure(v))) {
+                    fail("cannot freeze a procedure that outlived its request");
+                    return;
+                }
+                add(v, gc_objsize(unsafe_toclosure(v)), true);
+                return;
+            default:
+                fail("cannot freeze " + valprint(v));
+                return;
+        }
+    }
+
+    void visitproto(uint32_t index)
+    {
+        if (index < protoid.size() && protoid[index]) {
+            return;
+        }
+        if (index >= protoid.size()) {
+            protoid.resize(index + 1);
+        }
+        const Proto* p = vm_proto(index);
+        for (uint32_t child : p->protos) {
+            visitproto(child);
+        }
+        protos.push_back(index);
+        protoid[index] = protos.size();
+        visit(p->name);
+        for (Value k : p->consts) {
+            visit(k);
+        }
+        for (const CallSite& site : p->sites) {
+            visit(site.sym);
+        }
+    }
+
+    void drain()
+    {
+        while (!work.empty()) {
+            Value v = work.back();
+            work.pop_back();
+            switch (totag(v)) {
+                case LV_UDATA: {
+                    const Env* e = vm_env(v);
+                    visit(e->parent);
+                    for (uint32_t j = 0; j < e->n; ++j) {
+                        visit(e->slots[j]);
+                    }
+                    break;
+                }
+                case LV_FUN: {
+                    const Closure* cl = unsafe_toclosure(v);
+                    visitproto(cl->proto);
+                    visit(cl->env);
+                    break;
+                }
+                case LV_PAIR: {
+                    const Pair* p = unsafe_topair(v);
+                    visit(p->car);
+                    visit(p->cdr);
+                    break;
+                }
+                case LV_TAB: {
+                    std::vector<Value> entries;
+                    tab_entries(v, entries);
+                    for (Value x : entries) {
+                        visit(x);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    Value word(Value v) const
+    {
+        if (isdouble(v) || (v.uval & IMMBIT)) {
+            return v;  // immediates, short strings and builtins included
+        }
+        switch (totag(v)) {
+            case LV_SYM: case LV_STR: case LV_UDATA: case LV_FUN: case LV_PAIR: case LV_TAB: case LV_UVEC:
+                return mkref(totag(v), FROZENBIT | offsets.at(objkey(v)));
+            default:
+                return v;
+        }
+    }
+
+    void write(Frozen& frozen) const
+    {
+        char* base = frozen.base;
+        for (Value v : objs) {
+            char* at = base + offsets.at(objkey(v));
+            switch (totag(v)) {
+                case LV_SYM:
+                case LV_STR: {
+                    const String* from = (const String*) gc_deref(tohandle(v));
+                    String* s = (String*) at;
+                    s->kind = GC_STRING;
+                    s->len  = from->len;
+                    s->hash = from->hash;
+                    memcpy(s->str, from->str, from->len + 1);
+                    break;
+                }
+                case LV_UDATA: {
+                    const Env* from = vm_env(v);
+                    Env* e = (Env*) at;
+                    e->kind = GC_ENV;
+                    e->n = from->n;
+                    e->parent = word(from->parent);
+                    for (uint32_t j = 0; j < e->n; ++j) {
+                        e->slots[j] = word(from->slots[j]);
+                    }
+                    break;
+                }
+                case LV_FUN: {
+                    const Closure* from = unsafe_toclosure(v);
+                    Closure* cl = (Closure*) at;
+                    cl->kind  = GC_CLOSURE;
+                    cl->proto = protoid[from->proto] - 1;
+                    cl->epoch = 0;
+                    cl->env   = word(from->env);
+                    break;
+                }
+                case LV_PAIR: {
+                    const Pair* from = unsafe_topair(v);
+                    Pair* p = (Pair*) at;
+                    p->car = word(from->car);
+                    p->cdr = word(from->cdr);
+                    break;
+                }
+                case LV_TAB: {
+                    // the keys hash by their Value, so the slots are
+                    // built anew for the frozen ones
+                    std::vector<Value> entries;
+                    tab_entries(v, entries);
+                    for (Value& x : entries) {
+                        x = word(x);
+                    }
+                    Table* t = (Table*) at;
+                    t->kind = GC_TABLE;
+                    t->data = tab_newdata(entries);
+                    frozen.tables.push_back(t->data);
+                    break;
+                }
+                case LV_UVEC: {
+                    const Uvec* from = unsafe_touvec(v);
+                    Uvec* u = (Uvec*) at;
+                    u->kind = GC_UVEC;
+                    u->len  = from->len;
+                    u->type = from->type;
+                    memcpy(u->data, from->data, from->len * uvec_elemsize(from->type));
+                    break;
+                }
+            }
+        }
+    }
+
+    Proto* copyproto(uint32_t index) const
+    {
+        const Proto* from = vm_proto(index);
+        Proto* p = new Proto;
+        p->code    = from->code;
+        p->globals = from->globals;
+        p->nparams = from->nparams;
+        p->rest    = from->rest;
+        p->nregs   = from->nregs;
+        p->name    = word(from->name);
+        for (Value k : from->consts) {
+            p->consts.push_back(word(k));
+        }
+        for (uint32_t child : from->protos) {
+            p->protos.push_back(protoid[child] - 1);
+        }
+        for (const CallSite& s : from->sites) {
+            CallSite site;
+            site.sym  = word(s.sym);
+            site.slot = s.slot;
+            site.pc   = s.pc;
+            p->sites.push_back(site);
+        }
+        return p;
+    }
+};
+
+void buildstrings(FrozenStrings& t, const Freezer& f, const char* base)
+{
+    size_t cap = 16;
+    while (cap < 2 * f.syms.size()) {
+        cap *= 2;
+    }
+    t.slots.assign(cap, FrozenStrings::Slot{0, FrozenStrings::Empty});
+    for (uint64_t key : f.syms) {
+        uint32_t offset = f.offsets.at(key);
+        uint32_t hash = ((const String*) (base + offset))->hash;
+        size_t i = hash & (cap - 1);
+        while (t.slots[i].offset != FrozenStrings::Empty) {
+            i = (i + 1) & (cap - 1);
+        }
+        t.slots[i] = FrozenStrings::Slot{hash, offset};
+    }
+}
+
+thread_local std::shared_ptr<const Frozen> attached;
+
+} // namespace
+
+std::shared_ptr<const Frozen> freeze(std::string& err)
+{
+    std::vector<Value> syms, values;
+    std::vector<bool>  bound;
+    vm_slots(syms, values, bound);
+
+    Freezer f;
+    for (size_t i = 0; i < syms.size(); ++i) {
+        if (bound[i]) {
+            f.visit(syms[i]);
+            f.visit(values[i]);
+            f.drain();
+        }
+    }
+    if (!f.err.empty()) {
+        err = f.err;
+        return nullptr;
+    }
+    // FrozenStrings::Empty is the largest offset
+    if (f.size >= UINT32_MAX) {
+        err = "environment too large to freeze";
+        return nullptr;
+    }
+
+    auto frozen = std::make_shared<Frozen>();
+    size_t page = sysconf(_SC_PAGESIZE);
+    frozen->size   = f.size;
+    frozen->mapped = (std::max<size_t>(f.size, 1) + page - 1) / page * page;
+    void* map = mmap(nullptr, frozen->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        err = "cannot map the frozen segment";
+        return nullptr;
+    }
+    frozen->base = (char*) map;
+    f.write(*frozen);
+    buildstrings(frozen->strings, f, frozen->base);
+    mprotect(frozen->base, frozen->mapped, PROT_READ);
+
+    FrozenGlobals& g = frozen->globals;
+    for (uint32_t index : f.protos) {
+        g.protos.push_back(f.copyproto(index));
+    }
+    for (size_t i = 0; i < syms.size(); ++i) {
+        // An unbound slot's symbol may have died (see globalslot in
+        // vm.cpp) unless code refers to it. A dead one is left out of
+        // the lookup, but keeps its slot so the slot numbers stay valid.
+        Value sym = syms[i];
+        bool live = bound[i] || (issym(sym) && (isshort(sym) || f.syms.count(objkey(sym))));
+        g.syms.push_back(live ? f.word(sym) : mknil());
+        g.values.push_back(bound[i] ? f.word(values[i]) : mknil());
+        g.bound.push_back(bound[i]);
+        if (live) {
+            g.slots.emplace(g.syms.back().uval, i);
+        }
+    }
+    return frozen;
+}
+
+bool freeze_attach(std::shared_ptr<const Frozen> f, std::string& err)
+{
+    if (attached) {
+        err = "this thread is already attached to a frozen environment";
+        return false;
+    }
+    gc_frozen = f->base;
+    intern_attach(&f->strings);
+    if (!vm_attach(&f->globals)) {
+        gc_frozen = nullptr;
+        intern_attach(nullptr);
+        err = "the interpreter of this thread has already started";
+        return false;
+    }
+    attached = std::move(f);
+    return true;
+}
+
+size_t freeze_size(const Frozen& f) { return f.size; }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+//----------------------------------------------------------
+// Frozen environments. freeze() copies the calling thread's
+// global environment and everything reachable from it (the
+// same things an image holds, see image.h) into a read-only
+// segment. Threads attached to it start out with all of it
+// instead of loading a prelude each.
+//
+// Segment objects are referenced by their offset rather
+// than a handle (FROZENBIT, see gc.h). Every attached
+// thread reads the same bytes, with no locks, reference
+// counts or copies, and the collectors leave them alone.
+// Changes made by a thread stay local to it:
+//   globals      each interpreter has a binding table of
+//                its own, initialized from the frozen one,
+//                so define and set! are per thread
+//   variables    a frame captured by a frozen closure is
+//                copied into the thread's heap the first
+//                time one of its variables is set!
+//   pairs        immutable: set-car! and set-cdr! fail
+//   tables       immutable: hash-set! and hash-remove! fail
+//   vectors      immutable: their set!, fill! and copy!
+//                procedures and f64vector-map! fail
+// Ports cannot be frozen.
+//----------------------------------------------------------
+
+struct Frozen;
+
+// Returns nullptr, with `err` set, if the environment holds something
+// that cannot be frozen.
+std::shared_ptr<const Frozen> freeze(std::string& err);
+// Starts the calling thread's interpreter from `f`. Must come before
+// anything else uses the interpreter on this thread; the thread keeps
+// `f` alive until it exits.
+bool freeze_attach(std::shared_ptr<const Frozen> f, std::string& err);
+// Bytes of heap objects in the segment.
+size_t freeze_size(const Frozen& f);
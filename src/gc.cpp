@@ -0,0 +1,769 @@
+#include "gc.h"
+#include "arena.h"
+#include "value.h"
+#include "stats.h"
+#include "table.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <memory>
+
+__thread GcHeader** gc_objtab;
+__thread Slab*      gc_pairspace;
+__thread const char* gc_frozen;
+
+namespace {
+
+constexpr size_t DefaultNurserySize = 4u << 20;
+constexpr size_t MinOldThreshold    = 16u << 20;
+constexpr size_t MinPairThreshold   = 1u << 20; // pairs
+// Bytes of marking or compaction an incremental major collection does
+// for every byte allocated. Compaction also has to catch up with what is
+// promoted meanwhile, so below 3 or so the old generation keeps growing.
+constexpr size_t WorkRate           = 4;
+
+struct RootSet
+{
+    GcRootFn fn;
+    void*    ctx;
+};
+
+struct WeakSet
+{
+    GcWeakFn fn;
+    void*    ctx;
+};
+
+enum Phase { IDLE, MINOR, MAJOR };
+
+// The state of the incremental major collection, see majorgc.
+enum Cycle { NOCYCLE, MARKING, SLIDING };
+
+struct Heap
+{
+    std::vector<GcHeader*> objtab;     // gc_objtab points at its data
+    TypedSlab<Pair>       pairs;
+    bool                  ready = false;
+    Phase                 phase = IDLE;
+    Region                nursery;
+    Region                old;
+    size_t                old_threshold = MinOldThreshold;
+    std::vector<uint32_t> freeslots;   // recycled gc_objtab slots
+    std::vector<uint32_t> young;       // handles of objects living in the nursery
+    std::vector<uint32_t> remembered;  // old objects that may point into the nursery
+    std::vector<Value>    rememberedvalues; // young objects stored by gc_valuebarrier
+    std::vector<uint32_t> markstack;
+    size_t                markvisits = 0;  // calls to mark, see drain
+    size_t                markedbytes = 0; // old objects marked this cycle
+    std::vector<RootSet>  rootsets;
+    std::vector<WeakSet>  weaksets;
+    std::vector<Value>    rootstack;
+    // pair space bitmaps, one bit per gc_pairs slot
+    std::vector<uint64_t> pairlive;
+    std::vector<uint64_t> pairmarked;
+    std::vector<uint64_t> pairremembered;
+    std::vector<uint64_t> pairbase;        // see gc_markbase
+    std::vector<uint32_t> rememberedpairs; // pairs that may point into the nursery
+    std::vector<uint32_t> pairmarkstack;
+    size_t                pair_threshold = MinPairThreshold;
+    Cycle                 cycle = NOCYCLE;
+    // while SLIDING, offsets into `old`: live objects below slidedst are
+    // compacted, those from slidesrc up are still to be visited
+    size_t                slidedst = 0;
+    size_t                slidesrc = 0;
+    size_t                slidelimit = 0; // old.used() when marking ended
+    GcStats               stats = {};
+
+    ~Heap()
+    {
+        region_free(nursery);
+        region_free(old);
+    }
+};
+
+// One heap per thread, see isolate.h. Like the VM it is reached
+// through a __thread pointer; `ownheap` frees it at thread exit.
+__thread Heap* heap;
+thread_local std::unique_ptr<Heap> ownheap;
+
+// Called by the entry points that can come before any allocation.
+__attribute__((noinline)) void makeheap()
+{
+    stats_attach();
+    ownheap.reset(new Heap);
+    heap = ownheap.get();
+}
+
+uint64_t now_ns()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void setup(size_t nursery_size)
+{
+    if (!heap) {
+        makeheap();
+    }
+    region_init(heap->nursery, nursery_size);
+    region_init(heap->old, std::max(MinOldThreshold, 2 * heap->nursery.cap()));
+    gc_pairspace = &heap->pairs;
+    heap->ready = true;
+}
+
+uint32_t newhandle(GcHeader* obj)
+{
+    uint64_t index;
+    if (heap->freeslots.empty()) {
+        index = heap->objtab.size();
+        heap->objtab.push_back(obj);
+        gc_objtab = heap->objtab.data();
+    } else {
+        index = heap->freeslots.back();
+        heap->freeslots.pop_back();
+        assert(index < heap->objtab.size() && gc_objtab[index] == nullptr);
+        gc_objtab[index] = obj;
+    }
+    assert(index <= UINT32_MAX && index <= INDEXMASK && "out of handles");
+    return index;
+}
+
+void freehandle(uint32_t h)
+{
+    gc_objtab[h] = nullptr;
+    heap->freeslots.push_back(h);
+}
+
+bool testbit(const std::vector<uint64_t>& bits, uint32_t i) { return bits[i / 64] >> (i % 64) & 1; }
+void setbit(std::vector<uint64_t>& bits, uint32_t i) { bits[i / 64] |= 1ull << (i % 64); }
+
+bool isyoung(Value v) { return isheap(v) && heap->nursery.contains(gc_objtab[tohandle(v)]); }
+
+void rememberpair(uint32_t i)
+{
+    if (!testbit(heap->pairremembered, i)) {
+        setbit(heap->pairremembered, i);
+        heap->rememberedpairs.push_back(i);
+    }
+}
+
+void trace(GcHeader* obj, GcVisitFn visit)
+{
+    switch (obj->kind) {
+        case GC_STRING:
+            break;
+        case GC_ENV: {
+            Env* e = (Env*) obj;
+            visit(e->parent);
+            for (uint32_t i = 0; i < e->n; ++i) {
+                visit(e->slots[i]);
+            }
+            break;
+        }
+        case GC_CLOSURE:
+            visit(((Closure*) obj)->env);
+            break;
+        case GC_PORT:
+            break;
+        case GC_TABLE:
+            tab_trace((Table*) obj, visit);
+            break;
+        case GC_UVEC:
+            break;
+        default:
+            assert(0 && "invalid object kind");
+    }
+}
+
+void visitroots(GcVisitFn visit)
+{
+    for (const RootSet& rs : heap->rootsets) {
+        rs.fn(rs.ctx, visit);
+    }
+    for (Value v : heap->rootstack) {
+        visit(v);
+    }
+}
+
+void rebase(char* p, char* end)
+{
+    while (p < end) {
+        GcHeader* obj = (GcHeader*) p;
+        gc_objtab[obj->handle] = obj;
+        p += gc_objsize(obj);
+    }
+}
+
+// Make room for `need` more bytes in the old generation. If the region
+// moves, the table slots of all old objects are rebased.
+void oldreserve(size_t need)
+{
+    if (heap->old.avail() >= need) {
+        return;
+    }
+    size_t cap = std::max(2 * heap->old.cap(), heap->old.used() + need);
+    if (!region_grow(heap->old, cap)) {
+        return;
+    }
+    char* base = heap->old.base;
+    if (heap->cycle == SLIDING) {
+        // the gap between the compacted and the unvisited objects holds
+        // no headers
+        rebase(base, base + heap->slidedst);
+        rebase(base + heap->slidesrc, heap->old.top);
+    } else {
+        rebase(base, heap->old.top);
+    }
+}
+
+void promote(Value v)
+{
+    if (!isheap(v)) {
+        return;
+    }
+    uint64_t h = tohandle(v);
+    GcHeader* obj = gc_objtab[h];
+    // promoted objects already point into the old space
+    if (!heap->nursery.contains(obj)) {
+        return;
+    }
+    size_t size = gc_objsize(obj);
+    GcHeader* copy = (GcHeader*) heap->old.bump(size);
+    memcpy(copy, obj, size);
+    gc_objtab[h] = copy;
+    heap->stats.bytes_promoted += size;
+}
+
+void grey(GcHeader* obj)
+{
+    if (!(obj->flags & GC_MARKED)) {
+        obj->flags |= GC_MARKED;
+        heap->markstack.push_back(obj->handle);
+        heap->markedbytes += gc_objsize(obj);
+    }
+}
+
+// Young objects are left alone: while marking, every object a minor
+// collection promotes is greyed (see minorgc), and otherwise the
+// nursery is empty when marking.
+void mark(Value v)
+{
+    ++heap->markvisits;
+    if (ispair(v)) {
+        if (gc_isfrozen(v.uval)) {
+            return;
+        }
+        uint32_t i = v.b.lo;
+        if (!testbit(heap->pairmarked, i)) {
+            setbit(heap->pairmarked, i);
+            heap->pairmarkstack.push_back(i);
+        }
+        return;
+    }
+    if (!isheap(v)) {
+        return;
+    }
+    GcHeader* obj = gc_objtab[tohandle(v)];
+    if (!heap->nursery.contains(obj)) {
+        grey(obj);
+    }
+}
+
+// Traces grey objects and pairs until `budget` bytes of them are done.
+// An object counts its size plus the Values it holds, which for a table
+// live outside of it. Returns whether nothing is left to trace.
+bool drain(size_t budget)
+{
+    for (size_t work = 0; work < budget;) {
+        if (!heap->markstack.empty()) {
+            GcHeader* obj = gc_objtab[heap->markstack.back()];
+            heap->markstack.pop_back();
+            size_t visits = heap->markvisits;
+            trace(obj, mark);
+            work += gc_objsize(obj) + sizeof(Value) * (heap->markvisits - visits);
+        } else if (!heap->pairmarkstack.empty()) {
+            Pair* p = gc_pair(heap->pairmarkstack.back());
+            heap->pairmarkstack.pop_back();
+            mark(p->car);
+            mark(p->cdr);
+            work += sizeof(Pair);
+        } else {
+            return true;
+        }
+    }
+    return heap->markstack.empty() && heap->pairmarkstack.empty();
+}
+
+void visitweak(Phase phase)
+{
+    heap->phase = phase;
+    for (const WeakSet& ws : heap->weaksets) {
+        ws.fn(ws.ctx, phase == MAJOR);
+    }
+    heap->phase = IDLE;
+}
+
+void recordpause(uint64_t start, uint64_t& max, uint64_t* pauses)
+{
+    uint64_t pause = now_ns() - start;
+    heap->stats.last_pause_ns = pause;
+    heap->stats.total_pause_ns += pause;
+    max = std::max(max, pause);
+    stat_pause(pauses, pause);
+}
+
+// Compacts the old generation for up to `budget` bytes, see majorgc.
+void slide(size_t budget)
+{
+    char* base  = heap->old.base;
+    char* dst   = base + heap->slidedst;
+    char* p     = base + heap->slidesrc;
+    char* limit = base + heap->slidelimit;
+    for (size_t work = 0; p < heap->old.top && work < budget;) {
+        GcHeader* obj  = (GcHeader*) p;
+        size_t    size = gc_objsize(obj);
+        bool      live = p >= limit || (obj->flags & GC_MARKED);
+        p += size;
+        work += size;
+        if (live) {
+            obj->flags &= ~GC_MARKED;
+            if ((char*) obj != dst) {
+                memmove(dst, obj, size);
+            }
+            gc_objtab[((GcHeader*) dst)->handle] = (GcHeader*) dst;
+            dst += size;
+        } else {
+            heap->stats.bytes_freed += size;
+            freehandle(obj->handle);
+        }
+    }
+    heap->slidedst = dst - base;
+    heap->slidesrc = p - base;
+    if (p < heap->old.top) {
+        return;
+    }
+    heap->old.top = dst;
+    region_trim(heap->old);
+    // what came in while sliding is mostly garbage by now, and would
+    // otherwise raise the threshold more with every cycle
+    heap->old_threshold = std::max(MinOldThreshold, 2 * heap->markedbytes);
+    heap->markedbytes = 0;
+    heap->cycle = NOCYCLE;
+}
+
+void startmark()
+{
+    heap->cycle = MARKING;
+    visitroots(mark);
+}
+
+void advance(size_t budget)
+{
+    if (heap->cycle == NOCYCLE) {
+        return;
+    }
+    if (heap->cycle == MARKING) {
+        drain(budget);
+    } else {
+        slide(budget);
+    }
+    ++heap->stats.major_steps;
+}
+
+// Cheney-style evacuation of the live nursery into the old generation.
+// Work is proportional to the roots, the remembered set and the
+// surviving young objects; the rest of the old generation is untouched.
+// A major collection in progress then gets a budget of work in
+// proportion to the nursery, see majorgc.
+void minorgc()
+{
+    uint64_t start = now_ns();
+
+    // worst case everything survives, so promotion never has to grow
+    // the old space (and move objects) half way through
+    oldreserve(heap->nursery.used());
+    char* scan = heap->old.top;
+
+    // before anything is copied, so no copy carries the flag along
+    for (Value v : heap->rememberedvalues) {
+        gc_objtab[tohandle(v)]->flags &= ~GC_REMEMBERED;
+        promote(v);
+    }
+    heap->rememberedvalues.clear();
+    visitroots(promote);
+    for (uint32_t h : heap->remembered) {
+        GcHeader* obj = gc_objtab[h];
+        obj->flags &= ~GC_REMEMBERED;
+        trace(obj, promote);
+    }
+    heap->remembered.clear();
+    for (uint32_t i : heap->rememberedpairs) {
+        heap->pairremembered[i / 64] &= ~(1ull << (i % 64));
+        promote(gc_pair(i)->car);
+        promote(gc_pair(i)->cdr);
+    }
+    heap->rememberedpairs.clear();
+    while (scan < heap->old.top) {
+        GcHeader* obj = (GcHeader*) scan;
+        trace(obj, promote);
+        if (heap->cycle == MARKING) {
+            grey(obj);
+        }
+        scan += gc_objsize(obj);
+    }
+    visitweak(MINOR);
+
+    for (uint32_t h : heap->young) {
+        GcHeader* obj = gc_objtab[h];
+        if (heap->nursery.contains(obj)) {
+            heap->stats.bytes_freed += gc_objsize(obj);
+            freehandle(h);
+        }
+    }
+    heap->young.clear();
+    heap->nursery.top = heap->nursery.base;
+
+    advance(WorkRate * heap->nursery.cap());
+    if (heap->cycle == NOCYCLE && heap->old.used() > heap->old_threshold) {
+        startmark();
+    }
+
+    ++heap->stats.minor_collections;
+    stat_add(stats->minor_collections);
+    recordpause(start, heap->stats.max_minor_pause_ns, stats->minor_pauses);
+}
+
+// Frees every live pair that was not marked; pairs never move, so their
+// slots simply go back to the slab.
+void sweeppairs()
+{
+    for (size_t w = 0; w < heap->pairlive.size(); ++w) {
+        uint64_t dead = heap->pairlive[w] & ~heap->pairmarked[w];
+        heap->pairlive[w] &= heap->pairmarked[w];
+        heap->pairbase[w] &= heap->pairmarked[w];
+        heap->pairmarked[w] = 0;
+        for (; dead; dead &= dead - 1) {
+            heap->pairs.free(w * 64 + __builtin_ctzll(dead));
+            heap->stats.bytes_freed += sizeof(Pair);
+        }
+    }
+    heap->pair_threshold = std::max(MinPairThreshold, 2 * heap->pairs.used());
+}
+
+// Marking ends once nothing is left to trace, or early, in one pause,
+// if allocation took `used` to twice its threshold first.
+bool endmarking(size_t used, size_t threshold)
+{
+    return heap->cycle == MARKING &&
+        ((heap->markstack.empty() && heap->pairmarkstack.empty()) || used > 2 * threshold);
+}
+
+// Mark-compact of the old generation, done incrementally:
+//
+//   MARKING:  starts from the roots once the old generation (or the pair
+//             space) crosses its threshold. Every minor collection, pair
+//             reservation and allocation straight into the old space
+//             traces grey objects for WorkRate times the bytes allocated.
+//             The barriers mark every value stored into an object or a
+//             pair, so none can hide in one that was already traced.
+//             Whatever is promoted or allocated in the old space or the
+//             pair space meanwhile is marked as well.
+//   majorgc:  ends marking in one pause. The roots are scanned again
+//             (stores into them have no barrier) and traced to
+//             completion, then weak references and pairs are swept.
+//   SLIDING:  live objects slide down in address order, again for a
+//             budget per minor collection. Because references go through
+//             the handle table, each object only needs its slot updated.
+//             Objects above slidelimit came in after marking and are all
+//             live.
+//
+// `wait` makes it a full collection of everything unreachable right now:
+// a cycle in progress is completed first, since what it allocated black
+// survives it, and the compaction is done before returning.
+void majorgc(bool wait)
+{
+    if (wait && heap->cycle == MARKING) {
+        majorgc(false);
+    }
+    if (heap->cycle == SLIDING) {
+        slide(SIZE_MAX);
+    }
+    minorgc();
+    uint64_t start = now_ns();
+
+    visitroots(mark);
+    drain(SIZE_MAX);
+    visitweak(MAJOR);
+    sweeppairs();
+
+    heap->cycle      = SLIDING;
+    heap->slidedst   = 0;
+    heap->slidesrc   = 0;
+    heap->slidelimit = heap->old.used();
+    if (wait) {
+        slide(SIZE_MAX);
+    }
+
+    ++heap->stats.major_collections;
+    stat_add(stats->major_collections);
+    recordpause(start, heap->stats.max_major_pause_ns, stats->major_pauses);
+}
+
+void collect()
+{
+    if (endmarking(heap->old.used() + heap->nursery.used(), heap->old_threshold)) {
+        majorgc(false);
+    } else {
+        minorgc();
+    }
+}
+
+GcHeader* oldalloc(size_t size)
+{
+    if (heap->old.avail() < size && heap->old.used() + size > heap->old_threshold) {
+        if (heap->cycle == NOCYCLE) {
+            startmark();
+        } else if (endmarking(heap->old.used() + size, heap->old_threshold)) {
+            majorgc(false);
+        }
+    }
+    advance(WorkRate * size);
+    oldreserve(size);
+    return (GcHeader*) heap->old.bump(size);
+}
+
+} // namespace
+
+void gc_init(size_t nursery_size)
+{
+    if (!heap) {
+        makeheap();
+    }
+    assert(!heap->ready && "gc_init called after first allocation");
+    setup(nursery_size);
+}
+
+GcHeader* gc_alloc(uint8_t kind, size_t size)
+{
+    if (!heap || !heap->ready) {
+        setup(DefaultNurserySize);
+    }
+    size = sizeclass(size);
+
+    GcHeader* obj;
+    bool young = size <= heap->nursery.cap() / 4;
+    if (young) {
+        if (heap->nursery.avail() < size) {
+            collect();
+        }
+        obj = (GcHeader*) heap->nursery.bump(size);
+    } else {
+        obj = oldalloc(size);
+    }
+
+    memset(obj, 0, size);
+    obj->kind   = kind;
+    obj->handle = newhandle(obj);
+    if (young) {
+        heap->young.push_back(obj->handle);
+    } else if (heap->cycle == MARKING) {
+        grey(obj);
+    }
+    heap->stats.bytes_allocated += size;
+    stat_add(stats->allocs[kind]);
+    stat_add(stats->bytes_allocated, size);
+    return obj;
+}
+
+void gc_reservepairs(size_t n)
+{
+    if (!heap || !heap->ready) {
+        setup(DefaultNurserySize);
+    }
+    size_t used = heap->pairs.used() + n;
+    if (used > heap->pair_threshold) {
+        if (heap->cycle == NOCYCLE) {
+            startmark();
+        } else if (endmarking(used, heap->pair_threshold)) {
+            majorgc(false);
+            heap->pair_threshold = std::max(heap->pair_threshold, heap->pairs.used() + n);
+        }
+    }
+    // pairs are never compacted, so only marking keeps pace with them
+    if (heap->cycle == MARKING) {
+        drain(WorkRate * n * sizeof(Pair));
+    }
+}
+
+uint32_t gc_newpair(Value car, Value cdr)
+{
+    uint32_t i = heap->pairs.alloc();
+    if (i / 64 >= heap->pairlive.size()) {
+        size_t words = heap->pairs.capacity() / 64 + 1;
+        heap->pairlive.resize(words);
+        heap->pairmarked.resize(words);
+        heap->pairremembered.resize(words);
+        heap->pairbase.resize(words);
+    }
+    setbit(heap->pairlive, i);
+    Pair* p = gc_pair(i);
+    p->car = car;
+    p->cdr = cdr;
+    if (isyoung(car) || isyoung(cdr)) {
+        rememberpair(i);
+    }
+    if (heap->cycle == MARKING) {
+        setbit(heap->pairmarked, i);
+        mark(car);
+        mark(cdr);
+    }
+    heap->stats.bytes_allocated += sizeof(Pair);
+    stat_add(stats->allocs[StatPairs]);
+    stat_add(stats->bytes_allocated, sizeof(Pair));
+    return i;
+}
+
+void gc_pairbarrier(uint32_t index, Value v)
+{
+    if (isyoung(v)) {
+        rememberpair(index);
+    }
+    if (heap->cycle == MARKING) {
+        mark(v);
+    }
+}
+
+size_t gc_objsize(const GcHeader* obj)
+{
+    switch (obj->kind) {
+        case GC_STRING:  return sizeclass(sizeof(String) + ((const String*) obj)->len + 1);
+        case GC_ENV:     return sizeclass(sizeof(Env) + sizeof(Value) * ((const Env*) obj)->n);
+        case GC_CLOSURE: return sizeclass(sizeof(Closure));
+        case GC_PORT:    return sizeclass(sizeof(Port));
+        case GC_TABLE:   return sizeclass(sizeof(Table));
+        case GC_UVEC:    return sizeclass(sizeof(Uvec) + uvec_elemsize(((const Uvec*) obj)->type) * ((const Uvec*) obj)->len);
+    }
+    assert(0 && "invalid object kind");
+    return 0;
+}
+
+void gc_barrier(GcHeader* obj, Value v)
+{
+    if (heap->old.contains(obj) && !(obj->flags & GC_REMEMBERED)) {
+        obj->flags |= GC_REMEMBERED;
+        heap->remembered.push_back(obj->handle);
+    }
+    if (heap->cycle == MARKING) {
+        mark(v);
+    }
+}
+
+void gc_valuebarrier(GcHeader* obj, Value v)
+{
+    if (heap->old.contains(obj) && isyoung(v)) {
+        GcHeader* target = gc_objtab[tohandle(v)];
+        if (!(target->flags & GC_REMEMBERED)) {
+            target->flags |= GC_REMEMBERED;
+            heap->rememberedvalues.push_back(v);
+        }
+    }
+    if (heap->cycle == MARKING) {
+        mark(v);
+    }
+}
+
+void gc_addroots(GcRootFn fn, void* ctx)
+{
+    if (!heap) {
+        makeheap();
+    }
+    heap->rootsets.push_back({fn, ctx});
+}
+
+void gc_removeroots(GcRootFn fn, void* ctx)
+{
+    auto it = std::find_if(heap->rootsets.begin(), heap->rootsets.end(),
+            [=](const RootSet& rs) { return rs.fn == fn && rs.ctx == ctx; });
+    assert(it != heap->rootsets.end() && "roots were never added");
+    heap->rootsets.erase(it);
+}
+
+void gc_addweak(GcWeakFn fn, void* ctx)
+{
+    if (!heap) {
+        makeheap();
+    }
+    heap->weaksets.push_back({fn, ctx});
+}
+
+bool gc_isalive(uint32_t handle)
+{
+    GcHeader* obj = gc_objtab[handle];
+    switch (heap->phase) {
+        case MINOR: return !heap->nursery.contains(obj);
+        case MAJOR: return obj->flags & GC_MARKED;
+        case IDLE:  break;
+    }
+    assert(0 && "gc_isalive called outside of a collection");
+    return true;
+}
+
+void gc_pushroot(Value v)
+{
+    if (!heap) {
+        makeheap();
+    }
+    heap->rootstack.push_back(v);
+}
+
+void gc_poproot(size_t n)
+{
+    assert(heap->rootstack.size() >= n);
+    heap->rootstack.resize(heap->rootstack.size() - n);
+}
+
+void gc_collect(bool major)
+{
+    if (!heap || !heap->ready) {
+        return;
+    }
+    if (major) {
+        majorgc(true);
+    } else {
+        minorgc();
+    }
+}
+
+// The nursery is empty after a major collection, so every survivor is
+// in the old generation or the pair space.
+void gc_markbase()
+{
+    if (!heap || !heap->ready) {
+        setup(DefaultNurserySize);
+    }
+    majorgc(true);
+    for (char* p = heap->old.base; p < heap->old.top; p += gc_objsize((GcHeader*) p)) {
+        ((GcHeader*) p)->flags |= GC_BASE;
+    }
+    heap->pairbase = heap->pairlive;
+}
+
+bool gc_isbasepair(uint32_t index) { return testbit(heap->pairbase, index); }
+
+GcStats gc_stats()
+{
+    if (!heap) {
+        makeheap();
+    }
+    GcStats s = heap->stats;
+    s.nursery_size = heap->nursery.cap();
+    s.nursery_used = heap->nursery.used();
+    s.old_used     = heap->old.used();
+    s.live_handles = heap->objtab.size() - heap->freeslots.size();
+    s.live_pairs   = heap->pairs.used();
+    s.major_active = heap->cycle != NOCYCLE;
+    return s;
+}
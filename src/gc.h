@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "arena.h"
+
+struct Value;
+struct Pair;
+
+//----------------------------------------------------------
+// Heap layout:
+//
+// Heap objects are never referenced by address. A boxed
+// Value carries an index ("handle") into `gc_objtab`, and
+// the table holds the object's current address. Moving an
+// object only requires updating its table slot, so neither
+// collector has to find and rewrite references.
+//
+//   nursery:  bump-pointer region, evacuated by a copying
+//             minor collection into the old generation.
+//   old:      contiguous region, collected by a sliding
+//             mark-compact major collection. It runs
+//             incrementally: marking and compaction proceed
+//             a budget at a time inside minor collections,
+//             and only the end of marking is one pause, to
+//             rescan the roots and sweep weak references.
+//
+// Raw object pointers (e.g. from unsafe_tostr) are only
+// valid until the next allocation.
+//
+//   pairs:    16-byte cons cells in their own Slab, indexed
+//             directly by the LV_PAIR payload. They never
+//             move, are swept by major collections only, and
+//             are treated as old: a pair that points into the
+//             nursery is remembered, like a mutated old object.
+//             (Hash tables remember the young values stored
+//             into them instead, see gc_valuebarrier.)
+//
+//   frozen:   a read-only segment shared by threads (see
+//             freeze.h). Its objects and pairs are referenced
+//             by offset, with FROZENBIT set, instead of by
+//             handle or pair slot; the collector neither
+//             traces nor moves them.
+//----------------------------------------------------------
+
+enum GcKind : uint8_t {
+    GC_STRING,
+    GC_ENV,
+    GC_CLOSURE,
+    GC_PORT,
+    GC_TABLE,
+    GC_UVEC,
+
+    GC_NKINDS,
+};
+
+enum GcFlags : uint8_t {
+    GC_MARKED     = 0x1u,
+    GC_REMEMBERED = 0x2u,  // young objects too, see gc_valuebarrier
+    GC_BASE       = 0x4u,  // see gc_markbase
+};
+
+// The object size is not stored, it is derived from the kind and the
+// object's own length fields (see gc_objsize).
+struct GcHeader
+{
+    uint32_t handle; // slot in gc_objtab
+    uint8_t  kind;
+    uint8_t  flags;
+    uint16_t pad;
+};
+static_assert(sizeof(GcHeader) == 8, "unexpected GcHeader size");
+
+struct GcStats
+{
+    uint64_t minor_collections;
+    uint64_t major_collections;
+    uint64_t bytes_allocated;
+    uint64_t bytes_promoted;
+    uint64_t bytes_freed;
+    uint64_t nursery_size;
+    uint64_t nursery_used;
+    uint64_t old_used;
+    uint64_t live_handles;
+    uint64_t live_pairs;
+    uint64_t last_pause_ns;
+    uint64_t max_minor_pause_ns;
+    uint64_t max_major_pause_ns;
+    uint64_t total_pause_ns;
+    uint64_t major_steps;   // budgeted steps of incremental major work
+    uint64_t major_active;  // 1 while a major collection is in progress
+};
+
+using GcVisitFn = void (*)(Value v);
+using GcRootFn  = void (*)(void* ctx, GcVisitFn visit);
+using GcWeakFn  = void (*)(void* ctx, bool major);
+
+// Every thread has a heap of its own (see isolate.h). These point into
+// the calling thread's handle table and pair space; they are __thread
+// rather than thread_local so reading them is a plain TLS load, with no
+// initialization check.
+extern __thread GcHeader** gc_objtab;
+extern __thread Slab*      gc_pairspace;
+// The frozen segment the thread is attached to, if any.
+extern __thread const char* gc_frozen;
+
+// Set in a handle or pair index that is an offset into gc_frozen.
+constexpr uint64_t FROZENBIT = 0x0000200000000000ull;
+
+inline bool gc_isfrozen(uint64_t handle) { return (handle & FROZENBIT) != 0; }
+inline GcHeader* gc_deref(uint64_t handle)
+{
+    if (gc_isfrozen(handle)) {
+        return (GcHeader*) (gc_frozen + (handle ^ FROZENBIT));
+    }
+    return gc_objtab[handle];
+}
+inline Pair* gc_pair(uint32_t index) { return (Pair*) gc_pairspace->get(index); }
+
+// Must be called before the first allocation to change the nursery size,
+// otherwise the heap is lazily set up with the default size.
+void gc_init(size_t nursery_size);
+
+// Returns a zeroed object of `size` bytes (including the header) with a
+// fresh handle. The size is rounded up to its size class. May run a
+// collection.
+GcHeader* gc_alloc(uint8_t kind, size_t size);
+size_t gc_objsize(const GcHeader* obj);
+
+// Pair allocation. gc_reservepairs(n) collects if `n` more pairs would
+// cross the pair threshold, so every Value the caller holds must be
+// reachable from roots; the next `n` gc_newpair calls will not collect.
+void gc_reservepairs(size_t n);
+uint32_t gc_newpair(Value car, Value cdr);
+// Must be called after every store into an existing pair, see gc_barrier.
+void gc_pairbarrier(uint32_t index, Value v);
+
+// Record that `v` was stored into `obj`, which may now reference a young
+// object, or an old one that incremental marking has yet to find. Must
+// be called after every store of a heap Value into an object.
+void gc_barrier(GcHeader* obj, Value v);
+// The same, for objects too large to trace again at every minor
+// collection, such as hash tables: `v` is remembered instead of `obj`.
+// Handles never change, so keeping `v` alive is all `obj` needs; if it
+// is overwritten meanwhile, `v` is promoted all the same.
+void gc_valuebarrier(GcHeader* obj, Value v);
+
+// Roots: registered callbacks are invoked at every collection and must
+// visit each Value they hold. The root stack is meant for temporaries
+// held by C++ code across an allocation.
+void gc_addroots(GcRootFn fn, void* ctx);
+void gc_removeroots(GcRootFn fn, void* ctx);
+void gc_pushroot(Value v);
+void gc_poproot(size_t n = 1);
+
+// Weak references: registered callbacks run once liveness is known but
+// before dead objects are released, and must forget every handle for
+// which gc_isalive() is false. A minor collection only decides the fate
+// of nursery objects.
+void gc_addweak(GcWeakFn fn, void* ctx);
+bool gc_isalive(uint32_t handle);
+
+// A major collection here is complete: it finishes any incremental one
+// in progress and frees everything unreachable when it is called.
+void gc_collect(bool major);
+// Runs a major collection and flags every survivor as part of a base
+// environment (see vm_checkpoint): objects get GC_BASE, pairs are
+// recorded for gc_isbasepair. Anything allocated later is not.
+void gc_markbase();
+bool gc_isbasepair(uint32_t index);
+GcStats gc_stats();
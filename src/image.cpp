@@ -0,0 +1,676 @@
+#include "image.h"
+#include "table.h"
+#include "uvec.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout, after the header, one section per object table:
+//
+//   syms      (len:32, bytes)*
+//   strs      (len:32, bytes)*
+//   uvecs     (type:8, len:32, element*len)*
+//   envs      (n:32, parent, slot*n)*
+//   closures  (proto:32, env)*
+//   pairs     (car, cdr)*
+//   tables    (n:32, (key, value)*n)*
+//   protos    (nparams:32, rest:32, nregs:32, name, ncode:32, code,
+//              nconsts:32, const*, nchildren:32, child:32*,
+//              nsites:32, (sym, pc:32)*)*  children first
+//   globals   (sym, value)*
+//
+// Unnamed fields are 64-bit words: a Value whose heap payload (handle
+// or pair index) has been replaced by its index in the table of its
+// kind. Everything else is stored as is.
+
+namespace {
+
+struct ImageHeader
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t nops;
+    uint32_t nsyms;
+    uint32_t nstrs;
+    uint32_t nuvecs;
+    uint32_t nenvs;
+    uint32_t nclosures;
+    uint32_t npairs;
+    uint32_t ntabs;
+    uint32_t nprotos;
+    uint32_t nglobals;
+};
+
+const char Magic[4] = { 'C', 'S', 'I', '\0' };
+
+// Object tables of one kind: the Values in image order and the index
+// of each, by handle (or pair index). Both are dense, so a plain vector
+// does for the lookup. Objects of a frozen segment (see freeze.h), keyed
+// by FROZENBIT and their offset, go in a map instead.
+struct Table
+{
+    std::vector<Value>    objs;
+    std::vector<uint32_t> ids;  // key -> index + 1
+    std::unordered_map<uint64_t, uint32_t> frozen;
+
+    // Returns true the first time `key` is seen.
+    bool add(uint64_t key, Value v)
+    {
+        uint32_t* id;
+        if (gc_isfrozen(key)) {
+            id = &frozen[key];
+        } else {
+            if (key >= ids.size()) {
+                ids.resize(std::max<size_t>(key + 1, 2 * ids.size()));
+            }
+            id = &ids[key];
+        }
+        if (*id) {
+            return false;
+        }
+        objs.push_back(v);
+        *id = objs.size();
+        return true;
+    }
+
+    uint32_t index(uint64_t key) const
+    {
+        if (gc_isfrozen(key)) {
+            return frozen.at(key) - 1;
+        }
+        assert(key < ids.size() && ids[key]);
+        return ids[key] - 1;
+    }
+};
+
+// A pair's key in its Table: the index, or the offset of a frozen one.
+uint64_t pairkey(Value v) { return isfrozen(v) ? FROZENBIT | v.b.lo : v.b.lo; }
+
+struct Saver
+{
+    Table                 syms, strs, uvecs, envs, closures, pairs, tabs;
+    std::vector<uint32_t> protoid;    // vm index -> image index + 1
+    std::vector<uint32_t> protos;     // vm indices, in image order
+    std::vector<Value>    work;
+    std::string           out;
+    std::string           err;
+
+    void put32(uint32_t x) { out.append((const char*) &x, 4); }
+    void put64(uint64_t x) { out.append((const char*) &x, 8); }
+
+    void visit(Value v)
+    {
+        if (isdouble(v)) {
+            return;
+        }
+        bool added = false;
+        switch (totag(v)) {
+            case LV_SYM:   if (!isshort(v)) syms.add(tohandle(v), v); return;
+            case LV_STR:   if (!isshort(v)) strs.add(tohandle(v), v); return;
+            case LV_UVEC:  uvecs.add(tohandle(v), v); return;
+            case LV_UDATA: added = envs.add(tohandle(v), v); break;
+            case LV_PAIR:  added = pairs.add(pairkey(v), v); break;
+            case LV_TAB:   added = tabs.add(tohandle(v), v); break;
+            case LV_FUN:
+                if (isclosure(v) && !vm_closureproto(unsafe_toclosure(v))) {
+                    if (err.empty()) {
+                        err = "cannot save a procedure that outlived its request";
+                    }
+                    return;
+                }
+                added = isclosure(v) && closures.add(tohandle(v), v);
+                break;
+            case LV_INT: case LV_NIL: case LV_TRUE: case LV_FALSE:
+                return;
+            default:
+                if (err.empty()) {
+                    err = "cannot save " + valprint(v);
+                }
+                return;
+        }
+        if (added) {
+            work.push_back(v);
+        }
+    }
+
+    void visitproto(uint32_t index)
+    {
+        if (index < protoid.size() && protoid[index]) {
+            return;
+        }
+        if (index >= protoid.size()) {
+            protoid.resize(index + 1);
+        }
+        const Proto* p = vm_proto(index);
+        for (uint32_t child : p->protos) {
+            visitproto(child);
+        }
+        protos.push_back(index);
+        protoid[index] = protos.size();
+        visit(p->name);
+        for (Value k : p->consts) {
+            visit(k);
+        }
+        for (const CallSite& site : p->sites) {
+            visit(site.sym);
+        }
+    }
+
+    void drain()
+    {
+        while (!work.empty()) {
+            Value v = work.back();
+            work.pop_back();
+            switch (totag(v)) {
+                case LV_UDATA: {
+                    const Env* e = vm_env(v);
+                    visit(e->parent);
+                    for (uint32_t j = 0; j < e->n; ++j) {
+                        visit(e->slots[j]);
+                    }
+                    break;
+                }
+                case LV_FUN: {
+                    const Closure* cl = unsafe_toclosure(v);
+                    visitproto(cl->proto);
+                    visit(cl->env);
+                    break;
+                }
+                case LV_PAIR: {
+                    const Pair* p = unsafe_topair(v);
+                    visit(p->car);
+                    visit(p->cdr);
+                    break;
+                }
+                case LV_TAB: {
+                    std::vector<Value> entries;
+                    tab_entries(v, entries);
+                    for (Value x : entries) {
+                        visit(x);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    uint64_t word(Value v) const
+    {
+        if (isdouble(v)) {
+            return v.uval;
+        }
+        uint32_t tag = totag(v);
+        if ((tag == LV_SYM || tag == LV_STR) && isshort(v)) {
+            return v.uval;  // immediates mean the same in every process
+        }
+        switch (tag) {
+            case LV_SYM:   return mkref(tag, syms.index(tohandle(v))).uval;
+            case LV_STR:   return mkref(tag, strs.index(tohandle(v))).uval;
+            case LV_UVEC:  return mkref(tag, uvecs.index(tohandle(v))).uval;
+            case LV_UDATA: return mkref(tag, envs.index(tohandle(v))).uval;
+            case LV_PAIR:  return mkref(tag, pairs.index(pairkey(v))).uval;
+            case LV_TAB:   return mkref(tag, tabs.index(tohandle(v))).uval;
+            case LV_FUN:
+                if (isclosure(v)) {
+                    return mkref(tag, closures.index(tohandle(v))).uval;
+                }
+                return v.uval;
+            default:
+                return v.uval;
+        }
+    }
+
+    void putstrings(const Table& t)
+    {
+        for (Value v : t.objs) {
+            const String* s = (const String*) gc_deref(tohandle(v));
+            put32(s->len);
+            out.append(s->str, s->len);
+        }
+    }
+};
+
+// Bounds-checked reads over the mapped file; anything short or out of
+// range clears `ok`.
+struct Loader
+{
+    const char*        p;
+    const char*        end;
+    bool               ok = true;
+    std::vector<Value> syms, strs, uvecs, envs, closures, pairs, tabs;
+    std::vector<uint32_t> protos;  // image index -> vm index
+
+    bool need(size_t n)
+    {
+        ok = ok && (size_t) (end - p) >= n;
+        return ok;
+    }
+
+    uint32_t get32()
+    {
+        uint32_t x = 0;
+        if (need(4)) {
+            memcpy(&x, p, 4);
+            p += 4;
+        }
+        return x;
+    }
+
+    uint64_t get64()
+    {
+        uint64_t x = 0;
+        if (need(8)) {
+            memcpy(&x, p, 8);
+            p += 8;
+        }
+        return x;
+    }
+
+    static Value pick(const std::vector<Value>& t, uint64_t i, bool& ok)
+    {
+        ok = ok && i < t.size();
+        return ok ? t[i] : mknil();
+    }
+
+    Value value()
+    {
+        Value v;
+        v.uval = get64();
+        if (isdouble(v)) {
+            return v;
+        }
+        if ((totag(v) == LV_SYM || totag(v) == LV_STR) && isshort(v)) {
+            ok = ok && ((v.uval >> ShortLenShift) & 0x7u) <= ShortStrMax;
+            return v;
+        }
+        switch (totag(v)) {
+            case LV_SYM:   return pick(syms, tohandle(v), ok);
+            case LV_STR:   return pick(strs, tohandle(v), ok);
+            case LV_UVEC:  return pick(uvecs, tohandle(v), ok);
+            case LV_UDATA: return pick(envs, tohandle(v), ok);
+            case LV_PAIR:  return pick(pairs, v.b.lo, ok);
+            case LV_TAB:   return pick(tabs, tohandle(v), ok);
+            case LV_FUN:
+                if (isclosure(v)) {
+                    return pick(closures, tohandle(v), ok);
+                }
+                ok = ok && unsafe_tobuiltin(v) < nbuiltins;
+                return v;
+            case LV_INT: case LV_NIL: case LV_TRUE: case LV_FALSE:
+                return v;
+            default:
+                ok = false;
+                return mknil();
+        }
+    }
+
+    void strings(std::vector<Value>& t, uint32_t n, bool sym)
+    {
+        for (uint32_t j = 0; j < n && ok; ++j) {
+            uint32_t len = get32();
+            if (need(len)) {
+                t.push_back(sym ? mksym(p, len) : mkstr(p, len));
+                p += len;
+            }
+        }
+    }
+
+    // A count of records of at least `size` bytes each, checked against
+    // the bytes left before anything is allocated for them.
+    uint32_t count(size_t size)
+    {
+        uint32_t n = get32();
+        need(n * size);
+        return ok ? n : 0;
+    }
+
+    Value envref()
+    {
+        Value v = value();
+        ok = ok && (isnil(v) || totag(v) == LV_UDATA);
+        return v;
+    }
+
+    // The slot counts of `env` and its parents, innermost first.
+    bool frames(Value env, std::vector<uint32_t>& out) const
+    {
+        out.clear();
+        for (; !isnil(env); env = ((const Env*) gc_deref(tohandle(env)))->parent) {
+            // parent links may form a cycle
+            if (out.size() == envs.size()) {
+                return false;
+            }
+            out.push_back(((const Env*) gc_deref(tohandle(env)))->n);
+        }
+        return true;
+    }
+
+    static void visit(void* ctx, GcVisitFn fn)
+    {
+        Loader* l = (Loader*) ctx;
+        for (auto* t : { &l->syms, &l->strs, &l->uvecs, &l->envs, &l->closures, &l->pairs, &l->tabs }) {
+            for (Value v : *t) {
+                fn(v);
+            }
+        }
+    }
+};
+
+}
+
+bool image_save(const char* path, std::string& err)
+{
+    Saver s;
+    std::vector<Value> globals = vm_globalsyms();
+    for (Value sym : globals) {
+        Value v;
+        vm_getglobal(sym, v);
+        s.visit(sym);
+        s.visit(v);
+        s.drain();
+    }
+    if (!s.err.empty()) {
+        err = s.err;
+        return false;
+    }
+
+    ImageHeader h;
+    memcpy(h.magic, Magic, 4);
+    h.version   = ImageVersion;
+    h.nops      = OP_NOPS;
+    h.nsyms     = s.syms.objs.size();
+    h.nstrs     = s.strs.objs.size();
+    h.nuvecs    = s.uvecs.objs.size();
+    h.nenvs     = s.envs.objs.size();
+    h.nclosures = s.closures.objs.size();
+    h.npairs    = s.pairs.objs.size();
+    h.ntabs     = s.tabs.objs.size();
+    h.nprotos   = s.protos.size();
+    h.nglobals  = globals.size();
+    s.out.append((const char*) &h, sizeof(h));
+    s.putstrings(s.syms);
+    s.putstrings(s.strs);
+    for (Value v : s.uvecs.objs) {
+        s.out += (char) unsafe_touvec(v)->type;
+        s.put32(uvec_len(v));
+        s.out.append((const char*) uvec_u8(v), uvec_len(v) * uvec_elemsize(unsafe_touvec(v)->type));
+    }
+    for (Value v : s.envs.objs) {
+        const Env* e = vm_env(v);
+        s.put32(e->n);
+        s.put64(s.word(e->parent));
+        for (uint32_t j = 0; j < e->n; ++j) {
+            s.put64(s.word(e->slots[j]));
+        }
+    }
+    for (Value v : s.closures.objs) {
+        const Closure* cl = unsafe_toclosure(v);
+        s.put32(s.protoid[cl->proto] - 1);
+        s.put64(s.word(cl->env));
+    }
+    for (Value v : s.pairs.objs) {
+        const Pair* p = unsafe_topair(v);
+        s.put64(s.word(p->car));
+        s.put64(s.word(p->cdr));
+    }
+    for (Value v : s.tabs.objs) {
+        std::vector<Value> entries;
+        tab_entries(v, entries);
+        s.put32(entries.size() / 2);
+        for (Value x : entries) {
+            s.put64(s.word(x));
+        }
+    }
+    for (uint32_t index : s.protos) {
+        const Proto* p = vm_proto(index);
+        s.put32(p->nparams);
+        s.put32(p->rest);
+        s.put32(p->nregs);
+        s.put64(s.word(p->name));
+        s.put32(p->code.size());
+        s.out.append((const char*) p->code.data(), p->code.size() * sizeof(uint32_t));
+        s.put32(p->consts.size());
+        for (Value k : p->consts) {
+            s.put64(s.word(k));
+        }
+        s.put32(p->protos.size());
+        for (uint32_t child : p->protos) {
+            s.put32(s.protoid[child] - 1);
+        }
+        s.put32(p->sites.size());
+        for (const CallSite& site : p->sites) {
+            s.put64(s.word(site.sym));
+            s.put32(site.pc);
+        }
+    }
+    for (Value sym : globals) {
+        Value v;
+        vm_getglobal(sym, v);
+        s.put64(s.word(sym));
+        s.put64(s.word(v));
+    }
+
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    bool ok = f && fwrite(s.out.data(), 1, s.out.size(), f) == s.out.size();
+    ok = f && fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        unlink(tmp.c_str());
+        err = std::string("cannot write ") + path;
+        return false;
+    }
+    return true;
+}
+
+bool image_load(const char* path, std::string& err)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = size >= sizeof(ImageHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        err = std::string(path) + ": not an image";
+        return false;
+    }
+    ImageHeader h;
+    memcpy(&h, map, sizeof(h));
+    if (memcmp(h.magic, Magic, 4) != 0 || h.version != ImageVersion || h.nops != OP_NOPS) {
+        munmap(map, size);
+        err = std::string(path) + ": not an image for this version";
+        return false;
+    }
+
+    vm_init();
+    Loader l;
+    l.p   = (const char*) map + sizeof(h);
+    l.end = (const char*) map + size;
+    gc_addroots(Loader::visit, &l);
+
+    // first every object, with nil in every reference...
+    l.strings(l.syms, h.nsyms, true);
+    l.strings(l.strs, h.nstrs, false);
+    for (uint32_t j = 0; j < h.nuvecs && l.ok; ++j) {
+        uint8_t type = l.need(1) ? *l.p++ : 0;
+        size_t n = l.get32();
+        l.ok = l.ok && type <= UV_F64;
+        if (!l.need(n * uvec_elemsize(type))) {
+            break;
+        }
+        Value v = uvec_new((UvecType) type, n);
+        memcpy(uvec_u8(v), l.p, n * uvec_elemsize(type));
+        l.p += n * uvec_elemsize(type);
+        l.uvecs.push_back(v);
+    }
+    const char* envsat = l.p;
+    for (uint32_t j = 0; j < h.nenvs && l.ok; ++j) {
+        size_t n = l.get32();
+        if (!l.need((n + 1) * 8)) {
+            break;
+        }
+        l.p += (n + 1) * 8;
+        Env* e = (Env*) gc_alloc(GC_ENV, sizeof(Env) + sizeof(Value) * n);
+        e->n = n;
+        e->parent = mknil();
+        for (uint32_t k = 0; k < n; ++k) {
+            e->slots[k] = mknil();
+        }
+        l.envs.push_back(mkref(LV_UDATA, e->handle));
+    }
+    // closures are 12 bytes, pairs 16 and tables at least 4
+    l.need((size_t) h.nclosures * 12 + (size_t) h.npairs * 16 + (size_t) h.ntabs * 4);
+    for (uint32_t j = 0; j < h.nclosures && l.ok; ++j) {
+        Closure* cl = (Closure*) gc_alloc(GC_CLOSURE, sizeof(Closure));
+        cl->env = mknil();
+        l.closures.push_back(mkref(LV_FUN, cl->handle));
+    }
+    // before the pairs, which must not move once they are allocated
+    for (uint32_t j = 0; j < h.ntabs && l.ok; ++j) {
+        l.tabs.push_back(tab_new());
+    }
+    if (l.ok) {
+        gc_reservepairs(h.npairs);
+        for (uint32_t j = 0; j < h.npairs; ++j) {
+            l.pairs.push_back(mkref(LV_PAIR, gc_newpair(mknil(), mknil())));
+        }
+    }
+
+    // ...then the references, which no longer allocate
+    const char* closuresat = l.p;
+    l.p = envsat;
+    for (Value env : l.envs) {
+        Env* e = (Env*) gc_deref(tohandle(env));
+        l.get32();
+        e->parent = l.envref();
+        gc_barrier(e, e->parent);
+        for (uint32_t k = 0; k < e->n; ++k) {
+            e->slots[k] = l.value();
+            gc_barrier(e, e->slots[k]);
+        }
+    }
+    l.ok = l.ok && l.p == closuresat;
+    std::vector<std::pair<Closure*, uint32_t>> closureprotos;
+    for (Value v : l.closures) {
+        Closure* cl = unsafe_toclosure(v);
+        closureprotos.push_back({cl, l.get32()});
+        cl->env = l.envref();
+        gc_barrier(cl, cl->env);
+    }
+    for (Value v : l.pairs) {
+        Pair* p = unsafe_topair(v);
+        p->car = l.value();
+        gc_pairbarrier(v.b.lo, p->car);
+        p->cdr = l.value();
+        gc_pairbarrier(v.b.lo, p->cdr);
+    }
+    // tab_set keeps its slots off the heap, so this does not allocate
+    for (Value tab : l.tabs) {
+        uint32_t n = l.count(16);
+        for (uint32_t j = 0; j < n; ++j) {
+            Value key = l.value();
+            Value v   = l.value();
+            if (l.ok) {
+                tab_set(tab, key, v);
+            }
+        }
+    }
+    std::vector<Proto*> protos;
+    for (uint32_t j = 0; j < h.nprotos && l.ok; ++j) {
+        Proto* p = new Proto;
+        protos.push_back(p);
+        p->nparams = l.get32();
+        uint32_t rest = l.get32();
+        l.ok = l.ok && rest <= 1;
+        p->rest    = rest;
+        p->nregs   = l.get32();
+        p->name    = l.value();
+        p->code.resize(l.count(sizeof(uint32_t)));
+        if (!p->code.empty()) {
+            memcpy(p->code.data(), l.p, p->code.size() * sizeof(uint32_t));
+            l.p += p->code.size() * sizeof(uint32_t);
+        }
+        p->consts.resize(l.count(8));
+        for (Value& k : p->consts) {
+            k = l.value();
+        }
+        p->protos.resize(l.count(4));
+        for (uint32_t& child : p->protos) {
+            child = l.get32();
+            l.ok = l.ok && child < j;
+        }
+        p->sites.resize(l.count(12));
+        for (CallSite& site : p->sites) {
+            site.sym = l.value();
+            site.pc  = l.get32();
+        }
+    }
+    // The frames each prototype runs in: those of its closures, or of
+    // its parent's body. Every prototype in an image belongs to a
+    // closure or to the parent of one, and parents come after children.
+    std::vector<std::vector<uint32_t>> frames(protos.size());
+    std::vector<bool> known(protos.size());
+    auto runsin = [&](uint32_t j, const std::vector<uint32_t>& f) {
+        l.ok = l.ok && (!known[j] || frames[j] == f);
+        frames[j] = f;
+        known[j] = true;
+    };
+    std::vector<uint32_t> f;
+    for (auto& cp : closureprotos) {
+        l.ok = l.ok && cp.second < protos.size() && l.frames(cp.first->env, f);
+        if (l.ok) {
+            runsin(cp.second, f);
+        }
+    }
+    for (size_t j = protos.size(); j-- > 0 && l.ok;) {
+        l.ok = known[j] && vm_verify(protos[j], frames[j], f);
+        for (uint32_t child : protos[j]->protos) {
+            runsin(child, f);
+        }
+    }
+    std::vector<std::pair<Value, Value>> globals;
+    for (uint32_t j = 0; j < h.nglobals && l.ok; ++j) {
+        Value sym = l.value();
+        Value v   = l.value();
+        l.ok = l.ok && issym(sym);
+        globals.push_back({sym, v});
+    }
+
+    bool ok = l.ok && l.p == l.end;
+    if (ok) {
+        for (size_t j = 0; j < protos.size(); ++j) {
+            for (uint32_t& child : protos[j]->protos) {
+                child = l.protos[child];
+            }
+            l.protos.push_back(vm_addproto(protos[j]));
+        }
+        for (auto& cp : closureprotos) {
+            cp.first->proto = l.protos[cp.second];
+            cp.first->epoch = vm_proto(cp.first->proto)->epoch;
+        }
+        for (auto& g : globals) {
+            vm_setglobal(g.first, g.second);
+        }
+    } else {
+        for (Proto* p : protos) {
+            delete p;
+        }
+        err = std::string(path) + ": corrupt image";
+    }
+    gc_removeroots(Loader::visit, &l);
+    munmap(map, size);
+    return ok;
+}
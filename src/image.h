@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//----------------------------------------------------------
+// Heap images. An image holds an interpreter's global
+// environment and everything reachable from it: data, hash
+// tables, numeric vectors, closures with their environments
+// and prototypes, and the symbols they use, with sharing and
+// cycles preserved. Ports cannot be saved. The running
+// program's stack is not part of it.
+//
+// References inside an image are indices into its own
+// object tables instead of handles, so loading is a single
+// pass over the mapped file: allocate every object, then
+// patch the references through the tables. Nothing is
+// parsed and no Scheme code runs.
+//----------------------------------------------------------
+
+// Bump whenever the layout, the instruction set or the order of the
+// builtin table changes.
+constexpr uint32_t ImageVersion = 6;
+
+bool image_save(const char* path, std::string& err);
+// Defines the image's globals in the calling thread's interpreter,
+// replacing existing bindings of the same names.
+bool image_load(const char* path, std::string& err);
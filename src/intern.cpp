@@ -0,0 +1,184 @@
+#include "intern.h"
+#include "arena.h"
+#include "value.h"
+#include "stats.h"
+#include <vector>
+
+namespace {
+
+//----------------------------------------------------------
+// Open addressing with linear probing. A slot is 8 bytes
+// (hash + handle) so a probe sequence stays within a cache
+// line or two, and the stored hash rejects almost every
+// mismatch without touching the string itself.
+//----------------------------------------------------------
+
+constexpr uint32_t EMPTY     = UINT32_MAX;
+constexpr uint32_t TOMBSTONE = UINT32_MAX - 1;
+constexpr size_t   MinCapacity = 1024;
+
+struct Slot
+{
+    uint32_t hash;
+    uint32_t handle;
+};
+
+struct InternTable
+{
+    std::vector<Slot>     slots;
+    size_t                count = 0; // live entries
+    size_t                used  = 0; // live entries + tombstones
+    std::vector<uint32_t> young;     // entries added since the last collection
+    InternStats           stats = {};
+};
+
+thread_local InternTable tab;
+__thread const FrozenStrings* frozen;
+
+bool matches(const Slot& s, uint32_t hash, const char* str, size_t len)
+{
+    if (s.hash != hash || s.handle >= TOMBSTONE) {
+        return false;
+    }
+    const String* o = (const String*) gc_deref(s.handle);
+    return o->len == len && memcmp(o->str, str, len) == 0;
+}
+
+size_t freeslot(uint32_t hash)
+{
+    size_t mask = tab.slots.size() - 1;
+    size_t i = hash & mask;
+    while (tab.slots[i].handle < TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+void rehash(size_t cap)
+{
+    std::vector<Slot> old(cap, Slot{0, EMPTY});
+    tab.slots.swap(old);
+    for (const Slot& s : old) {
+        if (s.handle < TOMBSTONE) {
+            tab.slots[freeslot(s.hash)] = s;
+        }
+    }
+    tab.used = tab.count;
+}
+
+void remove(uint32_t handle)
+{
+    uint32_t hash = ((const String*) gc_deref(handle))->hash;
+    size_t mask = tab.slots.size() - 1;
+    for (size_t i = hash & mask; tab.slots[i].handle != EMPTY; i = (i + 1) & mask) {
+        if (tab.slots[i].handle == handle) {
+            tab.slots[i].handle = TOMBSTONE;
+            --tab.count;
+            return;
+        }
+    }
+}
+
+// Minor collections only look at the entries created since the last
+// collection, so their cost does not grow with the size of the table.
+void sweep(void*, bool major)
+{
+    if (major) {
+        for (Slot& s : tab.slots) {
+            if (s.handle < TOMBSTONE && !gc_isalive(s.handle)) {
+                s.handle = TOMBSTONE;
+                --tab.count;
+            }
+        }
+    } else {
+        for (uint32_t h : tab.young) {
+            if (!gc_isalive(h)) {
+                remove(h);
+            }
+        }
+    }
+    tab.young.clear();
+}
+
+// Returns 0 if the segment has no such string.
+uint64_t findfrozen(uint32_t hash, const char* str, size_t len)
+{
+    size_t mask = frozen->slots.size() - 1;
+    for (size_t i = hash & mask; frozen->slots[i].offset != FrozenStrings::Empty; i = (i + 1) & mask) {
+        const FrozenStrings::Slot& s = frozen->slots[i];
+        const String* o = (const String*) (gc_frozen + s.offset);
+        if (s.hash == hash && o->len == len && memcmp(o->str, str, len) == 0) {
+            return FROZENBIT | s.offset;
+        }
+    }
+    return 0;
+}
+
+void recordprobe(uint64_t probes)
+{
+    tab.stats.probes += probes;
+    if (probes > tab.stats.max_probe) {
+        tab.stats.max_probe = probes;
+    }
+}
+
+} // namespace
+
+uint64_t strintern(const char* str, size_t len)
+{
+    if (tab.slots.empty()) {
+        tab.slots.assign(MinCapacity, Slot{0, EMPTY});
+        gc_addweak(sweep, nullptr);
+    }
+
+    uint32_t hash = strhash(str, len);
+    size_t   mask = tab.slots.size() - 1;
+    uint64_t probes = 1;
+    ++tab.stats.lookups;
+    for (size_t i = hash & mask; tab.slots[i].handle != EMPTY; i = (i + 1) & mask, ++probes) {
+        if (matches(tab.slots[i], hash, str, len)) {
+            ++tab.stats.hits;
+            stat_add(stats->intern_hits);
+            tab.stats.bytes_saved += sizeclass(sizeof(String) + len + 1);
+            recordprobe(probes);
+            return tab.slots[i].handle;
+        }
+    }
+    recordprobe(probes);
+    if (frozen) {
+        if (uint64_t handle = findfrozen(hash, str, len)) {
+            ++tab.stats.hits;
+            stat_add(stats->intern_hits);
+            tab.stats.bytes_saved += sizeclass(sizeof(String) + len + 1);
+            return handle;
+        }
+    }
+    ++tab.stats.misses;
+    stat_add(stats->intern_misses);
+
+    // may collect, which can turn slots into tombstones
+    uint32_t handle = tohandle(mkstr(str, len));
+
+    if ((tab.used + 1) * 2 > tab.slots.size()) {
+        // only grow if live entries (not tombstones) fill the table
+        rehash((tab.count + 1) * 4 > tab.slots.size() ? 2 * tab.slots.size() : tab.slots.size());
+    }
+    size_t i = freeslot(hash);
+    if (tab.slots[i].handle == EMPTY) {
+        ++tab.used;
+    }
+    tab.slots[i] = Slot{hash, handle};
+    ++tab.count;
+    tab.young.push_back(handle);
+    return handle;
+}
+
+InternStats intern_stats()
+{
+    InternStats s = tab.stats;
+    s.entries  = tab.count;
+    s.capacity = tab.slots.size();
+    return s;
+}
+
+void intern_attach(const FrozenStrings* table) { frozen = table; }
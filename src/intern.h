@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+inline uint32_t strhash(const char* str, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    for (; len >= 8; str += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, str, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    if (len > 0) {
+        uint64_t w = 0;
+        memcpy(&w, str, len);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 32;
+    return (uint32_t) h;
+}
+
+struct InternStats
+{
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t probes;      // slots inspected over all lookups
+    uint64_t max_probe;
+    uint64_t entries;
+    uint64_t capacity;
+    uint64_t bytes_saved; // heap bytes not allocated thanks to hits
+};
+
+// The strings of a frozen segment (see freeze.h), in the same open
+// addressing layout as a thread's own table. It is built once and then
+// only read, so the threads attached to the segment share it without
+// locking.
+struct FrozenStrings
+{
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t offset;  // of the String in the segment; Empty if unused
+    };
+    static constexpr uint32_t Empty = UINT32_MAX;
+
+    std::vector<Slot> slots;  // a power of two, at most half full
+};
+
+// Returns the handle of the unique String with these contents. Entries
+// are weak: a string that is only referenced by the table is dropped at
+// the next collection. In a thread attached to a frozen segment a string
+// the thread has not interned itself is looked up in the segment's
+// table, so that symbols read by the thread are the segment's.
+uint64_t strintern(const char* str, size_t len);
+InternStats intern_stats();
+// Makes strintern fall back on `frozen` in the calling thread.
+void intern_attach(const FrozenStrings* frozen);
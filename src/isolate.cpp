@@ -0,0 +1,123 @@
+#include "isolate.h"
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+#include <cerrno>
+#include <unistd.h>
+
+// Compiles and runs one form; the form's atoms may be dropped afterwards.
+static EvalResult evalform(const Node& form)
+{
+    uint32_t proto;
+    std::string err;
+    if (compile(form, proto, err) != OK) {
+        return {ERROR, err};
+    }
+    Value v;
+    if (vm_run(proto, v) != OK) {
+        return {ERROR, valprint(v, false)};
+    }
+    return {OK, valprint(v)};
+}
+
+EvalResult eval(const char* src, size_t len)
+{
+    vm_init();
+    Input in(src, len);
+    Reader r(in);
+    EvalResult result;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            return result;
+        } else if (status == ERROR) {
+            return {ERROR, r.err};
+        }
+        result = evalform(form);
+        r.clear();
+        if (result.status != OK) {
+            return result;
+        }
+    }
+}
+
+int eval_stream(int fd, FILE* out)
+{
+    vm_init();
+    FeedReader r;
+    char buf[4096];
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n > 0) {
+            reader_feed(r, buf, n);
+        } else {
+            reader_close(r);
+        }
+        Node form;
+        int status;
+        while ((status = reader_next(r, form)) != DONE) {
+            EvalResult result = status == OK ? evalform(form) : EvalResult{ERROR, r.err};
+            r.clear();
+            if (result.status == OK) {
+                fprintf(out, "%s\n", result.value.c_str());
+            } else {
+                fprintf(out, "error: %s\n", result.value.c_str());
+            }
+        }
+        fflush(out);
+        if (n <= 0) {
+            return n < 0 ? ERROR : OK;
+        }
+    }
+}
+
+Isolate::Isolate()
+    : thread_(&Isolate::loop, this)
+{
+}
+
+Isolate::~Isolate()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
+}
+
+std::future<EvalResult> Isolate::submit(std::string src)
+{
+    std::packaged_task<EvalResult()> job([src = std::move(src)] {
+        return ::eval(src.data(), src.size());
+    });
+    std::future<EvalResult> done = job.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+    }
+    ready_.notify_one();
+    return done;
+}
+
+void Isolate::loop()
+{
+    vm_init();
+    for (;;) {
+        std::packaged_task<EvalResult()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        job();
+    }
+}
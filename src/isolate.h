@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "value.h"
+
+//----------------------------------------------------------
+// Isolates. All interpreter state (heap, symbol table,
+// globals, prototypes, value stack) is per thread, so every
+// thread that evaluates code has an interpreter of its own
+// and nothing is shared or locked on the hot paths. Values
+// must never cross threads: they are handles into the heap
+// of the thread that made them, so results come back as
+// printed strings.
+//
+// An Isolate is a thread owning such an interpreter. It can
+// be driven from any number of threads; its jobs run one at
+// a time, in submission order.
+//----------------------------------------------------------
+
+struct EvalResult
+{
+    int         status = 0;  // OK or ERROR
+    std::string value;       // printed value of the last form, or the error
+};
+
+// Evaluates every form of `src` with the calling thread's interpreter.
+EvalResult eval(const char* src, size_t len);
+
+// Evaluates the forms read from `fd` with the calling thread's
+// interpreter, each as soon as it has arrived (see FeedReader), and
+// writes one line per form to `out`: the printed value, or "error: " and
+// the message. An error does not end the stream. Returns at end of
+// input, ERROR if reading `fd` failed.
+int eval_stream(int fd, FILE* out);
+
+class Isolate
+{
+public:
+    Isolate();
+    // Finishes the queued jobs, then joins the thread.
+    ~Isolate();
+    Isolate(const Isolate&) = delete;
+    Isolate& operator=(const Isolate&) = delete;
+
+    std::future<EvalResult> submit(std::string src);
+    EvalResult eval(std::string src) { return submit(std::move(src)).get(); }
+
+private:
+    void loop();
+
+    std::mutex                                     mutex_;
+    std::condition_variable                        ready_;
+    std::deque<std::packaged_task<EvalResult()>>   jobs_;
+    bool                                           stopping_ = false;
+    std::thread                                    thread_;
+};
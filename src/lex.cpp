@@ -0,0 +1,333 @@
+#include "lex.h"
+#include "stats.h"
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* TokenStrings[] = {
+    "lparen",
+    "rparen",
+    "quote",
+    "dot",
+    "integer",
+    "double",
+    "string",
+    "symbol",
+    "true",
+    "false",
+
+    "eof",
+    "error",
+};
+
+const char* toktostr(Token t)
+{
+    if (t > T_ERROR) {
+        assert(0);
+        return "INVALID TOKEN";
+    }
+    return TokenStrings[t];
+}
+
+Input::Input(FILE* f, bool map) noexcept
+    : lim(buf)
+    , cur(buf)
+    , tok(buf)
+    , eof(false)
+    , file(f)
+{
+    stats_attach();
+    struct stat st;
+    if (!map || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return;
+    }
+    // nothing may have been buffered by stdio yet for the offset to be exact
+    long offset = ftell(f);
+    if (offset < 0 || offset > st.st_size) {
+        return;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    this->map = p;
+    maplen = st.st_size;
+    tok = cur = (const unsigned char*) p + offset;
+    lim = (const unsigned char*) p + st.st_size;
+    eof = true;
+    stat_add(stats->lex_bytes, lim - cur);
+}
+
+Input::Input(const char* str, size_t len) noexcept
+    : lim((const unsigned char*) str + len)
+    , cur((const unsigned char*) str)
+    , tok((const unsigned char*) str)
+    , eof(true)
+    , file(nullptr)
+{
+    stats_attach();
+    stat_add(stats->lex_bytes, len);
+}
+
+Input::~Input()
+{
+    if (map) {
+        munmap(map, maplen);
+    }
+}
+
+bool Input::fill() noexcept
+{
+    if (eof) {
+        return false;
+    }
+    size_t keep = lim - tok;
+    if (keep == SIZE) {
+        // token does not fit in the buffer
+        return false;
+    }
+    memmove(buf, tok, keep);
+    scan.base = nullptr;
+    cur = buf + (cur - tok);
+    tok = buf;
+    size_t n = fread(buf + keep, 1, SIZE - keep, file);
+    lim = buf + keep + n;
+    stat_add(stats->lex_bytes, n);
+    if (n == 0) {
+        eof = true;
+        return false;
+    }
+    return true;
+}
+
+static int peekc(Input& in)
+{
+    if (in.cur == in.lim && !in.fill()) {
+        return -1;
+    }
+    return *in.cur;
+}
+
+static Token error(Value& v, const char* msg)
+{
+    v = mkstr(msg);
+    return T_ERROR;
+}
+
+// `lim` bounds the readable input after the atom.
+static bool lex_int(const char* s, const char* e, const char* lim, Value& v)
+{
+    bool neg = false;
+    if (*s == '-' || *s == '+') {
+        neg = *s == '-';
+        ++s;
+    }
+    if (s == e) {
+        return false;
+    }
+    size_t len = e - s;
+    uint64_t hi, lo;
+    if (len <= 8 && swar_digits(s, len, lim, lo)) {
+        v = mkint(neg ? -(int) lo : (int) lo);
+        return true;
+    }
+    if (len > 8 && len <= 10 && swar_digits(s, len - 8, lim, hi) && swar_digits(e - 8, 8, lim, lo)) {
+        int64_t u = hi * 100000000 + lo;
+        if (neg) {
+            u = -u;
+        }
+        if (u < INT_MIN || u > INT_MAX) {
+            // too big for a fixnum, read it as a double instead
+            return false;
+        }
+        v = mkint((int) u);
+        return true;
+    }
+    int64_t u = 0;
+    for (; s < e; ++s) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        u = u * 10 + (*s - '0');
+        if (u > (int64_t) INT_MAX + 1) {
+            // too big for a fixnum, read it as a double instead
+            return false;
+        }
+    }
+    if (neg) {
+        u = -u;
+    }
+    if (u > INT_MAX) {
+        return false;
+    }
+    v = mkint((int) u);
+    return true;
+}
+
+static bool lex_double(const char* s, const char* e, Value& v)
+{
+    char tmp[64];
+    size_t len = e - s;
+    if (len >= sizeof(tmp)) {
+        return false;
+    }
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    char* end;
+    double d = strtod(tmp, &end);
+    if (end != tmp + len || d != d) {
+        return false;
+    }
+    v = mkdouble(d);
+    return true;
+}
+
+static Token lex_atom(Input& in, Value& v)
+{
+    for (;;) {
+        in.cur = scan_delim(in.scan, in.cur, in.lim);
+        if (in.cur < in.lim || !in.fill()) {
+            break;
+        }
+    }
+    if (in.cur == in.lim && !in.eof) {
+        return error(v, "atom too long");
+    }
+    const char* s = (const char*) in.tok;
+    const char* e = (const char*) in.cur;
+    size_t len = e - s;
+
+    if (len == 1 && *s == '.') {
+        return T_DOT;
+    }
+    if (*s == '#') {
+        if ((len == 2 && s[1] == 't') || (len == 5 && memcmp(s, "#true", 5) == 0)) {
+            return T_TRUE;
+        }
+        if ((len == 2 && s[1] == 'f') || (len == 6 && memcmp(s, "#false", 6) == 0)) {
+            return T_FALSE;
+        }
+        return error(v, "invalid # syntax");
+    }
+    bool numeric = (*s >= '0' && *s <= '9') || *s == '.' ||
+        ((*s == '-' || *s == '+') && len > 1 && ((s[1] >= '0' && s[1] <= '9') || s[1] == '.'));
+    if (numeric) {
+        if (lex_int(s, e, (const char*) in.lim, v)) {
+            return T_INT;
+        }
+        if (lex_double(s, e, v)) {
+            return T_DOUBLE;
+        }
+        return error(v, "invalid number");
+    }
+    v = mksym(s, len);
+    return T_SYM;
+}
+
+static Token lex_escaped(Input& in, Value& v, std::string& result)
+{
+    for (;;) {
+        int c = peekc(in);
+        if (c == -1) {
+            return error(v, "unterminated string literal");
+        }
+        ++in.cur;
+        in.tok = in.cur;
+        if (c == '"') {
+            break;
+        }
+        if (c == '\\') {
+            c = peekc(in);
+            if (c == -1) {
+                return error(v, "unterminated string literal");
+            }
+            ++in.cur;
+            in.tok = in.cur;
+            switch (c) {
+                case 'a':  c = '\a'; break;
+                case 'b':  c = '\b'; break;
+                case 'n':  c = '\n'; break;
+                case 'r':  c = '\r'; break;
+                case 't':  c = '\t'; break;
+                case '\\': c = '\\'; break;
+                case '"':  c = '"';  break;
+                default:
+                    return error(v, "invalid escape sequence");
+            }
+        }
+        result += (char) c;
+    }
+    v = mkistr(result.data(), result.size());
+    return T_STR;
+}
+
+// `in.tok` is just past the opening quote. A literal without escapes is
+// interned straight from the input; only escapes, or a literal that
+// outgrows the streaming buffer, go through a copy.
+static Token lex_str(Input& in, Value& v)
+{
+    for (;;) {
+        in.cur = scan_string(in.scan, in.cur, in.lim);
+        if (in.cur < in.lim || !in.fill()) {
+            break;
+        }
+    }
+    if (in.cur < in.lim && *in.cur == '"') {
+        v = mkistr((const char*) in.tok, in.cur - in.tok);
+        ++in.cur;
+        return T_STR;
+    }
+    std::string result((const char*) in.tok, in.cur - in.tok);
+    in.tok = in.cur;
+    return lex_escaped(in, v, result);
+}
+
+static Token next(Input& in, Value& v)
+{
+    for (;;) {
+        in.tok = in.cur;
+        int c = peekc(in);
+        switch (c) {
+            case -1:
+                return T_EOF;
+            case ' ': case '\t': case '\n': case '\r': case '\v': case '\f':
+                in.cur = scan_space(in.scan, in.cur + 1, in.lim);
+                continue;
+            case ';':
+                while ((c = peekc(in)) != -1 && c != '\n') {
+                    const void* nl = memchr(in.cur, '\n', in.lim - in.cur);
+                    in.cur = nl ? (const unsigned char*) nl : in.lim;
+                    in.tok = in.cur;
+                }
+                continue;
+            case '(':
+                ++in.cur;
+                return T_LPAREN;
+            case ')':
+                ++in.cur;
+                return T_RPAREN;
+            case '\'':
+                ++in.cur;
+                return T_QUOTE;
+            case '"':
+                ++in.cur;
+                in.tok = in.cur;
+                return lex_str(in, v);
+            default:
+                return lex_atom(in, v);
+        }
+    }
+}
+
+Token lex(Input& in, Value& v) noexcept
+{
+    Token t = next(in, v);
+    if (t < T_EOF) {
+        stat_add(stats->lex_tokens);
+    }
+    return t;
+}
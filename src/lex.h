@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdio>
+#include <cstddef>
+#include "value.h"
+#include "scan.h"
+
+enum Token
+{
+    T_LPAREN, T_RPAREN, T_QUOTE, T_DOT,
+    T_INT, T_DOUBLE, T_STR, T_SYM, T_TRUE, T_FALSE,
+
+    // finish markers
+    T_EOF, T_ERROR,
+};
+
+const char* toktostr(Token t);
+
+static constexpr size_t SIZE = 8 * 1024;
+
+// Lexer input. Regular files are mapped whole and lexed in place, so a
+// token is a view into the file; anything else (pipes, ttys, or
+// `map = false`) is streamed through `buf`. When streaming, the bytes of
+// the current token, [tok, cur), stay valid across fill(), so an atom may
+// not be longer than SIZE.
+struct Input
+{
+    unsigned char        buf[SIZE];
+    const unsigned char* lim;
+    const unsigned char* cur;
+    const unsigned char* tok;
+    bool                 eof;
+    FILE* const          file;
+    void*                map    = nullptr;
+    size_t               maplen = 0;
+    ScanBlock            scan;    // pre-scan masks of the bytes around cur
+
+    explicit Input(FILE* f, bool map = true) noexcept;
+    // Lexes an in-memory buffer which must outlive the Input.
+    Input(const char* str, size_t len) noexcept;
+    ~Input();
+    Input(const Input&) = delete;
+    Input& operator=(const Input&) = delete;
+
+    bool mapped() const { return map != nullptr; }
+    bool fill() noexcept;
+};
+
+// On T_ERROR `v` holds the error message.
+Token lex(Input& in, Value& v) noexcept;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "value.h"
+
+//----------------------------------------------------------
+// Numeric fast paths shared by the builtins and the VM's
+// two-operand opcodes. Fixnums are checked for overflow and
+// promote to flonums; mixed operands are compared and
+// combined as doubles. Each returns false, leaving `out`
+// untouched, when an operand is not a number.
+//----------------------------------------------------------
+
+inline double num_todouble(Value v) { return isint(v) ? unsafe_toint(v) : unsafe_todouble(v); }
+
+inline bool num_add(Value a, Value b, Value& out)
+{
+    int r;
+    if (isint(a) && isint(b)) {
+        if (__builtin_add_overflow(unsafe_toint(a), unsafe_toint(b), &r)) {
+            out = mkdouble((double) unsafe_toint(a) + unsafe_toint(b));
+        } else {
+            out = mkint(r);
+        }
+        return true;
+    }
+    if (!isnum(a) || !isnum(b)) {
+        return false;
+    }
+    out = mkdouble(num_todouble(a) + num_todouble(b));
+    return true;
+}
+
+inline bool num_sub(Value a, Value b, Value& out)
+{
+    int r;
+    if (isint(a) && isint(b)) {
+        if (__builtin_sub_overflow(unsafe_toint(a), unsafe_toint(b), &r)) {
+            out = mkdouble((double) unsafe_toint(a) - unsafe_toint(b));
+        } else {
+            out = mkint(r);
+        }
+        return true;
+    }
+    if (!isnum(a) || !isnum(b)) {
+        return false;
+    }
+    out = mkdouble(num_todouble(a) - num_todouble(b));
+    return true;
+}
+
+inline bool num_mul(Value a, Value b, Value& out)
+{
+    int r;
+    if (isint(a) && isint(b)) {
+        if (__builtin_mul_overflow(unsafe_toint(a), unsafe_toint(b), &r)) {
+            out = mkdouble((double) unsafe_toint(a) * unsafe_toint(b));
+        } else {
+            out = mkint(r);
+        }
+        return true;
+    }
+    if (!isnum(a) || !isnum(b)) {
+        return false;
+    }
+    out = mkdouble(num_todouble(a) * num_todouble(b));
+    return true;
+}
+
+// Three-way comparison: -1, 0 or 1 in `cmp`. NaN compares unequal to
+// everything, reported as 2.
+inline bool num_cmp(Value a, Value b, int& cmp)
+{
+    if (isint(a) && isint(b)) {
+        int x = unsafe_toint(a), y = unsafe_toint(b);
+        cmp = (x > y) - (x < y);
+        return true;
+    }
+    if (!isnum(a) || !isnum(b)) {
+        return false;
+    }
+    double x = num_todouble(a), y = num_todouble(b);
+    cmp = x < y ? -1 : x > y ? 1 : x == y ? 0 : 2;
+    return true;
+}
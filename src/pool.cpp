@@ -0,0 +1,127 @@
+#include "pool.h"
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+thread_local bool isworker = false;
+
+std::mutex            sharedlock;
+std::unique_ptr<Pool> sharedpool;
+
+}
+
+Pool::Pool(unsigned nthreads)
+{
+    assert(nthreads > 0);
+    for (unsigned j = 0; j < nthreads; ++j) {
+        workers_.emplace_back(new Worker);
+    }
+    for (unsigned j = 0; j < nthreads; ++j) {
+        workers_[j]->thread = std::thread(&Pool::loop, this, j);
+    }
+}
+
+Pool::~Pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_) {
+        w->thread.join();
+    }
+}
+
+Pool& Pool::shared()
+{
+    std::lock_guard<std::mutex> lock(sharedlock);
+    if (!sharedpool) {
+        sharedpool.reset(new Pool(std::max(1u, std::thread::hardware_concurrency())));
+    }
+    return *sharedpool;
+}
+
+void Pool::resize(unsigned nthreads)
+{
+    std::lock_guard<std::mutex> lock(sharedlock);
+    sharedpool.reset(new Pool(nthreads));
+}
+
+bool Pool::onworker() { return isworker; }
+
+void Pool::run(std::vector<std::function<void()>>& tasks)
+{
+    assert(!onworker());
+    std::mutex              mutex;
+    std::condition_variable finished;
+    size_t                  left = tasks.size();
+    std::vector<std::function<void()>> wrapped;
+    wrapped.reserve(tasks.size());
+    for (auto& task : tasks) {
+        wrapped.push_back([&] {
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--left == 0) {
+                finished.notify_one();
+            }
+        });
+    }
+    // counted first so take() never sees more tasks than queued_
+    queued_ += wrapped.size();
+    // deal them out round robin; stealing evens out the rest
+    for (size_t j = 0; j < wrapped.size(); ++j) {
+        Worker& w = *workers_[j % workers_.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(&wrapped[j]);
+    }
+    {
+        // a worker between its check of queued_ and its wait must not
+        // miss the wakeup
+        std::lock_guard<std::mutex> lock(idle_);
+    }
+    wake_.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return left == 0; });
+}
+
+std::function<void()>* Pool::take(unsigned self)
+{
+    unsigned n = workers_.size();
+    for (unsigned k = 0; k < n; ++k) {
+        Worker& w = *workers_[(self + k) % n];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.tasks.empty()) {
+            continue;
+        }
+        std::function<void()>* task;
+        if (k == 0) {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+        } else {
+            task = w.tasks.front();
+            w.tasks.pop_front();
+        }
+        --queued_;
+        return task;
+    }
+    return nullptr;
+}
+
+void Pool::loop(unsigned self)
+{
+    isworker = true;
+    for (;;) {
+        if (std::function<void()>* task = take(self)) {
+            (*task)();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------
+// Work-stealing thread pool. Every worker has a deque of its
+// own: it takes work from the back of it and, when that runs
+// dry, steals from the front of the others', so a batch
+// whose tasks vary in cost still keeps every worker busy.
+//
+// Workers are threads like any other, so each has its own
+// interpreter (see isolate.h); tasks hand values over with
+// transfer.h.
+//----------------------------------------------------------
+
+class Pool
+{
+public:
+    explicit Pool(unsigned nthreads);
+    ~Pool();
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // One worker per hardware thread unless resized, started on first use.
+    static Pool& shared();
+    // Replaces the shared pool with one of `nthreads` workers. Not safe
+    // while the shared pool is running a batch.
+    static void resize(unsigned nthreads);
+    // True on the threads of any pool.
+    static bool onworker();
+
+    // Runs every task and returns once they have all finished. Must not
+    // be called from a worker, which would wait on itself.
+    void run(std::vector<std::function<void()>>& tasks);
+
+    unsigned size() const { return workers_.size(); }
+
+private:
+    struct Worker
+    {
+        std::mutex                          mutex;
+        std::deque<std::function<void()>*>  tasks;
+        std::thread                         thread;
+    };
+
+    void loop(unsigned self);
+    std::function<void()>* take(unsigned self);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex                           idle_;
+    std::condition_variable              wake_;
+    std::atomic<size_t>                  queued_{0};
+    bool                                 stopping_ = false;
+};
@@ -0,0 +1,67 @@
+#include "port.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Buffer
+{
+    uint32_t     handle;
+    std::string* buf;
+};
+
+// Per thread, like the heap the ports live in. The buffers are kept
+// here too so they can be freed at thread exit without the heap.
+struct Ports
+{
+    std::vector<Buffer> live;
+    bool                registered = false;
+
+    ~Ports()
+    {
+        for (const Buffer& b : live) {
+            delete b.buf;
+        }
+    }
+};
+
+thread_local Ports ports;
+
+void sweep(void*, bool)
+{
+    auto dead = [](const Buffer& b) {
+        if (gc_isalive(b.handle)) {
+            return false;
+        }
+        delete b.buf;
+        return true;
+    };
+    ports.live.erase(std::remove_if(ports.live.begin(), ports.live.end(), dead), ports.live.end());
+}
+
+} // namespace
+
+Value port_open()
+{
+    if (!ports.registered) {
+        gc_addweak(sweep, nullptr);
+        ports.registered = true;
+    }
+    Port* p = (Port*) gc_alloc(GC_PORT, sizeof(Port));
+    p->buf = new std::string;
+    ports.live.push_back(Buffer{p->handle, p->buf});
+    return mkref(LV_PORT, p->handle);
+}
+
+void port_write(Value port, std::string_view s)
+{
+    unsafe_toport(port)->buf->append(s);
+}
+
+Value port_string(Value port)
+{
+    // the buffer is not in the heap, so it stays put if mkstr collects
+    const std::string* buf = unsafe_toport(port)->buf;
+    return mkstr(buf->data(), buf->size());
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string_view>
+#include "value.h"
+
+//----------------------------------------------------------
+// String output ports: a string builder. Writes append to a
+// buffer outside the collected heap, which grows
+// geometrically, so building a string out of n fragments
+// costs O(total length) instead of the O(n * length) of
+// repeated string-append. The text is copied into a String
+// only by port_string. A port's buffer is released by a weak
+// callback once the port itself is collected.
+//----------------------------------------------------------
+
+// May run a collection.
+Value port_open();
+void port_write(Value port, std::string_view s);
+// The text written so far, as a fresh string. May run a collection.
+Value port_string(Value port);
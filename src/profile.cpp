@@ -0,0 +1,197 @@
+#include "profile.h"
+#include "vm.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// The sample log: per sample, a header word (frame count, and whether
+// the stack was cut at ProfileDepth) and then the frames' prototypes,
+// innermost first. It is allocated once and only the signal handler
+// appends, so a reader only needs to snapshot `logused`. Each outermost
+// profile_start empties it, so a full log only drops the samples of
+// the session that filled it.
+constexpr uint32_t Truncated = 1u << 31;
+constexpr size_t   LogWords  = 1u << 22;
+
+std::mutex            lock;           // start/stop from any thread
+uint32_t*             samplelog = nullptr;
+volatile size_t       logused = 0;
+volatile size_t       dropped = 0;
+int                   nesting = 0;
+pid_t                 owner = 0;
+timer_t               timer;
+struct sigaction      previous;
+
+void onsample(int)
+{
+    int saved = errno;
+    size_t at = logused;
+    if (at + 1 + ProfileDepth > LogWords) {
+        dropped = dropped + 1;
+    } else {
+        size_t depth;
+        size_t n = vm_backtrace(samplelog + at + 1, ProfileDepth, depth);
+        samplelog[at] = n | (depth > n ? Truncated : 0);
+        logused = at + 1 + n;
+    }
+    errno = saved;
+}
+
+std::string protoname(uint32_t index, bool outermost)
+{
+    const Proto* p = vm_proto(index);
+    std::string name;
+    if (!isnil(p->name)) {
+        name = valprint(p->name, false);
+    } else if (outermost) {
+        name = "<toplevel>";
+    } else {
+        name = "<lambda:" + std::to_string(index) + ">";
+    }
+    // the folded format splits on ';' and on the last space
+    std::replace(name.begin(), name.end(), ';', '_');
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return name;
+}
+
+// Calls fn(frames, n, truncated) for every sample since `from`.
+template <typename Fn>
+void eachsample(size_t from, Fn fn)
+{
+    size_t end = logused;
+    for (size_t at = from; at < end; ) {
+        uint32_t head = samplelog[at];
+        uint32_t n = head & ~Truncated;
+        fn(samplelog + at + 1, n, (head & Truncated) != 0);
+        at += 1 + n;
+    }
+}
+
+}
+
+bool profile_start(unsigned hz, std::string& err)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    pid_t self = syscall(SYS_gettid);
+    if (nesting > 0) {
+        if (owner != self) {
+            err = "the profiler is already running on another thread";
+            return false;
+        }
+        ++nesting;
+        return true;
+    }
+    if (!samplelog) {
+        samplelog = new uint32_t[LogWords];
+    }
+    logused = 0;
+    dropped = 0;
+    vm_init();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onsample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &previous);
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev._sigev_un._tid = self;  // sigev_notify_thread_id, which older glibc lacks
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) != 0) {
+        sigaction(SIGPROF, &previous, nullptr);
+        err = std::string("timer_create: ") + strerror(errno);
+        return false;
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec  = 0;
+    its.it_interval.tv_nsec = 1000000000L / std::max(1u, hz);
+    its.it_value = its.it_interval;
+    timer_settime(timer, 0, &its, nullptr);
+    owner = self;
+    nesting = 1;
+    return true;
+}
+
+void profile_stop()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (nesting == 0 || --nesting > 0) {
+        return;
+    }
+    timer_delete(timer);
+    sigaction(SIGPROF, &previous, nullptr);
+    owner = 0;
+}
+
+size_t profile_mark() { return logused; }
+
+void profile_write(FILE* out, size_t from)
+{
+    std::map<std::string, size_t> stacks;
+    eachsample(from, [&](const uint32_t* frames, uint32_t n, bool truncated) {
+        std::string stack = truncated ? "[truncated]" : "";
+        for (uint32_t j = n; j-- > 0; ) {
+            if (!stack.empty()) {
+                stack += ';';
+            }
+            stack += protoname(frames[j], j == n - 1 && !truncated);
+        }
+        ++stacks[stack.empty() ? "[runtime]" : stack];
+    });
+    if (dropped > 0 && from == 0) {
+        stacks["[dropped]"] = dropped;
+    }
+    for (const auto& s : stacks) {
+        fprintf(out, "%s %zu\n", s.first.c_str(), s.second);
+    }
+}
+
+void profile_summary(FILE* out, size_t from, size_t limit)
+{
+    struct Counts { size_t self = 0, total = 0; };
+    std::map<std::string, Counts> procs;
+    size_t samples = 0;
+    eachsample(from, [&](const uint32_t* frames, uint32_t n, bool truncated) {
+        ++samples;
+        if (n == 0) {
+            ++procs["[runtime]"].self;
+            ++procs["[runtime]"].total;
+            return;
+        }
+        std::vector<std::string> seen;
+        for (uint32_t j = 0; j < n; ++j) {
+            std::string name = protoname(frames[j], j == n - 1 && !truncated);
+            if (j == 0) {
+                ++procs[name].self;
+            }
+            // recursion counts once towards the total
+            if (std::find(seen.begin(), seen.end(), name) == seen.end()) {
+                ++procs[name].total;
+                seen.push_back(name);
+            }
+        }
+    });
+    std::vector<std::pair<std::string, Counts>> sorted(procs.begin(), procs.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.self > b.second.self;
+    });
+    fprintf(out, "%zu samples\n%8s %8s  %s\n", samples, "self %", "total %", "procedure");
+    for (size_t j = 0; j < sorted.size() && j < limit; ++j) {
+        fprintf(out, "%8.1f %8.1f  %s\n",
+                100.0 * sorted[j].second.self / samples,
+                100.0 * sorted[j].second.total / samples,
+                sorted[j].first.c_str());
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+//----------------------------------------------------------
+// Sampling profiler. A CPU-time timer interrupts the thread
+// being profiled and the signal handler records the
+// interpreter's call frames (not the C stack): the prototype
+// of each of the innermost ProfileDepth frames. Time spent
+// in a builtin, or collecting, is charged to the procedure
+// that was running. One thread can be profiled at a time.
+//----------------------------------------------------------
+
+constexpr unsigned ProfileHz    = 1000;
+constexpr size_t   ProfileDepth = 128;
+
+// Starts sampling the calling thread. Starts nest: sampling goes on
+// until the matching number of stops.
+bool profile_start(unsigned hz, std::string& err);
+void profile_stop();
+// The position of the next sample, for the `from` arguments below. The
+// samples of a session, from an outermost start to its last stop, stay
+// readable until the next session starts; its positions start over.
+// Reports name procedures through the profiled thread's interpreter, so
+// they must be made on that thread.
+size_t profile_mark();
+// Writes the samples taken since `from` as collapsed stacks, outermost
+// frame first, one "a;b;c count" line per distinct stack: the input
+// format of flamegraph.pl.
+void profile_write(FILE* out, size_t from = 0);
+// Prints the `limit` procedures with the most samples at the top of the
+// stack (self) since `from`, and how often they were on it at all.
+void profile_summary(FILE* out, size_t from, size_t limit);
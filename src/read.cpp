@@ -0,0 +1,276 @@
+#include "read.h"
+#include "stats.h"
+
+static void visitatoms(void* ctx, GcVisitFn visit)
+{
+    Reader* r = (Reader*) ctx;
+    visit(r->v);
+    for (Value v : r->atoms) {
+        visit(v);
+    }
+}
+
+Reader::Reader(Input& in_)
+    : in(in_)
+    , t(T_EOF)
+    , v(mknil())
+{
+    gc_addroots(visitatoms, this);
+}
+
+Reader::~Reader()
+{
+    gc_removeroots(visitatoms, this);
+}
+
+Node mkatom(Value v)
+{
+    Node n;
+    n.atom = v;
+    return n;
+}
+
+Node mklist(std::vector<Node> items)
+{
+    Node n;
+    n.atom = mknil();
+    n.islist = true;
+    n.items = std::move(items);
+    return n;
+}
+
+static int fail(Reader& r, std::string msg)
+{
+    r.err = std::move(msg);
+    return ERROR;
+}
+
+static int datum(Reader& r, Node& out, int depth)
+{
+    if ((r.t == T_QUOTE || r.t == T_LPAREN) && depth == MaxNesting) {
+        return fail(r, "datum nested too deeply");
+    }
+    switch (r.t) {
+        case T_EOF:
+            return fail(r, "unexpected end of input");
+        case T_ERROR:
+            return fail(r, std::string(strview(r.v)));
+        case T_RPAREN:
+            return fail(r, "unexpected ')'");
+        case T_DOT:
+            return fail(r, "unexpected '.'");
+        case T_QUOTE: {
+            r.t = lex(r.in, r.v);
+            Node quoted;
+            if (datum(r, quoted, depth + 1) != OK) {
+                return ERROR;
+            }
+            r.atoms.push_back(mksym("quote"));
+            out = mklist({ mkatom(r.atoms.back()), std::move(quoted) });
+            return OK;
+        }
+        case T_LPAREN: {
+            out = mklist({});
+            for (;;) {
+                r.t = lex(r.in, r.v);
+                if (r.t == T_RPAREN) {
+                    return OK;
+                }
+                if (r.t == T_EOF) {
+                    return fail(r, "missing closing ')' for s-expression");
+                }
+                if (r.t == T_DOT && !out.items.empty()) {
+                    // the tail, and nothing after it
+                    r.t = lex(r.in, r.v);
+                    Node tail;
+                    if (datum(r, tail, depth + 1) != OK) {
+                        return ERROR;
+                    }
+                    out.items.push_back(std::move(tail));
+                    out.dotted = true;
+                    r.t = lex(r.in, r.v);
+                    if (r.t != T_RPAREN) {
+                        return fail(r, "expected ')' after the tail of a dotted list");
+                    }
+                    return OK;
+                }
+                Node item;
+                if (datum(r, item, depth + 1) != OK) {
+                    return ERROR;
+                }
+                out.items.push_back(std::move(item));
+            }
+        }
+        case T_INT:
+        case T_DOUBLE:
+        case T_STR:
+        case T_SYM:
+            r.atoms.push_back(r.v);
+            out = mkatom(r.v);
+            return OK;
+        case T_TRUE:
+            out = mkatom(mktrue());
+            return OK;
+        case T_FALSE:
+            out = mkatom(mkfalse());
+            return OK;
+    }
+    return fail(r, "invalid token");
+}
+
+int read(Reader& r, Node& out)
+{
+    r.t = lex(r.in, r.v);
+    if (r.t == T_EOF) {
+        return DONE;
+    }
+    return datum(r, out, 0);
+}
+
+FeedReader::FeedReader()
+    : start(std::string::npos)
+    , in("", 0)
+    , reader(in)
+{
+}
+
+static void complete(FeedReader& r, size_t end)
+{
+    r.ready.emplace_back(r.start, end);
+    r.start = std::string::npos;
+}
+
+// Drops the consumed prefix of the buffer once it is most of it.
+static void compact(FeedReader& r)
+{
+    size_t n = r.head;
+    if (n == 0 || n < r.buf.size() / 2) {
+        return;
+    }
+    r.buf.erase(0, n);
+    r.head = 0;
+    r.scanned -= n;
+    if (r.start != std::string::npos) {
+        r.start -= n;
+    }
+    for (auto& d : r.ready) {
+        d.first -= n;
+        d.second -= n;
+    }
+}
+
+void reader_feed(FeedReader& r, const char* data, size_t len)
+{
+    assert(!r.closed);
+    compact(r);
+    r.buf.append(data, len);
+
+    // the buffer may have moved, and bytes were appended to the block
+    ScanBlock scan;
+    const unsigned char* base = (const unsigned char*) r.buf.data();
+    const unsigned char* p = base + r.scanned;
+    const unsigned char* end = base + r.buf.size();
+    while (p < end) {
+        switch (r.state) {
+            case FeedReader::SPACE:
+                p = scan_space(scan, p, end);
+                if (p == end) {
+                    break;
+                }
+                if (*p == ';') {
+                    r.state = FeedReader::COMMENT;
+                    break;
+                }
+                if (r.start == std::string::npos) {
+                    r.start = p - base;
+                }
+                switch (*p++) {
+                    case '(':
+                        ++r.depth;
+                        break;
+                    case ')':
+                        // a stray one is a datum of its own, for the reader to reject
+                        if (r.depth == 0 || --r.depth == 0) {
+                            complete(r, p - base);
+                        }
+                        break;
+                    case '\'':
+                        // part of the datum that follows
+                        break;
+                    case '"':
+                        r.state = FeedReader::STRING;
+                        break;
+                    default:
+                        r.state = FeedReader::ATOM;
+                        break;
+                }
+                break;
+            case FeedReader::ATOM:
+                p = scan_delim(scan, p, end);
+                if (p < end) {
+                    r.state = FeedReader::SPACE;
+                    if (r.depth == 0) {
+                        complete(r, p - base);
+                    }
+                }
+                break;
+            case FeedReader::STRING:
+                p = scan_string(scan, p, end);
+                if (p < end) {
+                    r.state = *p++ == '"' ? FeedReader::SPACE : FeedReader::ESCAPE;
+                    if (r.state == FeedReader::SPACE && r.depth == 0) {
+                        complete(r, p - base);
+                    }
+                }
+                break;
+            case FeedReader::ESCAPE:
+                ++p;
+                r.state = FeedReader::STRING;
+                break;
+            case FeedReader::COMMENT: {
+                const void* nl = memchr(p, '\n', end - p);
+                if (nl) {
+                    p = (const unsigned char*) nl + 1;
+                    r.state = FeedReader::SPACE;
+                } else {
+                    p = end;
+                }
+                break;
+            }
+        }
+    }
+    r.scanned = r.buf.size();
+}
+
+void reader_close(FeedReader& r)
+{
+    if (r.start != std::string::npos) {
+        complete(r, r.buf.size());
+    }
+    r.depth = 0;
+    r.state = FeedReader::SPACE;
+    r.closed = true;
+}
+
+int reader_next(FeedReader& r, Node& out)
+{
+    if (r.ready.empty()) {
+        return DONE;
+    }
+    std::pair<size_t, size_t> d = r.ready.front();
+    r.ready.pop_front();
+    r.head = d.second;
+    // the datum is lexed in place, like any in-memory Input
+    const unsigned char* base = (const unsigned char*) r.buf.data();
+    r.in.tok = r.in.cur = base + d.first;
+    r.in.lim = base + d.second;
+    r.in.scan.base = nullptr;
+    stat_add(stats->lex_bytes, d.second - d.first);
+    int status = read(r.reader, out);
+    if (status != OK) {
+        // every range starts at a token, so there is no DONE
+        r.err = status == ERROR ? std::move(r.reader.err) : "unexpected end of input";
+        return ERROR;
+    }
+    return OK;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lex.h"
+
+// Reader output: an s-expression tree that only lives until it has been
+// compiled. Atoms are kept alive by the Reader that produced them.
+struct Node
+{
+    Value             atom;
+    bool              islist = false;
+    bool              dotted = false;  // the last item is the tail after a '.'
+    std::vector<Node> items;
+};
+
+struct Reader
+{
+    explicit Reader(Input& in);
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // Drops the atoms of previously read datums.
+    void clear() { atoms.clear(); }
+
+    Input&             in;
+    Token              t;
+    Value              v;
+    std::string        err;
+    std::vector<Value> atoms;
+};
+
+// Deepest nesting of lists and quotes the reader accepts. The reader
+// and the compiler recurse on it, so it bounds their use of the stack.
+constexpr int MaxNesting = 1000;
+
+// Reads one datum. Returns DONE at end of input, ERROR with `r.err` set
+// on malformed input, or nested deeper than MaxNesting.
+int read(Reader& r, Node& out);
+
+//----------------------------------------------------------
+// Incremental reader, for input that arrives in pieces (a
+// pipe, a socket, a terminal). reader_feed takes whatever
+// bytes have arrived and reader_next hands out each datum
+// as soon as it closes. The feed only tracks where datums
+// end: paren depth, and whether it stopped inside an atom,
+// a string, an escape or a comment. It resumes from that
+// state on the next feed, so no byte is looked at twice
+// before its datum is complete. A complete datum is then
+// read once, by the same lexer as everything else.
+//
+// A top-level atom ends at the delimiter after it, so "42"
+// is only a datum once a space or newline follows (or the
+// input is closed).
+//----------------------------------------------------------
+
+struct FeedReader
+{
+    enum State { SPACE, ATOM, STRING, ESCAPE, COMMENT };
+
+    FeedReader();
+    FeedReader(const FeedReader&) = delete;
+    FeedReader& operator=(const FeedReader&) = delete;
+
+    // Drops the atoms of previously read datums.
+    void clear() { reader.clear(); }
+
+    std::string                             buf;
+    size_t                                  head = 0;     // bytes before it are consumed
+    size_t                                  scanned = 0;  // bytes before it are classified
+    size_t                                  start;        // of the open datum, or npos
+    int                                     depth = 0;
+    State                                   state = SPACE;
+    bool                                    closed = false;
+    std::deque<std::pair<size_t, size_t>>   ready;        // complete datums in `buf`
+    std::string                             err;
+    Input                                   in;           // pointed at each datum in turn
+    Reader                                  reader;
+};
+
+void reader_feed(FeedReader& r, const char* buf, size_t len);
+// End of input: a pending atom is complete, and an unfinished datum is
+// handed out too, for reader_next to report.
+void reader_close(FeedReader& r);
+// Takes the next complete datum. Returns DONE if there is none (yet),
+// ERROR with `r.err` set if it is malformed; reading can go on after an
+// error, with the datum after it.
+int reader_next(FeedReader& r, Node& out);
+
+Node mkatom(Value v);
+Node mklist(std::vector<Node> items);
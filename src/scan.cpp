@@ -0,0 +1,167 @@
+#include "scan.h"
+#include <atomic>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+enum : uint8_t { SPACE = 1, DELIM = 2, STRING = 4 };
+
+struct Classes
+{
+    uint8_t c[256];
+
+    constexpr Classes() : c()
+    {
+        for (const char* s = " \t\n\r\v\f"; *s; ++s) {
+            c[(unsigned char) *s] |= SPACE | DELIM;
+        }
+        for (const char* s = "()\";'"; *s; ++s) {
+            c[(unsigned char) *s] |= DELIM;
+        }
+        c['"']  |= STRING;
+        c['\\'] |= STRING;
+    }
+};
+
+constexpr Classes classes;
+
+void scalar(ScanBlock& b, const unsigned char* p, size_t n)
+{
+    b.space = b.delim = b.string = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t c = classes.c[p[i]];
+        b.space  |= (uint64_t) (c & SPACE) << i;
+        b.delim  |= (uint64_t) ((c & DELIM) >> 1) << i;
+        b.string |= (uint64_t) ((c & STRING) >> 2) << i;
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+void sse42(ScanBlock& b, const unsigned char* p, size_t)
+{
+    // pcmpestrm tests membership in a set of up to 16 bytes at once
+    const __m128i delims = _mm_setr_epi8(' ', '\t', '\n', '\r', '\v', '\f', '(', ')', '"', ';', '\'', 0, 0, 0, 0, 0);
+    const __m128i spaces = _mm_setr_epi8(' ', '\t', '\n', '\r', '\v', '\f', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i quote  = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    b.space = b.delim = b.string = 0;
+    for (int i = 0; i < 64; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (p + i));
+        uint64_t d = _mm_movemask_epi8(_mm_cmpestrm(delims, 11, x, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_UNIT_MASK));
+        uint64_t s = _mm_movemask_epi8(_mm_cmpestrm(spaces, 6, x, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_UNIT_MASK));
+        uint64_t q = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, bslash)));
+        b.delim  |= d << i;
+        b.space  |= s << i;
+        b.string |= q << i;
+    }
+}
+
+__attribute__((target("avx2")))
+void avx2(ScanBlock& b, const unsigned char* p, size_t)
+{
+    b.space = b.delim = b.string = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+        // whitespace is ' ' or a byte in ['\t', '\r']
+        __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t));
+        __m256i quote = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+        __m256i other = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('(')),
+                                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8(')'))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(';')),
+                                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\''))));
+        __m256i delim = _mm256_or_si256(_mm256_or_si256(space, other), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+        b.space  |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+        b.delim  |= (uint64_t) (uint32_t) _mm256_movemask_epi8(delim) << i;
+        b.string |= (uint64_t) (uint32_t) _mm256_movemask_epi8(quote) << i;
+    }
+}
+
+#endif // __x86_64__
+
+using Kernel = void (*)(ScanBlock&, const unsigned char*, size_t);
+
+const Kernel kernels[SCAN_NISAS] = {
+    scalar,
+#if defined(__x86_64__)
+    sse42,
+    avx2,
+#else
+    scalar,
+    scalar,
+#endif
+};
+
+bool supported(ScanIsa isa)
+{
+#if defined(__x86_64__)
+    switch (isa) {
+        case SCAN_AVX2:  return __builtin_cpu_supports("avx2");
+        case SCAN_SSE42: return __builtin_cpu_supports("sse4.2");
+        default:         return true;
+    }
+#else
+    return isa == SCAN_SCALAR;
+#endif
+}
+
+ScanIsa best()
+{
+    for (int isa = SCAN_NISAS - 1; isa > SCAN_SCALAR; --isa) {
+        if (supported((ScanIsa) isa)) {
+            return (ScanIsa) isa;
+        }
+    }
+    return SCAN_SCALAR;
+}
+
+// Read by every reader thread and written by scan_setisa, so atomic;
+// relaxed is enough, as each kernel gives the same results and a reader
+// only needs to see one of them.
+std::atomic<ScanIsa> current{best()};
+std::atomic<Kernel>  active{kernels[best()]};
+
+} // namespace
+
+void scan_classify(ScanBlock& b, const unsigned char* p, const unsigned char* end)
+{
+    b.base = p;
+    size_t n = end - p;
+    if (n >= 64) {
+        active.load(std::memory_order_relaxed)(b, p, 64);
+        return;
+    }
+    // never read past `end`
+    scalar(b, p, n);
+    uint64_t past = ~0ull << n;
+    b.delim  |= past;
+    b.string |= past;
+}
+
+ScanIsa scan_isa() { return current.load(std::memory_order_relaxed); }
+
+const char* scan_isaname(ScanIsa isa)
+{
+    switch (isa) {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE42:  return "sse4.2";
+        case SCAN_AVX2:   return "avx2";
+        default:          return "invalid";
+    }
+}
+
+bool scan_setisa(ScanIsa isa)
+{
+    if (isa >= SCAN_NISAS || !supported(isa)) {
+        return false;
+    }
+    current.store(isa, std::memory_order_relaxed);
+    active.store(kernels[isa], std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//----------------------------------------------------------
+// Lexer pre-scan: classifies 64 bytes of input at a time
+// into bitmasks, one bit per byte, for whitespace,
+// delimiters (whitespace, parens, '"', ';', '\'') and
+// string specials ('"', '\\'). The masks of the current
+// block are cached, so consecutive short tokens cost a
+// shift and a count-trailing-zeros each. The widest
+// instruction set the CPU supports is picked at startup;
+// every kernel produces exactly the scalar one's masks.
+//----------------------------------------------------------
+
+enum ScanIsa { SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2, SCAN_NISAS };
+
+struct ScanBlock
+{
+    const unsigned char* base = nullptr; // classified bytes are [base, base + 64)
+    uint64_t             space;
+    uint64_t             delim;
+    uint64_t             string;
+};
+
+// Classifies [p, p + 64) into `b`. Bytes at or past `end` are neither
+// whitespace nor anything else, but count as a delimiter and a string
+// special so every search stops at `end`.
+void scan_classify(ScanBlock& b, const unsigned char* p, const unsigned char* end);
+
+// Returns the first byte in [p, end) whose bit is set in `mask` of the
+// block, or `end`. `b` must be reset whenever the bytes under it change.
+inline const unsigned char* scan_find(ScanBlock& b, uint64_t ScanBlock::*mask, bool invert,
+                                      const unsigned char* p, const unsigned char* end)
+{
+    while (p < end) {
+        if (p < b.base || p >= b.base + 64) {
+            scan_classify(b, p, end);
+        }
+        uint64_t m = (invert ? ~(b.*mask) : b.*mask) >> (p - b.base);
+        if (m) {
+            p += __builtin_ctzll(m);
+            return p < end ? p : end;
+        }
+        p = b.base + 64;
+    }
+    return end;
+}
+
+// First byte that is not whitespace.
+inline const unsigned char* scan_space(ScanBlock& b, const unsigned char* p, const unsigned char* end)
+{
+    return scan_find(b, &ScanBlock::space, true, p, end);
+}
+
+inline const unsigned char* scan_delim(ScanBlock& b, const unsigned char* p, const unsigned char* end)
+{
+    return scan_find(b, &ScanBlock::delim, false, p, end);
+}
+
+// First '"' or '\\'.
+inline const unsigned char* scan_string(ScanBlock& b, const unsigned char* p, const unsigned char* end)
+{
+    return scan_find(b, &ScanBlock::string, false, p, end);
+}
+
+ScanIsa scan_isa();
+const char* scan_isaname(ScanIsa isa);
+// Selects the kernel to use, for every thread; returns false if the CPU
+// lacks `isa`. Safe to call while other threads are reading.
+bool scan_setisa(ScanIsa isa);
+
+// Parses `len` <= 8 ASCII digits at `s` eight bytes at a time. `lim`
+// bounds the readable memory after `s`. Returns false if a byte is not
+// a digit, or if too little memory is readable.
+inline bool swar_digits(const char* s, size_t len, const char* lim, uint64_t& out)
+{
+    if (len == 0 || len > 8 || lim - s < 8) {
+        return false;
+    }
+    uint64_t v;
+    memcpy(&v, s, 8);
+    if (len < 8) {
+        // drop the bytes after the number and pad with leading '0's
+        v <<= (8 - len) * 8;
+        v |= 0x3030303030303030ull >> (len * 8);
+    }
+    // every byte must lie in ['0', '9']
+    if (((v + 0x4646464646464646ull) | (v - 0x3030303030303030ull)) & 0x8080808080808080ull) {
+        return false;
+    }
+    v -= 0x3030303030303030ull;
+    v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffull;
+    v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffull;
+    v = (v * 10000 + (v >> 32)) & 0x00000000ffffffffull;
+    out = v;
+    return true;
+}
@@ -0,0 +1,373 @@
+#include "serve.h"
+#include "freeze.h"
+#include "isolate.h"
+#include "image.h"
+#include "vm.h"
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// A connection sending more than this without completing a request is
+// dropped.
+constexpr size_t MaxRequest = 1u << 24;
+// A request printing more than this fails.
+constexpr size_t MaxOutput = 1u << 24;
+
+struct Conn
+{
+    int         fd;
+    std::string in;
+    std::string out;
+    bool        eof     = false;  // the peer is done sending
+    bool        polling = false;  // waiting for the socket to drain
+};
+
+enum Frame { INCOMPLETE, REQUEST, BADFRAME };
+
+// Finds the request at the start of [p, p + n): its text, whether it was
+// length-framed, and how many bytes it takes up. Once the peer is done
+// sending (`eof`), a last line needs no newline.
+Frame frame(const char* p, size_t n, bool eof, std::string_view& body, bool& framed, size_t& size)
+{
+    framed = n >= 2 && p[0] == '#' && p[1] >= '0' && p[1] <= '9';
+    if (!framed) {
+        const char* nl = (const char*) memchr(p, '\n', n);
+        if (!nl && eof && n > 0) {
+            size = n;
+            body = std::string_view(p, n);
+            return REQUEST;
+        }
+        if (!nl) {
+            return INCOMPLETE;
+        }
+        size = nl - p + 1;
+        body = std::string_view(p, nl > p && nl[-1] == '\r' ? nl - p - 1 : nl - p);
+        return REQUEST;
+    }
+    size_t len = 0;
+    size_t j = 1;
+    for (; j < n && p[j] >= '0' && p[j] <= '9'; ++j) {
+        len = len * 10 + (p[j] - '0');
+        if (len > MaxRequest) {
+            return BADFRAME;
+        }
+    }
+    if (j == n) {
+        return INCOMPLETE;
+    }
+    if (p[j] != '\n') {
+        return BADFRAME;
+    }
+    if (n - j - 1 < len) {
+        return INCOMPLETE;
+    }
+    body = std::string_view(p + j + 1, len);
+    size = j + 1 + len;
+    return REQUEST;
+}
+
+void answer(Conn& c, std::string_view body, bool framed)
+{
+    std::string text;
+    vm_capture(&text, MaxOutput);
+    EvalResult r = eval(body.data(), body.size());
+    vm_capture(nullptr, 0);
+    vm_rollback();
+    text += r.status == OK ? r.value : "error: " + r.value;
+    if (framed) {
+        c.out += '#';
+        c.out += std::to_string(text.size());
+        c.out += '\n';
+        c.out += text;
+        return;
+    }
+    // keep it one line
+    for (char ch : text) {
+        if (ch == '\n') {
+            c.out += "\\n";
+        } else {
+            c.out += ch;
+        }
+    }
+    c.out += '\n';
+}
+
+// Answers every complete request in `c.in`. Returns false if the
+// connection is broken beyond an answer.
+bool serverequests(Conn& c)
+{
+    size_t at = 0;
+    for (;;) {
+        std::string_view body;
+        bool framed;
+        size_t size;
+        Frame f = frame(c.in.data() + at, c.in.size() - at, c.eof, body, framed, size);
+        if (f == INCOMPLETE && c.eof && at < c.in.size()) {
+            // a length-framed request cut short
+            c.out += "error: incomplete request\n";
+            at = c.in.size();
+        }
+        if (f == INCOMPLETE) {
+            break;
+        }
+        if (f == BADFRAME) {
+            c.out += "error: bad request header\n";
+            return false;
+        }
+        if (framed || !body.empty()) {
+            answer(c, body, framed);
+        }
+        at += size;
+    }
+    c.in.erase(0, at);
+    if (c.in.size() > MaxRequest) {
+        c.out += "error: request too long\n";
+        return false;
+    }
+    return true;
+}
+
+// Sends what it can of `c.out` without blocking.
+bool flush(Conn& c)
+{
+    size_t sent = 0;
+    while (sent < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    c.out.erase(0, sent);
+    return true;
+}
+
+// Returns false once the connection should be closed.
+bool readable(Conn& c)
+{
+    char buf[1 << 16];
+    for (;;) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0) {
+            c.eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        break;
+    }
+    if (!serverequests(c)) {
+        flush(c);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+Server::Server(ServeConfig config)
+    : config_(std::move(config))
+{
+}
+
+Server::~Server()
+{
+    stop();
+}
+
+bool Server::start(std::string& err)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (config_.socket.empty() || config_.socket.size() >= sizeof(addr.sun_path)) {
+        err = "invalid socket path: " + config_.socket;
+        return false;
+    }
+    memcpy(addr.sun_path, config_.socket.data(), config_.socket.size());
+    // a socket left behind by an earlier server, but nothing else
+    struct stat st;
+    if (stat(config_.socket.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(config_.socket.c_str());
+    }
+    listenfd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd_ < 0 || bind(listenfd_, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(listenfd_, SOMAXCONN) != 0) {
+        err = config_.socket + ": " + strerror(errno);
+        stop();
+        return false;
+    }
+    stopfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (config_.freeze && (!config_.image.empty() || !config_.prelude.empty())) {
+        // a thread of its own, whose heap goes away once frozen
+        std::thread([&] {
+            if (load(err)) {
+                frozen_ = freeze(err);
+            }
+        }).join();
+        if (!frozen_) {
+            stop();
+            return false;
+        }
+    }
+
+    std::vector<std::future<std::string>> ready;
+    for (int j = 0; j < std::max(1, config_.workers); ++j) {
+        std::promise<std::string> p;
+        ready.push_back(p.get_future());
+        threads_.emplace_back(&Server::worker, this, std::move(p));
+    }
+    for (auto& r : ready) {
+        std::string e = r.get();
+        if (!e.empty() && err.empty()) {
+            err = std::move(e);
+        }
+    }
+    if (!err.empty()) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Server::stop()
+{
+    if (stopfd_ >= 0) {
+        uint64_t one = 1;
+        (void) !write(stopfd_, &one, sizeof(one));
+    }
+    for (std::thread& t : threads_) {
+        t.join();
+    }
+    threads_.clear();
+    frozen_.reset();
+    if (listenfd_ >= 0) {
+        close(listenfd_);
+        unlink(config_.socket.c_str());
+        listenfd_ = -1;
+    }
+    if (stopfd_ >= 0) {
+        close(stopfd_);
+        stopfd_ = -1;
+    }
+}
+
+bool Server::load(std::string& err)
+{
+    vm_init();
+    if (!config_.image.empty() && !image_load(config_.image.c_str(), err)) {
+        err = config_.image + ": " + err;
+        return false;
+    }
+    if (!config_.prelude.empty()) {
+        EvalResult r = eval(config_.prelude.data(), config_.prelude.size());
+        if (r.status != OK) {
+            err = "prelude: " + r.value;
+            return false;
+        }
+    }
+    return true;
+}
+
+void Server::worker(std::promise<std::string> ready)
+{
+    std::string err;
+    if (frozen_ ? !freeze_attach(frozen_, err) : !load(err)) {
+        ready.set_value(err);
+        return;
+    }
+    vm_checkpoint();
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = listenfd_;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listenfd_, &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = stopfd_;
+    epoll_ctl(ep, EPOLL_CTL_ADD, stopfd_, &ev);
+    ready.set_value("");
+
+    std::unordered_map<int, std::unique_ptr<Conn>> conns;
+    auto drop = [&](Conn& c) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        conns.erase(c.fd);
+    };
+    epoll_event events[64];
+    for (;;) {
+        int n = epoll_wait(ep, events, 64, -1);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        for (int j = 0; j < n; ++j) {
+            int fd = events[j].data.fd;
+            if (fd == stopfd_) {
+                for (auto& c : conns) {
+                    close(c.first);
+                }
+                close(ep);
+                return;
+            }
+            if (fd == listenfd_) {
+                int cfd;
+                while ((cfd = accept4(listenfd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    ev.events = EPOLLIN;
+                    ev.data.fd = cfd;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &ev);
+                    conns[cfd].reset(new Conn{cfd});
+                }
+                continue;
+            }
+            auto it = conns.find(fd);
+            if (it == conns.end()) {
+                continue;
+            }
+            Conn& c = *it->second;
+            if ((events[j].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c.eof && !readable(c)) {
+                drop(c);
+                continue;
+            }
+            if (!flush(c)) {
+                drop(c);
+                continue;
+            }
+            if (c.out.empty() && c.eof) {
+                drop(c);
+                continue;
+            }
+            // wait for the socket to drain, and stop reading until it has
+            bool polling = !c.out.empty();
+            if (polling != c.polling) {
+                c.polling = polling;
+                ev.events = polling ? EPOLLOUT : EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+    }
+    close(ep);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------
+// Evaluation server. Answers eval requests on a Unix domain
+// socket, so a client pays neither process startup nor
+// prelude loading per request.
+//
+// Each worker thread has an interpreter of its own (see
+// isolate.h) and its own epoll loop; the workers share the
+// listening socket and take turns accepting. The prelude is
+// loaded once, on a thread of its own, and frozen (see
+// freeze.h): the workers all start from the frozen copy, so
+// memory does not grow with the prelude per worker. A worker
+// checkpoints its global environment and rolls back to the
+// checkpoint after every request (see vm_checkpoint): a
+// request sees the prelude's globals and its own defines,
+// and nothing of the requests before it.
+//
+// Framing, chosen per request by its first bytes:
+//   "#<n>\n" then n bytes    length-framed, answered as
+//                            "#<m>\n" and m bytes
+//   anything else            one line, answered by a line
+// The answer is the printed value of the request's last
+// form, or "error: " and the message, after whatever the
+// request printed without a port (display, write, newline,
+// also inside pmap): that output never reaches the server's
+// stdout.
+//----------------------------------------------------------
+
+struct ServeConfig
+{
+    std::string socket;       // path to listen on
+    int         workers = 1;
+    std::string image;        // loaded before the prelude, if set
+    std::string prelude;      // source evaluated at startup, if set
+    // Share one frozen copy of the image and prelude; if false, every
+    // worker loads them itself, and a request may set-car! their data
+    // (undone with the rest of the request).
+    bool        freeze = true;
+};
+
+struct Frozen;
+
+class Server
+{
+public:
+    explicit Server(ServeConfig config);
+    // Stops the workers and removes the socket.
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Returns once every worker has loaded the prelude and is accepting,
+    // or false with `err` set if any of them could not.
+    bool start(std::string& err);
+    // Closes all connections; requests being evaluated are finished first.
+    void stop();
+
+private:
+    // Loads the image and prelude into the calling thread's interpreter.
+    bool load(std::string& err);
+    void worker(std::promise<std::string> ready);
+
+    ServeConfig              config_;
+    std::shared_ptr<const Frozen> frozen_;
+    int                      listenfd_ = -1;
+    int                      stopfd_   = -1;  // an eventfd, readable once stopping
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,156 @@
+#include "stats.h"
+#include "vm.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static_assert(OP_NOPS <= StatOps, "StatOps is too small");
+static_assert(sizeof(Stats) % sizeof(uint64_t) == 0, "Stats must be all counters");
+
+Stats stats_shared;
+__thread Stats* stats = &stats_shared;
+
+namespace {
+
+constexpr size_t Words = sizeof(Stats) / sizeof(uint64_t);
+
+struct Registry
+{
+    std::mutex          lock;
+    std::vector<Stats*> live;
+    Stats               retired = {};  // blocks of exited threads
+};
+
+// Never destroyed: threads such as the shared pool's workers can exit
+// during static destruction, and their Owner still needs it.
+Registry& registry()
+{
+    static Registry& r = *new Registry;
+    return r;
+}
+
+void addto(Stats& total, const Stats& s)
+{
+    uint64_t* dst = (uint64_t*) &total;
+    const uint64_t* src = (const uint64_t*) &s;
+    for (size_t j = 0; j < Words; ++j) {
+        dst[j] += __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+    }
+}
+
+struct Owner
+{
+    Stats block = {};
+
+    Owner()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.live.push_back(&block);
+    }
+
+    ~Owner()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        addto(r.retired, block);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), &block));
+        stats = &stats_shared;
+    }
+};
+
+thread_local std::unique_ptr<Owner> owner;
+
+const char* KindNames[StatKinds] = { "string", "env", "closure", "port", "table", "uvec", "pair" };
+static_assert(GC_NKINDS == 6, "name the new kind in KindNames");
+
+const char* PauseNames[StatPauses] = { "< 10us", "< 100us", "< 1ms", "< 10ms", "< 100ms", ">= 100ms" };
+
+void histogram(FILE* out, const char* name, const uint64_t* pauses)
+{
+    fprintf(out, "  %-8s", name);
+    for (size_t j = 0; j < StatPauses; ++j) {
+        fprintf(out, " %10llu", (unsigned long long) pauses[j]);
+    }
+    fputc('\n', out);
+}
+
+} // namespace
+
+void stats_attach_slow()
+{
+    owner.reset(new Owner);
+    stats = &owner->block;
+}
+
+void stat_pause(uint64_t* pauses, uint64_t ns)
+{
+    size_t bucket = 0;
+    for (uint64_t limit = 10000; bucket + 1 < StatPauses && ns >= limit; limit *= 10) {
+        ++bucket;
+    }
+    stat_add(pauses[bucket]);
+    stat_add(stats->pause_ns, ns);
+}
+
+Stats stats_total()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    Stats total = {};
+    addto(total, r.retired);
+    addto(total, stats_shared);
+    for (const Stats* s : r.live) {
+        addto(total, *s);
+    }
+    return total;
+}
+
+void stats_report(FILE* out, const Stats& s)
+{
+    auto u = [](uint64_t n) { return (unsigned long long) n; };
+    auto ratio = [](uint64_t a, uint64_t b) { return b ? (double) a / b : 0.0; };
+
+    uint64_t dispatched = 0;
+    std::vector<size_t> order;
+    for (size_t op = 0; op < OP_NOPS; ++op) {
+        dispatched += s.ops[op];
+        if (s.ops[op] > 0) {
+            order.push_back(op);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return s.ops[a] > s.ops[b]; });
+    fprintf(out, "instructions  %llu\n", u(dispatched));
+    for (size_t op : order) {
+        fprintf(out, "  %-10s %14llu %6.1f%%\n", optostr((Opcode) op), u(s.ops[op]),
+                100.0 * ratio(s.ops[op], dispatched));
+    }
+
+    uint64_t objects = 0;
+    for (size_t kind = 0; kind < StatKinds; ++kind) {
+        objects += s.allocs[kind];
+    }
+    fprintf(out, "allocations   %llu objects, %llu bytes\n", u(objects), u(s.bytes_allocated));
+    for (size_t kind = 0; kind < StatKinds; ++kind) {
+        fprintf(out, "  %-10s %14llu\n", KindNames[kind], u(s.allocs[kind]));
+    }
+
+    fprintf(out, "intern        %llu hits, %llu misses (%.1f%% hits)\n",
+            u(s.intern_hits), u(s.intern_misses),
+            100.0 * ratio(s.intern_hits, s.intern_hits + s.intern_misses));
+    fprintf(out, "env lookups   %llu, %.2f frames up on average\n",
+            u(s.env_lookups), ratio(s.env_depth, s.env_lookups));
+
+    fprintf(out, "collections   %llu minor, %llu major, %.3f ms paused\n",
+            u(s.minor_collections), u(s.major_collections), s.pause_ns / 1e6);
+    fprintf(out, "  %-8s", "pauses");
+    for (size_t j = 0; j < StatPauses; ++j) {
+        fprintf(out, " %10s", PauseNames[j]);
+    }
+    fputc('\n', out);
+    histogram(out, "minor", s.minor_pauses);
+    histogram(out, "major", s.major_pauses);
+
+    fprintf(out, "lexer         %llu bytes, %llu tokens\n", u(s.lex_bytes), u(s.lex_tokens));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include "gc.h"
+
+//----------------------------------------------------------
+// Runtime counters, always compiled in. Every thread bumps a
+// block of its own with relaxed atomic loads and stores (no
+// read-modify-write, so no locked instruction), and any
+// thread may read the blocks at any time. A block is folded
+// into the process totals when its thread exits.
+//----------------------------------------------------------
+
+constexpr size_t StatOps    = 32;            // at least OP_NOPS
+constexpr size_t StatPairs  = GC_NKINDS;     // allocs[] slot for pairs
+constexpr size_t StatKinds  = GC_NKINDS + 1;
+// collection pauses under 10us, 100us, 1ms, 10ms, 100ms, and longer
+constexpr size_t StatPauses = 6;
+
+struct Stats
+{
+    uint64_t ops[StatOps];            // instructions dispatched
+    uint64_t allocs[StatKinds];       // objects allocated, by GcKind
+    uint64_t bytes_allocated;
+    uint64_t intern_hits;
+    uint64_t intern_misses;
+    uint64_t env_lookups;             // GETENV and SETENV
+    uint64_t env_depth;               // frames walked by those
+    uint64_t minor_collections;
+    uint64_t major_collections;
+    uint64_t minor_pauses[StatPauses];
+    uint64_t major_pauses[StatPauses];
+    uint64_t pause_ns;
+    uint64_t lex_bytes;               // input handed to the lexer
+    uint64_t lex_tokens;
+};
+
+// The calling thread's block. Threads that have not attached yet share
+// one, so the pointer is never null.
+extern __thread Stats* stats;
+
+inline void stat_add(uint64_t& counter, uint64_t n = 1)
+{
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void stats_attach_slow();
+// Gives the calling thread a block of its own; called where a thread's
+// interpreter, heap or lexer input is set up.
+inline void stats_attach()
+{
+    extern Stats stats_shared;
+    if (stats == &stats_shared) {
+        stats_attach_slow();
+    }
+}
+
+void stat_pause(uint64_t* pauses, uint64_t ns);
+
+// The sum over every thread, live or exited.
+Stats stats_total();
+void stats_report(FILE* out, const Stats& s);
@@ -0,0 +1,315 @@
+#include "table.h"
+#include <algorithm>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t  Group   = 16;
+constexpr uint8_t Empty   = 0x80;
+constexpr uint8_t Deleted = 0xfe;  // full slots have the top bit clear
+
+struct Slot
+{
+    Value key;
+    Value val;
+};
+
+} // namespace
+
+// `ctrl` and `slots` have `cap` entries, a power of two and a multiple
+// of Group; probing moves a whole group at a time.
+struct TabData
+{
+    size_t   cap     = 0;
+    size_t   count   = 0;
+    size_t   deleted = 0;
+    uint8_t* ctrl    = nullptr;
+    Slot*    slots   = nullptr;
+
+    ~TabData()
+    {
+        delete[] ctrl;
+        delete[] slots;
+    }
+};
+
+namespace {
+
+uint64_t hashvalue(Value key)
+{
+    uint64_t h = key.uval;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint8_t h2(uint64_t hash) { return hash & 0x7f; }
+inline size_t h1(uint64_t hash) { return hash >> 7; }
+
+// Bit j is set if control byte j of the group equals `b`.
+inline uint32_t match(const uint8_t* group, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i*) group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char) b)));
+#else
+    uint32_t m = 0;
+    for (size_t j = 0; j < Group; ++j) {
+        m |= (uint32_t) (group[j] == b) << j;
+    }
+    return m;
+#endif
+}
+
+// Empty or deleted: the control bytes with the top bit set.
+inline uint32_t matchfree(const uint8_t* group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+    uint32_t m = 0;
+    for (size_t j = 0; j < Group; ++j) {
+        m |= (uint32_t) (group[j] >> 7) << j;
+    }
+    return m;
+#endif
+}
+
+// Calls fn(index) for candidate slots of `hash` until it returns true
+// or an empty slot ends the chain; returns that index or SIZE_MAX.
+// Groups are visited in triangular order, which covers all of them.
+template <typename Fn>
+size_t probe(const TabData* t, uint64_t hash, Fn fn)
+{
+    size_t mask = t->cap / Group - 1;
+    size_t g = h1(hash) & mask;
+    for (size_t step = 1; step <= mask + 1; ++step) {
+        const uint8_t* group = t->ctrl + g * Group;
+        for (uint32_t m = match(group, h2(hash)); m; m &= m - 1) {
+            size_t index = g * Group + __builtin_ctz(m);
+            if (fn(index)) {
+                return index;
+            }
+        }
+        if (match(group, Empty)) {
+            return SIZE_MAX;
+        }
+        g = (g + step) & mask;
+    }
+    return SIZE_MAX;
+}
+
+size_t find(const TabData* t, Value key)
+{
+    if (t->count == 0) {
+        return SIZE_MAX;
+    }
+    return probe(t, hashvalue(key), [&](size_t j) { return t->slots[j].key.uval == key.uval; });
+}
+
+// First empty or deleted slot on the probe path of `hash`.
+size_t freeslot(const TabData* t, uint64_t hash)
+{
+    size_t mask = t->cap / Group - 1;
+    size_t g = h1(hash) & mask;
+    for (size_t step = 1;; ++step) {
+        uint32_t m = matchfree(t->ctrl + g * Group);
+        if (m) {
+            return g * Group + __builtin_ctz(m);
+        }
+        g = (g + step) & mask;
+    }
+}
+
+void allocate(TabData* t, size_t cap)
+{
+    t->cap   = cap;
+    t->ctrl  = new uint8_t[cap];
+    t->slots = new Slot[cap];
+    std::fill(t->ctrl, t->ctrl + cap, Empty);
+}
+
+// Rebuilds at `cap` slots, which also clears the tombstones.
+void rehash(TabData* t, size_t cap)
+{
+    TabData old;
+    std::swap(old.cap, t->cap);
+    std::swap(old.ctrl, t->ctrl);
+    std::swap(old.slots, t->slots);
+    allocate(t, cap);
+    t->deleted = 0;
+    for (size_t j = 0; j < old.cap; ++j) {
+        if (!(old.ctrl[j] & 0x80)) {
+            uint64_t hash = hashvalue(old.slots[j].key);
+            size_t i = freeslot(t, hash);
+            t->ctrl[i]  = h2(hash);
+            t->slots[i] = old.slots[j];
+        }
+    }
+}
+
+// A table fills to 7/8, counting tombstones.
+size_t capacityfor(size_t n)
+{
+    size_t cap = Group;
+    while (cap * 7 / 8 < n) {
+        cap *= 2;
+    }
+    return cap;
+}
+
+TabData* todata(Value tab) { return unsafe_totab(tab)->data; }
+
+struct Live
+{
+    uint32_t handle;
+    TabData* data;
+};
+
+// Per thread, like ports: the data of every live table, freed at thread
+// exit or once its table is collected.
+struct Tables
+{
+    std::vector<Live> live;
+    bool              registered = false;
+
+    ~Tables()
+    {
+        for (const Live& l : live) {
+            delete l.data;
+        }
+    }
+};
+
+thread_local Tables tables;
+
+void sweep(void*, bool)
+{
+    auto dead = [](const Live& l) {
+        if (gc_isalive(l.handle)) {
+            return false;
+        }
+        delete l.data;
+        return true;
+    };
+    tables.live.erase(std::remove_if(tables.live.begin(), tables.live.end(), dead), tables.live.end());
+}
+
+} // namespace
+
+void tab_trace(const Table* tab, GcVisitFn visit)
+{
+    const TabData* t = tab->data;
+    for (size_t j = 0; j < t->cap; ++j) {
+        if (!(t->ctrl[j] & 0x80)) {
+            visit(t->slots[j].key);
+            visit(t->slots[j].val);
+        }
+    }
+}
+
+Value tab_new(size_t hint)
+{
+    if (!tables.registered) {
+        gc_addweak(sweep, nullptr);
+        tables.registered = true;
+    }
+    Table* tab = (Table*) gc_alloc(GC_TABLE, sizeof(Table));
+    tab->data = new TabData;
+    allocate(tab->data, capacityfor(hint));
+    tables.live.push_back(Live{tab->handle, tab->data});
+    return mkref(LV_TAB, tab->handle);
+}
+
+bool tab_get(Value tab, Value key, Value& out)
+{
+    const TabData* t = todata(tab);
+    size_t j = find(t, key);
+    if (j == SIZE_MAX) {
+        return false;
+    }
+    out = t->slots[j].val;
+    return true;
+}
+
+void tab_set(Value tab, Value key, Value v)
+{
+    Table* obj = unsafe_totab(tab);
+    TabData* t = obj->data;
+    size_t j = find(t, key);
+    if (j != SIZE_MAX) {
+        t->slots[j].val = v;
+    } else {
+        if ((t->count + t->deleted + 1) > t->cap * 7 / 8) {
+            // mostly tombstones: clean up in place, otherwise grow
+            rehash(t, capacityfor(t->count + 1) > t->cap ? t->cap * 2 : t->cap);
+        }
+        uint64_t hash = hashvalue(key);
+        j = freeslot(t, hash);
+        if (t->ctrl[j] == Deleted) {
+            --t->deleted;
+        }
+        t->ctrl[j]  = h2(hash);
+        t->slots[j] = Slot{key, v};
+        ++t->count;
+    }
+    // not gc_barrier: a minor collection would trace every slot again
+    gc_valuebarrier(obj, key);
+    gc_valuebarrier(obj, v);
+}
+
+bool tab_remove(Value tab, Value key)
+{
+    TabData* t = todata(tab);
+    size_t j = find(t, key);
+    if (j == SIZE_MAX) {
+        return false;
+    }
+    // a group with an empty slot ends every probe that reaches it, so
+    // the slot can go back to empty
+    const uint8_t* group = t->ctrl + j / Group * Group;
+    if (match(group, Empty)) {
+        t->ctrl[j] = Empty;
+    } else {
+        t->ctrl[j] = Deleted;
+        ++t->deleted;
+    }
+    t->slots[j] = Slot{mknil(), mknil()};
+    --t->count;
+    return true;
+}
+
+size_t tab_count(Value tab) { return todata(tab)->count; }
+
+TabData* tab_newdata(const std::vector<Value>& entries)
+{
+    TabData* t = new TabData;
+    allocate(t, capacityfor(entries.size() / 2));
+    for (size_t j = 0; j + 1 < entries.size(); j += 2) {
+        uint64_t hash = hashvalue(entries[j]);
+        size_t i = freeslot(t, hash);
+        t->ctrl[i]  = h2(hash);
+        t->slots[i] = Slot{entries[j], entries[j + 1]};
+        ++t->count;
+    }
+    return t;
+}
+
+void tab_freedata(TabData* t) { delete t; }
+
+void tab_entries(Value tab, std::vector<Value>& out)
+{
+    const TabData* t = todata(tab);
+    for (size_t j = 0; j < t->cap; ++j) {
+        if (!(t->ctrl[j] & 0x80)) {
+            out.push_back(t->slots[j].key);
+            out.push_back(t->slots[j].val);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "value.h"
+
+//----------------------------------------------------------
+// Hash tables (LV_TAB). Open addressing in the style of a
+// Swiss table: a control byte per slot holds 7 bits of the
+// key's hash, or marks the slot empty or deleted, and a
+// probe compares a group of 16 control bytes at once with
+// one SSE2 compare. Only slots whose control byte matches
+// are looked at.
+//
+// Keys are compared by their Value bits (eqv?), so fixnums,
+// symbols (short ones are immediates, long ones interned)
+// and booleans hash and compare without touching the heap.
+// Strings are keys by identity.
+//
+// Like a port's buffer, the slots live outside the
+// collected heap: the GC_TABLE object only points at them,
+// the collector traces them through it, and a weak callback
+// frees them once the table is collected.
+//----------------------------------------------------------
+
+// May run a collection.
+Value tab_new(size_t hint = 0);
+// Returns false if `key` is absent.
+bool tab_get(Value tab, Value key, Value& out);
+void tab_set(Value tab, Value key, Value v);
+// Returns false if `key` was absent.
+bool tab_remove(Value tab, Value key);
+size_t tab_count(Value tab);
+// Appends every key and its value, in slot order: key, value, key, ...
+void tab_entries(Value tab, std::vector<Value>& out);
+// For frozen tables (see freeze.h): slots holding `entries`, laid out
+// as tab_entries does, that belong to the caller rather than to a
+// thread's heap, and are released with tab_freedata.
+struct TabData* tab_newdata(const std::vector<Value>& entries);
+void tab_freedata(struct TabData* t);
+
+// For the collector: visits every key and value.
+void tab_trace(const Table* tab, GcVisitFn visit);
@@ -0,0 +1,504 @@
+#include "transfer.h"
+#include "table.h"
+#include "uvec.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <utility>
+
+// Packet layout: 'X' and the sender's vm_id(), then values. A value is
+// a one-byte tag and its payload; prototype ('P') and global ('G')
+// records may come before any value and are consumed on the way.
+//
+//   'i' int32  'd' double  'n' '()  't' #t  'f' #f  'b' builtin id
+//   's' len bytes (string)  'y' len bytes (symbol)
+//   'l' n item*n tail          list of n pairs
+//   'h' n (key value)*n        hash table
+//   'v' type len element*len   numeric vector
+//   'c' proto env              closure; env is '()', 'e' or 'E'
+//   'e' n parent slot*n        environment; 'E' k refers back to the
+//                              k-th one of the packet
+//   'P' id index len body      prototype `index` of the sender
+//   'G' sym value              global definition
+
+namespace {
+
+void put32(std::string& out, uint32_t x) { out.append((const char*) &x, 4); }
+void put64(std::string& out, uint64_t x) { out.append((const char*) &x, 8); }
+
+void putbytes(std::string& out, char tag, std::string_view s)
+{
+    out += tag;
+    put32(out, s.size());
+    out.append(s);
+}
+
+const char* const ArithNames[] = { "+", "-", "*", "<", "=", ">" };
+
+// Globals referenced by the code of `p`, not including its children.
+std::vector<Value> globalsof(const Proto* p)
+{
+    std::vector<Value> syms;
+    for (size_t pc = 0; pc < p->code.size(); ++pc) {
+        uint32_t i = p->code[pc];
+        switch (getop(i)) {
+            case OP_GETGLOBAL:
+            case OP_SETGLOBAL:
+                syms.push_back(p->consts[getbx(i)]);
+                break;
+            case OP_CALLG:
+            case OP_TAILCALLG:
+                syms.push_back(p->sites[p->code[++pc]].sym);
+                break;
+            case OP_ADD: case OP_SUB: case OP_MUL:
+            case OP_LT:  case OP_EQ:  case OP_GT:
+                syms.push_back(mksym(ArithNames[getop(i) - OP_ADD]));
+                break;
+            default:
+                break;
+        }
+    }
+    return syms;
+}
+
+// Lists and tables nest on the C stack of both sides, so the depth of
+// their nesting is bounded. Past TrackDepth the ones being packed are
+// kept in Packer::open_: a cycle through them nests without end, and is
+// caught on its next time around.
+constexpr int TrackDepth = 64;
+constexpr int MaxDepth   = 4000;
+
+// Prototypes this thread already unpacked, by sender and sender index.
+thread_local std::map<std::pair<uint64_t, uint32_t>, uint32_t> received;
+
+}
+
+Packer::Packer()
+{
+    out_ += 'X';
+    put64(out_, vm_id());
+}
+
+bool Packer::pack(Value v, std::string& err)
+{
+    return packvalue(v, 0, err);
+}
+
+bool Packer::packvalue(Value v, int depth, std::string& err)
+{
+    if (isdouble(v)) {
+        out_ += 'd';
+        put64(out_, v.uval);
+        return true;
+    }
+    switch (totag(v)) {
+        case LV_INT:
+            out_ += 'i';
+            put32(out_, v.b.lo);
+            return true;
+        case LV_NIL:   out_ += 'n'; return true;
+        case LV_TRUE:  out_ += 't'; return true;
+        case LV_FALSE: out_ += 'f'; return true;
+        case LV_STR:
+            putbytes(out_, 's', strview(v));
+            return true;
+        case LV_SYM:
+            putbytes(out_, 'y', strview(v));
+            return true;
+        case LV_PAIR:
+        case LV_TAB:
+            return packnested(v, depth, err);
+        case LV_UVEC: {
+            uint8_t type = unsafe_touvec(v)->type;
+            out_ += 'v';
+            out_ += (char) type;
+            put32(out_, uvec_len(v));
+            out_.append((const char*) uvec_u8(v), uvec_len(v) * uvec_elemsize(type));
+            return true;
+        }
+        case LV_FUN: {
+            if (isbuiltin(v)) {
+                out_ += 'b';
+                put32(out_, unsafe_tobuiltin(v));
+                return true;
+            }
+            const Closure* cl = unsafe_toclosure(v);
+            if (!vm_closureproto(cl)) {
+                err = "cannot send a procedure that outlived its request";
+                return false;
+            }
+            uint32_t index = cl->proto;
+            Value env = cl->env;
+            if (!packproto(index, err)) {
+                return false;
+            }
+            out_ += 'c';
+            put32(out_, protos_[index] - 1);
+            return packenv(env, err);
+        }
+        default:
+            err = "cannot send " + valprint(v) + " to another thread";
+            return false;
+    }
+}
+
+bool Packer::packnested(Value v, int depth, std::string& err)
+{
+    if (depth == MaxDepth) {
+        err = "cannot send a structure nested this deeply";
+        return false;
+    }
+    bool track = depth >= TrackDepth;
+    if (track && !open_.insert(v.uval).second) {
+        err = "cannot send a cyclic structure";
+        return false;
+    }
+    bool ok = ispair(v) ? packlist(v, depth, err) : packtable(v, depth, err);
+    if (track) {
+        open_.erase(v.uval);
+    }
+    return ok;
+}
+
+bool Packer::packlist(Value v, int depth, std::string& err)
+{
+    std::vector<Value> items;
+    // a cycle through the cdrs: `slow` follows at half the speed
+    Value slow = v;
+    for (size_t n = 0; ispair(v); ++n) {
+        items.push_back(unsafe_topair(v)->car);
+        v = unsafe_topair(v)->cdr;
+        if (n % 2) {
+            slow = unsafe_topair(slow)->cdr;
+        }
+        if (v.uval == slow.uval && ispair(v)) {
+            err = "cannot send a cyclic structure";
+            return false;
+        }
+    }
+    out_ += 'l';
+    put32(out_, items.size());
+    for (Value item : items) {
+        if (!packvalue(item, depth + 1, err)) {
+            return false;
+        }
+    }
+    return packvalue(v, depth + 1, err);
+}
+
+bool Packer::packtable(Value v, int depth, std::string& err)
+{
+    std::vector<Value> entries;
+    tab_entries(v, entries);
+    out_ += 'h';
+    put32(out_, entries.size() / 2);
+    for (Value x : entries) {
+        if (!packvalue(x, depth + 1, err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Packer::packproto(uint32_t index, std::string& err)
+{
+    if (index < protos_.size() && protos_[index]) {
+        return true;
+    }
+    const Proto* p = vm_proto(index);
+    // mark it first: the globals below may refer back to it
+    if (index >= protos_.size()) {
+        protos_.resize(index + 1);
+    }
+    uint32_t id = nprotos_++;
+    protos_[index] = id + 1;
+    for (uint32_t child : p->protos) {
+        if (!packproto(child, err)) {
+            return false;
+        }
+    }
+
+    out_ += 'P';
+    put32(out_, id);
+    put32(out_, index);
+    size_t lenat = out_.size();
+    put32(out_, 0);
+    put32(out_, p->nparams);
+    put32(out_, p->rest);
+    put32(out_, p->nregs);
+    if (!pack(p->name, err)) {
+        return false;
+    }
+    put32(out_, p->code.size());
+    out_.append((const char*) p->code.data(), p->code.size() * sizeof(uint32_t));
+    put32(out_, p->consts.size());
+    for (Value k : p->consts) {
+        if (!pack(k, err)) {
+            return false;
+        }
+    }
+    put32(out_, p->protos.size());
+    for (uint32_t child : p->protos) {
+        put32(out_, protos_[child] - 1);
+    }
+    put32(out_, p->sites.size());
+    for (const CallSite& site : p->sites) {
+        pack(site.sym, err);
+        put32(out_, site.pc);
+    }
+    uint32_t len = out_.size() - lenat - 4;
+    memcpy(&out_[lenat], &len, 4);
+
+    for (Value sym : globalsof(p)) {
+        uint64_t h = tohandle(sym);
+        Value v;
+        if (std::find(globals_.begin(), globals_.end(), h) != globals_.end() || !vm_getglobal(sym, v)) {
+            continue;
+        }
+        globals_.push_back(h);
+        out_ += 'G';
+        pack(sym, err);
+        if (!pack(v, err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Packer::packenv(Value env, std::string& err)
+{
+    if (isnil(env)) {
+        out_ += 'n';
+        return true;
+    }
+    uint64_t h = tohandle(env);
+    auto it = std::find(envs_.begin(), envs_.end(), h);
+    if (it != envs_.end()) {
+        out_ += 'E';
+        put32(out_, it - envs_.begin());
+        return true;
+    }
+    envs_.push_back(h);
+    const Env* e = vm_env(env);
+    uint32_t n = e->n;
+    out_ += 'e';
+    put32(out_, n);
+    if (!packenv(e->parent, err)) {
+        return false;
+    }
+    for (uint32_t j = 0; j < n; ++j) {
+        // re-fetch: handles stay put but keep this independent of that
+        e = vm_env(env);
+        if (!pack(e->slots[j], err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Unpacker::Unpacker(const char* data, size_t len)
+    : p_(data)
+    , end_(data + len)
+{
+    vm_init();
+    assert(len >= 9 && *p_ == 'X');
+    ++p_;
+    origin_ = get64();
+    gc_addroots(visit, this);
+}
+
+Unpacker::~Unpacker() { gc_removeroots(visit, this); }
+
+void Unpacker::visit(void* ctx, GcVisitFn fn)
+{
+    for (Value v : ((Unpacker*) ctx)->roots_) {
+        fn(v);
+    }
+}
+
+uint32_t Unpacker::get32()
+{
+    uint32_t x;
+    memcpy(&x, p_, 4);
+    p_ += 4;
+    return x;
+}
+
+uint64_t Unpacker::get64()
+{
+    uint64_t x;
+    memcpy(&x, p_, 8);
+    p_ += 8;
+    return x;
+}
+
+Value Unpacker::unpack()
+{
+    Value v = value();
+    roots_.push_back(v);
+    return v;
+}
+
+Value Unpacker::value()
+{
+    for (;;) {
+        char tag = *p_++;
+        switch (tag) {
+            case 'P': proto(); continue;
+            case 'G': global(); continue;
+            case 'i': return mkint((int) get32());
+            case 'd': { Value v; v.uval = get64(); return v; }
+            case 'n': return mknil();
+            case 't': return mktrue();
+            case 'f': return mkfalse();
+            case 'b': return mkbuiltin(get32());
+            case 's':
+            case 'y': {
+                uint32_t len = get32();
+                const char* s = p_;
+                p_ += len;
+                return tag == 's' ? mkstr(s, len) : mksym(s, len);
+            }
+            case 'l': {
+                uint32_t n = get32();
+                size_t first = roots_.size();
+                for (uint32_t j = 0; j < n; ++j) {
+                    roots_.push_back(value());
+                }
+                Value tail = value();
+                roots_.push_back(tail);
+                Value list = mklist(roots_.data() + first, n, tail);
+                roots_.resize(first);
+                return list;
+            }
+            case 'v': {
+                UvecType type = (UvecType) *p_++;
+                uint32_t n = get32();
+                Value v = uvec_new(type, n);
+                memcpy(uvec_u8(v), p_, n * uvec_elemsize(type));
+                p_ += n * uvec_elemsize(type);
+                return v;
+            }
+            case 'h': {
+                uint32_t n = get32();
+                Value tab = tab_new(n);
+                roots_.push_back(tab);
+                for (uint32_t j = 0; j < n; ++j) {
+                    Value key = value();
+                    roots_.push_back(key);
+                    Value v = value();
+                    roots_.pop_back();
+                    tab_set(tab, key, v);
+                }
+                roots_.pop_back();
+                return tab;
+            }
+            case 'c': {
+                uint32_t proto = protos_[get32()];
+                Value env = value();
+                roots_.push_back(env);
+                Closure* cl = (Closure*) gc_alloc(GC_CLOSURE, sizeof(Closure));
+                roots_.pop_back();
+                cl->proto = proto;
+                cl->epoch = vm_proto(proto)->epoch;
+                cl->env   = env;
+                gc_barrier(cl, env);
+                return mkref(LV_FUN, cl->handle);
+            }
+            case 'e': {
+                uint32_t n = get32();
+                Env* e = (Env*) gc_alloc(GC_ENV, sizeof(Env) + sizeof(Value) * n);
+                e->n = n;
+                e->parent = mknil();
+                for (uint32_t j = 0; j < n; ++j) {
+                    e->slots[j] = mknil();
+                }
+                Value env = mkref(LV_UDATA, e->handle);
+                envs_.push_back(env);
+                roots_.push_back(env);
+                Value parent = value();
+                e = (Env*) gc_deref(tohandle(env));
+                e->parent = parent;
+                gc_barrier(e, parent);
+                for (uint32_t j = 0; j < n; ++j) {
+                    Value v = value();
+                    e = (Env*) gc_deref(tohandle(env));
+                    e->slots[j] = v;
+                    gc_barrier(e, v);
+                }
+                return env;
+            }
+            case 'E': return envs_[get32()];
+            default:
+                assert(0 && "corrupt packet");
+                return mknil();
+        }
+    }
+}
+
+void Unpacker::proto()
+{
+    uint32_t id    = get32();
+    uint32_t index = get32();
+    uint32_t len   = get32();
+    // ids are given out parent first but children are sent first
+    if (id >= protos_.size()) {
+        protos_.resize(id + 1);
+    }
+    if (origin_ == vm_id()) {
+        // our own
+        protos_[id] = index;
+        p_ += len;
+        return;
+    }
+    auto key = std::make_pair(origin_, index);
+    auto it = received.find(key);
+    if (it != received.end()) {
+        protos_[id] = it->second;
+        p_ += len;
+        return;
+    }
+
+    // roots_ keeps the constants alive until the VM does
+    size_t first = roots_.size();
+    Proto* p = new Proto;
+    p->nparams = get32();
+    p->rest    = get32();
+    p->nregs   = get32();
+    p->name    = value();
+    roots_.push_back(p->name);
+    p->code.resize(get32());
+    memcpy(p->code.data(), p_, p->code.size() * sizeof(uint32_t));
+    p_ += p->code.size() * sizeof(uint32_t);
+    p->consts.resize(get32());
+    for (Value& k : p->consts) {
+        k = value();
+        roots_.push_back(k);
+    }
+    p->protos.resize(get32());
+    for (uint32_t& child : p->protos) {
+        child = protos_[get32()];
+    }
+    p->sites.resize(get32());
+    for (CallSite& site : p->sites) {
+        site.sym = value();
+        roots_.push_back(site.sym);
+        site.pc  = get32();
+    }
+    uint32_t local = vm_addproto(p);
+    roots_.resize(first);
+    received[key] = local;
+    protos_[id] = local;
+}
+
+void Unpacker::global()
+{
+    Value sym = value();
+    roots_.push_back(sym);
+    Value v = value();
+    roots_.pop_back();
+    if (origin_ != vm_id()) {
+        vm_setglobal(sym, v);
+    }
+}
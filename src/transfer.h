@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "value.h"
+
+//----------------------------------------------------------
+// Copying values between interpreters. A Value is only
+// meaningful to the thread whose heap it points into (see
+// isolate.h), so anything sent to another thread is packed
+// into a flat byte string and unpacked there into fresh
+// objects.
+//
+// Data is copied structurally: lists and hash tables as
+// trees (sharing is not preserved, and a cyclic structure
+// cannot be sent), strings and
+// numeric vectors by value, symbols by name. A procedure
+// takes its prototypes along, with every global its code
+// refers to, so a closure calling helpers defined at top
+// level works on the other side. Captured environments are
+// copied with their sharing intact; they are not shared
+// with the original, so the copies are only equivalent for
+// procedures that do not mutate state.
+//----------------------------------------------------------
+
+class Packer
+{
+public:
+    Packer();
+
+    // Appends `v`. Returns false with `err` set if `v` holds something
+    // that cannot leave its thread.
+    bool pack(Value v, std::string& err);
+
+    const std::string& data() const { return out_; }
+
+private:
+    bool packvalue(Value v, int depth, std::string& err);
+    bool packnested(Value v, int depth, std::string& err);
+    bool packlist(Value v, int depth, std::string& err);
+    bool packtable(Value v, int depth, std::string& err);
+    bool packproto(uint32_t index, std::string& err);
+    bool packenv(Value env, std::string& err);
+
+    std::string           out_;
+    std::vector<uint32_t> protos_;  // prototype vm index -> packet id + 1
+    uint32_t              nprotos_ = 0;
+    std::vector<uint64_t> envs_;    // handles of the environments already sent
+    std::vector<uint64_t> globals_; // symbol handles already sent
+    std::unordered_set<uint64_t> open_;  // lists and tables being packed, see packnested
+};
+
+class Unpacker
+{
+public:
+    // `data` must outlive the Unpacker. Everything unpacked stays
+    // reachable from roots until the Unpacker is destroyed.
+    Unpacker(const char* data, size_t len);
+    ~Unpacker();
+    Unpacker(const Unpacker&) = delete;
+    Unpacker& operator=(const Unpacker&) = delete;
+
+    bool done() const { return p_ == end_; }
+    // Unpacks the next value packed by Packer::pack().
+    Value unpack();
+
+private:
+    Value    value();
+    void     proto();
+    void     global();
+    uint32_t get32();
+    uint64_t get64();
+    static void visit(void* ctx, GcVisitFn fn);
+
+    const char*           p_;
+    const char*           end_;
+    uint64_t              origin_;
+    std::vector<uint32_t> protos_; // packet id -> local vm index
+    std::vector<Value>    envs_;   // packet id -> copy
+    std::vector<Value>    roots_;
+};
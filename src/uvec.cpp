@@ -0,0 +1,109 @@
+#include "uvec.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+Value uvec_new(UvecType type, size_t n)
+{
+    assert(n <= UINT32_MAX);
+    Uvec* u = (Uvec*) gc_alloc(GC_UVEC, sizeof(Uvec) + uvec_elemsize(type) * n);
+    u->len  = n;
+    u->type = type;
+    return mkref(LV_UVEC, u->handle);
+}
+
+#ifdef __AVX2__
+namespace {
+
+// Four independent accumulators, 16 doubles a round, to cover the
+// latency of the adds.
+template <typename Load>
+double reduce(size_t n, Load load)
+{
+    __m256d a0 = _mm256_setzero_pd();
+    __m256d a1 = _mm256_setzero_pd();
+    __m256d a2 = _mm256_setzero_pd();
+    __m256d a3 = _mm256_setzero_pd();
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        a0 = _mm256_add_pd(a0, load(j));
+        a1 = _mm256_add_pd(a1, load(j + 4));
+        a2 = _mm256_add_pd(a2, load(j + 8));
+        a3 = _mm256_add_pd(a3, load(j + 12));
+    }
+    for (; j + 4 <= n; j += 4) {
+        a0 = _mm256_add_pd(a0, load(j));
+    }
+    __m256d a = _mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3));
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+} // namespace
+
+double f64_sum(const double* x, size_t n)
+{
+    double sum = reduce(n, [x](size_t j) { return _mm256_loadu_pd(x + j); });
+    for (size_t j = n & ~size_t(3); j < n; ++j) {
+        sum += x[j];
+    }
+    return sum;
+}
+
+double f64_dot(const double* x, const double* y, size_t n)
+{
+    double sum = reduce(n, [x, y](size_t j) { return _mm256_mul_pd(_mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j)); });
+    for (size_t j = n & ~size_t(3); j < n; ++j) {
+        sum += x[j] * y[j];
+    }
+    return sum;
+}
+#else
+double f64_sum(const double* x, size_t n)
+{
+    double sum = 0.0;
+    for (size_t j = 0; j < n; ++j) {
+        sum += x[j];
+    }
+    return sum;
+}
+
+double f64_dot(const double* x, const double* y, size_t n)
+{
+    double sum = 0.0;
+    for (size_t j = 0; j < n; ++j) {
+        sum += x[j] * y[j];
+    }
+    return sum;
+}
+#endif
+
+// Integer addition is associative, so this one vectorizes as written.
+int64_t s32_sum(const int32_t* x, size_t n)
+{
+    int64_t sum = 0;
+    for (size_t j = 0; j < n; ++j) {
+        sum += x[j];
+    }
+    return sum;
+}
+
+void f64_map(UvecOp op, double* x, const double* y, size_t n)
+{
+    switch (op) {
+        case UV_ADD: for (size_t j = 0; j < n; ++j) x[j] += y[j]; break;
+        case UV_SUB: for (size_t j = 0; j < n; ++j) x[j] -= y[j]; break;
+        case UV_MUL: for (size_t j = 0; j < n; ++j) x[j] *= y[j]; break;
+        case UV_DIV: for (size_t j = 0; j < n; ++j) x[j] /= y[j]; break;
+    }
+}
+
+void f64_mapscalar(UvecOp op, double* x, double y, size_t n)
+{
+    switch (op) {
+        case UV_ADD: for (size_t j = 0; j < n; ++j) x[j] += y; break;
+        case UV_SUB: for (size_t j = 0; j < n; ++j) x[j] -= y; break;
+        case UV_MUL: for (size_t j = 0; j < n; ++j) x[j] *= y; break;
+        case UV_DIV: for (size_t j = 0; j < n; ++j) x[j] /= y; break;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "value.h"
+
+//----------------------------------------------------------
+// Homogeneous numeric vectors (SRFI 4): bytevector,
+// s32vector and f64vector. The elements are a plain C array
+// inside the heap object, 1, 4 or 8 bytes each with no
+// boxing, so a million doubles take 8 MB plus a 16-byte
+// header. Big vectors are allocated straight into the old
+// generation and are only moved by a major collection.
+//
+// The bulk operations run over the raw array. The
+// floating-point reductions use explicit AVX2 kernels with
+// several accumulators, because the compiler may not
+// reorder a floating-point sum by itself; the elementwise
+// operations are simple loops the compiler vectorizes.
+// There is a scalar fallback for targets without AVX2.
+//----------------------------------------------------------
+
+// A zero-filled vector. May run a collection.
+Value uvec_new(UvecType type, size_t n);
+inline size_t uvec_len(Value v) { return unsafe_touvec(v)->len; }
+// Valid until the next allocation, like any object pointer.
+inline uint8_t* uvec_u8(Value v) { return (uint8_t*) unsafe_touvec(v)->data; }
+inline int32_t* uvec_s32(Value v) { return (int32_t*) unsafe_touvec(v)->data; }
+inline double* uvec_f64(Value v) { return (double*) unsafe_touvec(v)->data; }
+
+enum UvecOp {
+    UV_ADD,
+    UV_SUB,
+    UV_MUL,
+    UV_DIV,
+};
+
+// The kernels. The reductions add in a different order than a
+// left-to-right loop, so their results can differ in the last bits.
+double f64_sum(const double* x, size_t n);
+double f64_dot(const double* x, const double* y, size_t n);
+int64_t s32_sum(const int32_t* x, size_t n);
+// x[i] = x[i] op y[i]; `y` may be `x`.
+void f64_map(UvecOp op, double* x, const double* y, size_t n);
+// x[i] = x[i] op y
+void f64_mapscalar(UvecOp op, double* x, double y, size_t n);
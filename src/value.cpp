@@ -1 +1,275 @@
 #include "value.h"
+#include "intern.h"
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+// NOTE: `str` must not point into the collected heap, the allocation
+// below may move it.
+Value mkstr(const char* str, size_t len)
+{
+    if (len <= ShortStrMax) {
+        return mkshort(LV_STR, str, len);
+    }
+    String* s = (String*) gc_alloc(GC_STRING, sizeof(String) + len + 1);
+    s->len  = len;
+    s->hash = strhash(str, len);
+    memcpy(&s->str[0], str, len);
+    s->str[len] = '\0';
+    return mkref(LV_STR, s->handle);
+}
+
+Value mksym(const char* str, size_t len)
+{
+    return len <= ShortStrMax ? mkshort(LV_SYM, str, len) : mkref(LV_SYM, strintern(str, len));
+}
+
+Value mkistr(const char* str, size_t len)
+{
+    return len <= ShortStrMax ? mkshort(LV_STR, str, len) : mkref(LV_STR, strintern(str, len));
+}
+
+Value mkpair(Value car, Value cdr)
+{
+    gc_pushroot(car);
+    gc_pushroot(cdr);
+    gc_reservepairs(1);
+    gc_poproot(2);
+    return mkref(LV_PAIR, gc_newpair(car, cdr));
+}
+
+// One collection check for the whole list, and the cells are taken in
+// list order so a fresh list walks forward through consecutive slots.
+Value mklist(const Value* items, size_t n, Value tail)
+{
+    if (n == 0) {
+        return tail;
+    }
+    gc_reservepairs(n);
+    uint32_t first = gc_newpair(items[0], mknil());
+    uint32_t last  = first;
+    for (size_t i = 1; i < n; ++i) {
+        uint32_t next = gc_newpair(items[i], mknil());
+        gc_pair(last)->cdr = mkref(LV_PAIR, next);
+        last = next;
+    }
+    gc_pair(last)->cdr = tail;
+    gc_pairbarrier(last, tail);
+    return mkref(LV_PAIR, first);
+}
+
+// The shortest digits that read back as `d`, in fixed notation unless
+// the exponent is outside [-7, 21): 100.0, 1e-08, 1e+21. NaN and the
+// infinities use the R7RS spellings.
+static void printdouble(std::string& out, double d)
+{
+    if (d != d) {
+        out += "+nan.0";
+        return;
+    }
+    if (std::isinf(d)) {
+        out += d > 0 ? "+inf.0" : "-inf.0";
+        return;
+    }
+    char buf[32];
+    int prec = 1;
+    for (; prec < 17; ++prec) {
+        snprintf(buf, sizeof(buf), "%.*e", prec - 1, d);
+        if (strtod(buf, nullptr) == d) {
+            break;
+        }
+    }
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, d);
+    int exp = atoi(strchr(buf, 'e') + 1);
+    if (exp < -7 || exp >= 21) {
+        // "%g" drops the trailing zeros "%e" keeps
+        snprintf(buf, sizeof(buf), "%.*g", prec, d);
+        out += buf;
+        return;
+    }
+    // the same decimal place as the digits above, so the same rounding
+    snprintf(buf, sizeof(buf), "%.*f", std::max(0, prec - 1 - exp), d);
+    out += buf;
+    if (!strchr(buf, '.')) {
+        out += ".0";
+    }
+}
+
+static void printstr(std::string& out, std::string_view s, bool write)
+{
+    if (!write) {
+        out.append(s);
+        return;
+    }
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\t': out += "\\t";  break;
+            default:   out += c;      break;
+        }
+    }
+    out += '"';
+}
+
+// SRFI 4 syntax: #u8(1 2), #s32(-1 2), #f64(1.5 2.0)
+static void printuvec(std::string& out, Value v)
+{
+    const char* prefix[] = { "#u8(", "#s32(", "#f64(" };
+    const Uvec* u = unsafe_touvec(v);
+    out += prefix[u->type];
+    for (uint32_t j = 0; j < u->len; ++j) {
+        if (j > 0) {
+            out += ' ';
+        }
+        switch (u->type) {
+            case UV_U8:  out += std::to_string(((const uint8_t*) u->data)[j]); break;
+            case UV_S32: out += std::to_string(((const int32_t*) u->data)[j]); break;
+            case UV_F64: printdouble(out, ((const double*) u->data)[j]); break;
+        }
+    }
+    out += ')';
+}
+
+static void printatom(std::string& out, Value v, bool write)
+{
+    switch (totag(v)) {
+        case 0:        printdouble(out, unsafe_todouble(v)); break;
+        case LV_INT:   out += std::to_string(unsafe_toint(v)); break;
+        case LV_NIL:   out += "()"; break;
+        case LV_TRUE:  out += "#t"; break;
+        case LV_FALSE: out += "#f"; break;
+        case LV_STR:   printstr(out, strview(v), write); break;
+        case LV_SYM:   printstr(out, strview(v), false); break;
+        case LV_FUN:   out += "#<procedure>"; break;
+        case LV_PORT:  out += "#<port>"; break;
+        case LV_TAB:   out += "#<hash-table>"; break;
+        case LV_UVEC:  printuvec(out, v); break;
+        default:       out += "#<unknown>"; break;
+    }
+}
+
+// Pairs a plain walk of the structure visits before it is taken to
+// possibly be cyclic.
+constexpr size_t AcyclicWalk = 1 << 16;
+
+// Pairs that are reached again from inside themselves, which get datum
+// labels: #0=(1 . #0#). Most structures are small trees, told apart by
+// a bounded walk without a visited set; shared structure only costs
+// that walk extra visits. Otherwise a depth first search finds the back
+// edges. Unlabelled pairs map to -1.
+static void findcycles(Value v, std::unordered_map<uint64_t, int>& labels)
+{
+    std::vector<Value> stack;
+    size_t walked = 0;
+    for (stack.push_back(v); !stack.empty() && walked <= AcyclicWalk;) {
+        Value w = stack.back();
+        stack.pop_back();
+        for (; ispair(w) && walked <= AcyclicWalk; ++walked) {
+            const Pair* p = unsafe_topair(w);
+            if (ispair(p->car)) {
+                stack.push_back(p->car);
+            }
+            w = p->cdr;
+        }
+    }
+    if (walked <= AcyclicWalk) {
+        return;
+    }
+
+    // ONPATH until both of its fields are searched
+    enum { ONPATH, DONE };
+    std::unordered_map<uint64_t, int> state;
+    std::vector<std::pair<Value, int>> path;  // pair, fields searched
+    auto enter = [&](Value w) {
+        if (!ispair(w)) {
+            return;
+        }
+        auto it = state.emplace(w.uval, ONPATH);
+        if (it.second) {
+            path.emplace_back(w, 0);
+        } else if (it.first->second == ONPATH) {
+            labels.emplace(w.uval, -1);
+        }
+    };
+    enter(v);
+    while (!path.empty()) {
+        auto& top = path.back();
+        const Pair* p = unsafe_topair(top.first);
+        if (top.second == 2) {
+            state[top.first.uval] = DONE;
+            path.pop_back();
+            continue;
+        }
+        enter(top.second++ == 0 ? p->car : p->cdr);
+    }
+}
+
+// Lists nest on a stack of their own rather than the C stack, since a
+// list can be nested as deeply as the heap allows.
+static void printvalue(std::string& out, Value v, bool write)
+{
+    std::unordered_map<uint64_t, int> labels;
+    if (ispair(v)) {
+        findcycles(v, labels);
+    }
+    int nextlabel = 0;
+
+    struct Open
+    {
+        Value pair;  // whose car was printed last
+        bool  tail;  // its dotted tail was
+    };
+    std::vector<Open> open;
+    for (;;) {
+        // print the datum `v`, or open it
+        auto label = ispair(v) && !labels.empty() ? labels.find(v.uval) : labels.end();
+        if (label != labels.end() && label->second >= 0) {
+            out += '#' + std::to_string(label->second) + '#';
+        } else if (ispair(v)) {
+            if (label != labels.end()) {
+                label->second = nextlabel++;
+                out += '#' + std::to_string(label->second) + '=';
+            }
+            out += '(';
+            open.push_back({ v, false });
+            v = unsafe_topair(v)->car;
+            continue;
+        } else {
+            printatom(out, v, write);
+        }
+
+        // then close the lists it ends, up to one that goes on
+        for (;;) {
+            if (open.empty()) {
+                return;
+            }
+            Open& o = open.back();
+            Value rest = unsafe_topair(o.pair)->cdr;
+            if (o.tail || isnil(rest)) {
+                out += ')';
+                open.pop_back();
+                continue;
+            }
+            if (ispair(rest) && (labels.empty() || !labels.count(rest.uval))) {
+                out += ' ';
+                o.pair = rest;
+                v = unsafe_topair(rest)->car;
+            } else {
+                // a labelled pair is printed as a tail of its own
+                out += " . ";
+                o.tail = true;
+                v = rest;
+            }
+            break;
+        }
+    }
+}
+std::string valprint(Value v, bool write)
+{
+    std::string out;
+    printvalue(out, v, write);
+    return out;
+}
@@ -7,7 +7,10 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <string_view>
 #include <vector>
+#include "gc.h"
 
 enum Kind {
     LV_INT    = 0x1u,
@@ -20,8 +23,12 @@ enum Kind {
     LV_THREAD = 0x8u,
     LV_LUDATA = 0x9u,
     LV_UDATA  = 0xau,
+    LV_SYM    = 0xbu,
+    LV_PAIR   = 0xcu,
+    LV_PORT   = 0xdu,
+    LV_UVEC   = 0xeu,
 
-    LV_NTYPES = LV_UDATA,
+    LV_NTYPES = LV_UVEC,
     LV_NBITS = 4,
 };
 static_assert(LV_NTYPES < (1u << LV_NBITS), "Types won't fit in tag bits");
@@ -31,6 +38,11 @@ static_assert(sizeof(uintptr_t) == 8, "only 64-bit pointers supported");
 
 constexpr uint64_t LV_DBLVAL = 0xfff8000000000000ull;
 constexpr uint64_t INDEXMASK = 0x00007fffffffffffull;
+// Set in the payload of tags that can hold either a heap handle or an
+// immediate (e.g. builtin procedures under LV_FUN).
+constexpr uint64_t IMMBIT    = 0x0000400000000000ull;
+
+enum Status { OK, DONE, ERROR };
 
 //----------------------------------------------------------
 // Value representation:
@@ -58,35 +70,87 @@ struct Value
     };
 };
 
-// TODO: add string interning
-// TODO: integrate with GC
-struct String
+// Header and payload are a single allocation: a string of up to 15
+// bytes takes 32 bytes in total. Symbols are interned Strings. Strings
+// and symbols of at most ShortStrMax bytes are not Strings at all but
+// immediates, see mkshort.
+struct String : GcHeader
 {
-    static constexpr size_t MaxSmallSize = 28;
     uint32_t len;
-    union {
-        char* ptr;
-        char  str[MaxSmallSize];
-    };
+    uint32_t hash;
+    char     str[];
+};
+
+inline const char* str2cstr(const String& s) { return &s.str[0]; }
+
+// Heap part of an activation frame, referenced through an LV_UDATA Value.
+// Only variables captured by an inner lambda live here; the compiler
+// resolves them to a (depth, slot) pair, depth counting parent links.
+struct Env : GcHeader
+{
+    uint32_t n;
+    uint32_t pad;
+    Value    parent;
+    Value    slots[];
+};
+
+struct Closure : GcHeader
+{
+    uint32_t proto; // index into the VM's prototype table
+    uint32_t epoch; // the prototype's, see vm_rollback
+    Value    env;
+};
+
+// String output port. The text is kept off the heap, where appending is
+// amortized O(1), and only becomes a String when it is asked for; see
+// port.h.
+struct Port : GcHeader
+{
+    std::string* buf;
 };
-std::vector<String*> strtab;
-std::vector<size_t>  strtabidx;
-
-const char* str2cstr(const String& s) {
-    if (s.len < String::MaxSmallSize) {
-        return &s.str[0];
-    } else {
-        return s.ptr;
-    }
-}
 
-uint32_t mktag(uint32_t tag)
+// Hash table, see table.h. The slots are off the heap as well.
+struct Table : GcHeader
+{
+    struct TabData* data;
+};
+
+// Homogeneous numeric vector (bytevector, s32vector, f64vector), see
+// uvec.h. The elements are stored unboxed right after the header, 16
+// bytes in, so `data` is 16-byte aligned.
+enum UvecType : uint8_t {
+    UV_U8,
+    UV_S32,
+    UV_F64,
+};
+
+inline size_t uvec_elemsize(uint8_t type) { return type == UV_U8 ? 1 : type == UV_S32 ? 4 : 8; }
+
+struct Uvec : GcHeader
+{
+    uint32_t len;
+    uint8_t  type;
+    uint8_t  pad[3];
+    alignas(8) unsigned char data[];
+};
+static_assert(sizeof(Uvec) == 16, "unexpected Uvec size");
+
+// A cons cell is just its two fields: no header, no handle. Pairs live
+// in the pair space (see gc.h) and an LV_PAIR Value carries the slot.
+struct Pair
+{
+    Value car;
+    Value cdr;
+};
+static_assert(sizeof(Pair) == 16, "unexpected Pair size");
+
+inline uint32_t mktag(uint32_t tag)
 {
     assert((tag < (1u << LV_NBITS)) && "invalid tag");
     return 0xfff80000u | (tag << 15);
 }
 
-Value mkdouble(double x)
+inline Value mkdouble(double x)
 {
     assert((x == x) || *reinterpret_cast<uint64_t*>(&x) == 0xfff8000000000000ull);
     Value v;
@@ -94,7 +158,7 @@ Value mkdouble(double x)
     return v;
 }
 
-Value mkint(int x)
+inline Value mkint(int x)
 {
     Value v;
     v.b.hi = mktag(LV_INT);
@@ -102,7 +166,7 @@ Value mkint(int x)
     return v;
 }
 
-Value mknil()
+inline Value mknil()
 {
     Value v;
     v.b.hi = mktag(LV_NIL);
@@ -110,7 +174,7 @@ Value mknil()
     return v;
 }
 
-Value mktrue()
+inline Value mktrue()
 {
     Value v;
     v.b.hi = mktag(LV_TRUE);
@@ -119,7 +183,7 @@ Value mktrue()
 }
 
 
-Value mkfalse()
+inline Value mkfalse()
 {
     Value v;
     v.b.hi = mktag(LV_FALSE);
@@ -127,47 +191,124 @@ Value mkfalse()
     return v;
 }
 
-Value mkstr(const char* str, size_t len)
-{
-    // TODO: GC needs to know about this allocation
-    String* s = (String*) malloc(sizeof(*s));
-    s->len = len;
-    if (len < String::MaxSmallSize) {
-        memcpy(&s->str[0], str, len);
-        s->str[len] = '\0';
-    } else {
-        s->ptr = (char*) malloc(len + 1);
-        memcpy(s->ptr, str, len);
-        s->ptr[len] = '\0';
-    }
+inline Value mkref(uint32_t tag, uint64_t handle)
+{
+    assert(handle <= INDEXMASK);
+    Value v;
+    v.b.hi = mktag(tag);
+    v.b.lo = 0u;
+    v.uval |= handle;
+    return v;
+}
+
+// Short strings and symbols live in the payload: the bytes in its low
+// five bytes (in memory order, like the rest of Value), the length
+// above them, and IMMBIT to tell them from handles. The encoding is
+// canonical, so equal short strings are identical Values and short
+// symbols need no interning.
+constexpr size_t   ShortStrMax   = 5;
+constexpr unsigned ShortLenShift = 40;
+
+inline Value mkshort(uint32_t tag, const char* str, size_t len)
+{
+    assert(len <= ShortStrMax);
+    uint64_t bytes = 0;
+    memcpy(&bytes, str, len);
+    return mkref(tag, IMMBIT | (uint64_t) len << ShortLenShift | bytes);
+}
+
+// Strings of up to ShortStrMax bytes are never allocated.
+Value mkstr(const char* str, size_t len);
+inline Value mkstr(const char* str) { return mkstr(str, strlen(str)); }
 
-    size_t index;
-    if (strtabidx.empty()) {
-        index = strtab.size();
-        strtab.push_back(s);
-    } else {
-        index = strtabidx.back();
-        strtabidx.pop_back();
-        assert(index < strtab.size() && strtab[index] == nullptr);
-        strtab[index] = s;
+// Interned: equal contents give identical Values, so symbols (and
+// interned string literals) compare with a single 64-bit compare.
+Value mksym(const char* str, size_t len);
+inline Value mksym(const char* str) { return mksym(str, strlen(str)); }
+Value mkistr(const char* str, size_t len);
+
+inline bool isdouble(Value v) { return v.uval <= LV_DBLVAL; }
+// The tag bits overlap the fraction of a double, so doubles must be
+// excluded first (1.125 would otherwise look like LV_FALSE).
+inline uint32_t totag(Value v) { return isdouble(v) ? 0u : (v.b.hi >> 15) & 0x00fu; }
+// Tags whose payload lives in the low word alone can be tested with one
+// compare of the high word, which never matches a double.
+inline bool isint(Value v) { return v.b.hi == mktag(LV_INT); }
+inline bool isnil(Value v) { return v.b.hi == mktag(LV_NIL); }
+inline bool istrue(Value v) { return v.b.hi == mktag(LV_TRUE); }
+inline bool isfalse(Value v) { return v.b.hi == mktag(LV_FALSE); }
+inline bool ispair(Value v) { return (v.b.hi & ~(uint32_t) (FROZENBIT >> 32)) == mktag(LV_PAIR); }
+inline bool isstr(Value v) { return totag(v) == LV_STR; }
+inline bool issym(Value v) { return totag(v) == LV_SYM; }
+inline bool isfun(Value v) { return totag(v) == LV_FUN; }
+inline bool isport(Value v) { return totag(v) == LV_PORT; }
+inline bool istab(Value v) { return totag(v) == LV_TAB; }
+inline bool isuvec(Value v) { return totag(v) == LV_UVEC; }
+inline bool isbuiltin(Value v) { return isfun(v) && (v.uval & IMMBIT); }
+inline bool isclosure(Value v) { return isfun(v) && !(v.uval & IMMBIT); }
+inline bool isnum(Value v) { return isdouble(v) || isint(v); }
+// Only meaningful for strings and symbols.
+inline bool isshort(Value v) { return (v.uval & IMMBIT) != 0; }
+
+inline int unsafe_toint(Value v) { assert(isint(v)); return v.b.lo; }
+inline double unsafe_todouble(Value v) { assert(isdouble(v)); return v.dval; }
+inline uint64_t tohandle(Value v) { return v.uval & INDEXMASK; }
+// Heap strings only; strview handles both encodings.
+inline String* unsafe_tostr(Value v) { assert(isstr(v) && !isshort(v)); return (String*) gc_deref(tohandle(v)); }
+inline String* unsafe_tosym(Value v) { assert(issym(v) && !isshort(v)); return (String*) gc_deref(tohandle(v)); }
+inline Closure* unsafe_toclosure(Value v) { assert(isclosure(v)); return (Closure*) gc_deref(tohandle(v)); }
+inline Table* unsafe_totab(Value v) { assert(istab(v)); return (Table*) gc_deref(tohandle(v)); }
+inline Port* unsafe_toport(Value v) { assert(isport(v)); return (Port*) gc_deref(tohandle(v)); }
+inline Uvec* unsafe_touvec(Value v) { assert(isuvec(v)); return (Uvec*) gc_deref(tohandle(v)); }
+inline bool isfrozen(Value v) { return !isdouble(v) && !(v.uval & IMMBIT) && gc_isfrozen(v.uval); }
+inline Pair* unsafe_topair(Value v)
+{
+    assert(ispair(v));
+    // the high word is the one ispair looked at
+    if (v.b.hi & (uint32_t) (FROZENBIT >> 32)) {
+        return (Pair*) (gc_frozen + v.b.lo);
     }
+    return gc_pair(v.b.lo);
+}
+inline uint32_t unsafe_tobuiltin(Value v) { assert(isbuiltin(v)); return v.uval & ~IMMBIT & INDEXMASK; }
+inline Value mkbuiltin(uint32_t id) { return mkref(LV_FUN, IMMBIT | id); }
 
-    Value v;
-    v.b.hi = mktag(LV_STR);
-    v.uval |= index;
-    return v;
+// May run a collection; `car` and `cdr` need not be rooted.
+Value mkpair(Value car, Value cdr);
+// The list of `items` ending in `tail`, allocated in one go. `items`
+// and `tail` must be reachable from roots.
+Value mklist(const Value* items, size_t n, Value tail = mknil());
+
+// The bytes of a string or symbol. A short one's are inside `v` itself,
+// so the view is valid as long as `v` is; a heap string's until the next
+// allocation. Neither is NUL-terminated.
+inline std::string_view strview(const Value& v)
+{
+    assert(isstr(v) || issym(v));
+    if (isshort(v)) {
+        return std::string_view((const char*) &v.uval, (v.uval >> ShortLenShift) & 0x7u);
+    }
+    const String* s = (const String*) gc_deref(tohandle(v));
+    return std::string_view(str2cstr(*s), s->len);
 }
+std::string_view strview(const Value&&) = delete;
 
-Value mkstr(const char* str) { return mkstr(str, strlen(str)); }
+// Scheme truthiness: everything except #f is true.
+inline bool truthy(Value v) { return !isfalse(v); }
 
-uint32_t totag(Value v) { return (v.b.hi >> 15) & 0x00fu; }
-bool isint(Value v) { return totag(v) == LV_INT; }
-bool isdouble(Value v) { return v.uval <= LV_DBLVAL; }
-bool isnil(Value v) { return totag(v) == LV_NIL; }
-bool istrue(Value v) { return totag(v) == LV_TRUE; }
-bool isfalse(Value v) { return totag(v) == LV_FALSE; }
-bool isstr(Value v) { return totag(v) == LV_STR; }
+// Values whose payload is a handle into the collected heap. Pairs are
+// collected too but are not handles, and frozen objects are not
+// collected at all, see gc.h.
+inline bool isheap(Value v)
+{
+    if (isdouble(v)) {
+        return false;
+    }
+    uint32_t tag = totag(v);
+    return (tag == LV_STR || tag == LV_SYM || tag == LV_UDATA || tag == LV_FUN || tag == LV_PORT ||
+            tag == LV_TAB || tag == LV_UVEC) &&
+        !(v.uval & (IMMBIT | FROZENBIT));
+}
 
-int unsafe_toint(Value v) { assert(isint(v)); return v.b.lo; }
-double unsafe_todouble(Value v) { assert(isdouble(v)); return v.dval; }
-String* unsafe_tostr(Value v) { assert(isstr(v)); return strtab[v.uval & INDEXMASK]; }
+// `write` quotes strings, `display` does not.
+std::string valprint(Value v, bool write = true);
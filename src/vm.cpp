@@ -0,0 +1,1366 @@
+#include "vm.h"
+#include "builtins.h"
+#include "num.h"
+#include "arena.h"
+#include "stats.h"
+#include "table.h"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+static const char* OpcodeStrings[] = {
+#define X(op) #op,
+    OPCODES(X)
+#undef X
+};
+
+const char* optostr(Opcode op)
+{
+    if (op >= OP_NOPS) {
+        return "INVALID OPCODE";
+    }
+    return OpcodeStrings[op];
+}
+
+namespace {
+
+// The value stack is one reserved mapping that the kernel backs page by
+// page as calls go deeper, so its address never changes and pointers
+// into it stay valid. Running past either limit is a "stack overflow"
+// error; so is nesting vm_call (and with it the C stack) too deeply.
+constexpr size_t StackLimit = 1u << 22; // values
+constexpr size_t FrameLimit = 1u << 20;
+constexpr int    NestLimit  = 1000;
+// stack pages kept committed between top-level runs
+constexpr size_t StackKeep  = 1u << 20; // bytes
+
+struct CallInfo
+{
+    uint32_t        proto;
+    const uint32_t* pc;   // saved while a callee runs
+    Value*          base;
+    Value           env;  // innermost heap frame, or nil
+};
+
+// Marks global table entries that were never defined.
+const Value Unbound = mkref(LV_LUDATA, 0);
+
+// A global binding. `version` changes whenever the binding does, so
+// call sites can tell whether their cached callee is still current.
+struct Global
+{
+    Value    value   = Unbound;
+    uint32_t version = 1;
+    uint32_t saved   = 0;  // the epoch in which the old value was saved
+};
+
+// A base binding as it was at the checkpoint.
+struct Saved
+{
+    uint32_t slot;
+    Value    value;
+};
+
+// What a store into a base heap object replaced, by the object's type:
+//   pair    `key` and `old` are its car and cdr
+//   frame   `old` was in slot `index`
+//   table   `old` was the value of `key`, Unbound if it had none
+//   vector  `bytes` were its elements from `index` on
+//   port    its text was `index` bytes long
+struct HeapSaved
+{
+    Value       obj;
+    Value       key;
+    Value       old;
+    size_t      index;
+    std::string bytes;
+};
+
+struct VM
+{
+    std::vector<Proto*>                  protos;
+    // Globals are numbered in order of first use: a symbol is either an
+    // immediate or a handle, so neither can index the table itself.
+    // Code refers to slots, resolved by vm_addproto.
+    std::vector<Global>                  globals;
+    std::vector<Value>                   globalsym; // slot -> symbol
+    std::unordered_map<uint64_t, uint32_t> slots;   // symbol -> slot
+    Region                               stack;
+    Value*                               top  = nullptr; // end of the live registers
+    Value*                               high = nullptr; // highest `top` since the last trim
+    int                                  nesting = 0;    // active vm_calls
+    std::vector<CallInfo>                frames;
+    // the builtins behind ADD .. GT, their global slots, and whether all
+    // of them are still bound to their global
+    Value                                arithsym[OP_GT - OP_ADD + 1];
+    Value                                arithfn[OP_GT - OP_ADD + 1];
+    uint32_t                             arithslot[OP_GT - OP_ADD + 1];
+    bool                                 arithok = false;
+    uint64_t                             id = 0;
+    // set while `frames` may be reallocating, see vm_backtrace
+    volatile sig_atomic_t                framesmoving = 0;
+    // vm_checkpoint: the base environment, and the saved bindings. The
+    // epoch is 0 without a checkpoint and changes with every rollback.
+    uint32_t                             epoch = 0;
+    size_t                               baseglobals = 0;
+    size_t                               baseprotos = 0;
+    std::vector<Saved>                   undo;
+    std::vector<HeapSaved>               heapundo;
+    // vm_attach: the frozen environment, whose prototypes are the first
+    // `nfrozen` of `protos`
+    const FrozenGlobals*                 frozen = nullptr;
+    size_t                               nfrozen = 0;
+    // the call sites of each prototype: its own, or for a frozen one a
+    // copy made on its first CALLG, as every call writes to the cache
+    std::vector<CallSite*>               sites;
+    std::unordered_map<uint32_t, std::vector<CallSite>> sitecopies;
+    // frozen frames this thread has written to, by handle, see vm_env
+    std::unordered_map<uint64_t, Value>  envcopies;
+    // vm_capture: where the output goes instead of stdout
+    std::string*                         output = nullptr;
+    size_t                               outputlimit = 0;
+
+    ~VM()
+    {
+        for (size_t i = nfrozen; i < protos.size(); ++i) {
+            delete protos[i];
+        }
+        region_free(stack);
+    }
+};
+
+// One VM per thread, see isolate.h. `vm` is a plain __thread pointer
+// so the interpreter loop reads it without thread_local init checks;
+// `ownvm` frees it when the thread exits.
+__thread VM* vm;
+thread_local std::unique_ptr<VM> ownvm;
+
+Value* stackbase() { return (Value*) vm->stack.base; }
+Value* stacklim()  { return (Value*) vm->stack.lim; }
+
+// A profiler signal may walk `frames` at any point (vm_backtrace), so a
+// push that reallocates it is flagged.
+void pushcall(const CallInfo& ci)
+{
+    if (vm->frames.size() < vm->frames.capacity()) {
+        vm->frames.push_back(ci);
+        return;
+    }
+    vm->framesmoving = 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    vm->frames.push_back(ci);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    vm->framesmoving = 0;
+}
+
+void visitroots(void*, GcVisitFn visit)
+{
+    // the frozen prototypes only hold frozen Values
+    for (size_t i = vm->nfrozen; i < vm->protos.size(); ++i) {
+        const Proto* p = vm->protos[i];
+        for (Value v : p->consts) {
+            visit(v);
+        }
+        // a cached callee is only used while its global still holds
+        // it, so the cache itself is not a root
+        for (const CallSite& site : p->sites) {
+            visit(site.sym);
+        }
+        visit(p->name);
+    }
+    // a defined global keeps its symbol, and so its handle, alive
+    for (size_t i = 0; i < vm->globals.size(); ++i) {
+        if (vm->globals[i].value.uval != Unbound.uval) {
+            visit(vm->globalsym[i]);
+            visit(vm->globals[i].value);
+        }
+    }
+    for (Value* p = stackbase(); p < vm->top; ++p) {
+        visit(*p);
+    }
+    for (const CallInfo& ci : vm->frames) {
+        visit(ci.env);
+    }
+    for (const auto& e : vm->envcopies) {
+        visit(e.second);
+    }
+    // what a rollback puts back must survive until then
+    for (const Saved& s : vm->undo) {
+        visit(s.value);
+    }
+    for (const HeapSaved& s : vm->heapundo) {
+        visit(s.obj);
+        visit(s.key);
+        visit(s.old);
+    }
+}
+
+Env* toenv(Value v)
+{
+    uint64_t h = tohandle(v);
+    if (gc_isfrozen(h) && !vm->envcopies.empty()) {
+        auto it = vm->envcopies.find(h);
+        if (it != vm->envcopies.end()) {
+            h = tohandle(it->second);
+        }
+    }
+    return (Env*) gc_deref(h);
+}
+
+Env* envat(Value env, uint32_t depth)
+{
+    Env* e = toenv(env);
+    for (; depth > 0; --depth) {
+        e = toenv(e->parent);
+    }
+    return e;
+}
+
+// Whether a store into `v` has to be saved for vm_rollback: it is a
+// heap object that was there at the checkpoint. Frozen ones are either
+// read-only or copied on write.
+bool isbase(Value v)
+{
+    if (vm->epoch == 0 || isfrozen(v)) {
+        return false;
+    }
+    return ispair(v) ? gc_isbasepair(v.b.lo) : (gc_objtab[tohandle(v)]->flags & GC_BASE) != 0;
+}
+
+// SETENV's frame, with `slot` saved if the frame belongs to the base. A
+// frozen one is copied into the heap on the first write, and toenv
+// finds the copy from then on.
+Env* writableenv(Value env, uint32_t depth, uint32_t slot)
+{
+    for (; depth > 0; --depth) {
+        env = toenv(env)->parent;
+    }
+    uint64_t h = tohandle(env);
+    if (!gc_isfrozen(h) || vm->envcopies.count(h)) {
+        Env* e = toenv(env);
+        if (isbase(mkref(LV_UDATA, e->handle))) {
+            vm->heapundo.push_back(HeapSaved{mkref(LV_UDATA, e->handle), mknil(), e->slots[slot], slot, {}});
+        }
+        return e;
+    }
+    // frozen objects never move, so `from` survives the allocation
+    const Env* from = (const Env*) gc_deref(h);
+    Env* e = (Env*) gc_alloc(GC_ENV, sizeof(Env) + sizeof(Value) * from->n);
+    e->n = from->n;
+    e->parent = from->parent;
+    std::copy(from->slots, from->slots + from->n, e->slots);
+    vm->envcopies.emplace(h, mkref(LV_UDATA, e->handle));
+    return e;
+}
+
+// The slot of global `sym`, in the frozen environment or the thread's
+// own table, or -1 if it has none.
+int64_t findslot(Value sym)
+{
+    if (vm->frozen) {
+        auto it = vm->frozen->slots.find(sym.uval);
+        if (it != vm->frozen->slots.end()) {
+            return it->second;
+        }
+    }
+    auto it = vm->slots.find(sym.uval);
+    return it == vm->slots.end() ? -1 : (int64_t) it->second;
+}
+
+// Returns the binding of global `sym`, or nullptr if it is unbound.
+Global* global(Value sym)
+{
+    int64_t slot = findslot(sym);
+    if (slot < 0 || vm->globals[slot].value.uval == Unbound.uval) {
+        return nullptr;
+    }
+    return &vm->globals[slot];
+}
+
+// The slot of `sym`, allocated unbound on first use. A heap symbol that
+// is neither bound nor referenced by code can die and its handle come
+// back as another symbol, which then simply inherits the unused slot.
+uint32_t globalslot(Value sym)
+{
+    if (vm->frozen) {
+        auto it = vm->frozen->slots.find(sym.uval);
+        if (it != vm->frozen->slots.end()) {
+            return it->second;
+        }
+    }
+    auto it = vm->slots.emplace(sym.uval, vm->globals.size());
+    if (it.second) {
+        vm->globals.emplace_back();
+        vm->globalsym.push_back(sym);
+    }
+    return it.first->second;
+}
+
+Global& reserveglobal(Value sym) { return vm->globals[globalslot(sym)]; }
+
+void setglobal(Global& g, Value v)
+{
+    if (g.saved != vm->epoch) {
+        g.saved = vm->epoch;
+        size_t slot = &g - vm->globals.data();
+        if (slot < vm->baseglobals) {
+            vm->undo.push_back(Saved{(uint32_t) slot, g.value});
+        }
+    }
+    g.value = v;
+    ++g.version;
+}
+
+void checkarith()
+{
+    vm->arithok = true;
+    for (int j = 0; j <= OP_GT - OP_ADD; ++j) {
+        vm->arithok &= vm->globals[vm->arithslot[j]].value.uval == vm->arithfn[j].uval;
+    }
+}
+
+// After a write to global `slot`: only the slots of ADD .. GT's
+// builtins can change whether they are still bound.
+inline void arithwritten(uint32_t slot)
+{
+    for (uint32_t s : vm->arithslot) {
+        if (s == slot) {
+            checkarith();
+            return;
+        }
+    }
+}
+
+Value mkerror(const char* msg, Value sym)
+{
+    std::string s = msg;
+    s += ": ";
+    s += valprint(sym);
+    return mkstr(s.c_str(), s.size());
+}
+
+bool accepts(const Proto* p, int nargs)
+{
+    return p->rest ? (uint32_t) nargs >= p->nparams : (uint32_t) nargs == p->nparams;
+}
+
+// Pushes a frame for prototype `index` with `nargs` arguments, already
+// checked against its arity, at `args`.
+int enterframe(uint32_t index, const Proto* callee, Value* args, int nargs, Value env, Value& err)
+{
+    if (args + callee->nregs > stacklim() || vm->frames.size() >= FrameLimit) {
+        err = mkstr("stack overflow");
+        return ERROR;
+    }
+    if (callee->rest) {
+        // the arguments, and `env` (a tail call has dropped the frame
+        // that held it), stay roots until the list is made
+        vm->top = std::max(vm->top, args + nargs);
+        gc_pushroot(env);
+        args[callee->nparams] = mklist(args + callee->nparams, nargs - callee->nparams);
+        gc_poproot();
+        nargs = callee->nparams + 1;
+    }
+    // everything above the arguments may hold stale handles
+    for (Value* r = args + nargs; r < args + callee->nregs; ++r) {
+        *r = mknil();
+    }
+    vm->top = args + callee->nregs;
+    vm->high = std::max(vm->high, vm->top);
+    pushcall(CallInfo{index, callee->code.data(), args, env});
+    return OK;
+}
+
+// Pushes a frame for closure `f`, whose `nargs` arguments are at `args`
+// just above the slot holding `f`.
+int pushframe(Value f, Value* args, int nargs, Value& err)
+{
+    uint32_t     index  = unsafe_toclosure(f)->proto;
+    const Proto* callee = vm_closureproto(unsafe_toclosure(f));
+    if (!callee) {
+        err = mkstr("procedure outlived its request");
+        return ERROR;
+    }
+    if (!accepts(callee, nargs)) {
+        err = mkerror("wrong number of arguments to", callee->name);
+        return ERROR;
+    }
+    return enterframe(index, callee, args, nargs, unsafe_toclosure(f)->env, err);
+}
+
+int callbuiltin(Value f, Value* args, int nargs, Value& out)
+{
+    const Builtin& b = builtins[unsafe_tobuiltin(f)];
+    if (nargs < b.minargs || (b.maxargs >= 0 && nargs > b.maxargs)) {
+        out = mkerror("wrong number of arguments to", mksym(b.name));
+        return ERROR;
+    }
+    return b.fn(args, nargs, out);
+}
+
+// Refills `site` from its global after a version mismatch. Returns
+// false, leaving the site empty, if the global does not hold a procedure
+// that accepts `nargs` arguments; the caller then takes the general path,
+// which reports the error.
+bool fillsite(CallSite& site, const Global& g, int nargs)
+{
+    ++site.misses;
+    site.version = 0;
+    site.fn      = nullptr;
+    site.proto   = nullptr;
+    Value f = g.value;
+    if (isbuiltin(f)) {
+        const Builtin& b = builtins[unsafe_tobuiltin(f)];
+        if (nargs < b.minargs || (b.maxargs >= 0 && nargs > b.maxargs)) {
+            return false;
+        }
+        site.fn = b.fn;
+    } else if (isclosure(f)) {
+        const Closure* cl     = unsafe_toclosure(f);
+        const Proto*   callee = vm_closureproto(cl);
+        if (!callee) {
+            return false;
+        }
+        if (!accepts(callee, nargs)) {
+            return false;
+        }
+        site.index = cl->proto;
+        site.proto = callee;
+        site.env   = cl->env;
+    } else {
+        return false;
+    }
+    site.version = g.version;
+    return true;
+}
+
+// A frozen prototype's call sites, copied for the thread on first use.
+CallSite* copysites(uint32_t index)
+{
+    std::vector<CallSite>& copy = vm->sitecopies[index];
+    copy = vm->protos[index]->sites;
+    vm->sites[index] = copy.data();
+    return copy.data();
+}
+
+int execute(size_t entry, Value& result);
+
+} // namespace
+
+int vm_call(Value f, const Value* args, int nargs, Value& result)
+{
+    Value* base = vm->top;
+    if (base + 1 + nargs > stacklim() || vm->nesting >= NestLimit) {
+        result = mkstr("stack overflow");
+        return ERROR;
+    }
+    ++vm->nesting;
+    base[0] = f;
+    std::copy(args, args + nargs, base + 1);
+    int status;
+    if (isbuiltin(f)) {
+        vm->top = base + 1 + nargs;
+        status = callbuiltin(f, base + 1, nargs, result);
+    } else if (!isclosure(f)) {
+        result = mkerror("not a procedure", f);
+        status = ERROR;
+    } else {
+        size_t entry = vm->frames.size();
+        status = pushframe(f, base + 1, nargs, result);
+        if (status == OK) {
+            status = execute(entry, result);
+        }
+    }
+    vm->top = base;
+    --vm->nesting;
+    return status;
+}
+
+namespace {
+
+// Runs until the frame at depth `entry` returns.
+int execute(size_t entry, Value& result)
+{
+    static void* const dispatch[] = {
+#define X(op) &&L_##op,
+        OPCODES(X)
+#undef X
+    };
+
+    uint64_t* const ops = stats->ops;
+    CallInfo*       ci;
+    Proto*          p;
+    CallSite*       sites;
+    const uint32_t* pc;
+    const Value*    k;
+    Value*          base;
+    uint32_t        i;
+    Value           rv;     // value being returned
+    struct {
+        uint32_t     index;
+        const Proto* proto;
+        Value        env;
+    } callee;               // target of a tail call
+
+#define RELOAD() \
+    ci   = &vm->frames.back(); \
+    p    = vm->protos[ci->proto]; \
+    sites = vm->sites[ci->proto]; \
+    pc   = ci->pc; \
+    k    = p->consts.data(); \
+    base = ci->base; \
+    vm->top = base + p->nregs
+
+#define DISPATCH() do { i = *pc++; stat_add(ops[getop(i)]); goto *dispatch[getop(i)]; } while (0)
+#define RA base[geta(i)]
+#define RB base[getb(i)]
+#define RC base[getc(i)]
+#define KBX k[getbx(i)]
+#define THROW(msg) do { result = (msg); goto error; } while (0)
+
+    RELOAD();
+    DISPATCH();
+
+L_MOVE:
+    RA = RB;
+    DISPATCH();
+
+L_LOADK:
+    RA = KBX;
+    DISPATCH();
+
+L_LOADNIL:
+    RA = mknil();
+    DISPATCH();
+
+L_LOADBOOL:
+    RA = getb(i) ? mktrue() : mkfalse();
+    DISPATCH();
+
+L_GETENV:
+    RA = envat(ci->env, getb(i))->slots[getc(i)];
+    stat_add(stats->env_lookups);
+    stat_add(stats->env_depth, getb(i));
+    DISPATCH();
+
+L_SETENV: {
+    Env* e = writableenv(ci->env, getb(i), getc(i));
+    stat_add(stats->env_lookups);
+    stat_add(stats->env_depth, getb(i));
+    e->slots[getc(i)] = RA;
+    gc_barrier(e, RA);
+    DISPATCH();
+}
+
+L_GETGLOBAL: {
+    const Global& g = vm->globals[p->globals[getbx(i)]];
+    if (g.value.uval == Unbound.uval) {
+        THROW(mkerror("unbound variable", KBX));
+    }
+    RA = g.value;
+    DISPATCH();
+}
+
+L_SETGLOBAL: {
+    uint32_t slot = p->globals[getbx(i)];
+    Global&  g    = vm->globals[slot];
+    if (g.value.uval == Unbound.uval) {
+        THROW(mkerror("set!: unbound variable", KBX));
+    }
+    setglobal(g, RA);
+    arithwritten(slot);
+    DISPATCH();
+}
+
+L_DEFGLOBAL: {
+    uint32_t slot = p->globals[getbx(i)];
+    setglobal(vm->globals[slot], RA);
+    arithwritten(slot);
+    DISPATCH();
+}
+
+L_ENTER: {
+    uint32_t n = geta(i);
+    Env* e = (Env*) gc_alloc(GC_ENV, sizeof(Env) + sizeof(Value) * n);
+    e->n = n;
+    e->parent = ci->env;
+    for (uint32_t j = 0; j < n; ++j) {
+        e->slots[j] = mknil();
+    }
+    ci->env = mkref(LV_UDATA, e->handle);
+    DISPATCH();
+}
+
+L_CLOSURE: {
+    Closure* cl = (Closure*) gc_alloc(GC_CLOSURE, sizeof(Closure));
+    cl->proto = p->protos[getbx(i)];
+    cl->epoch = vm->protos[cl->proto]->epoch;
+    cl->env   = ci->env;
+    RA = mkref(LV_FUN, cl->handle);
+    DISPATCH();
+}
+
+L_ADD: {
+    Value b = RB, c = RC;
+    int r;
+    if (isint(b) && isint(c) && !__builtin_add_overflow(unsafe_toint(b), unsafe_toint(c), &r) && vm->arithok) {
+        RA = mkint(r);
+        DISPATCH();
+    }
+    if (vm->arithok && num_add(b, c, RA)) {
+        DISPATCH();
+    }
+    goto arith;
+}
+
+L_SUB: {
+    Value b = RB, c = RC;
+    int r;
+    if (isint(b) && isint(c) && !__builtin_sub_overflow(unsafe_toint(b), unsafe_toint(c), &r) && vm->arithok) {
+        RA = mkint(r);
+        DISPATCH();
+    }
+    if (vm->arithok && num_sub(b, c, RA)) {
+        DISPATCH();
+    }
+    goto arith;
+}
+
+L_MUL: {
+    Value b = RB, c = RC;
+    int r;
+    if (isint(b) && isint(c) && !__builtin_mul_overflow(unsafe_toint(b), unsafe_toint(c), &r) && vm->arithok) {
+        RA = mkint(r);
+        DISPATCH();
+    }
+    if (vm->arithok && num_mul(b, c, RA)) {
+        DISPATCH();
+    }
+    goto arith;
+}
+
+#define COMPARE(op, test) \
+L_##op: { \
+    Value b = RB, c = RC; \
+    int cmp = 0; \
+    if (isint(b) && isint(c) && vm->arithok) { \
+        cmp = (unsafe_toint(b) > unsafe_toint(c)) - (unsafe_toint(b) < unsafe_toint(c)); \
+    } else if (!vm->arithok || !num_cmp(b, c, cmp)) { \
+        goto arith; \
+    } \
+    RA = (test) ? mktrue() : mkfalse(); \
+    DISPATCH(); \
+}
+
+    COMPARE(LT, cmp == -1)
+    COMPARE(EQ, cmp == 0)
+    COMPARE(GT, cmp == 1)
+#undef COMPARE
+
+arith: {
+    // not two numbers, or the operator was rebound: call it
+    Value args[2] = { RB, RC };
+    int j = getop(i) - OP_ADD;
+    Value f = vm->globals[vm->arithslot[j]].value;
+    if (f.uval == Unbound.uval) {
+        THROW(mkerror("unbound variable", vm->arithsym[j]));
+    }
+    Value out;
+    ci->pc = pc;
+    int status = vm_call(f, args, 2, out);
+    RELOAD();
+    if (status != OK) {
+        THROW(out);
+    }
+    RA = out;
+    DISPATCH();
+}
+
+L_CALL: {
+    Value  f     = RA;
+    int    nargs = getb(i);
+    Value* args  = &RA + 1;
+    if (isbuiltin(f)) {
+        if (callbuiltin(f, args, nargs, RA) != OK) {
+            THROW(RA);
+        }
+        // a builtin that called back into Scheme may have grown vm->frames
+        ci = &vm->frames.back();
+        DISPATCH();
+    }
+    if (!isclosure(f)) {
+        THROW(mkerror("not a procedure", f));
+    }
+    ci->pc = pc;
+    if (pushframe(f, args, nargs, result) != OK) {
+        goto error;
+    }
+    RELOAD();
+    DISPATCH();
+}
+
+L_CALLG: {
+    // the site's global is in the table: vm_addproto reserved it
+    if (!sites) {
+        sites = copysites(ci->proto);
+    }
+    CallSite&     site  = sites[*pc++];
+    const Global& g     = vm->globals[site.slot];
+    int           nargs = getb(i);
+    Value*        args  = &RA + 1;
+    ++site.calls;
+    if (site.version != g.version && !fillsite(site, g, nargs)) {
+        if (g.value.uval == Unbound.uval) {
+            THROW(mkerror("unbound variable", site.sym));
+        }
+        RA = g.value;
+        goto L_CALL;
+    }
+    if (site.fn) {
+        if (site.fn(args, nargs, RA) != OK) {
+            THROW(RA);
+        }
+        // as in CALL
+        ci = &vm->frames.back();
+        DISPATCH();
+    }
+    ci->pc = pc;
+    if (enterframe(site.index, site.proto, args, nargs, site.env, result) != OK) {
+        goto error;
+    }
+    RELOAD();
+    DISPATCH();
+}
+
+L_TAILCALLG: {
+    if (!sites) {
+        sites = copysites(ci->proto);
+    }
+    CallSite&     site  = sites[*pc++];
+    const Global& g     = vm->globals[site.slot];
+    int           nargs = getb(i);
+    ++site.calls;
+    if (site.version != g.version && !fillsite(site, g, nargs)) {
+        if (g.value.uval == Unbound.uval) {
+            THROW(mkerror("unbound variable", site.sym));
+        }
+        RA = g.value;
+        goto L_TAILCALL;
+    }
+    if (site.fn) {
+        if (site.fn(&RA + 1, nargs, RA) != OK) {
+            THROW(RA);
+        }
+        rv = RA;
+        goto ret;
+    }
+    callee = { site.index, site.proto, site.env };
+    goto tailcall;
+}
+
+L_TAILCALL: {
+    Value  f     = RA;
+    int    nargs = getb(i);
+    if (isbuiltin(f)) {
+        if (callbuiltin(f, &RA + 1, nargs, RA) != OK) {
+            THROW(RA);
+        }
+        rv = RA;
+        goto ret;
+    }
+    if (!isclosure(f)) {
+        THROW(mkerror("not a procedure", f));
+    }
+    const Closure* cl = unsafe_toclosure(f);
+    callee = { cl->proto, vm_closureproto(cl), cl->env };
+    if (!callee.proto) {
+        THROW(mkstr("procedure outlived its request"));
+    }
+    if (!accepts(callee.proto, nargs)) {
+        THROW(mkerror("wrong number of arguments to", callee.proto->name));
+    }
+    goto tailcall;
+}
+
+tailcall: {
+    // the callee replaces the current frame: its arguments move down to
+    // this frame's base and it returns straight to our caller
+    int nargs = getb(i);
+    std::copy(&RA + 1, &RA + 1 + nargs, base);
+    vm->frames.pop_back();
+    if (enterframe(callee.index, callee.proto, base, nargs, callee.env, result) != OK) {
+        goto error;
+    }
+    RELOAD();
+    DISPATCH();
+}
+
+L_RET:
+    rv = RA;
+ret:
+    vm->frames.pop_back();
+    if (vm->frames.size() == entry) {
+        result = rv;
+        return OK;
+    }
+    // the callee's registers start just above the called procedure
+    base[-1] = rv;
+    RELOAD();
+    DISPATCH();
+
+L_JMP:
+    pc += getsbx(i);
+    DISPATCH();
+
+L_JMPF:
+    if (isfalse(RA)) {
+        pc += getsbx(i);
+    }
+    DISPATCH();
+
+L_JMPT:
+    if (!isfalse(RA)) {
+        pc += getsbx(i);
+    }
+    DISPATCH();
+
+error:
+    vm->frames.resize(entry);
+    return ERROR;
+
+#undef RELOAD
+#undef DISPATCH
+#undef RA
+#undef RB
+#undef RC
+#undef KBX
+#undef THROW
+}
+
+} // namespace
+
+uint32_t vm_addproto(Proto* p)
+{
+    vm_init();
+    for (CallSite& site : p->sites) {
+        site.slot = globalslot(site.sym);
+    }
+    p->globals.assign(p->consts.size(), 0);
+    for (size_t j = 0; j < p->consts.size(); ++j) {
+        if (issym(p->consts[j])) {
+            p->globals[j] = globalslot(p->consts[j]);
+        }
+    }
+    p->epoch = vm->epoch;
+    vm->protos.push_back(p);
+    vm->sites.push_back(p->sites.data());
+    return vm->protos.size() - 1;
+}
+
+size_t vm_nprotos()
+{
+    vm_init();
+    return vm->protos.size();
+}
+
+void vm_dropprotos(size_t n)
+{
+    assert(n >= vm->nfrozen && n <= vm->protos.size());
+    for (size_t i = n; i < vm->protos.size(); ++i) {
+        delete vm->protos[i];
+    }
+    vm->protos.resize(n);
+    vm->sites.resize(n);
+}
+
+bool vm_verify(const Proto* p, const std::vector<uint32_t>& frames, std::vector<uint32_t>& inner)
+{
+    size_t n = p->code.size();
+    // register operands are 8 bits
+    if (n == 0 || p->nregs > 256 || p->nparams + p->rest > p->nregs) {
+        return false;
+    }
+    for (const CallSite& site : p->sites) {
+        if (!issym(site.sym)) {
+            return false;
+        }
+    }
+    // the word after a CALLG is its call site, not an instruction
+    std::vector<bool> start(n);
+    for (size_t pc = 0; pc < n; ++pc) {
+        start[pc] = true;
+        Opcode op = getop(p->code[pc]);
+        pc += op == OP_CALLG || op == OP_TAILCALLG;
+    }
+    // the compiler only emits ENTER first, so the frames are the same
+    // for the whole body
+    bool enters = getop(p->code[0]) == OP_ENTER;
+    inner = frames;
+    if (enters) {
+        inner.insert(inner.begin(), geta(p->code[0]));
+    }
+    auto reg = [&](uint32_t r) { return r < p->nregs; };
+    Opcode last = OP_NOPS;
+    for (size_t pc = 0; pc < n; ++pc) {
+        uint32_t i  = p->code[pc];
+        uint32_t a  = geta(i), b = getb(i), c = getc(i), bx = getbx(i);
+        bool     ok = false;
+        last = getop(i);
+        switch (last) {
+            case OP_MOVE:
+                ok = reg(a) && reg(b);
+                break;
+            case OP_LOADK:
+                ok = reg(a) && bx < p->consts.size();
+                break;
+            case OP_LOADNIL:
+            case OP_LOADBOOL:
+            case OP_RET:
+                ok = reg(a);
+                break;
+            case OP_GETENV:
+            case OP_SETENV:
+                ok = reg(a) && b < inner.size() && c < inner[b];
+                break;
+            case OP_GETGLOBAL:
+            case OP_SETGLOBAL:
+            case OP_DEFGLOBAL:
+                ok = reg(a) && bx < p->consts.size() && issym(p->consts[bx]);
+                break;
+            case OP_ENTER:
+                ok = pc == 0;
+                break;
+            case OP_CLOSURE:
+                ok = reg(a) && bx < p->protos.size();
+                break;
+            case OP_ADD: case OP_SUB: case OP_MUL:
+            case OP_LT: case OP_EQ: case OP_GT:
+                ok = reg(a) && reg(b) && reg(c);
+                break;
+            case OP_CALL:
+            case OP_TAILCALL:
+                ok = reg(a + b);
+                break;
+            case OP_CALLG:
+            case OP_TAILCALLG:
+                ok = reg(a + b) && pc + 1 < n && p->code[pc + 1] < p->sites.size();
+                ++pc;
+                break;
+            case OP_JMP:
+            case OP_JMPF:
+            case OP_JMPT: {
+                int64_t to = (int64_t) pc + 1 + getsbx(i);
+                ok = (last == OP_JMP || reg(a)) && to >= 0 && to < (int64_t) n && start[to] &&
+                     !(to == 0 && enters);
+                break;
+            }
+            default:
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return last == OP_RET || last == OP_JMP || last == OP_TAILCALL || last == OP_TAILCALLG;
+}
+
+Proto* vm_proto(uint32_t index) { return vm->protos[index]; }
+
+Proto* vm_closureproto(const Closure* cl)
+{
+    if (cl->proto >= vm->protos.size() || vm->protos[cl->proto]->epoch != cl->epoch) {
+        return nullptr;
+    }
+    return vm->protos[cl->proto];
+}
+
+void vm_checkpoint()
+{
+    vm_init();
+    assert(vm->frames.empty());
+    vm->baseglobals = vm->globals.size();
+    vm->baseprotos = vm->protos.size();
+    vm->undo.clear();
+    vm->heapundo.clear();
+    gc_markbase();
+    ++vm->epoch;
+}
+
+void vm_rollback()
+{
+    assert(vm->epoch > 0 && vm->frames.empty());
+    // a fresh version, so no call site keeps a callee cached since
+    for (const Saved& s : vm->undo) {
+        Global& g = vm->globals[s.slot];
+        g.value = s.value;
+        ++g.version;
+    }
+    vm->undo.clear();
+    // newest first, so each object ends up as it was at the checkpoint;
+    // none of this allocates on the heap
+    for (size_t j = vm->heapundo.size(); j-- > 0;) {
+        const HeapSaved& s = vm->heapundo[j];
+        switch (totag(s.obj)) {
+            case LV_PAIR: {
+                Pair* p = unsafe_topair(s.obj);
+                p->car = s.key;
+                p->cdr = s.old;
+                gc_pairbarrier(s.obj.b.lo, s.key);
+                gc_pairbarrier(s.obj.b.lo, s.old);
+                break;
+            }
+            case LV_UDATA: {
+                Env* e = toenv(s.obj);
+                e->slots[s.index] = s.old;
+                gc_barrier(e, s.old);
+                break;
+            }
+            case LV_TAB:
+                if (s.old.uval == Unbound.uval) {
+                    tab_remove(s.obj, s.key);
+                } else {
+                    tab_set(s.obj, s.key, s.old);
+                }
+                break;
+            case LV_UVEC: {
+                size_t size = uvec_elemsize(unsafe_touvec(s.obj)->type);
+                memcpy(unsafe_touvec(s.obj)->data + s.index * size, s.bytes.data(), s.bytes.size());
+                break;
+            }
+            case LV_PORT:
+                unsafe_toport(s.obj)->buf->resize(s.index);
+                break;
+        }
+    }
+    vm->heapundo.clear();
+    // frozen frames first written to by the request
+    for (auto it = vm->envcopies.begin(); it != vm->envcopies.end();) {
+        it = isbase(it->second) ? std::next(it) : vm->envcopies.erase(it);
+    }
+    for (size_t i = vm->baseglobals; i < vm->globals.size(); ++i) {
+        vm->slots.erase(vm->globalsym[i].uval);
+    }
+    vm->globals.resize(vm->baseglobals);
+    vm->globalsym.resize(vm->baseglobals);
+    for (size_t i = vm->baseprotos; i < vm->protos.size(); ++i) {
+        delete vm->protos[i];
+    }
+    vm->protos.resize(vm->baseprotos);
+    vm->sites.resize(vm->baseprotos);
+    ++vm->epoch;
+    checkarith();
+}
+
+void vm_savepair(Value pair)
+{
+    if (isbase(pair)) {
+        const Pair* p = unsafe_topair(pair);
+        vm->heapundo.push_back(HeapSaved{pair, p->car, p->cdr, 0, {}});
+    }
+}
+
+void vm_saveentry(Value tab, Value key)
+{
+    if (isbase(tab)) {
+        Value old = Unbound;
+        tab_get(tab, key, old);
+        vm->heapundo.push_back(HeapSaved{tab, key, old, 0, {}});
+    }
+}
+
+void vm_saveelems(Value uvec, size_t start, size_t end)
+{
+    if (isbase(uvec)) {
+        size_t size = uvec_elemsize(unsafe_touvec(uvec)->type);
+        const char* data = (const char*) unsafe_touvec(uvec)->data;
+        vm->heapundo.push_back(HeapSaved{uvec, mknil(), mknil(), start, std::string(data + start * size, (end - start) * size)});
+    }
+}
+
+void vm_saveport(Value port)
+{
+    if (isbase(port)) {
+        vm->heapundo.push_back(HeapSaved{port, mknil(), mknil(), unsafe_toport(port)->buf->size(), {}});
+    }
+}
+
+FrozenGlobals::~FrozenGlobals()
+{
+    for (Proto* p : protos) {
+        delete p;
+    }
+}
+
+namespace {
+
+uint32_t builtinnamed(const char* name)
+{
+    size_t i = 0;
+    while (strcmp(builtins[i].name, name) != 0) {
+        ++i;
+    }
+    return i;
+}
+
+void startvm(const FrozenGlobals* f)
+{
+    static std::atomic<uint64_t> nextid{1};
+    ownvm.reset(new VM);
+    vm = ownvm.get();
+    vm->id = nextid++;
+    stats_attach();
+    region_init(vm->stack, StackLimit * sizeof(Value));
+    vm->top = vm->high = stackbase();
+    gc_addroots(visitroots, nullptr);
+    if (f) {
+        vm->frozen = f;
+        vm->globalsym = f->syms;
+        vm->globals.resize(f->syms.size());
+        for (size_t i = 0; i < f->syms.size(); ++i) {
+            if (f->bound[i]) {
+                vm->globals[i].value = f->values[i];
+            }
+        }
+        vm->protos = f->protos;
+        vm->nfrozen = f->protos.size();
+        vm->sites.assign(vm->nfrozen, nullptr);
+    } else {
+        for (size_t i = 0; i < nbuiltins; ++i) {
+            setglobal(reserveglobal(mksym(builtins[i].name)), mkbuiltin(i));
+        }
+    }
+    const char* arith[] = { "+", "-", "*", "<", "=", ">" };
+    for (int j = 0; j <= OP_GT - OP_ADD; ++j) {
+        vm->arithsym[j] = mksym(arith[j]);
+        vm->arithfn[j] = mkbuiltin(builtinnamed(arith[j]));
+        // reserved before any checkpoint, so rollbacks keep it
+        vm->arithslot[j] = globalslot(vm->arithsym[j]);
+    }
+    checkarith();
+}
+
+} // namespace
+
+void vm_init()
+{
+    if (!vm) {
+        startvm(nullptr);
+    }
+}
+
+bool vm_attach(const FrozenGlobals* f)
+{
+    if (vm) {
+        return false;
+    }
+    startvm(f);
+    return true;
+}
+
+void vm_slots(std::vector<Value>& syms, std::vector<Value>& values, std::vector<bool>& bound)
+{
+    vm_init();
+    syms = vm->globalsym;
+    values.clear();
+    bound.clear();
+    for (const Global& g : vm->globals) {
+        bool b = g.value.uval != Unbound.uval;
+        values.push_back(b ? g.value : mknil());
+        bound.push_back(b);
+    }
+}
+
+Env* vm_env(Value env) { return toenv(env); }
+
+uint64_t vm_id()
+{
+    vm_init();
+    return vm->id;
+}
+
+void vm_capture(std::string* text, size_t limit)
+{
+    vm_init();
+    vm->output      = text;
+    vm->outputlimit = limit;
+}
+
+bool vm_capturing(size_t& room)
+{
+    if (!vm->output) {
+        return false;
+    }
+    room = vm->outputlimit - std::min(vm->outputlimit, vm->output->size());
+    return true;
+}
+
+bool vm_print(std::string_view s)
+{
+    if (!vm->output) {
+        fwrite(s.data(), 1, s.size(), stdout);
+        return true;
+    }
+    if (s.size() > vm->outputlimit - std::min(vm->outputlimit, vm->output->size())) {
+        return false;
+    }
+    vm->output->append(s);
+    return true;
+}
+
+bool vm_getglobal(Value sym, Value& out)
+{
+    vm_init();
+    const Global* g = global(sym);
+    if (!g) {
+        return false;
+    }
+    out = g->value;
+    return true;
+}
+
+void vm_setglobal(Value sym, Value v)
+{
+    vm_init();
+    setglobal(reserveglobal(sym), v);
+    checkarith();
+}
+
+size_t vm_backtrace(uint32_t* out, size_t max, size_t& depth)
+{
+    depth = 0;
+    if (!vm || vm->framesmoving) {
+        return 0;
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    const CallInfo* frames = vm->frames.data();
+    depth = vm->frames.size();
+    size_t n = std::min(depth, max);
+    for (size_t j = 0; j < n; ++j) {
+        out[j] = frames[depth - 1 - j].proto;
+    }
+    return n;
+}
+
+std::vector<Value> vm_globalsyms()
+{
+    vm_init();
+    std::vector<Value> syms;
+    for (size_t i = 0; i < vm->globals.size(); ++i) {
+        if (vm->globals[i].value.uval != Unbound.uval) {
+            syms.push_back(vm->globalsym[i]);
+        }
+    }
+    return syms;
+}
+
+int vm_run(uint32_t proto, Value& result)
+{
+    const Proto* p = vm->protos[proto];
+    Value* base = vm->top;
+    if (base + p->nregs > stacklim()) {
+        result = mkstr("stack overflow");
+        return ERROR;
+    }
+    for (Value* r = base; r < base + p->nregs; ++r) {
+        *r = mknil();
+    }
+    size_t entry = vm->frames.size();
+    pushcall(CallInfo{proto, p->code.data(), base, mknil()});
+    int status = execute(entry, result);
+    vm->top = base;
+    // give back what a deep recursion committed
+    if (vm->frames.empty() && (char*) vm->high - vm->stack.base > (ptrdiff_t) StackKeep) {
+        vm->stack.top = vm->stack.base + StackKeep;
+        region_trim(vm->stack);
+        vm->high = vm->top;
+        vm->framesmoving = 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        vm->frames.shrink_to_fit();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        vm->framesmoving = 0;
+    }
+    return status;
+}
+
+void vm_dump(uint32_t proto, FILE* out)
+{
+    const Proto* p = vm->protos[proto];
+    fprintf(out, "function %s <%u> (%u params%s, %u regs, %zu consts)\n",
+            isnil(p->name) ? "<toplevel>" : valprint(p->name).c_str(),
+            proto, p->nparams, p->rest ? " and a rest" : "", p->nregs, p->consts.size());
+    for (size_t pc = 0; pc < p->code.size(); ++pc) {
+        uint32_t i = p->code[pc];
+        Opcode op = getop(i);
+        fprintf(out, "  %4zu  %-9s", pc, optostr(op));
+        switch (op) {
+            case OP_LOADK:
+            case OP_GETGLOBAL:
+            case OP_SETGLOBAL:
+            case OP_DEFGLOBAL:
+                fprintf(out, "%3u %5u    ; %s\n", geta(i), getbx(i), valprint(p->consts[getbx(i)]).c_str());
+                break;
+            case OP_CALLG:
+            case OP_TAILCALLG: {
+                const CallSite& site = p->sites[p->code[++pc]];
+                fprintf(out, "%3u %3u %3u  ; %s\n", geta(i), getb(i), p->code[pc], valprint(site.sym).c_str());
+                break;
+            }
+            case OP_CLOSURE:
+                fprintf(out, "%3u %5u    ; <%u>\n", geta(i), getbx(i), p->protos[getbx(i)]);
+                break;
+            case OP_JMP:
+            case OP_JMPF:
+            case OP_JMPT:
+                fprintf(out, "%3u %5d    ; to %zu\n", geta(i), getsbx(i), pc + 1 + getsbx(i));
+                break;
+            default:
+                fprintf(out, "%3u %3u %3u\n", geta(i), getb(i), getc(i));
+                break;
+        }
+    }
+    for (uint32_t child : p->protos) {
+        vm_dump(child, out);
+    }
+}
+
+void vm_dumpcallsites(FILE* out, size_t limit)
+{
+    if (!vm) {
+        return;
+    }
+    std::vector<const CallSite*> sites;
+    std::vector<uint32_t>        owner;
+    for (uint32_t j = 0; j < vm->protos.size(); ++j) {
+        // a frozen prototype's sites only count once copied
+        if (!vm->sites[j]) {
+            continue;
+        }
+        for (size_t k = 0; k < vm->protos[j]->sites.size(); ++k) {
+            const CallSite& site = vm->sites[j][k];
+            if (site.calls > 0) {
+                sites.push_back(&site);
+                owner.push_back(j);
+            }
+        }
+    }
+    std::vector<size_t> order(sites.size());
+    for (size_t j = 0; j < order.size(); ++j) {
+        order[j] = j;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return sites[a]->calls > sites[b]->calls;
+    });
+    fprintf(out, "%14s %10s  %-20s %s\n", "calls", "misses", "site", "callee");
+    for (size_t j = 0; j < order.size() && j < limit; ++j) {
+        const CallSite& site = *sites[order[j]];
+        const Proto*    p    = vm->protos[owner[order[j]]];
+        std::string where = isnil(p->name) ? "<toplevel>" : valprint(p->name);
+        where += ":" + std::to_string(site.pc);
+        fprintf(out, "%14llu %10llu  %-20s %s\n", (unsigned long long) site.calls,
+                (unsigned long long) site.misses, where.c_str(), valprint(site.sym).c_str());
+    }
+}
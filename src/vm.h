@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+#include "value.h"
+#include "builtins.h"
+
+//----------------------------------------------------------
+// Instruction format (32 bits, little end first):
+//   | op:8 | A:8 | B:8 | C:8 |    iABC
+//   | op:8 | A:8 |   Bx:16   |    iABx, sBx is Bx as int16
+//
+// R[x] is register x of the current frame, K[x] constant x
+// of the current prototype. Env(d) is the heap frame d parent
+// links up from the innermost one; only captured variables
+// live there, everything else stays in registers.
+//
+// ADD .. GT are (op a b) for the global builtin of that name;
+// if the global has been rebound they call whatever it holds.
+//
+// CALLG is CALL of a global procedure; it takes a second code
+// word, the index of its call site in the prototype, which
+// caches the callee for as long as the global is not rebound.
+// The TAIL variants reuse the caller's frame, so a loop written
+// as tail recursion runs in constant space.
+//----------------------------------------------------------
+
+#define OPCODES(X) \
+    X(MOVE)      /* A B     R[A] = R[B]                            */ \
+    X(LOADK)     /* A Bx    R[A] = K[Bx]                           */ \
+    X(LOADNIL)   /* A       R[A] = '()                             */ \
+    X(LOADBOOL)  /* A B     R[A] = B ? #t : #f                     */ \
+    X(GETENV)    /* A B C   R[A] = Env(B)[C]                       */ \
+    X(SETENV)    /* A B C   Env(B)[C] = R[A]                       */ \
+    X(GETGLOBAL) /* A Bx    R[A] = global K[Bx]                    */ \
+    X(SETGLOBAL) /* A Bx    set! global K[Bx] to R[A]              */ \
+    X(DEFGLOBAL) /* A Bx    define global K[Bx] as R[A]            */ \
+    X(ENTER)     /* A       push a heap frame with A slots         */ \
+    X(CLOSURE)   /* A Bx    R[A] = closure of child prototype Bx   */ \
+    X(ADD)       /* A B C   R[A] = R[B] + R[C]                     */ \
+    X(SUB)       /* A B C   R[A] = R[B] - R[C]                     */ \
+    X(MUL)       /* A B C   R[A] = R[B] * R[C]                     */ \
+    X(LT)        /* A B C   R[A] = R[B] < R[C]                     */ \
+    X(EQ)        /* A B C   R[A] = R[B] = R[C]                     */ \
+    X(GT)        /* A B C   R[A] = R[B] > R[C]                     */ \
+    X(CALL)      /* A B     R[A] = R[A](R[A+1], ..., R[A+B])       */ \
+    X(CALLG)     /* A B     R[A] = global(R[A+1], ..., R[A+B])     */ \
+    X(TAILCALL)  /* A B     return R[A](R[A+1], ..., R[A+B])       */ \
+    X(TAILCALLG) /* A B     return global(R[A+1], ..., R[A+B])     */ \
+    X(RET)       /* A       return R[A]                            */ \
+    X(JMP)       /* sBx     pc += sBx                              */ \
+    X(JMPF)      /* A sBx   if R[A] is #f then pc += sBx           */ \
+    X(JMPT)      /* A sBx   if R[A] is not #f then pc += sBx       */
+
+enum Opcode : uint8_t {
+#define X(op) OP_##op,
+    OPCODES(X)
+#undef X
+    OP_NOPS
+};
+
+inline uint32_t mkabc(Opcode op, uint32_t a, uint32_t b, uint32_t c)
+{
+    assert(a < 256 && b < 256 && c < 256);
+    return op | (a << 8) | (b << 16) | (c << 24);
+}
+
+inline uint32_t mkabx(Opcode op, uint32_t a, uint32_t bx)
+{
+    assert(a < 256 && bx < 65536);
+    return op | (a << 8) | (bx << 16);
+}
+
+inline uint32_t mkasbx(Opcode op, uint32_t a, int32_t sbx)
+{
+    assert(sbx >= INT16_MIN && sbx <= INT16_MAX);
+    return mkabx(op, a, (uint16_t) sbx);
+}
+
+inline Opcode  getop(uint32_t i)  { return (Opcode) (i & 0xffu); }
+inline uint32_t geta(uint32_t i)  { return (i >> 8) & 0xffu; }
+inline uint32_t getb(uint32_t i)  { return (i >> 16) & 0xffu; }
+inline uint32_t getc(uint32_t i)  { return i >> 24; }
+inline uint32_t getbx(uint32_t i) { return i >> 16; }
+inline int32_t  getsbx(uint32_t i) { return (int16_t) (i >> 16); }
+
+const char* optostr(Opcode op);
+
+struct Proto;
+
+// Monomorphic inline cache of a CALLG. It holds the callee resolved
+// on the last miss, either a builtin or a closure whose arity matched,
+// and is valid while the global's binding version equals `version`.
+struct CallSite
+{
+    Value        sym;              // the global being called
+    uint32_t     slot    = 0;      // its global, set by vm_addproto
+    uint32_t     pc;               // of the CALLG, for reports
+    uint32_t     version = 0;      // 0: empty
+    BuiltinFn    fn      = nullptr;
+    uint32_t     index   = 0;      // closure's prototype
+    const Proto* proto   = nullptr;
+    Value        env     = mknil(); // closure's environment
+    uint64_t     calls   = 0;
+    uint64_t     misses  = 0;
+};
+
+// Compiled procedure. Prototypes are never collected, and closures
+// refer to them by index so heap objects hold no C++ pointers.
+struct Proto
+{
+    std::vector<uint32_t> code;
+    std::vector<Value>    consts;
+    std::vector<uint32_t> protos;  // child prototypes, as vm_protos indices
+    std::vector<CallSite> sites;
+    // the global slot of each symbol constant, set by vm_addproto
+    std::vector<uint32_t> globals;
+    uint32_t              nparams = 0;
+    bool                  rest    = false;  // the arguments past nparams, as a list in R[nparams]
+    uint32_t              nregs   = 0;
+    uint32_t              epoch   = 0;      // set by vm_addproto
+    Value                 name    = mknil();
+};
+
+uint32_t vm_addproto(Proto* p);
+// The number of prototypes; vm_dropprotos(n) deletes those added after
+// the first `n`, for a compilation that failed part way.
+size_t vm_nprotos();
+void vm_dropprotos(size_t n);
+// Checks code that did not come from the compiler (see csc.h, image.h)
+// before it is added: every register, constant, child and call site
+// index in range, every jump onto an instruction, no falling off the
+// end, and every heap frame access within `frames`, the slot counts of
+// the frames the code runs in, innermost first. Sets `inner` to those
+// of the frames its closures capture.
+bool vm_verify(const Proto* p, const std::vector<uint32_t>& frames, std::vector<uint32_t>& inner);
+Proto* vm_proto(uint32_t index);
+// The prototype of closure `cl`, or nullptr if it was compiled after a
+// checkpoint that has since been rolled back.
+Proto* vm_closureproto(const Closure* cl);
+
+// Checkpoints, for running requests against a fixed base environment
+// (see serve.h). vm_checkpoint takes the current globals and prototypes
+// as the base. Until vm_rollback, the first change of each base binding
+// saves its old value, so a rollback costs as much as the changes made,
+// not the size of the environment: it restores those bindings, and
+// drops the globals and prototypes added since. Heap objects work the
+// same way: the checkpoint flags everything live as the base (see
+// gc_markbase), the vm_save functions below log what each store into a
+// base object replaces, and the rollback puts it back, so a request
+// cannot leave a closure of its own in a base list either.
+// Frozen frames written to since the checkpoint are copied again on
+// their next write. Both must be called outside of vm_run.
+void vm_checkpoint();
+void vm_rollback();
+// Called by the builtins before a store into a pair, the entry of `key`
+// in a table, the elements [start, end) of a numeric vector or the
+// text of a port; they save it if the object belongs to the base.
+void vm_savepair(Value pair);
+void vm_saveentry(Value tab, Value key);
+void vm_saveelems(Value uvec, size_t start, size_t end);
+void vm_saveport(Value port);
+
+// The part of a frozen environment (see freeze.h) that interpreters
+// start from: every global slot of the interpreter that was frozen, in
+// slot order, so that the slot numbers compiled into `protos` stay
+// valid, and the prototypes that the segment's closures index. Never
+// changed once built, so the interpreters of any number of threads
+// share it without locking.
+struct FrozenGlobals
+{
+    std::vector<Value>                     syms;    // slot -> symbol
+    std::vector<Value>                     values;  // slot -> value
+    std::vector<bool>                      bound;
+    std::unordered_map<uint64_t, uint32_t> slots;   // symbol -> slot
+    std::vector<Proto*>                    protos;
+
+    ~FrozenGlobals();
+};
+
+// Every global slot of the calling thread's interpreter, in slot order,
+// bound or not; `values` holds nil for the unbound ones.
+void vm_slots(std::vector<Value>& syms, std::vector<Value>& values, std::vector<bool>& bound);
+// Starts the calling thread's interpreter from `f` rather than from the
+// builtins alone. Its globals start out as copies of the frozen ones,
+// so its define and set! only change its own; the frozen prototypes
+// are run in place, each with call sites of the thread's own. `f` must
+// outlive the interpreter. Returns false if the interpreter has
+// already started.
+bool vm_attach(const FrozenGlobals* f);
+// The heap frame `env` refers to. The first write to a variable of a
+// frozen frame copies the frame into the thread's heap, and from then on
+// this returns the copy.
+Env* vm_env(Value env);
+
+// Defines the builtins in the global environment. Idempotent.
+void vm_init();
+// Tells apart the interpreters of a process (see isolate.h); ids are
+// never reused.
+uint64_t vm_id();
+// Global bindings, for code outside the VM. vm_getglobal returns false
+// if `sym` is unbound.
+bool vm_getglobal(Value sym, Value& out);
+void vm_setglobal(Value sym, Value v);
+// The symbols of every bound global.
+std::vector<Value> vm_globalsyms();
+// Stores the prototypes of the innermost `max` frames of the calling
+// thread, innermost first, and sets `depth` to the number of frames.
+// Async-signal-safe; returns 0 if the frames cannot be read right now.
+size_t vm_backtrace(uint32_t* out, size_t max, size_t& depth);
+// The output procedures, called without a port, print with vm_print:
+// to stdout, or once vm_capture(&text, limit) is called, appended to
+// `text` until vm_capture(nullptr, 0). vm_print prints nothing and
+// returns false if `text` would grow past `limit` bytes. vm_capturing
+// sets `room` to the bytes left.
+void vm_capture(std::string* text, size_t limit);
+bool vm_capturing(size_t& room);
+bool vm_print(std::string_view s);
+// Runs a top-level prototype. On ERROR `result` holds the message.
+int vm_run(uint32_t proto, Value& result);
+// Applies procedure `f`; may be called from builtins.
+int vm_call(Value f, const Value* args, int nargs, Value& result);
+void vm_dump(uint32_t proto, FILE* out);
+// Prints the `limit` most called call sites with their cache misses.
+void vm_dumpcallsites(FILE* out, size_t limit);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include "isolate.h"
+
+// Evaluates `src` in the calling thread's interpreter. Returns the
+// printed value of its last form, or "error: " and the message.
+inline std::string evalprint(const char* src)
+{
+    EvalResult r = eval(src, strlen(src));
+    return r.status == OK ? r.value : "error: " + r.value;
+}
+
+#ifdef CSCHEME_BIN
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs `src` as a script file in a fresh cscheme process, with `flags`
+// on its command line. Returns what it wrote to stdout; `status` gets
+// its wait status.
+inline std::string runscript(const char* src, int& status, const char* flags = "--no-cache")
+{
+    std::string path = "/tmp/cscheme-test-" + std::to_string(getpid()) + ".scm";
+    FILE* fp = fopen(path.c_str(), "w");
+    fputs(src, fp);
+    fclose(fp);
+    std::string cmd = std::string(CSCHEME_BIN) + " " + flags + " " + path;
+    FILE* out = popen(cmd.c_str(), "r");
+    std::string text;
+    char buf[256];
+    for (size_t n; (n = fread(buf, 1, sizeof buf, out)) > 0;) {
+        text.append(buf, n);
+    }
+    status = pclose(out);
+    unlink(path.c_str());
+    return text;
+}
+#endif
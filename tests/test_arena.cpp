@@ -0,0 +1,45 @@
+#include <catch2/catch.hpp>
+#include "arena.h"
+
+TEST_CASE("Arena: size classes", "[arena]")
+{
+    REQUIRE(sizeclass(1) == 16);
+    REQUIRE(sizeclass(16) == 16);
+    REQUIRE(sizeclass(17) == 32);
+    REQUIRE(sizeclass(512) == 512);
+    REQUIRE(sizeclass(513) == 576);
+}
+
+TEST_CASE("Arena: region grows and keeps contents", "[arena]")
+{
+    Region r;
+    region_init(r, 4096);
+    char* p = (char*) r.bump(100);
+    memset(p, 'a', 100);
+    region_grow(r, 1u << 20);
+    REQUIRE(r.cap() >= (1u << 20));
+    REQUIRE(r.used() == 100);
+    REQUIRE(r.base[0] == 'a');
+    REQUIRE(r.base[99] == 'a');
+    region_free(r);
+}
+
+TEST_CASE("Arena: slab slots are stable and reused", "[arena]")
+{
+    struct Pair { uint64_t car, cdr; };
+    TypedSlab<Pair> slab;
+    std::vector<uint32_t> idx;
+    for (uint64_t i = 0; i < 10000; ++i) {
+        uint32_t n = slab.alloc();
+        slab.get(n)->car = i;
+        idx.push_back(n);
+    }
+    REQUIRE(slab.used() == 10000);
+    for (uint64_t i = 0; i < 10000; ++i) {
+        REQUIRE(slab.get(idx[i])->car == i);
+    }
+    REQUIRE((uintptr_t) slab.get(0) % CacheLine == 0);
+
+    slab.free(idx[42]);
+    REQUIRE(slab.alloc() == idx[42]);
+}
@@ -0,0 +1,141 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "csc.h"
+#include "evalprint.h"
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+// Compiles every form of `src` without running it.
+static std::vector<uint32_t> compileall(const char* src)
+{
+    vm_init();
+    Input in(src, strlen(src));
+    Reader r(in);
+    std::vector<uint32_t> protos;
+    for (Node form; read(r, form) == OK; form = Node()) {
+        uint32_t proto;
+        std::string err;
+        REQUIRE(compile(form, proto, err) == OK);
+        protos.push_back(proto);
+        r.clear();
+    }
+    return protos;
+}
+
+// Loads `path` in a fresh interpreter and returns the printed value of
+// the last form, or "" if the cache was rejected.
+static std::string loadandrun(const std::string& path, uint64_t hash)
+{
+    return std::async(std::launch::async, [&] {
+        std::vector<uint32_t> protos;
+        if (!csc_load(path.c_str(), hash, protos)) {
+            return std::string();
+        }
+        Value v = mknil();
+        for (uint32_t p : protos) {
+            if (vm_run(p, v) != OK) {
+                return "error: " + valprint(v, false);
+            }
+        }
+        return valprint(v);
+    }).get();
+}
+
+TEST_CASE("Csc: compiled code round trip", "[csc]")
+{
+    const char* src =
+        "(define (csc-fact n) (if (= n 0) 1 (* n (csc-fact (- n 1)))))"
+        "(define csc-data '(a \"b\" 1.5 (c) #t))"
+        "(define (csc-adder k) (lambda (x) (+ x k)))"
+        "(list (csc-fact 10) csc-data ((csc-adder 2) 40))";
+    uint64_t hash = csc_hash(src, strlen(src));
+    std::string path = "csc_test.csc";
+    REQUIRE(csc_save(path.c_str(), hash, compileall(src)));
+    REQUIRE(loadandrun(path, hash) == "(3628800 (a \"b\" 1.5 (c) #t) 42)");
+
+    // stale source
+    REQUIRE(loadandrun(path, hash + 1) == "");
+    // truncated file
+    FILE* f = fopen(path.c_str(), "r+");
+    REQUIRE(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    REQUIRE(truncate(path.c_str(), size - 3) == 0);
+    REQUIRE(loadandrun(path, hash) == "");
+    remove(path.c_str());
+    REQUIRE(loadandrun(path, hash) == "");
+}
+
+TEST_CASE("Csc: damaged files are ignored", "[csc]")
+{
+    const char* src =
+        "(define (csc-count n) (let ((k 0)) (lambda () (set! k (+ k n)) k)))"
+        "(define csc-tick (csc-count 3))"
+        "(csc-tick)"
+        "(list (csc-tick) '(x \"y\" 2.5))";
+    uint64_t hash = csc_hash(src, strlen(src));
+    std::string path = "csc_damaged.csc";
+    REQUIRE(csc_save(path.c_str(), hash, compileall(src)));
+    std::ifstream in(path, std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    REQUIRE(loadandrun(path, hash) == "(6 (x \"y\" 2.5))");
+
+    for (size_t j = 0; j < file.size(); ++j) {
+        std::string copy = file;
+        copy[j] ^= 0x10;
+        FILE* f = fopen(path.c_str(), "wb");
+        REQUIRE(f);
+        REQUIRE(fwrite(copy.data(), 1, copy.size(), f) == copy.size());
+        fclose(f);
+        REQUIRE(loadandrun(path, hash) == "");
+    }
+    remove(path.c_str());
+}
+
+TEST_CASE("Csc: a forged double is rejected", "[csc]")
+{
+    const char* src = "1.5";
+    uint64_t hash = csc_hash(src, strlen(src));
+    std::string path = "csc_forged.csc";
+    REQUIRE(csc_save(path.c_str(), hash, compileall(src)));
+    std::ifstream in(path, std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    double d = 1.5;
+    size_t at = file.find('d' + std::string((const char*) &d, 8));
+    REQUIRE(at != std::string::npos);
+
+    // a pair reference in place of the double, under a correct checksum
+    // (the header is 40 bytes, the sum at offset 24)
+    uint64_t forged = mkref(LV_PAIR, 0).uval;
+    memcpy(&file[at + 1], &forged, 8);
+    uint64_t sum = csc_hash(file.data() + 40, file.size() - 40);
+    memcpy(&file[24], &sum, 8);
+    FILE* f = fopen(path.c_str(), "wb");
+    REQUIRE(f);
+    REQUIRE(fwrite(file.data(), 1, file.size(), f) == file.size());
+    fclose(f);
+    REQUIRE(loadandrun(path, hash) == "");
+    remove(path.c_str());
+}
+
+TEST_CASE("Csc: constants are cached as read, not as the script left them", "[csc]")
+{
+    const char* src = "(define x '(1 2)) (display x) (set-car! x 5)";
+    int status;
+    REQUIRE(runscript(src, status, "") == "(1 2)");
+    REQUIRE(status == 0);
+    // from the cache
+    REQUIRE(runscript(src, status, "") == "(1 2)");
+    REQUIRE(status == 0);
+    remove(("/tmp/cscheme-test-" + std::to_string(getpid()) + ".csc").c_str());
+}
@@ -0,0 +1,177 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "evalprint.h"
+#include "freeze.h"
+#include "image.h"
+#include "isolate.h"
+#include "vm.h"
+
+// Evaluates `src` on a thread of its own and freezes the result.
+static std::shared_ptr<const Frozen> frozenprelude(const char* src, std::string& err)
+{
+    std::shared_ptr<const Frozen> f;
+    std::thread([&] {
+        EvalResult r = eval(src, strlen(src));
+        REQUIRE(r.status == OK);
+        f = freeze(err);
+    }).join();
+    return f;
+}
+
+TEST_CASE("Freeze: attached threads start from the frozen globals", "[freeze]")
+{
+    std::string err;
+    auto f = frozenprelude(
+        "(define (sq x) (* x x))"
+        "(define (fact n) (if (< n 2) 1 (* n (fact (- n 1)))))"
+        "(define (adder n) (lambda (x) (+ x n)))"
+        "(define names '(alpha-beta gamma-delta))"
+        "(define greeting \"hello, world\")"
+        "(define ratio 3.25)", err);
+    REQUIRE(f);
+    REQUIRE(freeze_size(*f) > 0);
+    for (int j = 0; j < 2; ++j) {
+        std::thread([&] {
+            std::string e;
+            REQUIRE(freeze_attach(f, e));
+            REQUIRE(evalprint("(sq 12)") == "144");
+            REQUIRE(evalprint("(fact 10)") == "3628800");
+            REQUIRE(evalprint("((adder 3) 4)") == "7");
+            REQUIRE(evalprint("(eq? (car names) 'alpha-beta)") == "#t");
+            REQUIRE(evalprint("names") == "(alpha-beta gamma-delta)");
+            REQUIRE(evalprint("(string-append greeting \"!\")") == "\"hello, world!\"");
+            REQUIRE(evalprint("(= ratio 3.25)") == "#t");
+            REQUIRE(evalprint("(car 1)") == "error: car: not a pair");
+        }).join();
+    }
+}
+
+TEST_CASE("Freeze: changes stay with the thread that made them", "[freeze]")
+{
+    std::string err;
+    auto f = frozenprelude(
+        "(define (sq x) (* x x))"
+        "(define box (list 1 2 3))"
+        "(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))", err);
+    REQUIRE(f);
+    std::thread([&] {
+        std::string e;
+        REQUIRE(freeze_attach(f, e));
+        evalprint("(define (sq x) 0) (define extra 1)");
+        REQUIRE(evalprint("(sq 3)") == "0");
+        REQUIRE(evalprint("extra") == "1");
+        REQUIRE(evalprint("(set-car! box 9)") == "error: set-car!: pair is frozen");
+        REQUIRE(evalprint("(set-cdr! box '())") == "error: set-cdr!: pair is frozen");
+        REQUIRE(evalprint("(next) (next) (next)") == "3");
+    }).join();
+    std::thread([&] {
+        std::string e;
+        REQUIRE(freeze_attach(f, e));
+        REQUIRE(evalprint("(sq 3)") == "9");
+        REQUIRE(evalprint("extra") == "error: unbound variable: extra");
+        REQUIRE(evalprint("box") == "(1 2 3)");
+        REQUIRE(evalprint("(next)") == "1");
+    }).join();
+}
+
+TEST_CASE("Freeze: the collector leaves frozen objects alone", "[freeze]")
+{
+    std::string err;
+    auto f = frozenprelude(
+        "(define names '(alpha-beta gamma-delta epsilon-zeta))"
+        "(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))", err);
+    REQUIRE(f);
+    std::thread([&] {
+        std::string e;
+        REQUIRE(freeze_attach(f, e));
+        evalprint("(define keep (cons names (list (string-append \"long \" \"string\") 'alpha-beta)))");
+        evalprint("(next)");
+        for (int j = 0; j < 3; ++j) {
+            evalprint("(define (churn n acc) (if (= n 0) acc (churn (- n 1) (cons n names))))"
+                      "(churn 100000 '())");
+            gc_collect(j == 2);
+        }
+        REQUIRE(evalprint("keep") == "((alpha-beta gamma-delta epsilon-zeta) \"long string\" alpha-beta)");
+        REQUIRE(evalprint("(eq? (car (car keep)) (car (cdr (cdr keep))))") == "#t");
+        REQUIRE(evalprint("(next)") == "2");
+    }).join();
+}
+
+TEST_CASE("Freeze: hash tables and vectors are shared read-only", "[freeze]")
+{
+    std::string err;
+    auto f = frozenprelude(
+        "(define key \"a long string key\")"
+        "(define table (make-hash-table))"
+        "(hash-set! table 'alpha-beta 1) (hash-set! table 2 '(two)) (hash-set! table key table)"
+        "(define v (f64vector 1.5 2.5 3.5)) (define bytes (bytevector 7 8))", err);
+    REQUIRE(f);
+    for (int j = 0; j < 2; ++j) {
+        std::thread([&] {
+            std::string e;
+            REQUIRE(freeze_attach(f, e));
+            REQUIRE(evalprint("(list (hash-ref table 'alpha-beta) (hash-ref table 2) (hash-count table))") == "(1 (two) 3)");
+            REQUIRE(evalprint("(eq? (hash-ref table key) table)") == "#t");
+            REQUIRE(evalprint("(hash-ref table \"a long string key\" 'missing)") == "missing");
+            REQUIRE(evalprint("(list (f64vector-sum v) (bytevector-u8-ref bytes 1))") == "(7.5 8)");
+            REQUIRE(evalprint("(hash-set! table 3 3)") == "error: hash-set!: table is frozen");
+            REQUIRE(evalprint("(hash-remove! table 2)") == "error: hash-remove!: table is frozen");
+            REQUIRE(evalprint("(f64vector-set! v 0 0.0)") == "error: f64vector-set!: vector is frozen");
+            REQUIRE(evalprint("(f64vector-fill! v 0.0)") == "error: f64vector-fill!: vector is frozen");
+            REQUIRE(evalprint("(f64vector-map! * v 2.0)") == "error: f64vector-map!: vector is frozen");
+            REQUIRE(evalprint("(bytevector-copy! bytes 0 (bytevector 1))") == "error: bytevector-copy!: vector is frozen");
+            REQUIRE(evalprint("(let ((w (make-f64vector 3))) (f64vector-copy! w 0 v) w)") == "#f64(1.5 2.5 3.5)");
+            REQUIRE(evalprint("(list v bytes)") == "(#f64(1.5 2.5 3.5) #u8(7 8))");
+        }).join();
+    }
+}
+
+TEST_CASE("Freeze: an image saved by an attached thread has its changes", "[freeze][image]")
+{
+    std::string err;
+    auto f = frozenprelude(
+        "(define table (make-hash-table)) (hash-set! table 'alpha-beta (f64vector 0.5))"
+        "(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))", err);
+    REQUIRE(f);
+    const char* path = "freeze_test.img";
+    std::thread([&] {
+        std::string e;
+        REQUIRE(freeze_attach(f, e));
+        REQUIRE(evalprint("(next) (next) (save-image \"freeze_test.img\")") == "#t");
+    }).join();
+    std::thread([&] {
+        std::string e;
+        REQUIRE(image_load(path, e));
+        REQUIRE(evalprint("(next)") == "3");
+        REQUIRE(evalprint("(hash-set! table 1 1) (list (hash-ref table 'alpha-beta) (hash-count table))") == "(#f64(0.5) 2)");
+    }).join();
+    remove(path);
+}
+
+TEST_CASE("Freeze: errors", "[freeze]")
+{
+    std::string err;
+    REQUIRE_FALSE(frozenprelude("(define out (open-output-string))", err));
+    REQUIRE(err.find("cannot freeze") == 0);
+    err.clear();
+    REQUIRE_FALSE(frozenprelude("(define t (make-hash-table)) (hash-set! t 1 (open-output-string))", err));
+    REQUIRE(err.find("cannot freeze") == 0);
+
+    auto f = frozenprelude("(define x 1)", err);
+    REQUIRE(f);
+    std::thread([&] {
+        vm_init();
+        std::string e;
+        REQUIRE_FALSE(freeze_attach(f, e));
+        REQUIRE(e == "the interpreter of this thread has already started");
+    }).join();
+    std::thread([&] {
+        std::string e;
+        REQUIRE(freeze_attach(f, e));
+        REQUIRE_FALSE(freeze_attach(f, e));
+        REQUIRE(evalprint("x") == "1");
+    }).join();
+}
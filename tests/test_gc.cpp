@@ -0,0 +1,261 @@
+#include <catch2/catch.hpp>
+#include <string>
+#include "value.h"
+#include "gc.h"
+#include "table.h"
+
+static std::vector<Value> gcroots;
+
+static void visitgcroots(void* ctx, GcVisitFn visit)
+{
+    for (Value v : *(std::vector<Value>*) ctx) {
+        visit(v);
+    }
+}
+
+TEST_CASE("GC: rooted strings survive collections", "[gc]")
+{
+    gc_addroots(visitgcroots, &gcroots);
+    std::string longstr(100, 'x');
+    gcroots.push_back(mkstr("not short"));
+    gcroots.push_back(mkstr(longstr.c_str()));
+
+    gc_collect(false);
+    REQUIRE(std::string(strview(gcroots[0])) == "not short");
+    REQUIRE(std::string(strview(gcroots[1])) == longstr);
+
+    gc_collect(true);
+    REQUIRE(std::string(strview(gcroots[0])) == "not short");
+    REQUIRE(std::string(strview(gcroots[1])) == longstr);
+
+    gcroots.clear();
+    gc_removeroots(visitgcroots, &gcroots);
+}
+
+TEST_CASE("GC: unreachable strings are freed", "[gc]")
+{
+    gc_collect(true);
+    GcStats before = gc_stats();
+    for (int i = 0; i < 1000; ++i) {
+        mkstr("garbage");
+    }
+    REQUIRE(gc_stats().live_handles == before.live_handles + 1000);
+    gc_collect(false);
+    GcStats after = gc_stats();
+    REQUIRE(after.live_handles == before.live_handles);
+    REQUIRE(after.minor_collections == before.minor_collections + 1);
+    REQUIRE(after.bytes_freed > before.bytes_freed);
+}
+
+TEST_CASE("GC: objects survive automatic collections", "[gc]")
+{
+    gc_addroots(visitgcroots, &gcroots);
+    GcStats before = gc_stats();
+    for (int i = 0; i < 200000; ++i) {
+        Value v = mkstr(("object" + std::to_string(i)).c_str());
+        if (i % 100 == 0) {
+            gcroots.push_back(v);
+        }
+    }
+    GcStats after = gc_stats();
+    REQUIRE(after.minor_collections > before.minor_collections);
+    REQUIRE(after.bytes_promoted > before.bytes_promoted);
+    for (size_t i = 0; i < gcroots.size(); ++i) {
+        REQUIRE(std::string(strview(gcroots[i])) == "object" + std::to_string(i * 100));
+    }
+    gcroots.clear();
+    gc_removeroots(visitgcroots, &gcroots);
+}
+
+TEST_CASE("GC: major collection compacts the old generation", "[gc]")
+{
+    gc_collect(true);
+    size_t baseline = gc_stats().old_used;
+
+    for (int i = 0; i < 1000; ++i) {
+        gc_pushroot(mkstr("promoted"));
+    }
+    gc_collect(false);
+    REQUIRE(gc_stats().old_used > baseline);
+
+    Value keep = mkstr("keep me");
+    gc_poproot(1000);
+    gc_pushroot(keep);
+    gc_collect(true);
+    REQUIRE(gc_stats().old_used < baseline + 1000);
+    REQUIRE(std::string(strview(keep)) == "keep me");
+    gc_poproot();
+}
+
+TEST_CASE("GC: pairs keep young objects alive", "[gc]")
+{
+    gc_collect(true);
+    Value list = mklist(nullptr, 0);
+    for (int i = 0; i < 100; ++i) {
+        gc_pushroot(list);
+        list = mkpair(mkstr(("object" + std::to_string(i)).c_str()), list);
+        gc_poproot();
+    }
+    gc_pushroot(list);
+    // the strings are only reachable through pairs, which the minor
+    // collection finds through the remembered set
+    gc_collect(false);
+    Value v = list;
+    for (int i = 99; i >= 0; --i) {
+        REQUIRE(std::string(strview(unsafe_topair(v)->car)) == "object" + std::to_string(i));
+        v = unsafe_topair(v)->cdr;
+    }
+    REQUIRE(isnil(v));
+
+    // a store into an old pair needs the barrier
+    Value young = mkstr("young object");
+    unsafe_topair(list)->car = young;
+    gc_pairbarrier(list.b.lo, young);
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(std::string(strview(unsafe_topair(list)->car)) == "young object");
+    gc_poproot();
+}
+
+TEST_CASE("GC: unreachable pairs are swept", "[gc]")
+{
+    gc_collect(true);
+    uint64_t before = gc_stats().live_pairs;
+    Value items[3] = { mkint(1), mkint(2), mkint(3) };
+    Value kept = mklist(items, 3);
+    gc_pushroot(kept);
+    for (int i = 0; i < 1000; ++i) {
+        mklist(items, 3);
+    }
+    REQUIRE(gc_stats().live_pairs == before + 3003);
+    gc_collect(false);
+    REQUIRE(gc_stats().live_pairs == before + 3003);
+    gc_collect(true);
+    REQUIRE(gc_stats().live_pairs == before + 3);
+    REQUIRE(valprint(kept) == "(1 2 3)");
+    gc_poproot();
+}
+
+static std::string gcvalue(int i)
+{
+    return "a value long enough to live on the heap " + std::to_string(i);
+}
+
+static std::vector<uint32_t> gclist(int n)
+{
+    Value list = mklist(nullptr, 0);
+    std::vector<uint32_t> pairs;
+    for (int k = 0; k < n; ++k) {
+        gc_pushroot(list);
+        list = mkpair(mkint(k), list);
+        gc_poproot();
+        pairs.push_back(list.b.lo);
+    }
+    gc_pushroot(list);
+    return pairs;
+}
+
+static void gcsetcar(uint32_t pair, Value v)
+{
+    gc_pair(pair)->car = v;
+    gc_pairbarrier(pair, v);
+}
+
+TEST_CASE("GC: a major collection runs a step at a time in minor ones", "[gc]")
+{
+    gc_collect(true);
+    const int n = 50000;
+    Value tab = tab_new();
+    gc_pushroot(tab);
+    std::vector<uint32_t> recent = gclist(n);
+    std::vector<uint32_t> oldest = gclist(n);
+    // values old before marking starts, which move back and forth
+    // between a list and a second table, and ones that move from a list
+    // into a third table once
+    const int m = 1000;
+    std::vector<uint32_t> listed = gclist(m);
+    Value parked = tab_new();
+    gc_pushroot(parked);
+    const int once = 10000;
+    std::vector<uint32_t> packed = gclist(once);
+    Value moved = tab_new();
+    gc_pushroot(moved);
+    for (int j = 0; j < m; ++j) {
+        gcsetcar(listed[j], mkstr(gcvalue(-j).c_str()));
+    }
+    for (int j = 0; j < once; ++j) {
+        gcsetcar(packed[j], mkstr(gcvalue(-j).c_str()));
+    }
+
+    // Overwrite the table until the old generation crosses its threshold
+    // and a major collection completes on its own. A value replaced in
+    // the table moves to `recent`, and the one there to `oldest`, so the
+    // pair it moves to is each time the only thing that holds it. The
+    // pair allocated every time round does a little marking.
+    GcStats before = gc_stats();
+    int i = 0;
+    for (; gc_stats().major_collections == before.major_collections && i < 10000000; ++i) {
+        int k = i % n;
+        Value old;
+        if (tab_get(tab, mkint(k), old)) {
+            gcsetcar(oldest[k], gc_pair(recent[k])->car);
+            gcsetcar(recent[k], old);
+        }
+        tab_set(tab, mkint(k), mkstr(gcvalue(i).c_str()));
+        mkpair(mkint(i), mklist(nullptr, 0));
+
+        int j = i % m;
+        if ((i / m) % 2) {
+            Value v;
+            tab_get(parked, mkint(j), v);
+            gcsetcar(listed[j], v);
+            tab_remove(parked, mkint(j));
+        } else {
+            tab_set(parked, mkint(j), gc_pair(listed[j])->car);
+            gcsetcar(listed[j], mkint(0));
+        }
+        if (i % 100 == 0 && i / 100 < once) {
+            tab_set(moved, mkint(i / 100), gc_pair(packed[i / 100])->car);
+            gcsetcar(packed[i / 100], mkint(0));
+        }
+    }
+    GcStats after = gc_stats();
+    REQUIRE(after.major_collections == before.major_collections + 1);
+    // marking took more than the pause that ended it
+    REQUIRE(after.major_steps > before.major_steps + 1);
+    REQUIRE(after.minor_collections > before.minor_collections + 1);
+
+    // the iteration that last wrote key `k` of `size`
+    auto last = [&](int k, int size) { return (i - 1) - (i - 1 - k) % size; };
+    auto check = [&] {
+        Value v;
+        for (int k = 0; k < n; ++k) {
+            int l = last(k, n);
+            REQUIRE(tab_get(tab, mkint(k), v));
+            REQUIRE(std::string(strview(v)) == gcvalue(l));
+            REQUIRE(std::string(strview(gc_pair(recent[k])->car)) == gcvalue(l - n));
+            REQUIRE(std::string(strview(gc_pair(oldest[k])->car)) == gcvalue(l - 2 * n));
+        }
+        for (int j = 0; j < m; ++j) {
+            if ((last(j, m) / m) % 2) {
+                v = gc_pair(listed[j])->car;
+            } else {
+                REQUIRE(tab_get(parked, mkint(j), v));
+            }
+            REQUIRE(std::string(strview(v)) == gcvalue(-j));
+        }
+        for (int j = 0; j < once; ++j) {
+            if (j <= (i - 1) / 100) {
+                REQUIRE(tab_get(moved, mkint(j), v));
+            } else {
+                v = gc_pair(packed[j])->car;
+            }
+            REQUIRE(std::string(strview(v)) == gcvalue(-j));
+        }
+    };
+    check();
+    gc_collect(true);
+    REQUIRE(gc_stats().major_active == 0);
+    check();
+    gc_poproot(7);
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <thread>
+#include <string>
+#include <unistd.h>
+#include "evalprint.h"
+#include "image.h"
+#include "isolate.h"
+
+// Runs `src` in a fresh interpreter, after loading `image` if given.
+static std::string fresh(const char* image, const char* src)
+{
+    return std::async(std::launch::async, [=] {
+        std::string err;
+        if (image && !image_load(image, err)) {
+            return "error: " + err;
+        }
+        return evalprint(src);
+    }).get();
+}
+
+TEST_CASE("Image: save and load", "[image]")
+{
+    const char* path = "image_test.img";
+    REQUIRE(fresh(nullptr,
+        "(define (img-iota n acc) (if (= n 0) acc (img-iota (- n 1) (cons n acc))))"
+        "(define img-table (map (lambda (i) (list i (* i i) \"row\" 'sym 0.5)) (img-iota 5000 '())))"
+        "(define img-shared (list 1 2 3))"
+        "(define img-both (list img-shared img-shared))"
+        "(define img-counter (let ((n 0)) (lambda () (set! n (+ n 1)) n)))"
+        "(img-counter)"
+        "(define img-loop (letrec ((go (lambda (n) (if (= n 0) 'done (go (- n 1)))))) go))"
+        "(define img-key \"key\")"
+        "(define img-hash (make-hash-table))"
+        "(hash-set! img-hash 'a-long-symbol img-shared) (hash-set! img-hash 1 2.5)"
+        "(hash-set! img-hash img-key 'by-identity)"
+        "(define img-f64 (f64vector 1.5 -2.25 1e300))"
+        "(define img-vecs (list img-f64 (s32vector -7 2147483647) (bytevector 0 255) (make-f64vector 0)))"
+        "(save-image \"image_test.img\")") == "#t");
+
+    REQUIRE(fresh(path, "(length img-table)") == "5000");
+    REQUIRE(fresh(path, "(car (cdr (car (reverse img-table))))") == "25000000");
+    REQUIRE(fresh(path, "(car (reverse (car img-table)))") == "0.5");
+    // the closure kept its state, and sharing is preserved
+    REQUIRE(fresh(path, "(img-counter) (img-counter)") == "3");
+    REQUIRE(fresh(path, "(set-car! img-shared 9) img-both") == "((9 2 3) (9 2 3))");
+    REQUIRE(fresh(path, "(img-loop 100)") == "done");
+    REQUIRE(fresh(path, "(img-iota 3 '())") == "(1 2 3)");
+    REQUIRE(fresh(path, "(list (hash-ref img-hash 'a-long-symbol) (hash-ref img-hash 1)"
+                        "      (hash-ref img-hash img-key) (hash-count img-hash))") == "((1 2 3) 2.5 by-identity 3)");
+    REQUIRE(fresh(path, "(eq? (hash-ref img-hash 'a-long-symbol) img-shared)") == "#t");
+    REQUIRE(fresh(path, "img-vecs") == "(#f64(1.5 -2.25 1e+300) #s32(-7 2147483647) #u8(0 255) #f64())");
+    REQUIRE(fresh(path, "(eq? (car img-vecs) img-f64)") == "#t");
+
+    // a truncated image is rejected and defines nothing
+    FILE* f = fopen(path, "r");
+    REQUIRE(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    REQUIRE(truncate(path, size - 5) == 0);
+    REQUIRE(fresh(path, "1") == std::string("error: ") + path + ": corrupt image");
+    remove(path);
+    REQUIRE(fresh(path, "1") == std::string("error: cannot open ") + path);
+}
+
+TEST_CASE("Image: corrupt images are rejected before anything is defined", "[image]")
+{
+    const char* path = "image_corrupt.img";
+    const char* bad  = "image_corrupt_bad.img";
+    REQUIRE(fresh(nullptr,
+        "(define (img-adder n) (lambda (x) (set! n (+ n x)) (list n (car (list x)))))"
+        "(define img-add2 (img-adder 2))"
+        "(define img-car car)"
+        "(define img-data (list 1.5 \"a string\" 'a-symbol))"
+        "(save-image \"image_corrupt.img\")") == "#t");
+    std::ifstream in(path, std::ios::binary);
+    std::string image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    REQUIRE(image.size() > 0);
+
+    // every byte, with its low and high bits flipped in turn: either the
+    // image still checks out, or it is turned away whole
+    std::thread([&] {
+        size_t rejected = 0;
+        for (size_t j = 0; j < image.size(); ++j) {
+            for (int flip : { 0x01, 0x80 }) {
+                std::string copy = image;
+                copy[j] ^= flip;
+                FILE* f = fopen(bad, "wb");
+                REQUIRE(f);
+                REQUIRE(fwrite(copy.data(), 1, copy.size(), f) == copy.size());
+                fclose(f);
+                std::string err;
+                if (!image_load(bad, err)) {
+                    bool reported = err.find("corrupt image") != std::string::npos ||
+                                    err.find("not an image") != std::string::npos;
+                    REQUIRE(reported);
+                    ++rejected;
+                }
+            }
+        }
+        REQUIRE(rejected > 0);
+    }).join();
+    remove(bad);
+    REQUIRE(fresh(path, "(img-add2 1)") == "(3 1)");
+    remove(path);
+}
@@ -0,0 +1,58 @@
+#include <catch2/catch.hpp>
+#include <string>
+#include "value.h"
+#include "intern.h"
+
+TEST_CASE("Intern: equal symbols are identical values", "[intern]")
+{
+    Value a = mksym("lambda");
+    Value b = mksym("lambda");
+    Value c = mksym("define");
+    REQUIRE(issym(a));
+    REQUIRE(!isstr(a));
+    REQUIRE(a.uval == b.uval);
+    REQUIRE(a.uval != c.uval);
+    REQUIRE(std::string(strview(a)) == "lambda");
+
+    Value s = mkistr("lambda", 6);
+    REQUIRE(isstr(s));
+    REQUIRE(tohandle(s) == tohandle(a));
+    REQUIRE(mkstr("lambda").uval != s.uval);
+}
+
+TEST_CASE("Intern: entries survive rehashing", "[intern]")
+{
+    std::vector<Value> syms;
+    for (int i = 0; i < 5000; ++i) {
+        syms.push_back(mksym(("sym" + std::to_string(i)).c_str()));
+        gc_pushroot(syms.back());
+    }
+    REQUIRE(intern_stats().capacity >= 10000);
+    gc_collect(true);
+    for (int i = 0; i < 5000; ++i) {
+        REQUIRE(mksym(("sym" + std::to_string(i)).c_str()).uval == syms[i].uval);
+    }
+    gc_poproot(5000);
+}
+
+TEST_CASE("Intern: unreferenced entries are dropped by the collector", "[intern]")
+{
+    gc_collect(true);
+    uint64_t before = intern_stats().entries;
+    Value keep = mksym("weak-keep");
+    gc_pushroot(keep);
+    for (int i = 0; i < 100; ++i) {
+        mksym(("weak-" + std::to_string(i)).c_str());
+    }
+    REQUIRE(intern_stats().entries == before + 101);
+
+    gc_collect(false);
+    REQUIRE(intern_stats().entries == before + 1);
+    REQUIRE(mksym("weak-keep").uval == keep.uval);
+
+    gc_poproot();
+    gc_collect(true);
+    REQUIRE(intern_stats().entries == before);
+    Value again = mksym("weak-keep");
+    REQUIRE(std::string(strview(again)) == "weak-keep");
+}
@@ -0,0 +1,81 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "isolate.h"
+
+static EvalResult evalstr(const char* src) { return eval(src, strlen(src)); }
+
+TEST_CASE("Isolate: evaluates on its own thread", "[isolate]")
+{
+    Isolate iso;
+    EvalResult r = iso.eval("(define (sq x) (* x x)) (sq 12)");
+    REQUIRE(r.status == OK);
+    REQUIRE(r.value == "144");
+    r = iso.eval("(car '())");
+    REQUIRE(r.status == ERROR);
+    // an error does not lose earlier definitions
+    REQUIRE(iso.eval("(sq 3)").value == "9");
+}
+
+TEST_CASE("Isolate: globals are not shared", "[isolate]")
+{
+    Isolate a, b;
+    REQUIRE(a.eval("(define iso-x 1) iso-x").value == "1");
+    REQUIRE(b.eval("(define iso-x 2) iso-x").value == "2");
+    REQUIRE(a.eval("iso-x").value == "1");
+    REQUIRE(b.eval("(set! iso-x 3) iso-x").value == "3");
+    REQUIRE(a.eval("iso-x").value == "1");
+    // nor with the calling thread's interpreter
+    REQUIRE(evalstr("iso-x").status == ERROR);
+    REQUIRE(evalstr("(define iso-x 4) iso-x").value == "4");
+    REQUIRE(a.eval("iso-x").value == "1");
+}
+
+TEST_CASE("Isolate: concurrent evaluation", "[isolate]")
+{
+    const char* src =
+        "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"
+        "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))"
+        "(sum (build 50000 '()) 0)";
+    std::vector<std::unique_ptr<Isolate>> isolates;
+    std::vector<std::future<EvalResult>> results;
+    for (int i = 0; i < 4; ++i) {
+        isolates.emplace_back(new Isolate);
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (auto& iso : isolates) {
+            results.push_back(iso->submit(src));
+        }
+    }
+    for (auto& f : results) {
+        EvalResult r = f.get();
+        REQUIRE(r.status == OK);
+        REQUIRE(r.value == "1250025000");
+    }
+}
+
+TEST_CASE("Isolate: eval_stream answers each form as it arrives", "[isolate]")
+{
+    int in[2];
+    REQUIRE(pipe(in) == 0);
+    FILE* out = tmpfile();
+    std::thread driver([&] { eval_stream(in[0], out); });
+    const char* forms = "(define (sq x) (* x x))\n(sq 12)\n(car '())\n)\n(sq";
+    // a byte at a time, as from a slow client
+    for (const char* p = forms; *p; ++p) {
+        REQUIRE(write(in[1], p, 1) == 1);
+    }
+    REQUIRE(write(in[1], " 3)", 3) == 3);
+    close(in[1]);
+    driver.join();
+    close(in[0]);
+
+    rewind(out);
+    char buf[256];
+    size_t n = fread(buf, 1, sizeof(buf), out);
+    fclose(out);
+    REQUIRE(std::string(buf, n) == "#<procedure>\n144\nerror: car: not a pair\nerror: unexpected ')'\n9\n");
+}
@@ -0,0 +1,115 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <string>
+#include "evalprint.h"
+#include "isolate.h"
+#include "pool.h"
+#include "transfer.h"
+#include "vm.h"
+
+TEST_CASE("Pool: runs every task once", "[parallel]")
+{
+    Pool pool(3);
+    std::vector<int> hits(100);
+    std::vector<std::function<void()>> tasks;
+    for (size_t j = 0; j < hits.size(); ++j) {
+        tasks.push_back([&hits, j] { ++hits[j]; });
+    }
+    pool.run(tasks);
+    pool.run(tasks);
+    for (int h : hits) {
+        REQUIRE(h == 2);
+    }
+}
+
+TEST_CASE("Transfer: values copied to another thread", "[parallel]")
+{
+    evalprint("(define tr-n 7) (define (tr-add x) (+ x tr-n))"
+              "(define tr-data (list 1 2.5 \"s\" 'sym '(a (b)) #t #f '()))"
+              "(define tr-hash (make-hash-table)) (hash-set! tr-hash 35 '(found)) (hash-set! tr-hash 'k 1)"
+              "(define (tr-lookup k) (list (hash-ref tr-hash k) (hash-count tr-hash)))"
+              "(define tr-vec (f64vector 0.5 1.5 2.5)) (define tr-bytes (bytevector 1 2 35))"
+              "(define (tr-vecs k) (list (f64vector-sum tr-vec) (= k (bytevector-u8-ref tr-bytes 2))))"
+              // its environment refers back to itself
+              "(define tr-loop (letrec ((go (lambda (n) (if (= n 0) 'done (go (- n 1)))))) go))");
+    struct { const char* name; const char* expected; } cases[] = {
+        { "tr-data", "(1 2.5 \"s\" sym (a (b)) #t #f ())" },
+        { "tr-add",  "42" },
+        { "tr-loop", "done" },
+        { "tr-lookup", "((found) 2)" },
+        { "tr-vecs", "(4.5 #t)" },
+    };
+    for (auto& c : cases) {
+        Value v;
+        REQUIRE(vm_getglobal(mksym(c.name), v));
+        Packer p;
+        std::string err;
+        REQUIRE(p.pack(v, err));
+        std::string data = p.data();
+        // a new thread has an interpreter of its own
+        std::string printed = std::async(std::launch::async, [&] {
+            Unpacker u(data.data(), data.size());
+            Value w = u.unpack();
+            if (isclosure(w)) {
+                Value arg = mkint(35);
+                vm_call(w, &arg, 1, w);
+            }
+            return valprint(w);
+        }).get();
+        REQUIRE(printed == c.expected);
+    }
+}
+
+TEST_CASE("Parallel: pmap, pfor-each and preduce", "[parallel]")
+{
+    Pool::resize(4);
+    REQUIRE(evalprint("(pmap (lambda (x) (* x x)) '(1 2 3 4 5 6 7 8 9 10))") == "(1 4 9 16 25 36 49 64 81 100)");
+    REQUIRE(evalprint("(pmap car '())") == "()");
+    REQUIRE(evalprint("(preduce + 0 '(1 2 3 4 5 6 7 8 9 10))") == "55");
+    REQUIRE(evalprint("(preduce + 0 '())") == "0");
+    REQUIRE(evalprint("(pfor-each (lambda (x) x) '(1 2 3))") == "()");
+    // closures, captured variables, and globals the procedure calls
+    REQUIRE(evalprint("(define (pp-sq x) (* x x))"
+                      "(define (pp-sumsq l) (preduce + 0 (pmap pp-sq l)))"
+                      "(pp-sumsq (make-list 1000 3))") == "9000");
+    REQUIRE(evalprint("(define (pp-scale k l) (pmap (lambda (x) (* k x)) l)) (pp-scale 3 '(1 2 3))") == "(3 6 9)");
+    REQUIRE(evalprint("(define (pp-fib n) (if (< n 2) n (+ (pp-fib (- n 1)) (pp-fib (- n 2)))))"
+                      "(pmap pp-fib '(10 15 20))") == "(55 610 6765)");
+    // results can be lists and procedures
+    REQUIRE(evalprint("(pmap (lambda (x) (list x x)) '(1 2))") == "((1 1) (2 2))");
+    REQUIRE(evalprint("(map (lambda (f) (f 1)) (pmap (lambda (k) (lambda (x) (+ x k))) '(1 2)))") == "(2 3)");
+    // nested: the inner one runs sequentially on the worker
+    REQUIRE(evalprint("(pmap (lambda (l) (preduce + 0 (pmap pp-sq l))) '((1 2) (3 4)))") == "(5 25)");
+    REQUIRE(evalprint("(pmap car '(1 2))") == "error: car: not a pair");
+    REQUIRE(evalprint("(pmap 1 '(1 2))") == "error: pmap: not a procedure");
+    Pool::resize(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+TEST_CASE("Parallel: cyclic structures are refused", "[parallel]")
+{
+    Pool::resize(4);
+    REQUIRE(evalprint("(define pc-c (list 1 2)) (set-cdr! (cdr pc-c) pc-c) (pmap car (list pc-c pc-c))") ==
+            "error: pmap: cannot send a cyclic structure");
+    REQUIRE(evalprint("(define pc-d (list 1 2)) (set-car! pc-d pc-d) (pmap length (list pc-d))") ==
+            "error: pmap: cannot send a cyclic structure");
+    REQUIRE(evalprint("(define pc-t (make-hash-table)) (hash-set! pc-t 'self pc-t) (pmap (lambda (t) 1) (list pc-t))") ==
+            "error: pmap: cannot send a cyclic structure");
+    // a result, sent back from a worker
+    REQUIRE(evalprint("(pmap (lambda (x) (let ((l (list x))) (set-cdr! l l) l)) '(1))") ==
+            "error: cannot send a cyclic structure");
+    REQUIRE(evalprint("(define (pc-nest n x) (if (= n 0) x (pc-nest (- n 1) (list x))))"
+                      "(pmap length (list (pc-nest 1000000 1)))") == "error: pmap: cannot send a structure nested this deeply");
+    // shared structure is copied, and deep nesting short of the limit is fine
+    REQUIRE(evalprint("(let ((x (list 1))) (pmap (lambda (l) l) (list (list x x))))") == "(((1) (1)))");
+    REQUIRE(evalprint("(pmap length (list (pc-nest 3900 1)))") == "(1)");
+    Pool::resize(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+TEST_CASE("Parallel: a script that uses the pool exits cleanly", "[parallel]")
+{
+    // the workers outlive main and exit during static destruction
+    int status;
+    REQUIRE(runscript("(display (pmap (lambda (x) (* x x)) (list 1 2 3)))", status) == "(1 4 9)");
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+}
@@ -0,0 +1,40 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <string>
+#include "evalprint.h"
+#include "isolate.h"
+#include "port.h"
+
+TEST_CASE("Port: output strings", "[port]")
+{
+    REQUIRE(evalprint("(define p (open-output-string)) (get-output-string p)") == "\"\"");
+    REQUIRE(evalprint("(write-string \"abc\" p) (display 12 p) (write \"q\" p) (newline p)"
+                      "(display '(a b) p) (get-output-string p)") == "\"abc12\\\"q\\\"\\n(a b)\"");
+    // getting the string does not consume it
+    REQUIRE(evalprint("(write-string \"!\" p) (get-output-string p)") == "\"abc12\\\"q\\\"\\n(a b)!\"");
+    REQUIRE(evalprint("p") == "#<port>");
+    REQUIRE(evalprint("(get-output-string \"s\")") == "error: get-output-string: not a port");
+    REQUIRE(evalprint("(write-string 1 p)") == "error: write-string: not a string");
+    REQUIRE(evalprint("(display 1 \"s\")") == "error: display: not a port");
+}
+
+TEST_CASE("Port: ports survive and are freed by collections", "[port]")
+{
+    REQUIRE(evalprint(
+        "(define (fill p n) (if (= n 0) p (begin (write-string \"fragment \" p) (fill p (- n 1)))))"
+        "(define kept (fill (open-output-string) 10000))"
+        "(define (churn n) (if (= n 0) 'done (begin (fill (open-output-string) 10) (churn (- n 1)))))"
+        "(churn 20000)") == "done");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(evalprint("(string-length (get-output-string kept))") == "90000");
+
+    // a port only referenced from C++ is swept with its buffer
+    Value p = port_open();
+    gc_pushroot(p);
+    port_write(p, "held");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(valprint(port_string(p)) == "\"held\"");
+    gc_poproot();
+}
@@ -0,0 +1,64 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "isolate.h"
+#include "profile.h"
+
+TEST_CASE("Profile: with-profiling writes collapsed stacks", "[profile]")
+{
+    const char* src =
+        "(define (prof-fib n) (if (< n 2) n (+ (prof-fib (- n 1)) (prof-fib (- n 2)))))"
+        "(with-profiling (lambda () (prof-fib 27)) \"profile_test.folded\")";
+    EvalResult r = eval(src, strlen(src));
+    REQUIRE(r.status == OK);
+    REQUIRE(r.value == "196418");
+
+    FILE* f = fopen("profile_test.folded", "r");
+    REQUIRE(f);
+    char line[4096];
+    size_t lines = 0, samples = 0;
+    bool sawfib = false;
+    while (fgets(line, sizeof(line), f)) {
+        ++lines;
+        const char* count = strrchr(line, ' ');
+        REQUIRE(count);
+        samples += strtoul(count + 1, nullptr, 10);
+        sawfib |= strstr(line, "prof-fib;prof-fib") != nullptr;
+    }
+    fclose(f);
+    remove("profile_test.folded");
+    REQUIRE(lines > 0);
+    REQUIRE(samples > 0);
+    REQUIRE(sawfib);
+}
+
+TEST_CASE("Profile: errors", "[profile]")
+{
+    const char* src = "(with-profiling 1)";
+    REQUIRE(eval(src, strlen(src)).status != OK);
+    src = "(with-profiling (lambda () (car 1)))";
+    REQUIRE(eval(src, strlen(src)).status != OK);
+    // the profiler was stopped by the failing call
+    std::string err;
+    REQUIRE(profile_start(ProfileHz, err));
+    profile_stop();
+}
+
+TEST_CASE("Profile: every session starts the log over", "[profile]")
+{
+    const char* src = "(define (prof-loop n) (if (= n 0) 0 (prof-loop (- n 1))))";
+    REQUIRE(eval(src, strlen(src)).status == OK);
+    src = "(prof-loop 3000000)";
+    std::string err;
+    for (int j = 0; j < 2; ++j) {
+        REQUIRE(profile_start(ProfileHz, err));
+        REQUIRE(profile_mark() == 0);
+        REQUIRE(eval(src, strlen(src)).status == OK);
+        REQUIRE(profile_start(ProfileHz, err));
+        // nested: the log goes on
+        REQUIRE(profile_mark() > 0);
+        profile_stop();
+        profile_stop();
+    }
+}
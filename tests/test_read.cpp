@@ -0,0 +1,144 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <string>
+#include "read.h"
+
+// Reads every datum of `text` from a temporary file, printed one per line.
+static std::string readfile(const std::string& text, bool map, bool* mapped = nullptr)
+{
+    FILE* f = tmpfile();
+    fwrite(text.data(), 1, text.size(), f);
+    rewind(f);
+    std::string out;
+    {
+        Input in(f, map);
+        if (mapped) {
+            *mapped = in.mapped();
+        }
+        Reader r(in);
+        for (;;) {
+            Node form;
+            int status = read(r, form);
+            if (status == DONE) {
+                break;
+            } else if (status == ERROR) {
+                out += "error: " + r.err;
+                break;
+            }
+            out += form.islist ? "(" + std::to_string(form.items.size()) + ")" : valprint(form.atom);
+            out += '\n';
+        }
+    }
+    fclose(f);
+    return out;
+}
+
+TEST_CASE("Reader: regular files are mapped, streaming gives the same result", "[read]")
+{
+    std::string text = "(define x 1) \"plain\" \"esc\\\"aped\\n\" sym -42 1.5 ; comment\n'q";
+    const char* expected = "(3)\n\"plain\"\n\"esc\\\"aped\\n\"\nsym\n-42\n1.5\n(2)\n";
+    bool mapped = false;
+    REQUIRE(readfile(text, true, &mapped) == expected);
+    REQUIRE(mapped);
+    REQUIRE(readfile(text, false, &mapped) == expected);
+    REQUIRE(!mapped);
+}
+
+TEST_CASE("Reader: string literals longer than the streaming buffer", "[read]")
+{
+    std::string big(3 * SIZE, 'x');
+    std::string expected = "\"" + big + "\"\n";
+    REQUIRE(readfile("\"" + big + "\"", true) == expected);
+    REQUIRE(readfile("\"" + big + "\"", false) == expected);
+    REQUIRE(readfile("\"" + big + "\\\\\"", false) == "\"" + big + "\\\\\"\n");
+    REQUIRE(readfile("\"" + big, false) == "error: unterminated string literal");
+    REQUIRE(readfile("\"" + big + "\\", true) == "error: unterminated string literal");
+    REQUIRE(readfile("\"" + big + "\\", false) == "error: unterminated string literal");
+}
+
+// Feeds `text` in pieces of `chunk` bytes; prints every datum as soon as
+// reader_next has it, and "|" after each feed.
+static std::string feedall(const std::string& text, size_t chunk, bool close = true)
+{
+    FeedReader r;
+    std::string out;
+    auto drain = [&] {
+        Node form;
+        int status;
+        while ((status = reader_next(r, form)) != DONE) {
+            if (status == ERROR) {
+                out += "error: " + r.err + "\n";
+            } else {
+                out += form.islist ? "(" + std::to_string(form.items.size()) + ")" : valprint(form.atom);
+                out += '\n';
+            }
+            r.clear();
+        }
+    };
+    for (size_t at = 0; at < text.size(); at += chunk) {
+        reader_feed(r, text.data() + at, std::min(chunk, text.size() - at));
+        drain();
+    }
+    if (close) {
+        reader_close(r);
+        drain();
+    }
+    return out;
+}
+
+TEST_CASE("Reader: fed in pieces, datums come out as they close", "[read]")
+{
+    std::string text = "(define x 1) \"plain\" \"esc\\\"aped\\n\" sym -42 1.5 ; comment ) (\n'q (a (b \"c)\" d)) '(1 2)";
+    const char* expected = "(3)\n\"plain\"\n\"esc\\\"aped\\n\"\nsym\n-42\n1.5\n(2)\n(2)\n(2)\n";
+    for (size_t chunk : { 1, 2, 3, 7, 64, 1000 }) {
+        REQUIRE(feedall(text, chunk) == expected);
+    }
+    // a top-level atom waits for its delimiter
+    REQUIRE(feedall("(+ 1 2) 42", 1, false) == "(3)\n");
+    REQUIRE(feedall("(+ 1 2) 42", 1, true) == "(3)\n42\n");
+    REQUIRE(feedall("(+ 1 2)", 1, false) == "(3)\n");
+}
+
+TEST_CASE("Reader: fed input recovers after an error", "[read]")
+{
+    REQUIRE(feedall(") 1 #x 2 (3", 1) ==
+            "error: unexpected ')'\n1\nerror: invalid # syntax\n2\nerror: missing closing ')' for s-expression\n");
+    REQUIRE(feedall("\"abc", 2) == "error: unterminated string literal\n");
+    REQUIRE(feedall("\"abc\\", 2) == "error: unterminated string literal\n");
+    REQUIRE(feedall("' ", 1) == "error: unexpected end of input\n");
+    REQUIRE(feedall(" ; only a comment", 3) == "");
+}
+
+TEST_CASE("Reader: dotted lists", "[read]")
+{
+    REQUIRE(readfile("(1 . 2) (a b . (c))", true) == "(2)\n(3)\n");
+    REQUIRE(readfile("(. 2)", true) == "error: unexpected '.'");
+    REQUIRE(readfile("(1 .)", true) == "error: unexpected ')'");
+    REQUIRE(readfile("(1 . 2 3)", true) == "error: expected ')' after the tail of a dotted list");
+}
+
+TEST_CASE("Reader: nesting is limited", "[read]")
+{
+    std::string deep = std::string(MaxNesting, '(') + std::string(MaxNesting, ')');
+    REQUIRE(readfile(deep, true) == "(1)\n");
+    REQUIRE(readfile("(" + deep + ")", true) == "error: datum nested too deeply");
+    REQUIRE(readfile(std::string(MaxNesting + 1, '\'') + "x", true) == "error: datum nested too deeply");
+    // far past the limit, and the datum after it still reads
+    std::string deeper = std::string(100000, '(') + std::string(100000, ')');
+    REQUIRE(readfile(deeper, true) == "error: datum nested too deeply");
+    REQUIRE(feedall(deeper + " 1 ", 4096) == "error: datum nested too deeply\n1\n");
+}
+
+TEST_CASE("Reader: fed input does not keep consumed bytes", "[read]")
+{
+    FeedReader r;
+    std::string datum = "(some datum \"with a string\" 12345)\n";
+    for (int j = 0; j < 10000; ++j) {
+        reader_feed(r, datum.data(), datum.size());
+        Node form;
+        REQUIRE(reader_next(r, form) == OK);
+        REQUIRE(form.items.size() == 4);
+        r.clear();
+    }
+    REQUIRE(r.buf.size() <= 2 * datum.size());
+}
@@ -0,0 +1,134 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include "scan.h"
+#include "lex.h"
+
+TEST_CASE("Scan: every supported kernel agrees with the scalar one", "[scan]")
+{
+    const char alphabet[] = "ab1 \t\n\r\v\f()\";'\\x-.#";
+    std::mt19937 rng(7);
+    ScanIsa best = scan_isa();
+    for (int round = 0; round < 2000; ++round) {
+        // long runs of one class so blocks with no hits get exercised
+        std::string text;
+        size_t len = rng() % 200;
+        while (text.size() < len) {
+            text.append(1 + rng() % 70, alphabet[rng() % (sizeof(alphabet) - 1)]);
+        }
+        text.resize(len);
+        const unsigned char* p = (const unsigned char*) text.data();
+        const unsigned char* end = p + text.size();
+        size_t from = text.empty() ? 0 : rng() % text.size();
+
+        REQUIRE(scan_setisa(SCAN_SCALAR));
+        ScanBlock b;
+        const unsigned char* space  = scan_space(b, p + from, end);
+        const unsigned char* delim  = scan_delim(b, p + from, end);
+        const unsigned char* string = scan_string(b, p + from, end);
+        ScanBlock expected;
+        scan_classify(expected, p + from, end);
+        for (int isa = SCAN_SCALAR + 1; isa < SCAN_NISAS; ++isa) {
+            if (!scan_setisa((ScanIsa) isa)) {
+                continue;
+            }
+            INFO(scan_isaname((ScanIsa) isa) << " on \"" << text << "\" from " << from);
+            ScanBlock c;
+            scan_classify(c, p + from, end);
+            REQUIRE(c.space == expected.space);
+            REQUIRE(c.delim == expected.delim);
+            REQUIRE(c.string == expected.string);
+            REQUIRE(scan_space(c, p + from, end) == space);
+            REQUIRE(scan_delim(c, p + from, end) == delim);
+            REQUIRE(scan_string(c, p + from, end) == string);
+        }
+    }
+    scan_setisa(best);
+}
+
+TEST_CASE("Scan: the kernel can change while other threads scan", "[scan]")
+{
+    std::string text;
+    for (int j = 0; j < 200; ++j) {
+        text += "(define \"str\" 'sym) ";
+    }
+    const unsigned char* p = (const unsigned char*) text.data();
+    const unsigned char* end = p + text.size();
+    ScanBlock expected;
+    scan_classify(expected, p, end);
+    ScanIsa best = scan_isa();
+    std::atomic<bool> done{false};
+    std::atomic<int>  wrong{0};
+    std::thread reader([&] {
+        while (!done) {
+            ScanBlock b;
+            scan_classify(b, p, end);
+            wrong += b.space != expected.space || b.delim != expected.delim || b.string != expected.string;
+        }
+    });
+    for (int j = 0; j < 10000; ++j) {
+        scan_setisa((ScanIsa) (j % SCAN_NISAS));
+    }
+    done = true;
+    reader.join();
+    scan_setisa(best);
+    REQUIRE(wrong == 0);
+}
+
+TEST_CASE("Scan: searches agree with a byte loop", "[scan]")
+{
+    std::string text = "  (define   x\t\n \"str\\\"ing\" ; c\n" + std::string(100, 'y') + " )";
+    const unsigned char* p = (const unsigned char*) text.data();
+    const unsigned char* end = p + text.size();
+    ScanBlock b;
+    for (size_t i = 0; i < text.size(); ++i) {
+        size_t sp = i, de = i, st = i;
+        while (sp < text.size() && strchr(" \t\n\r\v\f", text[sp])) ++sp;
+        while (de < text.size() && !strchr(" \t\n\r\v\f()\";'", text[de])) ++de;
+        while (st < text.size() && text[st] != '"' && text[st] != '\\') ++st;
+        REQUIRE(scan_space(b, p + i, end) == p + sp);
+        REQUIRE(scan_delim(b, p + i, end) == p + de);
+        REQUIRE(scan_string(b, p + i, end) == p + st);
+    }
+}
+
+TEST_CASE("Scan: SWAR digit parsing", "[scan]")
+{
+    const char* buf = "12345678 9 0000000042x";
+    uint64_t v;
+    REQUIRE(swar_digits(buf, 8, buf + 22, v));
+    REQUIRE(v == 12345678);
+    REQUIRE(swar_digits(buf, 3, buf + 22, v));
+    REQUIRE(v == 123);
+    REQUIRE(swar_digits(buf + 13, 8, buf + 22, v));
+    REQUIRE(v == 42);
+    REQUIRE(!swar_digits(buf, 9, buf + 22, v));
+    REQUIRE(!swar_digits(buf + 4, 6, buf + 22, v));    // "5678 9"
+    REQUIRE(!swar_digits(buf + 15, 7, buf + 22, v));   // "00042x"
+    REQUIRE(!swar_digits(buf + 18, 2, buf + 22, v));   // fewer than 8 bytes readable
+}
+
+TEST_CASE("Scan: integer literals", "[scan]")
+{
+    auto lexone = [](const char* s, Value& v) {
+        Input in(s, strlen(s));
+        return lex(in, v);
+    };
+    Value v;
+    REQUIRE(lexone("7", v) == T_INT);
+    REQUIRE(unsafe_toint(v) == 7);
+    REQUIRE(lexone("-12345678 ", v) == T_INT);
+    REQUIRE(unsafe_toint(v) == -12345678);
+    REQUIRE(lexone("2147483647)", v) == T_INT);
+    REQUIRE(unsafe_toint(v) == 2147483647);
+    REQUIRE(lexone("-2147483648", v) == T_INT);
+    REQUIRE(unsafe_toint(v) == -2147483647 - 1);
+    REQUIRE(lexone("2147483648", v) == T_DOUBLE);
+    REQUIRE(unsafe_todouble(v) == 2147483648.0);
+    REQUIRE(lexone("0000000000012", v) == T_INT);
+    REQUIRE(unsafe_toint(v) == 12);
+    REQUIRE(lexone("123456789x", v) == T_ERROR);
+    REQUIRE(lexone("1e3", v) == T_DOUBLE);
+}
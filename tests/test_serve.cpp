@@ -0,0 +1,265 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "evalprint.h"
+#include "isolate.h"
+#include "serve.h"
+#include "vm.h"
+
+static std::string sockpath()
+{
+    return "/tmp/cscheme-test-" + std::to_string(getpid()) + ".sock";
+}
+
+// A blocking client; `ask` sends a request and reads until `until`
+// responses (lines, or length frames) are complete.
+struct Client
+{
+    int fd;
+
+    explicit Client(const std::string& path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.data(), path.size());
+        REQUIRE(connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0);
+    }
+    ~Client() { close(fd); }
+
+    // Sends `req` as the last thing on the connection and reads until the
+    // server closes it.
+    std::string finish(const std::string& req)
+    {
+        REQUIRE(write(fd, req.data(), req.size()) == (ssize_t) req.size());
+        shutdown(fd, SHUT_WR);
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            out.append(buf, n);
+        }
+        return out;
+    }
+
+    std::string ask(const std::string& req)
+    {
+        REQUIRE(write(fd, req.data(), req.size()) == (ssize_t) req.size());
+        std::string out;
+        char buf[4096];
+        while (!complete(out)) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            out.append(buf, n);
+        }
+        return out;
+    }
+
+    static bool complete(const std::string& out)
+    {
+        if (out.empty() || out[0] != '#') {
+            return !out.empty() && out.back() == '\n';
+        }
+        size_t nl = out.find('\n');
+        return nl != std::string::npos && out.size() - nl - 1 >= std::stoul(out.substr(1, nl - 1));
+    }
+};
+
+TEST_CASE("Serve: checkpoints roll back globals and prototypes", "[serve]")
+{
+    // on a thread of its own, to keep the checkpoint out of other tests
+    std::thread([] {
+        evalprint("(define (f) 1) (define (g) (f)) (define x 10) (define box (list (cons 0 0)))");
+        vm_checkpoint();
+        for (int j = 0; j < 3; ++j) {
+            // g's call site caches the redefined f, and must let go of it
+            REQUIRE(evalprint("(define (f) 2) (set! x 11) (define y 1) (list (g) x y)") == "(2 11 1)");
+            vm_rollback();
+            REQUIRE(evalprint("(list (g) x)") == "(1 10)");
+            vm_rollback();
+            REQUIRE(evalprint("y") == "error: unbound variable: y");
+            vm_rollback();
+        }
+        // what a rollback puts back outlives the collections in between
+        evalprint("(set! box 0)");
+        gc_collect(true);
+        evalprint("(define (fill n acc) (if (= n 0) acc (fill (- n 1) (cons (cons 7 7) acc)))) (fill 1000 '())");
+        vm_rollback();
+        REQUIRE(evalprint("box") == "((0 . 0))");
+        vm_rollback();
+    }).join();
+}
+
+TEST_CASE("Serve: requests see the prelude and nothing of each other", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    config.prelude = "(define (sq x) (* x x)) (define counter 0) (define box (cons 0 0))"
+                     "(define table (make-hash-table)) (hash-set! table 'k 1) (define v (f64vector 1.0 2.0))"
+                     "(define out (open-output-string)) (write-string \"base\" out)"
+                     "(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))";
+    config.freeze = false;
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    Client c(config.socket);
+    REQUIRE(c.ask("(sq 12)\n") == "144\n");
+    REQUIRE(c.ask("(set! counter (+ counter 1)) counter\n") == "1\n");
+    REQUIRE(c.ask("counter\n") == "0\n");
+    REQUIRE(c.ask("(define (sq x) 0) (sq 3)\n") == "0\n");
+    REQUIRE(c.ask("(sq 3)\n") == "9\n");
+    REQUIRE(c.ask("(define y 1)\n") == "1\n");
+    REQUIRE(c.ask("y\n") == "error: unbound variable: y\n");
+    // so are the stores into the prelude's data
+    REQUIRE(c.ask("(set-car! box (lambda () 42)) (set-cdr! box box) ((car box))\n") == "42\n");
+    REQUIRE(c.ask("box\n") == "(0 . 0)\n");
+    REQUIRE(c.ask("(hash-set! table 'k 2) (hash-set! table 'new 3) (hash-remove! table 'k) (hash-count table)\n") == "1\n");
+    REQUIRE(c.ask("(list (hash-ref table 'k) (hash-ref table 'new #f) (hash-count table))\n") == "(1 #f 1)\n");
+    REQUIRE(c.ask("(f64vector-set! v 0 9.0) (f64vector-map! * v 2.0) (f64vector-fill! v 5.0 1)"
+                  "(list (f64vector-ref v 0) (f64vector-ref v 1))\n") == "(18.0 5.0)\n");
+    REQUIRE(c.ask("(list (f64vector-ref v 0) (f64vector-ref v 1))\n") == "(1.0 2.0)\n");
+    REQUIRE(c.ask("(write-string \" more\" out) (get-output-string out)\n") == "\"base more\"\n");
+    REQUIRE(c.ask("(get-output-string out)\n") == "\"base\"\n");
+    REQUIRE(c.ask("(next) (next)\n") == "2\n");
+    REQUIRE(c.ask("(next)\n") == "1\n");
+    REQUIRE(c.ask("(define l (list 1 2)) (set-car! l 3) l\n") == "(3 2)\n");
+}
+
+TEST_CASE("Serve: workers share a frozen prelude", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    config.workers = 2;
+    config.prelude = "(define (sq x) (* x x)) (define box (cons 0 0))"
+                     "(define next (let ((n 0)) (lambda () (set! n (+ n 1)) n)))";
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    Client c(config.socket);
+    REQUIRE(c.ask("(sq 12)\n") == "144\n");
+    REQUIRE(c.ask("(define (sq x) 0) (sq 3)\n") == "0\n");
+    REQUIRE(c.ask("(sq 3)\n") == "9\n");
+    REQUIRE(c.ask("(set-car! box 1)\n") == "error: set-car!: pair is frozen\n");
+    REQUIRE(c.ask("(car box)\n") == "0\n");
+    // a captured variable is copied on write, and the copy dropped
+    // with the request
+    REQUIRE(c.ask("(next) (next)\n") == "2\n");
+    REQUIRE(c.ask("(next)\n") == "1\n");
+}
+
+TEST_CASE("Serve: framing", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    Client c(config.socket);
+    REQUIRE(c.ask("#8\n(+ 1\n 2)") == "#1\n3");
+    REQUIRE(c.ask("(car 1)\r\n") == "error: car: not a pair\n");
+    // several requests in one write, answered in order
+    REQUIRE(c.ask("1\n\n#1\n2(+ 1 2)\n") == "1\n#1\n23\n");
+    REQUIRE(c.ask("(string-append \"a\" \"b\")\n") == "\"ab\"\n");
+    REQUIRE(c.ask("#12x\n") == "error: bad request header\n");
+    // the last request of a connection needs no newline
+    REQUIRE(Client(config.socket).finish("1\n(+ 1 2)") == "1\n3\n");
+    REQUIRE(Client(config.socket).finish("(+ 1 2)\n") == "3\n");
+    REQUIRE(Client(config.socket).finish("#20\n(+ 1 2)") == "error: incomplete request\n");
+}
+
+TEST_CASE("Serve: what a request prints comes back with its answer", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    // none of it may reach the server's stdout
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    FILE* sink = tmpfile();
+    dup2(fileno(sink), STDOUT_FILENO);
+    Client c(config.socket);
+    std::string line = c.ask("(display \"hi\") (newline) (write \"x\") 42\n");
+    std::string framed = c.ask("#27\n(display 1) (car (write 2))");
+    std::string workers = c.ask("(pfor-each display (list 1 2 3 4 5 6 7 8)) 0\n");
+    std::string ported = c.ask("(define p (open-output-string)) (display 1 p) (get-output-string p)\n");
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    REQUIRE(line == "hi\\n\"x\"42\n");
+    REQUIRE(framed == "#24\n12error: car: not a pair");
+    REQUIRE(workers == "123456780\n");
+    REQUIRE(ported == "\"1\"\n");
+    REQUIRE(ftell(sink) == 0);
+    fclose(sink);
+
+    // the output of a request is limited
+    std::string text;
+    vm_capture(&text, 8);
+    REQUIRE(evalprint("(display \"12345\") (display \"6789\")") == "error: display: output too long");
+    vm_capture(nullptr, 0);
+    REQUIRE(text == "12345");
+}
+
+TEST_CASE("Serve: a deeply nested request is an error", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    Client c(config.socket);
+    REQUIRE(c.ask(std::string(100000, '(') + std::string(100000, ')') + "\n") == "error: datum nested too deeply\n");
+    REQUIRE(c.ask("(+ 1 2)\n") == "3\n");
+}
+
+TEST_CASE("Serve: concurrent clients over several workers", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    config.workers = 3;
+    config.prelude = "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))";
+    Server server(config);
+    std::string err;
+    REQUIRE(server.start(err));
+    std::vector<std::thread> clients;
+    std::vector<int> ok(6, 0);
+    for (int j = 0; j < 6; ++j) {
+        clients.emplace_back([&, j] {
+            Client c(config.socket);
+            for (int k = 0; k < 50; ++k) {
+                std::string n = std::to_string(j + k % 10);
+                ok[j] += c.ask("(define mine " + n + ") (fib 15)\n") == "610\n";
+                ok[j] += c.ask("(define (fib n) 0) (fib 15)\n") == "0\n";
+            }
+        });
+    }
+    for (std::thread& t : clients) {
+        t.join();
+    }
+    for (int n : ok) {
+        REQUIRE(n == 100);
+    }
+}
+
+TEST_CASE("Serve: a broken prelude fails start", "[serve]")
+{
+    ServeConfig config;
+    config.socket = sockpath();
+    config.prelude = "(car 1)";
+    Server server(config);
+    std::string err;
+    REQUIRE(!server.start(err));
+    REQUIRE(err == "prelude: car: not a pair");
+    REQUIRE(access(config.socket.c_str(), F_OK) != 0);
+}
@@ -0,0 +1,49 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <thread>
+#include "isolate.h"
+#include "stats.h"
+#include "vm.h"
+
+TEST_CASE("Stats: counters follow the program", "[stats]")
+{
+    Stats before = stats_total();
+    const char* src =
+        "(define (stats-adder n) (lambda (m) (lambda (x) (+ (+ x n) m))))"
+        "(define stats-add5 ((stats-adder 2) 3))"
+        "(define (stats-loop i acc) (if (= i 0) acc (stats-loop (- i 1) (cons (stats-add5 i) acc))))"
+        "(length (stats-loop 1000 '()))";
+    EvalResult r = eval(src, strlen(src));
+    REQUIRE(r.status == OK);
+    REQUIRE(r.value == "1000");
+    Stats after = stats_total();
+
+    REQUIRE(after.ops[OP_TAILCALLG] - before.ops[OP_TAILCALLG] >= 1000);
+    REQUIRE(after.ops[OP_ADD] - before.ops[OP_ADD] >= 1000);
+    REQUIRE(after.allocs[StatPairs] - before.allocs[StatPairs] >= 1000);
+    REQUIRE(after.bytes_allocated - before.bytes_allocated >= 1000 * 16);
+    // `m` is in the innermost heap frame, `n` one further up
+    REQUIRE(after.env_lookups - before.env_lookups >= 2000);
+    REQUIRE(after.env_depth - before.env_depth >= 1000);
+    REQUIRE(after.lex_bytes - before.lex_bytes == strlen(src));
+    REQUIRE(after.lex_tokens > before.lex_tokens);
+    REQUIRE(after.intern_misses + after.intern_hits > before.intern_misses + before.intern_hits);
+}
+
+TEST_CASE("Stats: exited threads stay in the totals", "[stats]")
+{
+    Stats before = stats_total();
+    std::thread([] {
+        const char* src = "(define (stats-count n) (if (= n 0) 0 (stats-count (- n 1)))) (stats-count 5000)";
+        REQUIRE(eval(src, strlen(src)).status == OK);
+        gc_collect(true);
+    }).join();
+    Stats after = stats_total();
+    REQUIRE(after.ops[OP_TAILCALLG] - before.ops[OP_TAILCALLG] >= 5000);
+    REQUIRE(after.major_collections > before.major_collections);
+    uint64_t pauses = 0;
+    for (size_t j = 0; j < StatPauses; ++j) {
+        pauses += after.major_pauses[j] - before.major_pauses[j];
+    }
+    REQUIRE(pauses == after.major_collections - before.major_collections);
+}
@@ -0,0 +1,100 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include "evalprint.h"
+#include "isolate.h"
+#include "table.h"
+
+TEST_CASE("Table: hash-ref and hash-set!", "[table]")
+{
+    REQUIRE(evalprint("(define h (make-hash-table)) (hash-set! h 1 'one) (hash-set! h 'two 2)"
+                      "(hash-set! h 'a-long-symbol \"x\") (list (hash-ref h 1) (hash-ref h 'two) (hash-ref h 'a-long-symbol))")
+            == "(one 2 \"x\")");
+    REQUIRE(evalprint("(hash-set! h 1 'uno) (hash-ref h 1)") == "uno");
+    REQUIRE(evalprint("(hash-ref h 3 'none)") == "none");
+    REQUIRE(evalprint("(hash-ref h 3)") == "error: hash-ref: no such key: 3");
+    REQUIRE(evalprint("(hash-count h)") == "3");
+    REQUIRE(evalprint("(list (hash-remove! h 'two) (hash-remove! h 'two) (hash-count h))") == "(#t #f 2)");
+    REQUIRE(evalprint("h") == "#<hash-table>");
+    REQUIRE(evalprint("(hash-ref 1 1)") == "error: hash-ref: not a hash table");
+    REQUIRE(evalprint("(make-hash-table -1)") == "error: make-hash-table: expected a non-negative size");
+}
+
+TEST_CASE("Table: agrees with std::unordered_map", "[table]")
+{
+    Value tab = tab_new();
+    gc_pushroot(tab);
+    std::unordered_map<int, int> ref;
+    std::mt19937 rng(7);
+    for (int step = 0; step < 200000; ++step) {
+        int key = rng() % 5000;
+        switch (rng() % 4) {
+            case 0:
+            case 1:
+                tab_set(tab, mkint(key), mkint(step));
+                ref[key] = step;
+                break;
+            case 2:
+                REQUIRE(tab_remove(tab, mkint(key)) == (ref.erase(key) == 1));
+                break;
+            case 3: {
+                Value v;
+                auto it = ref.find(key);
+                REQUIRE(tab_get(tab, mkint(key), v) == (it != ref.end()));
+                if (it != ref.end()) {
+                    REQUIRE(unsafe_toint(v) == it->second);
+                }
+                break;
+            }
+        }
+    }
+    REQUIRE(tab_count(tab) == ref.size());
+    gc_poproot();
+}
+
+TEST_CASE("Table: keys and values survive collections", "[table]")
+{
+    REQUIRE(evalprint(
+        "(define big (make-hash-table))"
+        "(define (fill n) (if (= n 0) 'done (begin (hash-set! big n (list n \"value string\")) (fill (- n 1)))))"
+        "(fill 20000)") == "done");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(evalprint("(hash-ref big 12345)") == "(12345 \"value string\")");
+    // an old table pointing at young objects needs the barrier
+    REQUIRE(evalprint("(hash-set! big 'fresh (list \"young string\"))") == "()");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(evalprint("(hash-ref big 'fresh)") == "(\"young string\")");
+    REQUIRE(evalprint("(hash-count big)") == "20001");
+}
+
+TEST_CASE("Table: young keys and values stored into an old table", "[table]")
+{
+    Value tab = tab_new();
+    gc_pushroot(tab);
+    gc_collect(true);
+    for (int j = 0; j < 3; ++j) {
+        // a string key is kept by identity, so only the table holds it
+        std::string name = "a key long enough to live on the heap " + std::to_string(j);
+        Value key = mkstr(name.c_str());
+        gc_pushroot(key);
+        Value v = mkstr(("a young value string " + std::to_string(j)).c_str());
+        gc_poproot();
+        tab_set(tab, key, v);
+        tab_set(tab, mkint(j), key);
+        tab_set(tab, mkint(j), key);
+    }
+    gc_collect(false);
+    gc_collect(false);
+    for (int j = 0; j < 3; ++j) {
+        Value key, v;
+        REQUIRE(tab_get(tab, mkint(j), key));
+        REQUIRE(std::string(strview(key)) == "a key long enough to live on the heap " + std::to_string(j));
+        REQUIRE(tab_get(tab, key, v));
+        REQUIRE(std::string(strview(v)) == "a young value string " + std::to_string(j));
+    }
+    gc_poproot();
+}
@@ -0,0 +1,103 @@
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <random>
+#include <string>
+#include "evalprint.h"
+#include "isolate.h"
+#include "uvec.h"
+
+TEST_CASE("Uvec: constructors, ref and set!", "[uvec]")
+{
+    REQUIRE(evalprint("(bytevector 1 2 255)") == "#u8(1 2 255)");
+    REQUIRE(evalprint("(make-s32vector 3 -7)") == "#s32(-7 -7 -7)");
+    REQUIRE(evalprint("(make-f64vector 2)") == "#f64(0.0 0.0)");
+    REQUIRE(evalprint("(f64vector 1 2.5)") == "#f64(1.0 2.5)");
+    REQUIRE(evalprint("(define v (make-f64vector 4 1.5)) (f64vector-set! v 2 3) (list (f64vector-ref v 2) (f64vector-length v))")
+            == "(3.0 4)");
+    REQUIRE(evalprint("(define b (make-bytevector 2 0)) (bytevector-u8-set! b 1 200) (bytevector-u8-ref b 1)") == "200");
+    REQUIRE(evalprint("(list (bytevector? b) (f64vector? b) (s32vector? (s32vector)) (f64vector? 1.0))") == "(#t #f #t #f)");
+
+    REQUIRE(evalprint("(bytevector 256)") == "error: bytevector: expected a byte");
+    REQUIRE(evalprint("(s32vector 1.5)") == "error: s32vector: expected an integer");
+    REQUIRE(evalprint("(f64vector-ref v 4)") == "error: f64vector-ref: index out of range");
+    REQUIRE(evalprint("(f64vector-ref v -1)") == "error: f64vector-ref: index out of range");
+    REQUIRE(evalprint("(f64vector-ref b 0)") == "error: f64vector-ref: not an f64vector");
+    REQUIRE(evalprint("(make-f64vector -1)") == "error: make-f64vector: expected a non-negative length");
+}
+
+TEST_CASE("Uvec: fill! and copy!", "[uvec]")
+{
+    REQUIRE(evalprint("(define s (s32vector 1 2 3 4 5)) (s32vector-fill! s 9 1 3) s") == "#s32(1 9 9 4 5)");
+    REQUIRE(evalprint("(s32vector-fill! s 0) s") == "#s32(0 0 0 0 0)");
+    REQUIRE(evalprint("(define t (s32vector 1 2 3 4 5)) (s32vector-copy! s 1 t 0 3) s") == "#s32(0 1 2 3 0)");
+    // overlapping, both ways
+    REQUIRE(evalprint("(s32vector-copy! t 1 t 0 4) t") == "#s32(1 1 2 3 4)");
+    REQUIRE(evalprint("(s32vector-copy! t 0 t 1) t") == "#s32(1 2 3 4 4)");
+    REQUIRE(evalprint("(s32vector-copy! t 3 t 0 3)") == "error: s32vector-copy!: index out of range");
+    REQUIRE(evalprint("(s32vector-copy! t 0 (f64vector 1))") == "error: s32vector-copy!: not an s32vector");
+    REQUIRE(evalprint("(define b (bytevector 1 2 3)) (bytevector-copy! b 0 (bytevector 7 8)) b") == "#u8(7 8 3)");
+    REQUIRE(evalprint("(bytevector-fill! b 300)") == "error: bytevector-fill!: expected a byte");
+}
+
+TEST_CASE("Uvec: sum, dot and map!", "[uvec]")
+{
+    REQUIRE(evalprint("(define x (f64vector 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19))"
+                      "(define y (make-f64vector 19 2)) (list (= (f64vector-sum x) 190) (= (f64vector-dot x y) 380))")
+            == "(#t #t)");
+    REQUIRE(evalprint("(f64vector-map! * y x) (f64vector-ref y 18)") == "38.0");
+    REQUIRE(evalprint("(f64vector-map! - y x) (f64vector-map! / y 2) (= (f64vector-sum y) 95)") == "#t");
+    REQUIRE(evalprint("(f64vector-map! + x x) (f64vector-ref x 3)") == "8.0");
+    REQUIRE(evalprint("(f64vector-map! car x x)") == "error: f64vector-map!: expected one of + - * /");
+    REQUIRE(evalprint("(f64vector-map! + x (f64vector 1))") == "error: f64vector-map!: vectors differ in length");
+    REQUIRE(evalprint("(f64vector-dot x (f64vector 1))") == "error: f64vector-dot: vectors differ in length");
+    REQUIRE(evalprint("(f64vector-sum (f64vector))") == "0.0");
+    REQUIRE(evalprint("(= (s32vector-sum (make-s32vector 3 2000000000)) 6e9)") == "#t");
+}
+
+TEST_CASE("Uvec: kernels agree with plain loops", "[uvec]")
+{
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> small(-1000, 1000);
+    for (size_t n : { 0, 1, 3, 4, 5, 15, 16, 17, 33, 1000, 1003 }) {
+        // integer-valued doubles, so every summation order is exact
+        std::vector<double> x(n), y(n);
+        std::vector<int32_t> s(n);
+        double sum = 0, dot = 0;
+        int64_t ssum = 0;
+        for (size_t j = 0; j < n; ++j) {
+            x[j] = small(rng);
+            y[j] = small(rng);
+            s[j] = small(rng) * 1000000;
+            sum += x[j];
+            dot += x[j] * y[j];
+            ssum += s[j];
+        }
+        REQUIRE(f64_sum(x.data(), n) == sum);
+        REQUIRE(f64_dot(x.data(), y.data(), n) == dot);
+        REQUIRE(s32_sum(s.data(), n) == ssum);
+
+        std::vector<double> z = x;
+        f64_map(UV_SUB, z.data(), y.data(), n);
+        f64_mapscalar(UV_MUL, z.data(), 2.0, n);
+        for (size_t j = 0; j < n; ++j) {
+            REQUIRE(z[j] == (x[j] - y[j]) * 2.0);
+        }
+    }
+}
+
+TEST_CASE("Uvec: elements are unboxed and survive collections", "[uvec]")
+{
+    Value v = uvec_new(UV_F64, 100000);
+    gc_pushroot(v);
+    REQUIRE(gc_objsize(gc_deref(tohandle(v))) == sizeclass(sizeof(Uvec) + 8 * 100000));
+    for (size_t j = 0; j < 100000; ++j) {
+        uvec_f64(v)[j] = j;
+    }
+    gc_collect(true);
+    for (int j = 0; j < 1000; ++j) {
+        mkstr("garbage that fills the nursery");
+    }
+    gc_collect(true);
+    REQUIRE(f64_sum(uvec_f64(v), uvec_len(v)) == 99999.0 * 100000 / 2);
+    gc_poproot();
+}
@@ -1,4 +1,5 @@
 #include <catch2/catch.hpp>
+#include "evalprint.h"
 #include "value.h"
 
 TEST_CASE("Value: double", "[value]")
@@ -14,6 +15,23 @@ TEST_CASE("Value: double", "[value]")
     REQUIRE(unsafe_todouble(v) == d);
 }
 
+TEST_CASE("Value: doubles print in the shortest form that reads back", "[value]")
+{
+    REQUIRE(valprint(mkdouble(100.0)) == "100.0");
+    REQUIRE(valprint(mkdouble(0.0)) == "0.0");
+    REQUIRE(valprint(mkdouble(-0.0)) == "-0.0");
+    REQUIRE(valprint(mkdouble(0.1)) == "0.1");
+    REQUIRE(valprint(mkdouble(-123.456)) == "-123.456");
+    REQUIRE(valprint(mkdouble(1.0 / 3)) == "0.3333333333333333");
+    REQUIRE(valprint(mkdouble(1e20)) == "100000000000000000000.0");
+    REQUIRE(valprint(mkdouble(1e21)) == "1e+21");
+    REQUIRE(valprint(mkdouble(1.5e-7)) == "0.00000015");
+    REQUIRE(valprint(mkdouble(1e-8)) == "1e-08");
+    REQUIRE(valprint(mkdouble(1e300)) == "1e+300");
+    REQUIRE(valprint(mkdouble(INFINITY)) == "+inf.0");
+    REQUIRE(valprint(mkdouble(-INFINITY)) == "-inf.0");
+}
+
 TEST_CASE("Value: int", "[value]")
 {
     int i = 4;
@@ -72,3 +90,89 @@ TEST_CASE("String", "[string]")
     REQUIRE(!isdouble(v));
     REQUIRE(!isint(v));
 }
+
+TEST_CASE("Value: doubles are never mistaken for tagged values", "[value]")
+{
+    // 1.125's high bits look like a tag word when read naively
+    Value v = mkdouble(1.125);
+    REQUIRE(isdouble(v));
+    REQUIRE(!isfalse(v));
+    REQUIRE(!istrue(v));
+    REQUIRE(!isnil(v));
+    REQUIRE(totag(v) == 0);
+}
+
+TEST_CASE("Value: pair", "[value]")
+{
+    Value items[3] = { mkint(1), mkstr("two"), mkdouble(3.5) };
+    Value v = mklist(items, 3);
+    REQUIRE(ispair(v));
+    REQUIRE(totag(v) == LV_PAIR);
+    REQUIRE(!isnil(v));
+    REQUIRE(!isdouble(v));
+    REQUIRE(!ispair(mknil()));
+    REQUIRE(!ispair(mkdouble(1.125)));
+    REQUIRE(unsafe_toint(unsafe_topair(v)->car) == 1);
+    REQUIRE(valprint(v) == "(1 \"two\" 3.5)");
+    REQUIRE(valprint(v, false) == "(1 two 3.5)");
+    REQUIRE(valprint(mkpair(mkint(1), mkint(2))) == "(1 . 2)");
+    REQUIRE(valprint(mklist(items, 1, mkint(9))) == "(1 . 9)");
+    REQUIRE(valprint(mkpair(v, mknil())) == "((1 \"two\" 3.5))");
+}
+
+TEST_CASE("Value: cycles print with datum labels", "[value]")
+{
+    REQUIRE(evalprint("(let ((l (list 1 2))) (set-cdr! (cdr l) l) l)") == "#0=(1 2 . #0#)");
+    REQUIRE(evalprint("(let ((l (list 1 2))) (set-car! l l) l)") == "#0=(#0# 2)");
+    REQUIRE(evalprint("(let ((l (list 1 2 3))) (set-cdr! (cdr (cdr l)) (cdr l)) l)") == "(1 . #0=(2 3 . #0#))");
+    REQUIRE(evalprint("(let ((a (list 1)) (b (list 2)))"
+                      "  (set-cdr! a a) (set-cdr! b b) (list a b a))") == "(#0=(1 . #0#) #1=(2 . #1#) #0#)");
+    // shared, but not cyclic
+    REQUIRE(evalprint("(let ((x (list 1))) (list x x))") == "((1) (1))");
+    // past the walk that rules cycles out cheaply
+    std::string ones;
+    for (int j = 1; j < 100000; ++j) {
+        ones += " 1";
+    }
+    REQUIRE(evalprint("(let ((l (make-list 100000 1))) (set-car! l l) l)") == "#0=(#0#" + ones + ")");
+    REQUIRE(evalprint("(make-list 100000 (list 1))").size() == 100000 * 4 + 1);
+}
+
+TEST_CASE("Value: deep nesting prints without recursion", "[value]")
+{
+    std::string deep = evalprint("(define (nest n x) (if (= n 0) x (nest (- n 1) (list x)))) (nest 1000000 1)");
+    REQUIRE(deep == std::string(1000000, '(') + "1" + std::string(1000000, ')'));
+    REQUIRE(evalprint("(nest 2 (cons 1 2))") == "(((1 . 2)))");
+}
+
+TEST_CASE("String: short strings and symbols are immediates", "[string]")
+{
+    GcStats before = gc_stats();
+    Value s = mkstr("abcde");
+    Value e = mkstr("");
+    Value y = mksym("car");
+    REQUIRE(gc_stats().bytes_allocated == before.bytes_allocated);
+
+    REQUIRE(isstr(s));
+    REQUIRE(isshort(s));
+    REQUIRE(!isheap(s));
+    REQUIRE(strview(s) == "abcde");
+    REQUIRE(strview(e).empty());
+    REQUIRE(issym(y));
+    REQUIRE(!isstr(y));
+    REQUIRE(strview(y) == "car");
+    REQUIRE(mksym("car").uval == y.uval);
+    REQUIRE(mkistr("car", 3).uval != y.uval);
+    REQUIRE(mkstr("abcde").uval == s.uval);
+    // embedded NULs are part of the contents
+    Value nul = mkstr("a\0b", 3);
+    REQUIRE(nul.uval != mkstr("a", 1).uval);
+    REQUIRE(strview(nul) == std::string_view("a\0b", 3));
+    REQUIRE(valprint(s) == "\"abcde\"");
+    REQUIRE(valprint(y) == "car");
+
+    Value heap = mkstr("abcdef");
+    REQUIRE(!isshort(heap));
+    REQUIRE(isheap(heap));
+    REQUIRE(strview(heap) == "abcdef");
+}
@@ -0,0 +1,269 @@
+#include <catch2/catch.hpp>
+#include <string>
+#include "read.h"
+#include "compile.h"
+#include "vm.h"
+
+// Evaluates every form in `src`, returning the printed value of the
+// last one or "error: <message>".
+static std::string run(const char* src)
+{
+    vm_init();
+    Input in(src, strlen(src));
+    Reader r(in);
+    std::string result;
+    for (;;) {
+        Node form;
+        int status = read(r, form);
+        if (status == DONE) {
+            return result;
+        } else if (status == ERROR) {
+            return "error: " + r.err;
+        }
+        uint32_t proto;
+        std::string err;
+        if (compile(form, proto, err) != OK) {
+            return "error: " + err;
+        }
+        r.clear();
+        Value v;
+        if (vm_run(proto, v) != OK) {
+            return "error: " + valprint(v, false);
+        }
+        result = valprint(v);
+    }
+}
+
+TEST_CASE("VM: constants and arithmetic", "[vm]")
+{
+    REQUIRE(run("42") == "42");
+    REQUIRE(run("-1.5") == "-1.5");
+    REQUIRE(run("\"str\"") == "\"str\"");
+    REQUIRE(run("'sym") == "sym");
+    REQUIRE(run("'()") == "()");
+    REQUIRE(run("(+ 1 2 3)") == "6");
+    REQUIRE(run("(- 10 4 3)") == "3");
+    REQUIRE(run("(- 5)") == "-5");
+    REQUIRE(run("(* 2 3.5)") == "7.0");
+    REQUIRE(run("(/ 6 3)") == "2");
+    REQUIRE(run("(< 1 2 3)") == "#t");
+    REQUIRE(run("(< 1 3 2)") == "#f");
+    REQUIRE(run("(modulo -7 2)") == "1");
+}
+
+TEST_CASE("VM: fixnum overflow promotes to flonum", "[vm]")
+{
+    REQUIRE(run("(+ 2147483647 1)") == "2147483648.0");
+    REQUIRE(run("(- -2147483647 2)") == "-2147483649.0");
+    REQUIRE(run("(* 65536 65536)") == "4294967296.0");
+    REQUIRE(run("(/ -2147483648 -1)") == "2147483648.0");
+    REQUIRE(run("(list (/ 1 0) (/ -1 0) (/ 0 0) (= (/ 0 0) (/ 0 0)))") == "(+inf.0 -inf.0 +nan.0 #f)");
+    REQUIRE(run("(define (f a b) (+ a b)) (f 2147483647 2147483647)") == "4294967294.0");
+    REQUIRE(run("(define (g a b) (* a b)) (g 46341 46341)") == "2147488281.0");
+    REQUIRE(run("(g 46340 46340)") == "2147395600");
+    REQUIRE(run("(+ 1 2147483647 -10)") == "2147483638.0");
+    REQUIRE(run("(- -2147483648)") == "2147483648.0");
+    REQUIRE(run("(quotient -2147483648 -1)") == "2147483648.0");
+    REQUIRE(run("(remainder -2147483648 -1)") == "0");
+}
+
+TEST_CASE("VM: two-operand arithmetic opcodes", "[vm]")
+{
+    REQUIRE(run("(define (add a b) (+ a b)) (add 1.5 2)") == "3.5");
+    REQUIRE(run("(define (lt a b) (< a b)) (lt 1 1.5)") == "#t");
+    REQUIRE(run("(define (eq a b) (= a b)) (eq 2 2.0)") == "#t");
+    REQUIRE(run("(define (gt a b) (> a b)) (gt 3 2)") == "#t");
+    REQUIRE(run("(define (sub a b) (- a b)) (sub 1 'x)") == "error: -: non-numeric argument");
+    REQUIRE(run("(lt 'x 1)") == "error: <: non-numeric argument");
+    // the opcodes follow a rebound global, and a local shadowing it
+    REQUIRE(run("(define (inc x) (+ x 1)) (inc 41)") == "42");
+    REQUIRE(run("(define saved+ +) (define (+ a b) (* a b)) (inc 41)") == "41");
+    REQUIRE(run("(set! + saved+) (inc 41)") == "42");
+    REQUIRE(run("(define (f - a) (- a 1)) (f + 41)") == "42");
+}
+
+TEST_CASE("VM: special forms", "[vm]")
+{
+    REQUIRE(run("(if #f 1 2)") == "2");
+    REQUIRE(run("(if 0 1 2)") == "1");
+    REQUIRE(run("(and 1 2)") == "2");
+    REQUIRE(run("(and 1 #f 2)") == "#f");
+    REQUIRE(run("(or #f 3)") == "3");
+    REQUIRE(run("(cond ((= 1 2) 'a) ((= 1 1) 'b) (else 'c))") == "b");
+    REQUIRE(run("(let ((x 1) (y 2)) (+ x y))") == "3");
+    REQUIRE(run("(let* ((x 1) (y (+ x 1))) (* x y))") == "2");
+    REQUIRE(run("(let loop ((i 0) (acc 0)) (if (= i 5) acc (loop (+ i 1) (+ acc i))))") == "10");
+    REQUIRE(run("(begin 1 2 3)") == "3");
+}
+
+TEST_CASE("VM: procedures and closures", "[vm]")
+{
+    REQUIRE(run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 15)") == "610");
+    REQUIRE(run("(define (adder n) (lambda (x) (+ x n))) ((adder 3) 4)") == "7");
+    REQUIRE(run("(define (counter) (define n 0) (lambda () (set! n (+ n 1)) n))"
+                "(define c (counter)) (c) (c) (c)") == "3");
+    REQUIRE(run("(define (f) (define x 2) (define (g) (* x 21)) (g)) (f)") == "42");
+    REQUIRE(run("(letrec ((ev? (lambda (n) (if (= n 0) #t (od? (- n 1)))))"
+                "         (od? (lambda (n) (if (= n 0) #f (ev? (- n 1))))))"
+                "  (ev? 10))") == "#t");
+}
+
+TEST_CASE("VM: rest parameters", "[vm]")
+{
+    REQUIRE(run("((lambda args args) 1 2)") == "(1 2)");
+    REQUIRE(run("((lambda args args))") == "()");
+    REQUIRE(run("(define (f a . xs) (list a xs)) (f 1 2 3)") == "(1 (2 3))");
+    REQUIRE(run("(define (f a . xs) (list a xs)) (f 1)") == "(1 ())");
+    REQUIRE(run("(define (f a . xs) xs) (f)") == "error: wrong number of arguments to: f");
+    REQUIRE(run("(define (f . xs) (lambda () (cons (length xs) xs))) ((f 1 2))") == "(2 1 2)");
+    // a tail call into a rest procedure, deep enough to need the space
+    REQUIRE(run("(define (loop n . acc) (if (= n 0) acc (loop (- n 1) n))) (loop 100000)") == "(1)");
+    REQUIRE(run("'(1 . 2)") == "(1 . 2)");
+    REQUIRE(run("'(1 2 . 3)") == "(1 2 . 3)");
+    REQUIRE(run("'(1 . (2 3))") == "(1 2 3)");
+    REQUIRE(run("(1 . 2)") == "error: invalid s-expression, dotted list");
+    REQUIRE(run("(let ((x . 1)) x)") == "error: let: invalid binding");
+}
+
+TEST_CASE("VM: lexical addressing", "[vm]")
+{
+    // shadowing picks the innermost binding, captured or not
+    REQUIRE(run("(define x 'global) (let ((x 1)) (let ((x 2)) x))") == "2");
+    REQUIRE(run("(let ((x 1)) ((lambda (x) x) 2))") == "2");
+    REQUIRE(run("(let ((x 1)) (let ((f (lambda () x))) (let ((x 2)) (f))))") == "1");
+    REQUIRE(run("x") == "global");
+    // free variables several frames up, skipping frames that capture nothing
+    REQUIRE(run("(((((lambda (a) (lambda (b) (lambda (c) (lambda (d) (+ a c d))))) 1) 2) 3) 4)") == "8");
+    // captured parameters are shared between closures and the frame
+    REQUIRE(run("(define (box v) (define (get) v) (define (put! x) (set! v x)) (put! (+ v 1)) (get)) (box 41)") == "42");
+    REQUIRE(run("(define g 1) (define (bump!) (set! g (+ g 1))) (bump!) (bump!) g") == "3");
+    REQUIRE(run("(set! never-defined 1)") == "error: set!: unbound variable: never-defined");
+    REQUIRE(run("(define (f) (when #t (define y 1)) y)") == "error: define: not allowed in this context: y");
+}
+
+TEST_CASE("VM: closures survive collections", "[vm]")
+{
+    REQUIRE(run("(define (mk s) (lambda () s))"
+                "(define (kept) (define x \"kept\") (mk x))"
+                "(define g (kept))") == "#<procedure>");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(run("(mk \"garbage\") (g)") == "\"kept\"");
+    gc_collect(true);
+    REQUIRE(run("(g)") == "\"kept\"");
+}
+
+TEST_CASE("VM: call site caches follow rebinding", "[vm]")
+{
+    REQUIRE(run("(define (ic-f x) (* x 2))"
+                "(define (ic-call x) (ic-f x))"
+                "(ic-call 1) (ic-call 2)") == "4");
+    REQUIRE(run("(define (ic-f x) (+ x 100)) (ic-call 1)") == "101");
+    REQUIRE(run("(set! ic-f not) (ic-call #f)") == "#t");
+    REQUIRE(run("(set! ic-f (lambda (x y) x)) (ic-call 1)") == "error: wrong number of arguments to: ()");
+    REQUIRE(run("(set! ic-f 5) (ic-call 1)") == "error: not a procedure: 5");
+    REQUIRE(run("(define (ic-late) (ic-undefined 1)) (ic-late)") == "error: unbound variable: ic-undefined");
+    REQUIRE(run("(define (ic-undefined x) (- x)) (ic-late)") == "-1");
+    REQUIRE(run("(ic-f)") == "error: not a procedure: 5");
+    REQUIRE(run("(not 1 2)") == "error: wrong number of arguments to: not");
+}
+
+TEST_CASE("VM: call site counters", "[vm]")
+{
+    REQUIRE(run("(define (cs-leaf x) x)"
+                "(define (cs-loop n) (if (= n 0) 0 (begin (cs-leaf n) (cs-loop (- n 1)))))"
+                "(cs-loop 1000)") == "0");
+    char*  buf = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    vm_dumpcallsites(out, 1000);
+    fclose(out);
+    std::string dump(buf, len);
+    free(buf);
+    INFO(dump);
+    REQUIRE(dump.find("          1000          1  cs-loop:") != std::string::npos);
+    REQUIRE(dump.find("cs-leaf\n") != std::string::npos);
+}
+
+TEST_CASE("VM: pairs and lists", "[vm]")
+{
+    REQUIRE(run("(cons 1 2)") == "(1 . 2)");
+    REQUIRE(run("(car (cons 1 2))") == "1");
+    REQUIRE(run("(cdr '(1 2 3))") == "(2 3)");
+    REQUIRE(run("'(a (b \"c\") ())") == "(a (b \"c\") ())");
+    REQUIRE(run("(list 1 2 3)") == "(1 2 3)");
+    REQUIRE(run("(list)") == "()");
+    REQUIRE(run("(make-list 3 'x)") == "(x x x)");
+    REQUIRE(run("(length '(1 2 3 4))") == "4");
+    REQUIRE(run("(reverse '(1 2 3))") == "(3 2 1)");
+    REQUIRE(run("(append '(1 2) '(3) '() '(4 5))") == "(1 2 3 4 5)");
+    REQUIRE(run("(append '(1) 2)") == "(1 . 2)");
+    REQUIRE(run("(pair? '(1)) ") == "#t");
+    REQUIRE(run("(null? '())") == "#t");
+    REQUIRE(run("(null? '(1))") == "#f");
+    REQUIRE(run("(define p (list 1 2)) (set-car! p 'a) (set-cdr! (cdr p) '(b)) p") == "(a 2 b)");
+    REQUIRE(run("(map (lambda (x) (* x x)) '(1 2 3))") == "(1 4 9)");
+    REQUIRE(run("(map + '(1 2 3) '(10 20))") == "(11 22)");
+    REQUIRE(run("(define acc 0) (for-each (lambda (x) (set! acc (+ acc x))) '(1 2 3)) acc") == "6");
+    REQUIRE(run("(car '())") == "error: car: not a pair");
+    REQUIRE(run("(length (cons 1 2))") == "error: length: not a proper list");
+    REQUIRE(run("(string-append \"ab\" \"\" \"cd\")") == "\"abcd\"");
+    REQUIRE(run("(string-append)") == "\"\"");
+    REQUIRE(run("(string-length (string-append \"ab\" \"cde\"))") == "5");
+    REQUIRE(run("(string-append \"a\" 'b)") == "error: string-append: not a string");
+    REQUIRE(run("(map car '(1))") == "error: car: not a pair");
+}
+
+TEST_CASE("VM: lists survive collections", "[vm]")
+{
+    REQUIRE(run("(define (build n acc) (if (= n 0) acc (build (- n 1) (cons (list n \"s\") acc))))"
+                "(define big (build 100000 '()))"
+                "(length big)") == "100000");
+    gc_collect(false);
+    gc_collect(true);
+    REQUIRE(run("(car big)") == "(1 \"s\")");
+    REQUIRE(run("(length (map (lambda (x) (cons (car x) (make-list 3))) big))") == "100000");
+    gc_collect(true);
+    REQUIRE(run("(car (reverse big))") == "(100000 \"s\")");
+}
+
+TEST_CASE("VM: tail calls run in constant space", "[vm]")
+{
+    // each loop is deeper than the frame limit without tail calls
+    REQUIRE(run("(define (tc-loop n) (if (= n 0) 'done (tc-loop (- n 1))))"
+                "(tc-loop 1100000)") == "done");
+    REQUIRE(run("(define (tc-even? n) (if (= n 0) #t (tc-odd? (- n 1))))"
+                "(define (tc-odd? n) (if (= n 0) #f (tc-even? (- n 1))))"
+                "(tc-even? 1100001)") == "#f");
+    REQUIRE(run("(define (tc-forms n)"
+                "  (cond ((< n 0) 'negative)"
+                "        ((= n 0) 'zero)"
+                "        (else (and #t (or #f (when #t (tc-forms (- n 1))))))))"
+                "(tc-forms 1100000)") == "zero");
+    REQUIRE(run("((lambda (loop) (loop loop 1100000))"
+                " (lambda (self n) (if (= n 0) 'local (self self (- n 1)))))") == "local");
+    REQUIRE(run("(define (tc-builtin x) (not x)) (tc-builtin #f)") == "#t");
+    REQUIRE(run("(define (tc-arity) (tc-loop 1 2)) (tc-arity)") == "error: wrong number of arguments to: tc-loop");
+}
+
+TEST_CASE("VM: deep recursion grows the stack", "[vm]")
+{
+    REQUIRE(run("(define (sr-depth n) (if (= n 0) 0 (+ 1 (sr-depth (- n 1)))))"
+                "(sr-depth 200000)") == "200000");
+    REQUIRE(run("(define (sr-inf n) (+ 1 (sr-inf n))) (sr-inf 0)") == "error: stack overflow");
+    REQUIRE(run("(sr-depth 10)") == "10");
+}
+
+TEST_CASE("VM: errors", "[vm]")
+{
+    REQUIRE(run("(undefined-variable)") == "error: unbound variable: undefined-variable");
+    REQUIRE(run("(1 2)") == "error: not a procedure: 1");
+    REQUIRE(run("(+ 1 'a)") == "error: +: non-numeric argument");
+    REQUIRE(run("((lambda (x) x))") == "error: wrong number of arguments to: ()");
+    REQUIRE(run("(1 2") == "error: missing closing ')' for s-expression");
+    REQUIRE(run("(if)") == "error: if: expected 2 or 3 arguments");
+    // the procedures compiled before the error are dropped with it
+    size_t n = vm_nprotos();
+    REQUIRE(run("(list (lambda () 1) (lambda () (lambda () (if))))") == "error: if: expected 2 or 3 arguments");
+    REQUIRE(vm_nprotos() == n);
+}
@@ -1,3 +1,22 @@
 #define CATCH_CONFIG_MAIN
+// sigaltstack sizing in this Catch2 version does not build against newer glibc
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include <catch2/catch.hpp>
 #include "test_value.cpp"
+#include "test_gc.cpp"
+#include "test_arena.cpp"
+#include "test_intern.cpp"
+#include "test_read.cpp"
+#include "test_scan.cpp"
+#include "test_vm.cpp"
+#include "test_isolate.cpp"
+#include "test_parallel.cpp"
+#include "test_csc.cpp"
+#include "test_image.cpp"
+#include "test_profile.cpp"
+#include "test_stats.cpp"
+#include "test_port.cpp"
+#include "test_table.cpp"
+#include "test_uvec.cpp"
+#include "test_serve.cpp"
+#include "test_freeze.cpp"